@@ -164,6 +164,24 @@ LSB_EXPORT void lsb_add_function(lua_sandbox* lsb, lua_CFunction func,
  */
 LSB_EXPORT const char* lsb_get_output(lua_sandbox* lsb, size_t* len);
 
+/**
+ * Retrieve a batch of framed messages (see lsb_output_protobuf_batch) and
+ * reset the buffer. The buffer can be forwarded with a single write; the
+ * offsets locate the start of each framed message within it. The returned
+ * pointers remain valid until additional sandbox output is performed.
+ *
+ * @param lsb Pointer to the sandbox.
+ * @param len If len is not NULL, it will be set to the length of the batch.
+ * @param count If count is not NULL, it will be set to the number of messages.
+ * @param offsets If offsets is not NULL, it will be set to the array of
+ *                message offsets.
+ *
+ * @return const char* Pointer to the output buffer.
+ */
+LSB_EXPORT const char* lsb_get_output_batch(lua_sandbox* lsb, size_t* len,
+                                            size_t* count,
+                                            const size_t** offsets);
+
 /**
  * Write a userdata structure to the output buffer.
  *
@@ -188,6 +206,54 @@ lsb_output_userdata(lua_sandbox* lsb, int index, int append);
  */
 LSB_EXPORT int lsb_output_protobuf(lua_sandbox* lsb, int index, int append);
 
+/**
+ * Write a Lua array of values to the output buffer as a Heka protobuf message
+ * using a compiled message_template. The template supplies the static headers
+ * and pre-encoded field metadata; the values are matched to the template
+ * fields by position.
+ *
+ * @param lsb Pointer to the sandbox.
+ * @param tindex Lua stack index of the message_template userdata.
+ * @param vindex Lua stack index of the value array.
+ * @param append 0 to overwrite the output buffer, 1 to append the output to it
+ *
+ * @return int 0 on success
+ */
+LSB_EXPORT int lsb_output_protobuf_template(lua_sandbox* lsb, int tindex,
+                                            int vindex, int append);
+
+/**
+ * Append a Lua table (in a Heka protobuf structure) to the output buffer as a
+ * Heka stream framed message (record separator, header length, header, unit
+ * separator, message). The first message of a batch resets the output buffer;
+ * the whole batch is bounded by the output_limit. Use lsb_get_output_batch()
+ * to retrieve the batch.
+ *
+ * @param lsb Pointer to the sandbox.
+ * @param index Lua stack index of the table.
+ *
+ * @return int 0 on success
+ */
+LSB_EXPORT int lsb_output_protobuf_batch(lua_sandbox* lsb, int index);
+
+/**
+ * Index a Heka protobuf message and make it available to the sandbox through
+ * the read_message() function. The message is not copied or decoded; the
+ * field offsets are recorded and the values are only converted to Lua when
+ * requested. The buffer must remain valid until the next call to this function
+ * (or until it is cleared by passing a NULL msg). The built-in read_message()
+ * is only installed by lsb_init() if the host has not already added its own
+ * with lsb_add_function().
+ *
+ * @param lsb Pointer to the sandbox.
+ * @param msg Pointer to the protobuf encoded message.
+ * @param len Length of the message.
+ *
+ * @return int 0 on success
+ */
+LSB_EXPORT int lsb_decode_protobuf(lua_sandbox* lsb, const char* msg,
+                                   size_t len);
+
 /**
  * Helper function to load the Lua function and set the instruction limits
  *
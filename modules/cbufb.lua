@@ -0,0 +1,86 @@
+-- This Source Code Form is subject to the terms of the Mozilla Public
+-- License, v. 2.0. If a copy of the MPL was not distributed with this
+-- file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+-- Imports
+local string = require "string"
+local math = require "math"
+local tonumber = tonumber
+
+local M = {}
+setfenv(1, M) -- Remove external access to contain everything in the module
+
+--[[ cbufb decoder
+The payload is the cbuf JSON header line followed by one block per column of
+`rows` little-endian IEEE 754 doubles, oldest row first.
+
+sample input:
+{"time":1379574900,"rows":1440,"columns":2,"seconds_per_row":60,"column_info":[{"name":"Requests","unit":"count","aggregation":"sum"},{"name":"Total_Size","unit":"KiB","aggregation":"sum"}]}
+<1440 doubles for column 1><1440 doubles for column 2>
+
+output table:
+1
+    1=12075 (number)
+    ...
+    1440=11837 (number)
+2
+    1=159901 (number)
+    ...
+    1440=154880 (number)
+header={"time":1379574900,"rows":1440,"columns":2,"seconds_per_row":60,"column_info":[{"name":"Requests","unit":"count","aggregation":"sum"},{"name":"Total_Size","unit":"KiB","aggregation":"sum"}]}
+time=1379574900000000000 (number)
+rows=1440 (number)
+columns=2 (number)
+seconds_per_row=60 (number)
+--]]
+
+local function read_double(s, pos)
+    local b1, b2, b3, b4, b5, b6, b7, b8 = string.byte(s, pos, pos + 7)
+    local sign = 1
+    if b8 >= 128 then
+        sign = -1
+        b8 = b8 - 128
+    end
+    local exponent = b8 * 16 + math.floor(b7 / 16)
+    local mantissa = ((((((b7 % 16) * 256 + b6) * 256 + b5) * 256 + b4) * 256
+                       + b3) * 256 + b2) * 256 + b1
+    if exponent == 2047 then
+        if mantissa == 0 then return sign * math.huge end
+        return 0/0
+    end
+    if exponent == 0 then -- subnormal
+        return sign * math.ldexp(mantissa, -1074)
+    end
+    return sign * math.ldexp(mantissa + 2^52, exponent - 1075)
+end
+
+-- Decodes a cbufb payload, returns nil if the payload is invalid.
+function decode(payload)
+    local eol = string.find(payload, "\n", 1, true)
+    if not eol then return nil end
+
+    local header = string.sub(payload, 1, eol - 1)
+    local t = {header = header}
+    t.time = tonumber(string.match(header, '"time":(%d+)'))
+    t.rows = tonumber(string.match(header, '"rows":(%d+)'))
+    t.columns = tonumber(string.match(header, '"columns":(%d+)'))
+    t.seconds_per_row = tonumber(string.match(header, '"seconds_per_row":(%d+)'))
+    if not t.time or not t.rows or not t.columns or not t.seconds_per_row
+    or #payload ~= eol + t.rows * t.columns * 8 then
+        return nil
+    end
+    t.time = t.time * 1e9
+
+    local pos = eol + 1
+    for c = 1, t.columns do
+        local values = {}
+        for r = 1, t.rows do
+            values[r] = read_double(payload, pos)
+            pos = pos + 8
+        end
+        t[c] = values
+    end
+    return t
+end
+
+return M
@@ -0,0 +1,205 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/// @brief Streaming forecast/band anomaly detectors implementation @file
+
+#include "anomaly_detector.h"
+
+#include <math.h>
+
+// scales the median absolute deviation to a normal standard deviation
+static const double mad_scale = 1.4826;
+
+
+size_t detector_size(DETECTOR_METHOD method, unsigned season)
+{
+  size_t size = sizeof(detector);
+  if (method == DETECTOR_HOLT_WINTERS && season > 1) {
+    size += sizeof(double) * (season - 1);
+  }
+  return size;
+}
+
+
+void detector_init(detector* d, DETECTOR_METHOD method, double alpha,
+                   double beta, double gamma, unsigned season, double k)
+{
+  d->method = method;
+  d->alpha = alpha;
+  d->beta = beta;
+  d->gamma = gamma;
+  d->k = k;
+  d->season = season;
+  d->count = 0;
+  d->last_row = 0;
+  d->level = 0;
+  d->trend = 0;
+  d->variance = 0;
+  if (method == DETECTOR_HOLT_WINTERS) {
+    for (unsigned i = 0; i < season; ++i) {
+      d->seasonal[i] = NAN;
+    }
+  }
+}
+
+
+static void update_ewma(detector* d, double value)
+{
+  if (!d->count) {
+    d->level = value;
+    return;
+  }
+  double diff = value - d->level;
+  double incr = d->alpha * diff;
+  d->level += incr;
+  d->variance = (1 - d->alpha) * (d->variance + diff * incr);
+}
+
+
+// Rows before the epoch are negative; keep the season slot non negative.
+static unsigned season_index(const detector* d, long long row)
+{
+  long long season = d->season;
+  return (unsigned)(((row % season) + season) % season);
+}
+
+
+static void update_holt_winters(detector* d, long long row, double value)
+{
+  unsigned s = season_index(d, row);
+  if (d->count < d->season) { // the first season initializes the components
+    d->seasonal[s] = value;
+    d->level += value;
+    if (d->count + 1 == d->season) {
+      d->level /= d->season;
+      for (unsigned i = 0; i < d->season; ++i) {
+        d->seasonal[i] = isnan(d->seasonal[i]) ? 0 : d->seasonal[i] - d->level;
+      }
+    }
+    return;
+  }
+
+  long long steps = row - d->last_row;
+  double level = d->level + d->trend * (steps - 1); // carried over the gap
+  double error = value - (level + d->trend + d->seasonal[s]);
+  d->variance = (1 - d->alpha) * (d->variance + d->alpha * error * error);
+
+  double prev = level;
+  d->level = d->alpha * (value - d->seasonal[s])
+    + (1 - d->alpha) * (level + d->trend);
+  d->trend = d->beta * (d->level - prev) + (1 - d->beta) * d->trend;
+  d->seasonal[s] = d->gamma * (value - d->level)
+    + (1 - d->gamma) * d->seasonal[s];
+}
+
+
+void detector_update(detector* d, long long row, double value)
+{
+  if (isnan(value)) return;
+
+  switch (d->method) {
+  case DETECTOR_EWMA:
+    update_ewma(d, value);
+    break;
+  case DETECTOR_HOLT_WINTERS:
+    update_holt_winters(d, row, value);
+    break;
+  default:
+    return;
+  }
+  d->last_row = row;
+  ++d->count;
+}
+
+
+static void swap(double* a, double* b)
+{
+  double tmp = *a;
+  *a = *b;
+  *b = tmp;
+}
+
+
+// Returns the kth smallest value; afterwards the values before k are <= it.
+// Three way partitioning keeps runs of equal values linear.
+static double select_kth(double* values, size_t n, size_t k)
+{
+  size_t lo = 0, hi = n;
+  while (hi - lo > 1) {
+    double pivot = values[lo + (hi - lo) / 2];
+    size_t lt = lo, i = lo, gt = hi;
+    while (i < gt) {
+      if (values[i] < pivot) {
+        swap(&values[lt++], &values[i++]);
+      } else if (values[i] > pivot) {
+        swap(&values[i], &values[--gt]);
+      } else {
+        ++i;
+      }
+    }
+    if (k < lt) {
+      hi = lt;
+    } else if (k >= gt) {
+      lo = gt;
+    } else {
+      return pivot;
+    }
+  }
+  return values[k];
+}
+
+
+static double median(double* values, size_t n)
+{
+  double m = select_kth(values, n, n / 2);
+  if (n % 2 == 0) { // the lower middle is the largest value below n / 2
+    double lower = values[0];
+    for (size_t i = 1; i < n / 2; ++i) {
+      if (values[i] > lower) lower = values[i];
+    }
+    m = (m + lower) / 2;
+  }
+  return m;
+}
+
+
+void detector_fit(detector* d, double* values, size_t n)
+{
+  d->count = (unsigned)n;
+  if (!n) return;
+
+  d->level = median(values, n);
+  for (size_t i = 0; i < n; ++i) {
+    values[i] = fabs(values[i] - d->level);
+  }
+  double mad = mad_scale * median(values, n);
+  d->variance = mad * mad;
+}
+
+
+int detector_forecast(const detector* d, long long row, double* forecast,
+                      double* scale)
+{
+  switch (d->method) {
+  case DETECTOR_EWMA:
+    if (d->count < 2) return 1;
+    *forecast = d->level;
+    break;
+  case DETECTOR_HOLT_WINTERS:
+    if (d->count <= d->season) return 1;
+    *forecast = d->level + d->trend * (row - d->last_row)
+      + d->seasonal[season_index(d, row)];
+    break;
+  case DETECTOR_MAD:
+    if (d->count < 3) return 1;
+    *forecast = d->level;
+    break;
+  default:
+    return 1;
+  }
+  *scale = sqrt(d->variance);
+  return 0;
+}
@@ -0,0 +1,107 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/// @brief Streaming forecast/band anomaly detectors @file
+#ifndef anomaly_detector_h_
+#define anomaly_detector_h_
+
+#include <stddef.h>
+
+typedef enum {
+  DETECTOR_NONE         = 0,
+  DETECTOR_EWMA         = 1,
+  DETECTOR_HOLT_WINTERS = 2,
+  DETECTOR_MAD          = 3,
+
+  MAX_DETECTOR
+} DETECTOR_METHOD;
+
+/**
+ * Forecast state of one column. The detectors consume one value per completed
+ * row; the row index is the absolute row number (time / seconds_per_row) so
+ * gaps and the seasonal position are tracked.
+ *
+ * - EWMA: exponentially weighted mean and variance (alpha).
+ * - Holt-Winters: additive level (alpha), trend (beta) and seasonal (gamma)
+ *   components with a season of `season` rows; the first season initializes
+ *   the components. The scale is the exponentially weighted deviation of the
+ *   one step forecast errors.
+ * - MAD: median and 1.4826 * median absolute deviation of a window of rows,
+ *   refitted from the row values by detector_fit().
+ */
+typedef struct detector
+{
+  DETECTOR_METHOD method;
+  double          alpha;
+  double          beta;
+  double          gamma;
+  double          k;          // band width in scales
+  unsigned        season;     // Holt-Winters season, MAD window (rows)
+  unsigned        count;      // values consumed
+  long long       last_row;   // row of the last value consumed
+  double          level;
+  double          trend;
+  double          variance;
+  double          seasonal[1];
+} detector;
+
+/**
+ * Returns the number of bytes needed by a detector.
+ *
+ * @param method Detector method.
+ * @param season Rows per season (Holt-Winters only).
+ *
+ * @return size_t Size of the detector structure.
+ */
+size_t detector_size(DETECTOR_METHOD method, unsigned season);
+
+/**
+ * Initializes an empty detector.
+ *
+ * @param d Detector of detector_size() bytes.
+ * @param method Detector method.
+ * @param alpha Level/mean smoothing factor (0, 1].
+ * @param beta Trend smoothing factor [0, 1].
+ * @param gamma Seasonal smoothing factor [0, 1].
+ * @param season Rows per season or MAD window.
+ * @param k Band width in scales.
+ */
+void detector_init(detector* d, DETECTOR_METHOD method, double alpha,
+                   double beta, double gamma, unsigned season, double k);
+
+/**
+ * Consumes the value of a completed row (EWMA and Holt-Winters), NaN values
+ * are ignored.
+ *
+ * @param d Detector to update.
+ * @param row Absolute row index of the value.
+ * @param value Row value.
+ */
+void detector_update(detector* d, long long row, double value);
+
+/**
+ * Refits a MAD detector.
+ *
+ * @param d Detector to update.
+ * @param values Window values without NaN; the array is reordered.
+ * @param n Number of values.
+ */
+void detector_fit(detector* d, double* values, size_t n);
+
+/**
+ * Forecasts the value of a row.
+ *
+ * @param d Detector to query.
+ * @param row Absolute row index to forecast.
+ * @param forecast Expected value.
+ * @param scale Expected deviation (one standard deviation equivalent).
+ *
+ * @return int 0 on success, 1 if the detector has not seen enough values
+ */
+int detector_forecast(const detector* d, long long row, double* forecast,
+                      double* scale);
+
+#endif
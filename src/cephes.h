@@ -4,5 +4,34 @@
 * Direct inquiries to 30 Frost Street, Cambridge, MA 02140
 */
 
+#include <stddef.h>
+
+/* Error Functions */
+double erf(double x);
+double erfc(double a);
+
 /* Normal Distribution Function */
 double ndtr(double a);
+
+/* Inverse of the Normal Distribution Function, NaN outside of [0, 1] */
+double ndtri(double y0);
+
+/* Regularized Incomplete Gamma Integral and its complement */
+double igam(double a, double x);
+double igamc(double a, double x);
+
+/* Regularized Incomplete Beta Integral */
+double incbet(double a, double b, double x);
+
+/* Chi-square Distribution Function and its complement (df degrees of
+ * freedom) */
+double chdtr(double df, double x);
+double chdtrc(double df, double x);
+
+/* Student's t Distribution Function (df degrees of freedom) */
+double stdtr(double df, double t);
+
+/* Batched erfc/ndtr over n values, y may alias x; the SIMD kernel selected at
+ * run time returns the same values as the scalar functions */
+void erfc_array(const double* x, double* y, size_t n);
+void ndtr_array(const double* x, double* y, size_t n);
@@ -0,0 +1,201 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/// @brief NaN aware column aggregation kernels implementation @file
+
+#include "column_stats.h"
+
+#include <math.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define COLUMN_STATS_X86
+#include <immintrin.h>
+#include <pthread.h>
+#endif
+
+typedef void (*span_kernel)(column_stats* s, const double* values, size_t n,
+                            size_t stride);
+
+
+////////////////////////////////////////////////////////////////////////////////
+/// Kernels; NaNs are masked out of the sums and the min/max comparisons never
+/// select a NaN so no kernel branches on the data.
+////////////////////////////////////////////////////////////////////////////////
+static void span_scalar(column_stats* s, const double* values, size_t n,
+                        size_t stride)
+{
+  const double k = s->shift;
+  double sum = 0, shifted_sum = 0, shifted_sumsq = 0, count = 0;
+  double mn = s->min, mx = s->max;
+
+  for (size_t i = 0; i < n; ++i, values += stride) {
+    double x = *values;
+    int valid = x == x;
+    double d = valid ? x - k : 0;
+    sum += valid ? x : 0;
+    shifted_sum += d;
+    shifted_sumsq += d * d;
+    count += valid;
+    mn = x < mn ? x : mn;
+    mx = x > mx ? x : mx;
+  }
+  s->sum += sum;
+  s->shifted_sum += shifted_sum;
+  s->shifted_sumsq += shifted_sumsq;
+  s->count += (size_t)count;
+  s->min = mn;
+  s->max = mx;
+}
+
+
+#ifdef COLUMN_STATS_X86
+__attribute__((target("sse2")))
+static void span_sse2(column_stats* s, const double* values, size_t n,
+                      size_t stride)
+{
+  const __m128d k = _mm_set1_pd(s->shift);
+  const __m128d one = _mm_set1_pd(1);
+  __m128d sum = _mm_setzero_pd(), shifted_sum = _mm_setzero_pd();
+  __m128d shifted_sumsq = _mm_setzero_pd(), count = _mm_setzero_pd();
+  __m128d mn = _mm_set1_pd(s->min), mx = _mm_set1_pd(s->max);
+
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2) {
+    __m128d x = stride == 1 ? _mm_loadu_pd(values + i)
+      : _mm_set_pd(values[(i + 1) * stride], values[i * stride]);
+    __m128d valid = _mm_cmpord_pd(x, x);
+    __m128d d = _mm_and_pd(valid, _mm_sub_pd(x, k));
+    sum = _mm_add_pd(sum, _mm_and_pd(valid, x));
+    shifted_sum = _mm_add_pd(shifted_sum, d);
+    shifted_sumsq = _mm_add_pd(shifted_sumsq, _mm_mul_pd(d, d));
+    count = _mm_add_pd(count, _mm_and_pd(valid, one));
+    // returns the second operand when the first is NaN
+    mn = _mm_min_pd(x, mn);
+    mx = _mm_max_pd(x, mx);
+  }
+
+  double r[6][2];
+  _mm_storeu_pd(r[0], sum);
+  _mm_storeu_pd(r[1], shifted_sum);
+  _mm_storeu_pd(r[2], shifted_sumsq);
+  _mm_storeu_pd(r[3], count);
+  _mm_storeu_pd(r[4], mn);
+  _mm_storeu_pd(r[5], mx);
+  s->sum += r[0][0] + r[0][1];
+  s->shifted_sum += r[1][0] + r[1][1];
+  s->shifted_sumsq += r[2][0] + r[2][1];
+  s->count += (size_t)(r[3][0] + r[3][1]);
+  s->min = r[4][0] < r[4][1] ? r[4][0] : r[4][1];
+  s->max = r[5][0] > r[5][1] ? r[5][0] : r[5][1];
+  span_scalar(s, values + i * stride, n - i, stride);
+}
+
+
+__attribute__((target("avx2")))
+static void span_avx2(column_stats* s, const double* values, size_t n,
+                      size_t stride)
+{
+  const __m256d k = _mm256_set1_pd(s->shift);
+  const __m256d one = _mm256_set1_pd(1);
+  __m256d sum = _mm256_setzero_pd(), shifted_sum = _mm256_setzero_pd();
+  __m256d shifted_sumsq = _mm256_setzero_pd(), count = _mm256_setzero_pd();
+  __m256d mn = _mm256_set1_pd(s->min), mx = _mm256_set1_pd(s->max);
+
+  const __m256i offsets = _mm256_set_epi64x(3 * stride, 2 * stride, stride, 0);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256d x = stride == 1 ? _mm256_loadu_pd(values + i)
+      : _mm256_i64gather_pd(values + i * stride, offsets, 8);
+    __m256d valid = _mm256_cmp_pd(x, x, _CMP_ORD_Q);
+    __m256d d = _mm256_and_pd(valid, _mm256_sub_pd(x, k));
+    sum = _mm256_add_pd(sum, _mm256_and_pd(valid, x));
+    shifted_sum = _mm256_add_pd(shifted_sum, d);
+    shifted_sumsq = _mm256_add_pd(shifted_sumsq, _mm256_mul_pd(d, d));
+    count = _mm256_add_pd(count, _mm256_and_pd(valid, one));
+    // returns the second operand when the first is NaN
+    mn = _mm256_min_pd(x, mn);
+    mx = _mm256_max_pd(x, mx);
+  }
+
+  double r[6][4];
+  _mm256_storeu_pd(r[0], sum);
+  _mm256_storeu_pd(r[1], shifted_sum);
+  _mm256_storeu_pd(r[2], shifted_sumsq);
+  _mm256_storeu_pd(r[3], count);
+  _mm256_storeu_pd(r[4], mn);
+  _mm256_storeu_pd(r[5], mx);
+  for (int j = 0; j < 4; ++j) {
+    s->sum += r[0][j];
+    s->shifted_sum += r[1][j];
+    s->shifted_sumsq += r[2][j];
+    s->count += (size_t)r[3][j];
+    if (r[4][j] < s->min) s->min = r[4][j];
+    if (r[5][j] > s->max) s->max = r[5][j];
+  }
+  span_scalar(s, values + i * stride, n - i, stride);
+}
+#endif
+
+
+#ifdef COLUMN_STATS_X86
+// Sandboxes run on several host threads; the kernel is selected exactly once.
+static span_kernel kernel = span_scalar;
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+
+static void select_kernel(void)
+{
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    kernel = span_avx2;
+  } else if (__builtin_cpu_supports("sse2")) {
+    kernel = span_sse2;
+  }
+}
+#endif
+
+
+void column_stats_init(column_stats* s)
+{
+  s->sum = 0;
+  s->shifted_sum = 0;
+  s->shifted_sumsq = 0;
+  s->shift = NAN;
+  s->min = INFINITY;
+  s->max = -INFINITY;
+  s->count = 0;
+}
+
+
+void column_stats_span(column_stats* s, const double* values, size_t n,
+                       size_t stride)
+{
+  if (isnan(s->shift)) {
+    // skip the leading NaNs and shift by the first value
+    while (n > 0 && isnan(*values)) {
+      values += stride;
+      --n;
+    }
+    if (n == 0) return;
+    s->shift = *values;
+  }
+
+#ifdef COLUMN_STATS_X86
+  pthread_once(&kernel_once, select_kernel);
+  kernel(s, values, n, stride);
+#else
+  span_scalar(s, values, n, stride);
+#endif
+}
+
+
+double column_stats_variance(const column_stats* s)
+{
+  if (s->count == 0) return NAN;
+  double n = (double)s->count;
+  double variance = (s->shifted_sumsq - s->shifted_sum * s->shifted_sum / n)
+    / n;
+  return variance < 0 ? 0 : variance;
+}
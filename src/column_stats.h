@@ -0,0 +1,57 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/// @brief NaN aware column aggregation kernels @file
+#ifndef column_stats_h_
+#define column_stats_h_
+
+#include <stddef.h>
+
+/**
+ * Aggregates accumulated over one or more spans of values. NaN values are
+ * ignored. The squares are accumulated relative to the first value seen
+ * (shift) to keep the single pass variance numerically stable.
+ */
+typedef struct
+{
+  double sum;
+  double shifted_sum;
+  double shifted_sumsq;
+  double shift;
+  double min;
+  double max;
+  size_t count;
+} column_stats;
+
+/**
+ * Resets the aggregates.
+ *
+ * @param s Stats to initialize.
+ */
+void column_stats_init(column_stats* s);
+
+/**
+ * Accumulates a span of values into the aggregates in a single pass using
+ * the widest vector kernel supported by the CPU.
+ *
+ * @param s Stats to update.
+ * @param values Pointer to the first value of the span.
+ * @param n Number of values in the span.
+ * @param stride Distance between consecutive values (in doubles).
+ */
+void column_stats_span(column_stats* s, const double* values, size_t n,
+                       size_t stride);
+
+/**
+ * Computes the population variance of the accumulated values.
+ *
+ * @param s Accumulated stats.
+ *
+ * @return double Variance or NaN if no values were accumulated.
+ */
+double column_stats_variance(const column_stats* s);
+
+#endif
@@ -0,0 +1,116 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/// @brief Fixed size mergeable distinct count estimator implementation @file
+
+#include "hyperloglog.h"
+
+#include <math.h>
+#include <string.h>
+
+
+static unsigned leading_zeros(uint64_t x)
+{
+#if defined(__GNUC__)
+  return (unsigned)__builtin_clzll(x);
+#else
+  unsigned n = 0;
+  for (uint64_t m = 1ULL << 63; !(x & m); m >>= 1) ++n;
+  return n;
+#endif
+}
+
+
+// Returns 2^-rank exactly.
+static double inverse_power(unsigned rank)
+{
+  uint64_t bits = (uint64_t)(1023 - rank) << 52;
+  double d;
+  memcpy(&d, &bits, sizeof(d));
+  return d;
+}
+
+
+static void set_register(hyperloglog* h, unsigned idx, uint8_t rank)
+{
+  uint8_t old = h->registers[idx];
+  if (!old) --h->zeros;
+  h->sum += inverse_power(rank) - inverse_power(old);
+  h->registers[idx] = rank;
+}
+
+
+void hll_clear(hyperloglog* h)
+{
+  memset(h->registers, 0, sizeof(h->registers));
+  h->sum = HLL_REGISTERS;
+  h->zeros = HLL_REGISTERS;
+}
+
+
+uint64_t hll_hash(const void* data, size_t len)
+{
+  // FNV-1a followed by the MurmurHash3 finalizer to spread the high bits
+  const unsigned char* p = data;
+  uint64_t h = 14695981039346656037ULL;
+  for (size_t i = 0; i < len; ++i) {
+    h ^= p[i];
+    h *= 1099511628211ULL;
+  }
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+
+int hll_insert(hyperloglog* h, uint64_t hash)
+{
+  unsigned idx = (unsigned)(hash >> (64 - HLL_PRECISION));
+  uint64_t w = hash << HLL_PRECISION;
+  uint8_t rank = w ? (uint8_t)(leading_zeros(w) + 1)
+    : (uint8_t)(64 - HLL_PRECISION + 1);
+  if (rank > h->registers[idx]) {
+    set_register(h, idx, rank);
+    return 1;
+  }
+  return 0;
+}
+
+
+void hll_merge(hyperloglog* dst, const hyperloglog* src)
+{
+  for (unsigned i = 0; i < HLL_REGISTERS; ++i) {
+    if (src->registers[i] > dst->registers[i]) {
+      set_register(dst, i, src->registers[i]);
+    }
+  }
+}
+
+
+void hll_refresh(hyperloglog* h)
+{
+  h->sum = 0;
+  h->zeros = 0;
+  for (unsigned i = 0; i < HLL_REGISTERS; ++i) {
+    h->sum += inverse_power(h->registers[i]);
+    if (!h->registers[i]) ++h->zeros;
+  }
+}
+
+
+double hll_count(const hyperloglog* h)
+{
+  static const double m = HLL_REGISTERS;
+  const double alpha = 0.7213 / (1 + 1.079 / m);
+  double estimate = alpha * m * m / h->sum;
+  if (estimate <= 2.5 * m && h->zeros) { // linear counting
+    estimate = m * log(m / h->zeros);
+  }
+  return floor(estimate + 0.5);
+}
@@ -0,0 +1,83 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/// @brief Fixed size mergeable distinct count estimator (HyperLogLog) @file
+#ifndef hyperloglog_h_
+#define hyperloglog_h_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define HLL_PRECISION 10
+#define HLL_REGISTERS (1 << HLL_PRECISION)
+
+/**
+ * HyperLogLog with 1024 one byte registers; the standard error of the estimate
+ * is 1.04 / sqrt(1024) (~3.25%). Small cardinalities are estimated with linear
+ * counting so they are close to exact. The harmonic sum and the number of
+ * empty registers are kept up to date so the estimate is O(1).
+ */
+typedef struct hyperloglog
+{
+  double    sum;      // sum of 2^-register
+  uint32_t  zeros;    // registers still empty
+  uint8_t   registers[HLL_REGISTERS];
+} hyperloglog;
+
+/**
+ * Empties the estimator.
+ *
+ * @param h Estimator to clear.
+ */
+void hll_clear(hyperloglog* h);
+
+/**
+ * Hashes an item for insertion.
+ *
+ * @param data Item bytes.
+ * @param len Number of bytes.
+ *
+ * @return uint64_t 64 bit hash of the item.
+ */
+uint64_t hll_hash(const void* data, size_t len);
+
+/**
+ * Records an item.
+ *
+ * @param h Estimator to update.
+ * @param hash Item hash returned by hll_hash().
+ *
+ * @return int 1 if a register changed (the estimate may have changed), 0 if
+ *         not
+ */
+int hll_insert(hyperloglog* h, uint64_t hash);
+
+/**
+ * Adds all items of one estimator to another (set union).
+ *
+ * @param dst Estimator receiving the items.
+ * @param src Estimator to merge.
+ */
+void hll_merge(hyperloglog* dst, const hyperloglog* src);
+
+/**
+ * Recomputes the cached sum after the registers were written directly i.e.
+ * restored from a serialized copy.
+ *
+ * @param h Estimator to update.
+ */
+void hll_refresh(hyperloglog* h);
+
+/**
+ * Estimates the number of distinct items.
+ *
+ * @param h Estimator to query.
+ *
+ * @return double The estimated cardinality rounded to the nearest integer.
+ */
+double hll_count(const hyperloglog* h);
+
+#endif
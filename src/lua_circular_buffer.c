@@ -6,16 +6,23 @@
 
 /// @brief Lua circular buffer implementation @file
 
+#include "anomaly_detector.h"
 #include "cephes.h"
+#include "column_stats.h"
 #include "lua_circular_buffer.h"
 #include "lua_serialize.h"
+#include "hyperloglog.h"
+#include "quantile_sketch.h"
+#include "vector_expr.h"
+#include "xor_codec.h"
 
 #include <ctype.h>
-#include <float.h>
+#include <limits.h>
 #include <lua.h>
 #include <lauxlib.h>
 #include <lualib.h>
 #include <math.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
@@ -25,12 +32,14 @@ const char* lsb_circular_buffer_table = "circular_buffer";
 
 #define COLUMN_NAME_SIZE 16
 #define UNIT_LABEL_SIZE 8
+#define COLD_BLOCK_ROWS 64
 
 static const time_t seconds_in_day = 60 * 60 * 24;
 
 static const char* column_aggregation_methods[] = { "sum", "min", "max", "none",
-  "none", NULL };
+  "none", "quantile", "distinct", NULL };
 static const char* default_unit = "count";
+static const char* scratch_key = "lsb_circular_buffer_scratch";
 
 typedef enum {
   AGGREGATION_SUM     = 0,
@@ -38,6 +47,8 @@ typedef enum {
   AGGREGATION_MAX     = 2,
   AGGREGATION_UNUSED  = 3,
   AGGREGATION_NONE    = 4,
+  AGGREGATION_QUANTILE = 5,
+  AGGREGATION_DISTINCT = 6,
 
   MAX_AGGREGATION
 } COLUMN_AGGREGATION;
@@ -45,15 +56,126 @@ typedef enum {
 typedef enum {
   OUTPUT_CBUF     = 0,
   OUTPUT_CBUFD    = 1,
+  OUTPUT_CBUFB    = 2,
 
   LSB_OUTPUT_FORMAT
 } OUTPUT_FORMAT;
 
+static const char* value_layouts[] = { "row", "column", NULL };
+static const char* detector_methods[] = { "none", "ewma", "holt_winters",
+  "mad", NULL };
+
+static const char* value_storage_types[] = { "double", "float", "int32",
+  "int64", NULL };
+
+// NaN is stored as the type's minimum value in the integer storage types
+typedef enum {
+  STORAGE_DOUBLE  = 0,
+  STORAGE_FLOAT   = 1,
+  STORAGE_INT32   = 2,
+  STORAGE_INT64   = 3,
+
+  MAX_STORAGE
+} VALUE_STORAGE;
+
+static const size_t value_sizes[] = { sizeof(double), sizeof(float),
+  sizeof(int32_t), sizeof(int64_t) };
+
+typedef enum {
+  LAYOUT_ROW      = 0, // values[row * columns + column]
+  LAYOUT_COLUMN   = 1, // values[column * rows + row]
+
+  MAX_LAYOUT
+} VALUE_LAYOUT;
+
+static const char* compute_functions[] = { "sum", "avg", "sd", "min", "max",
+  "variance", "distinct", NULL };
+
+typedef enum {
+  COMPUTE_SUM       = 0,
+  COMPUTE_AVG       = 1,
+  COMPUTE_SD        = 2,
+  COMPUTE_MIN       = 3,
+  COMPUTE_MAX       = 4,
+  COMPUTE_VARIANCE  = 5,
+  COMPUTE_DISTINCT  = 6,
+
+  MAX_COMPUTE
+} COMPUTE_FUNCTION;
+
+static const char* combine_ops[] = { "add", "sub", "mul", "div", "min", "max",
+  NULL };
+
+typedef enum {
+  COMBINE_ADD     = 0,
+  COMBINE_SUB     = 1,
+  COMBINE_MUL     = 2,
+  COMBINE_DIV     = 3,
+  COMBINE_MIN     = 4,
+  COMBINE_MAX     = 5,
+
+  MAX_COMBINE
+} COMBINE_OP;
+
+// Per column window aggregates maintained by every value update so the full
+// window statistics do not require a scan. The sums are Kahan compensated and
+// the squares are accumulated relative to the first value (shift). Min/max
+// are only marked stale when the extreme value is removed and are rescanned
+// on demand.
+typedef struct
+{
+  double    sum;
+  double    sum_c;
+  double    shifted_sum;
+  double    shifted_sum_c;
+  double    shifted_sumsq;
+  double    shifted_sumsq_c;
+  double    shift;
+  double    min;
+  double    max;
+  unsigned  count;
+  int       stale;
+} running_stats;
+
+// Per column prefix sums over the physical rows; entry i covers rows [0, i).
+// Entries [0, valid] are current, a write to row r lowers the watermark to r
+// and the entries are recomputed up to the highest row a query needs.
+typedef struct
+{
+  double*   shifted_sum;
+  double*   shifted_sumsq;
+  double*   count;
+  double    shift;
+  unsigned  valid;
+} prefix_index;
+
+// Rows older than the hot window are kept in blocks of COLD_BLOCK_ROWS rows.
+// A block stays open (raw row major doubles) until all of its rows are cold,
+// it is then sealed; every column XOR compressed behind a table of column
+// offsets. Writing to a sealed block reopens it until the next advance.
+typedef struct
+{
+  long long       id;     // absolute row / COLD_BLOCK_ROWS, -1 when unused
+  unsigned char*  data;
+  size_t          size;
+  int             sealed;
+} cold_block;
+
+// A sparse buffer only keeps the populated cells of each row; the values are
+// followed by their ascending column numbers in a single allocation.
+typedef struct
+{
+  double*         values;
+  unsigned        count;
+  unsigned        capacity;
+} sparse_row;
+
 typedef struct
 {
   char                name[COLUMN_NAME_SIZE];
   char                unit[UNIT_LABEL_SIZE];
   COLUMN_AGGREGATION  aggregation;
+  double              quantile; // reported by the output, quantile columns
 } header_info;
 
 struct circular_buffer
@@ -64,11 +186,38 @@ struct circular_buffer
   unsigned        rows;
   unsigned        columns;
   header_info*    headers;
-  double*         values;
+  void*           values;
+  running_stats*  running;
+  prefix_index*   prefix;
   int             delta;
   OUTPUT_FORMAT   format;
-  int             ref;
-  char            bytes[1];
+  VALUE_LAYOUT    layout;
+  VALUE_STORAGE   storage;
+  double*         deltas;         // pending delta rows sorted by time
+  size_t          delta_rows;
+  size_t          delta_capacity;
+  size_t          delta_last;     // most recently updated delta row
+  unsigned        future;         // seconds a write may lead the clock, 0
+                                  // when unchecked
+  size_t          late_writes;    // accepted behind the current row
+  size_t          dropped_writes; // older than the buffer
+  size_t          future_writes;  // rejected by the future guard
+  unsigned        hot_rows;       // uncompressed rows, 0 when disabled
+  unsigned        cold_blocks;
+  cold_block*     cold;
+  double*         decoded;        // sealed block columns decoded on read
+  long long*      decoded_ids;    // block decoded into each column, -1 none
+  sparse_row*     sparse;         // populated cells per row, NULL unless
+                                  // the buffer is sparse
+  circular_buffer* rollup;        // next coarser tier, NULL if none
+  quantile_sketch** sketches;     // per column row sketches, NULL unless the
+                                  // column aggregation is quantile
+  hyperloglog**   distinct;       // per column row registers, NULL unless the
+                                  // column aggregation is distinct
+  detector**      detectors;      // per column anomaly detectors, NULL if none
+  unsigned        detector_columns; // columns with a detector
+  double          bytes[1];       // the sections allocated with the buffer,
+                                  // each starting on a double boundary
 };
 
 
@@ -78,7 +227,685 @@ static time_t get_start_time(circular_buffer* cb)
 }
 
 
-static void copy_cleared_row(circular_buffer* cb, double* cleared, size_t rows)
+static size_t value_index(circular_buffer* cb, unsigned row, unsigned column)
+{
+  if (cb->layout == LAYOUT_COLUMN) {
+    return (size_t)column * cb->rows + row;
+  }
+  return (size_t)row * cb->columns + column;
+}
+
+
+static double get_value(circular_buffer* cb, size_t i)
+{
+  switch (cb->storage) {
+  case STORAGE_FLOAT:
+    return ((float*)cb->values)[i];
+  case STORAGE_INT32:
+    {
+      int32_t v = ((int32_t*)cb->values)[i];
+      return v == INT32_MIN ? NAN : (double)v;
+    }
+  case STORAGE_INT64:
+    {
+      int64_t v = ((int64_t*)cb->values)[i];
+      return v == INT64_MIN ? NAN : (double)v;
+    }
+  default:
+    return ((double*)cb->values)[i];
+  }
+}
+
+
+static void put_value(circular_buffer* cb, size_t i, double value)
+{
+  switch (cb->storage) {
+  case STORAGE_FLOAT:
+    ((float*)cb->values)[i] = (float)value;
+    break;
+  case STORAGE_INT32:
+    if (isnan(value)) {
+      ((int32_t*)cb->values)[i] = INT32_MIN;
+    } else if (value >= INT32_MAX) {
+      ((int32_t*)cb->values)[i] = INT32_MAX;
+    } else if (value <= -INT32_MAX) {
+      ((int32_t*)cb->values)[i] = -INT32_MAX;
+    } else {
+      ((int32_t*)cb->values)[i] = (int32_t)llround(value);
+    }
+    break;
+  case STORAGE_INT64:
+    if (isnan(value)) {
+      ((int64_t*)cb->values)[i] = INT64_MIN;
+    } else if (value >= 9223372036854775807.0) {
+      ((int64_t*)cb->values)[i] = INT64_MAX;
+    } else if (value <= -9223372036854775807.0) {
+      ((int64_t*)cb->values)[i] = -INT64_MAX;
+    } else {
+      ((int64_t*)cb->values)[i] = llround(value);
+    }
+    break;
+  default:
+    ((double*)cb->values)[i] = value;
+    break;
+  }
+}
+
+
+static void* buffer_realloc(lua_State* lua, void* p, size_t osize, size_t nsize)
+{
+  // allocated through Lua so the memory is charged to the sandbox
+  void* ud;
+  lua_Alloc alloc = lua_getallocf(lua, &ud);
+  void* np = alloc(ud, p, osize, nsize);
+  if (!np && nsize) {
+    luaL_error(lua, "not enough memory");
+  }
+  return np;
+}
+
+
+// Returns a scratch buffer of at least size bytes. The buffer is a userdata
+// held in the registry so it is reused across calls and charged to the
+// sandbox memory limit; it is only valid until the next call.
+static void* get_scratch(lua_State* lua, size_t size)
+{
+  lua_getfield(lua, LUA_REGISTRYINDEX, scratch_key);
+  void* p = lua_touserdata(lua, -1);
+  if (!p || lua_objlen(lua, -1) < size) {
+    lua_pop(lua, 1);
+    p = lua_newuserdata(lua, size);
+    lua_pushvalue(lua, -1);
+    lua_setfield(lua, LUA_REGISTRYINDEX, scratch_key);
+  }
+  lua_pop(lua, 1);
+  return p;
+}
+
+
+static void cold_forget(circular_buffer* cb, long long id)
+{
+  for (unsigned c = 0; c < cb->columns; ++c) {
+    if (cb->decoded_ids[c] == id) {
+      cb->decoded_ids[c] = -1;
+    }
+  }
+}
+
+
+static void cold_release(lua_State* lua, circular_buffer* cb, cold_block* b)
+{
+  if (b->data) {
+    buffer_realloc(lua, b->data, b->size, 0);
+  }
+  cold_forget(cb, b->id);
+  b->id = -1;
+  b->data = NULL;
+  b->size = 0;
+  b->sealed = 0;
+}
+
+
+static void cold_decode(circular_buffer* cb, cold_block* b, unsigned column,
+                        double* values)
+{
+  const uint32_t* offsets = (const uint32_t*)b->data;
+  xor_decode(b->data + offsets[column], COLD_BLOCK_ROWS, values + column,
+             cb->columns);
+}
+
+
+static void cold_seal(lua_State* lua, circular_buffer* cb, cold_block* b)
+{
+  const double* raw = (const double*)b->data;
+  size_t size = sizeof(uint32_t) * cb->columns;
+  for (unsigned c = 0; c < cb->columns; ++c) {
+    size += xor_encode(raw + c, COLD_BLOCK_ROWS, cb->columns, NULL);
+  }
+
+  unsigned char* data = buffer_realloc(lua, NULL, 0, size);
+  uint32_t* offsets = (uint32_t*)data;
+  size_t pos = sizeof(uint32_t) * cb->columns;
+  for (unsigned c = 0; c < cb->columns; ++c) {
+    offsets[c] = (uint32_t)pos;
+    pos += xor_encode(raw + c, COLD_BLOCK_ROWS, cb->columns, data + pos);
+  }
+  buffer_realloc(lua, b->data, b->size, 0);
+  b->data = data;
+  b->size = size;
+  b->sealed = 1;
+}
+
+
+// Seals the open blocks that no longer contain any hot rows.
+static void cold_seal_blocks(lua_State* lua, circular_buffer* cb)
+{
+  long long oldest_hot = (long long)(cb->current_time / cb->seconds_per_row)
+    - cb->hot_rows + 1;
+  for (unsigned i = 0; i < cb->cold_blocks; ++i) {
+    cold_block* b = &cb->cold[i];
+    if (b->id != -1 && !b->sealed
+        && (b->id + 1) * COLD_BLOCK_ROWS <= oldest_hot) {
+      cold_seal(lua, cb, b);
+    }
+  }
+}
+
+
+// Returns the writable row of a cold block, the block is created or reopened
+// as necessary.
+static double* cold_ref(lua_State* lua, circular_buffer* cb, long long abs_row)
+{
+  long long id = abs_row / COLD_BLOCK_ROWS;
+  cold_block* b = &cb->cold[id % cb->cold_blocks];
+  size_t raw_bytes = sizeof(double) * COLD_BLOCK_ROWS * cb->columns;
+  if (b->id != id) { // the slot is unused or holds an expired block
+    cold_release(lua, cb, b);
+    double* raw = buffer_realloc(lua, NULL, 0, raw_bytes);
+    for (size_t i = 0; i < COLD_BLOCK_ROWS * cb->columns; ++i) {
+      raw[i] = NAN;
+    }
+    b->id = id;
+    b->data = (unsigned char*)raw;
+    b->size = raw_bytes;
+  } else if (b->sealed) {
+    double* raw = buffer_realloc(lua, NULL, 0, raw_bytes);
+    for (unsigned c = 0; c < cb->columns; ++c) {
+      cold_decode(cb, b, c, raw);
+    }
+    buffer_realloc(lua, b->data, b->size, 0);
+    b->data = (unsigned char*)raw;
+    b->size = raw_bytes;
+    b->sealed = 0;
+    cold_forget(cb, id);
+  }
+  return (double*)b->data + (abs_row % COLD_BLOCK_ROWS) * cb->columns;
+}
+
+
+// Returns the row major values of a cold block with the column available or
+// NULL if the block has no values.
+static const double* cold_values(circular_buffer* cb, long long id,
+                                 unsigned column)
+{
+  cold_block* b = &cb->cold[id % cb->cold_blocks];
+  if (b->id != id) return NULL;
+  if (!b->sealed) return (const double*)b->data;
+
+  // columns are decoded independently so a scan only decodes its column
+  if (cb->decoded_ids[column] != id) {
+    cold_decode(cb, b, column, cb->decoded);
+    cb->decoded_ids[column] = id;
+  }
+  return cb->decoded;
+}
+
+
+// Maps a physical row to the number of rows since the epoch and returns its
+// age (0 for the current row).
+static unsigned absolute_row(circular_buffer* cb, unsigned row,
+                             long long* abs_row)
+{
+  unsigned age = (cb->current_row + cb->rows - row) % cb->rows;
+  *abs_row = (long long)(cb->current_time / cb->seconds_per_row) - age;
+  return age;
+}
+
+
+static double cell_get(circular_buffer* cb, unsigned row, unsigned column)
+{
+  long long abs_row;
+  if (absolute_row(cb, row, &abs_row) < cb->hot_rows) {
+    return ((double*)cb->values)[(abs_row % cb->hot_rows) * cb->columns
+      + column];
+  }
+  const double* values = cold_values(cb, abs_row / COLD_BLOCK_ROWS, column);
+  if (!values) return NAN;
+  return values[(abs_row % COLD_BLOCK_ROWS) * cb->columns + column];
+}
+
+
+// Returns the longest run of contiguous (stride columns) values starting at
+// the row or NULL if the run has no values.
+static const double* cell_run(circular_buffer* cb, long long abs_row,
+                              unsigned age, unsigned column, unsigned* len)
+{
+  if (age < cb->hot_rows) {
+    unsigned slot = (unsigned)(abs_row % cb->hot_rows);
+    *len = cb->hot_rows - slot;
+    return (double*)cb->values + slot * cb->columns + column;
+  }
+  unsigned offset = (unsigned)(abs_row % COLD_BLOCK_ROWS);
+  *len = COLD_BLOCK_ROWS - offset;
+  if (*len > age - cb->hot_rows + 1) { // stop at the first hot row
+    *len = age - cb->hot_rows + 1;
+  }
+  const double* values = cold_values(cb, abs_row / COLD_BLOCK_ROWS, column);
+  return values ? values + offset * cb->columns + column : NULL;
+}
+
+
+static double* cell_ref(lua_State* lua, circular_buffer* cb, unsigned row,
+                        unsigned column)
+{
+  long long abs_row;
+  if (absolute_row(cb, row, &abs_row) < cb->hot_rows) {
+    return (double*)cb->values + (abs_row % cb->hot_rows) * cb->columns
+      + column;
+  }
+  return cold_ref(lua, cb, abs_row) + column;
+}
+
+
+// Moves the rows leaving the hot window into the cold blocks, clears the new
+// rows and releases the expired blocks.
+static void cold_advance(lua_State* lua, circular_buffer* cb,
+                         unsigned num_rows)
+{
+  long long current = (long long)(cb->current_time / cb->seconds_per_row);
+  long long next = current + num_rows;
+  long long oldest = next - cb->rows + 1;
+  for (unsigned i = 0; i < cb->cold_blocks; ++i) {
+    cold_block* b = &cb->cold[i];
+    if (b->id != -1 && (b->id + 1) * COLD_BLOCK_ROWS <= oldest) {
+      cold_release(lua, cb, b);
+    }
+  }
+
+  long long first = current - cb->hot_rows + 1;
+  long long last = next - cb->hot_rows;
+  if (first < oldest) first = oldest; // skip the rows that expire anyway
+  if (last > current) last = current;
+  double* hot = (double*)cb->values;
+  for (long long r = first; r <= last; ++r) {
+    double* values = hot + (r % cb->hot_rows) * cb->columns;
+    unsigned c = 0;
+    while (c < cb->columns && isnan(values[c])) ++c;
+    if (c == cb->columns) continue; // empty rows are not stored
+
+    memcpy(cold_ref(lua, cb, r), values, sizeof(double) * cb->columns);
+  }
+
+  if (num_rows > cb->hot_rows) num_rows = cb->hot_rows;
+  for (long long r = next - num_rows + 1; r <= next; ++r) {
+    double* values = hot + (r % cb->hot_rows) * cb->columns;
+    for (unsigned c = 0; c < cb->columns; ++c) {
+      values[c] = NAN;
+    }
+  }
+}
+
+
+static uint32_t* sparse_columns(sparse_row* r)
+{
+  return (uint32_t*)(r->values + r->capacity);
+}
+
+
+// Returns the position of the first populated cell at or after the column.
+static unsigned sparse_find(sparse_row* r, unsigned column)
+{
+  const uint32_t* columns = sparse_columns(r);
+  unsigned lo = 0, hi = r->count;
+  while (lo < hi) {
+    unsigned mid = (lo + hi) / 2;
+    if (columns[mid] < column) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+
+static double sparse_get(circular_buffer* cb, unsigned row, unsigned column)
+{
+  sparse_row* r = &cb->sparse[row];
+  unsigned i = sparse_find(r, column);
+  if (i < r->count && sparse_columns(r)[i] == column) {
+    return r->values[i];
+  }
+  return NAN;
+}
+
+
+static void sparse_release(lua_State* lua, sparse_row* r)
+{
+  if (r->values) {
+    buffer_realloc(lua, r->values,
+                   (sizeof(double) + sizeof(uint32_t)) * r->capacity, 0);
+  }
+  r->values = NULL;
+  r->count = 0;
+  r->capacity = 0;
+}
+
+
+static void sparse_grow(lua_State* lua, circular_buffer* cb, sparse_row* r)
+{
+  unsigned capacity = r->capacity ? r->capacity * 2 : 4;
+  if (capacity > cb->columns) capacity = cb->columns;
+  double* values = buffer_realloc(lua, NULL, 0,
+                                  (sizeof(double) + sizeof(uint32_t))
+                                  * capacity);
+  if (r->count) {
+    memcpy(values, r->values, sizeof(double) * r->count);
+    memcpy(values + capacity, sparse_columns(r),
+           sizeof(uint32_t) * r->count);
+  }
+  unsigned count = r->count;
+  sparse_release(lua, r);
+  r->values = values;
+  r->count = count;
+  r->capacity = capacity;
+}
+
+
+// Stores a cell value; NaN removes the cell.
+static void sparse_set(lua_State* lua, circular_buffer* cb, unsigned row,
+                       unsigned column, double value)
+{
+  sparse_row* r = &cb->sparse[row];
+  unsigned i = sparse_find(r, column);
+  if (i < r->count && sparse_columns(r)[i] == column) {
+    if (!isnan(value)) {
+      r->values[i] = value;
+      return;
+    }
+    if (--r->count == 0) {
+      sparse_release(lua, r);
+      return;
+    }
+    uint32_t* columns = sparse_columns(r);
+    memmove(r->values + i, r->values + i + 1,
+            sizeof(double) * (r->count - i));
+    memmove(columns + i, columns + i + 1, sizeof(uint32_t) * (r->count - i));
+    return;
+  }
+  if (isnan(value)) return;
+
+  if (r->count == r->capacity) {
+    sparse_grow(lua, cb, r);
+  }
+  uint32_t* columns = sparse_columns(r);
+  memmove(r->values + i + 1, r->values + i, sizeof(double) * (r->count - i));
+  memmove(columns + i + 1, columns + i, sizeof(uint32_t) * (r->count - i));
+  r->values[i] = value;
+  columns[i] = column;
+  ++r->count;
+}
+
+
+// Empties the rows the buffer is advancing into.
+static void sparse_clear_rows(lua_State* lua, circular_buffer* cb,
+                              unsigned num_rows)
+{
+  if (num_rows > cb->rows) num_rows = cb->rows;
+  unsigned row = cb->current_row;
+  for (unsigned i = 0; i < num_rows; ++i) {
+    if (++row == cb->rows) row = 0;
+    sparse_release(lua, &cb->sparse[row]);
+  }
+}
+
+
+static double read_value(circular_buffer* cb, unsigned row, unsigned column)
+{
+  if (cb->hot_rows) {
+    return cell_get(cb, row, column);
+  }
+  if (cb->sparse) {
+    return sparse_get(cb, row, column);
+  }
+  return get_value(cb, value_index(cb, row, column));
+}
+
+
+// Returns the index of the column's first value and the distance between its
+// rows.
+static size_t column_values(circular_buffer* cb, unsigned column,
+                            size_t* stride)
+{
+  if (cb->layout == LAYOUT_COLUMN) {
+    *stride = 1;
+    return (size_t)column * cb->rows;
+  }
+  *stride = cb->columns;
+  return column;
+}
+
+
+static void column_stats_rows(circular_buffer* cb, unsigned column,
+                              unsigned row, unsigned n, column_stats* stats)
+{
+  if (cb->hot_rows) {
+    long long abs_row;
+    unsigned age = absolute_row(cb, row, &abs_row);
+    while (n > 0) {
+      unsigned len;
+      const double* values = cell_run(cb, abs_row, age, column, &len);
+      if (len > n) len = n;
+      if (values) {
+        column_stats_span(stats, values, len, cb->columns);
+      }
+      abs_row += len;
+      age -= len;
+      n -= len;
+    }
+    return;
+  }
+
+  double block[256];
+  if (cb->sparse) {
+    while (n > 0) {
+      unsigned len = n < 256 ? n : 256;
+      for (unsigned j = 0; j < len; ++j) {
+        block[j] = sparse_get(cb, row + j, column);
+      }
+      column_stats_span(stats, block, len, 1);
+      row += len;
+      n -= len;
+    }
+    return;
+  }
+
+  size_t stride;
+  size_t i = column_values(cb, column, &stride) + row * stride;
+  if (cb->storage == STORAGE_DOUBLE) {
+    column_stats_span(stats, (double*)cb->values + i, n, stride);
+    return;
+  }
+  // convert the narrower storage types in blocks
+  while (n > 0) {
+    unsigned len = n < 256 ? n : 256;
+    for (unsigned j = 0; j < len; ++j, i += stride) {
+      block[j] = get_value(cb, i);
+    }
+    column_stats_span(stats, block, len, 1);
+    n -= len;
+  }
+}
+
+
+static void kahan_add(double* sum, double* c, double value)
+{
+  double y = value - *c;
+  double t = *sum + y;
+  *c = (t - *sum) - y;
+  *sum = t;
+}
+
+
+static void running_reset(running_stats* rs)
+{
+  memset(rs, 0, sizeof(running_stats));
+  rs->min = INFINITY;
+  rs->max = -INFINITY;
+}
+
+
+static void running_update(circular_buffer* cb, unsigned column, double old,
+                           double value)
+{
+  running_stats* rs = &cb->running[column];
+  double d;
+  if (!isnan(old)) {
+    if (--rs->count == 0) {
+      running_reset(rs);
+    } else {
+      d = old - rs->shift;
+      kahan_add(&rs->sum, &rs->sum_c, -old);
+      kahan_add(&rs->shifted_sum, &rs->shifted_sum_c, -d);
+      kahan_add(&rs->shifted_sumsq, &rs->shifted_sumsq_c, -d * d);
+      if (old <= rs->min || old >= rs->max) {
+        rs->stale = 1;
+      }
+    }
+  }
+  if (!isnan(value)) {
+    if (rs->count++ == 0) {
+      rs->shift = value;
+    }
+    d = value - rs->shift;
+    kahan_add(&rs->sum, &rs->sum_c, value);
+    kahan_add(&rs->shifted_sum, &rs->shifted_sum_c, d);
+    kahan_add(&rs->shifted_sumsq, &rs->shifted_sumsq_c, d * d);
+    if (value < rs->min) rs->min = value;
+    if (value > rs->max) rs->max = value;
+  }
+}
+
+
+static void store_value(lua_State* lua, circular_buffer* cb, unsigned row,
+                        unsigned column, double value)
+{
+  if (cb->hot_rows) {
+    *cell_ref(lua, cb, row, column) = value;
+    return;
+  }
+  if (cb->sparse) {
+    sparse_set(lua, cb, row, column, value);
+    return;
+  }
+  size_t i = value_index(cb, row, column);
+  if (cb->running) {
+    double old = get_value(cb, i);
+    put_value(cb, i, value);
+    running_update(cb, column, old, get_value(cb, i));
+  } else {
+    put_value(cb, i, value);
+  }
+  if (cb->prefix && cb->prefix[column].valid > row) {
+    cb->prefix[column].valid = row;
+  }
+}
+
+
+static void running_rebuild(circular_buffer* cb, unsigned column)
+{
+  running_stats* rs = &cb->running[column];
+  column_stats stats;
+  column_stats_init(&stats);
+  column_stats_rows(cb, column, 0, cb->rows, &stats);
+  running_reset(rs);
+  if (stats.count) {
+    rs->sum = stats.sum;
+    rs->shifted_sum = stats.shifted_sum;
+    rs->shifted_sumsq = stats.shifted_sumsq;
+    rs->shift = stats.shift;
+    rs->min = stats.min;
+    rs->max = stats.max;
+    rs->count = (unsigned)stats.count;
+  }
+}
+
+
+static void running_expire_rows(circular_buffer* cb, unsigned row,
+                                unsigned num_rows)
+{
+  if (num_rows >= cb->rows) {
+    for (unsigned c = 0; c < cb->columns; ++c) {
+      running_reset(&cb->running[c]);
+    }
+    return;
+  }
+  for (unsigned i = 0; i < num_rows; ++i, ++row) {
+    if (row == cb->rows) row = 0;
+    for (unsigned c = 0; c < cb->columns; ++c) {
+      running_update(cb, c, get_value(cb, value_index(cb, row, c)), NAN);
+    }
+  }
+}
+
+
+static void prefix_invalidate(circular_buffer* cb, unsigned row)
+{
+  for (unsigned c = 0; c < cb->columns; ++c) {
+    if (cb->prefix[c].valid > row) {
+      cb->prefix[c].valid = row;
+    }
+  }
+}
+
+
+static void prefix_extend(circular_buffer* cb, unsigned column, unsigned end)
+{
+  prefix_index* pi = &cb->prefix[column];
+  if (pi->valid >= end) return;
+
+  size_t stride;
+  size_t values = column_values(cb, column, &stride);
+  if (pi->valid == 0) { // rebuilding; shift by the first value in the column
+    pi->shift = 0;
+    for (unsigned r = 0; r < cb->rows; ++r) {
+      double v = get_value(cb, values + r * stride);
+      if (!isnan(v)) {
+        pi->shift = v;
+        break;
+      }
+    }
+  }
+  for (unsigned r = pi->valid; r < end; ++r) {
+    double v = get_value(cb, values + r * stride);
+    int valid = v == v;
+    double d = valid ? v - pi->shift : 0;
+    pi->shifted_sum[r + 1] = pi->shifted_sum[r] + d;
+    pi->shifted_sumsq[r + 1] = pi->shifted_sumsq[r] + d * d;
+    pi->count[r + 1] = pi->count[r] + valid;
+  }
+  pi->valid = end;
+}
+
+
+static void prefix_range(circular_buffer* cb, unsigned column,
+                         unsigned start_row, unsigned end_row,
+                         column_stats* stats)
+{
+  prefix_index* pi = &cb->prefix[column];
+  column_stats_init(stats);
+  if (start_row > end_row) { // the range wraps
+    prefix_extend(cb, column, cb->rows);
+    stats->shifted_sum = pi->shifted_sum[cb->rows] - pi->shifted_sum[start_row]
+      + pi->shifted_sum[end_row + 1];
+    stats->shifted_sumsq = pi->shifted_sumsq[cb->rows]
+      - pi->shifted_sumsq[start_row] + pi->shifted_sumsq[end_row + 1];
+    stats->count = (size_t)(pi->count[cb->rows] - pi->count[start_row]
+                            + pi->count[end_row + 1]);
+  } else {
+    prefix_extend(cb, column, end_row + 1);
+    stats->shifted_sum = pi->shifted_sum[end_row + 1]
+      - pi->shifted_sum[start_row];
+    stats->shifted_sumsq = pi->shifted_sumsq[end_row + 1]
+      - pi->shifted_sumsq[start_row];
+    stats->count = (size_t)(pi->count[end_row + 1] - pi->count[start_row]);
+  }
+  stats->shift = pi->shift;
+  stats->sum = stats->shifted_sum + stats->count * pi->shift;
+}
+
+
+static void copy_cleared_row(circular_buffer* cb, char* cleared, size_t rows)
 {
   size_t pool = 1;
   size_t ask;
@@ -89,13 +916,26 @@ static void copy_cleared_row(circular_buffer* cb, double* cleared, size_t rows)
     } else {
       ask = rows;
     }
-    memcpy(cleared + (pool * cb->columns), cleared, sizeof(double) * cb->columns * ask);
+    size_t row_bytes = value_sizes[cb->storage] * cb->columns;
+    memcpy(cleared + (pool * row_bytes), cleared, row_bytes * ask);
     rows -= ask;
     pool += ask;
   }
 }
 
 
+static void clear_column_rows(circular_buffer* cb, unsigned row,
+                              unsigned num_rows)
+{
+  for (unsigned c = 0; c < cb->columns; ++c) {
+    size_t v = (size_t)c * cb->rows + row;
+    for (unsigned i = 0; i < num_rows; ++i) {
+      put_value(cb, v + i, NAN);
+    }
+  }
+}
+
+
 static void clear_rows(circular_buffer* cb, unsigned num_rows)
 {
   if (num_rows >= cb->rows) {
@@ -104,14 +944,31 @@ static void clear_rows(circular_buffer* cb, unsigned num_rows)
   unsigned row = cb->current_row;
   ++row;
   if (row >= cb->rows) {row = 0;}
+  if (cb->running) {
+    running_expire_rows(cb, row, num_rows);
+  }
+  if (cb->prefix) {
+    prefix_invalidate(cb, row + num_rows > cb->rows ? 0 : row);
+  }
+  if (cb->layout == LAYOUT_COLUMN) {
+    if (row + num_rows > cb->rows) {
+      clear_column_rows(cb, row, cb->rows - row);
+      clear_column_rows(cb, 0, row + num_rows - cb->rows);
+    } else {
+      clear_column_rows(cb, row, num_rows);
+    }
+    return;
+  }
+
   for (unsigned c = 0; c < cb->columns; ++c) {
-    cb->values[(row * cb->columns) + c] = NAN;
+    put_value(cb, (row * cb->columns) + c, NAN);
   }
-  double* cleared = &cb->values[row * cb->columns];
+  char* cleared = (char*)cb->values
+    + value_sizes[cb->storage] * row * cb->columns;
   if (row + num_rows - 1 >= cb->rows) {
     copy_cleared_row(cb, cleared, cb->rows - row - 1);
     for (unsigned c = 0; c < cb->columns; ++c) {
-      cb->values[c] = NAN;
+      put_value(cb, c, NAN);
     }
     copy_cleared_row(cb, cb->values, row + num_rows - 1 - cb->rows);
   } else {
@@ -120,6 +977,61 @@ static void clear_rows(circular_buffer* cb, unsigned num_rows)
 }
 
 
+// Clears the sketches of the rows the buffer is advancing into.
+static void clear_sketch_rows(circular_buffer* cb, unsigned num_rows)
+{
+  if (num_rows > cb->rows) num_rows = cb->rows;
+  for (unsigned c = 0; c < cb->columns; ++c) {
+    quantile_sketch* sketches = cb->sketches[c];
+    hyperloglog* distinct = cb->distinct[c];
+    if (!sketches && !distinct) continue;
+    unsigned row = cb->current_row + 1;
+    for (unsigned i = 0; i < num_rows; ++i, ++row) {
+      if (row == cb->rows) row = 0;
+      if (sketches) sketch_clear(&sketches[row]);
+      if (distinct) hll_clear(&distinct[row]);
+    }
+  }
+}
+
+
+static void set_aggregation(lua_State* lua, circular_buffer* cb,
+                            unsigned column, COLUMN_AGGREGATION aggregation,
+                            double quantile)
+{
+  cb->headers[column].aggregation = aggregation;
+  cb->headers[column].quantile = quantile;
+  size_t bytes = sizeof(quantile_sketch) * cb->rows;
+  if (aggregation == AGGREGATION_QUANTILE && !cb->sketches[column]) {
+    cb->sketches[column] = buffer_realloc(lua, NULL, 0, bytes);
+    for (unsigned row = 0; row < cb->rows; ++row) {
+      sketch_clear(&cb->sketches[column][row]);
+    }
+  } else if (aggregation != AGGREGATION_QUANTILE && cb->sketches[column]) {
+    buffer_realloc(lua, cb->sketches[column], bytes, 0);
+    cb->sketches[column] = NULL;
+  }
+
+  bytes = sizeof(hyperloglog) * cb->rows;
+  if (aggregation == AGGREGATION_DISTINCT && !cb->distinct[column]) {
+    cb->distinct[column] = buffer_realloc(lua, NULL, 0, bytes);
+    for (unsigned row = 0; row < cb->rows; ++row) {
+      hll_clear(&cb->distinct[column][row]);
+    }
+  } else if (aggregation != AGGREGATION_DISTINCT && cb->distinct[column]) {
+    buffer_realloc(lua, cb->distinct[column], bytes, 0);
+    cb->distinct[column] = NULL;
+  }
+}
+
+
+// Rounds a section size up so the next section starts on a double boundary.
+static size_t align_bytes(size_t n)
+{
+  return (n + sizeof(double) - 1) & ~(sizeof(double) - 1);
+}
+
+
 static int circular_buffer_new(lua_State* lua)
 {
   int n = lua_gettop(lua);
@@ -132,24 +1044,99 @@ static int circular_buffer_new(lua_State* lua)
   luaL_argcheck(lua, 0 < seconds_per_row
                 && seconds_per_row <= seconds_in_day, 3,
                 "seconds_per_row is out of range");
-  int delta = 0;
+  int delta = 0, running = 0, prefix = 0, hot_rows = 0, sparse = 0;
+  unsigned future = 0;
+  VALUE_LAYOUT layout = LAYOUT_ROW;
+  VALUE_STORAGE storage = STORAGE_DOUBLE;
   if (4 == n) {
-    delta = lua_toboolean(lua, 4);
+    if (lua_istable(lua, 4)) { // options table
+      lua_getfield(lua, 4, "delta");
+      delta = lua_toboolean(lua, -1);
+      lua_getfield(lua, 4, "layout");
+      layout = luaL_checkoption(lua, -1, "row", value_layouts);
+      lua_getfield(lua, 4, "running");
+      running = lua_toboolean(lua, -1);
+      lua_getfield(lua, 4, "prefix");
+      prefix = lua_toboolean(lua, -1);
+      lua_getfield(lua, 4, "storage");
+      storage = luaL_checkoption(lua, -1, "double", value_storage_types);
+      lua_getfield(lua, 4, "hot_rows");
+      hot_rows = luaL_optint(lua, -1, 0);
+      lua_getfield(lua, 4, "sparse");
+      sparse = lua_toboolean(lua, -1);
+      lua_getfield(lua, 4, "future");
+      double ahead = luaL_optnumber(lua, -1, 0);
+      lua_pop(lua, 8);
+      luaL_argcheck(lua, 0 <= ahead && ahead <= UINT_MAX, 4,
+                    "future is out of range");
+      future = (unsigned)ahead;
+      luaL_argcheck(lua, 0 <= hot_rows && hot_rows < rows, 4,
+                    "hot_rows is out of range");
+      luaL_argcheck(lua, hot_rows == 0 || (layout == LAYOUT_ROW
+                                           && storage == STORAGE_DOUBLE
+                                           && !running && !prefix), 4,
+                    "hot_rows requires the default layout and storage");
+      luaL_argcheck(lua, !sparse || (layout == LAYOUT_ROW
+                                     && storage == STORAGE_DOUBLE
+                                     && !running && !prefix && !hot_rows), 4,
+                    "sparse requires the default layout and storage");
+    } else {
+      delta = lua_toboolean(lua, 4);
+    }
   }
 
-  size_t header_bytes = sizeof(header_info) * columns;
-  size_t buffer_bytes = sizeof(double) * rows * columns;
-  size_t struct_bytes = sizeof(circular_buffer) - 1; // subtract 1 for the
-                                                     // byte already included
-                                                     // in the struct
-
-  size_t nbytes = header_bytes + buffer_bytes + struct_bytes;
+  size_t header_bytes = align_bytes(sizeof(header_info) * columns);
+  size_t buffer_bytes = align_bytes(sparse ? sizeof(sparse_row) * rows
+    : value_sizes[storage] * (hot_rows ? hot_rows : rows) * columns);
+  size_t running_bytes = running
+    ? align_bytes(sizeof(running_stats) * columns) : 0;
+  size_t prefix_index_bytes = align_bytes(sizeof(prefix_index) * columns);
+  size_t prefix_bytes = prefix ? prefix_index_bytes
+    + sizeof(double) * 3 * (rows + 1) * columns : 0;
+  unsigned cold_blocks = hot_rows ? rows / COLD_BLOCK_ROWS + 2 : 0;
+  size_t cold_block_bytes = align_bytes(sizeof(cold_block) * cold_blocks);
+  size_t cold_bytes = hot_rows ? cold_block_bytes
+    + (sizeof(double) * COLD_BLOCK_ROWS + sizeof(long long)) * columns : 0;
+  size_t sketch_bytes = align_bytes((sizeof(quantile_sketch*)
+                                     + sizeof(hyperloglog*)
+                                     + sizeof(detector*)) * columns);
+  size_t struct_bytes = sizeof(circular_buffer) - sizeof(double); // subtract
+                                                  // the bytes member already
+                                                  // included in the struct
+
+  size_t nbytes = header_bytes + buffer_bytes + running_bytes + prefix_bytes
+    + cold_bytes + sketch_bytes + struct_bytes;
   circular_buffer* cb = (circular_buffer*)lua_newuserdata(lua, nbytes);
-  cb->ref = LUA_NOREF;
+  char* bytes = (char*)cb->bytes;
   cb->delta = delta;
+  cb->deltas = NULL;
+  cb->delta_rows = 0;
+  cb->delta_capacity = 0;
+  cb->delta_last = 0;
+  cb->future = future;
+  cb->late_writes = 0;
+  cb->dropped_writes = 0;
+  cb->future_writes = 0;
   cb->format = OUTPUT_CBUF;
-  cb->headers = (header_info*)&cb->bytes[0];
-  cb->values = (double*)&cb->bytes[header_bytes];
+  cb->layout = layout;
+  cb->headers = (header_info*)bytes;
+  cb->storage = storage;
+  cb->values = bytes + header_bytes;
+  cb->running = NULL; // enabled after the values are initialized
+  cb->prefix = NULL;
+  cb->hot_rows = hot_rows;
+  cb->cold_blocks = cold_blocks;
+  cb->cold = NULL;
+  cb->sparse = sparse ? (sparse_row*)cb->values : NULL;
+  cb->decoded = NULL;
+  cb->decoded_ids = NULL;
+  cb->rollup = NULL;
+  cb->sketches = (quantile_sketch**)(bytes + nbytes - struct_bytes
+                                     - sketch_bytes);
+  cb->distinct = (hyperloglog**)(cb->sketches + columns);
+  cb->detectors = (detector**)(cb->distinct + columns);
+  cb->detector_columns = 0;
+  memset(cb->sketches, 0, sketch_bytes);
 
   luaL_getmetatable(lua, lsb_circular_buffer);
   lua_setmetatable(lua, -2);
@@ -159,14 +1146,99 @@ static int circular_buffer_new(lua_State* lua)
   cb->rows = rows;
   cb->columns = columns;
   cb->seconds_per_row = seconds_per_row;
-  memset(cb->bytes, 0, header_bytes);
+  memset(bytes, 0, header_bytes);
   for (unsigned column_idx = 0; column_idx < cb->columns; ++column_idx) {
     snprintf(cb->headers[column_idx].name, COLUMN_NAME_SIZE,
              "Column_%d", column_idx + 1);
     strncpy(cb->headers[column_idx].unit, default_unit,
             UNIT_LABEL_SIZE - 1);
   }
-  clear_rows(cb, rows);
+  if (hot_rows) {
+    char* p = bytes + header_bytes + buffer_bytes;
+    cb->cold = (cold_block*)p;
+    cb->decoded = (double*)(p + cold_block_bytes);
+    cb->decoded_ids = (long long*)(cb->decoded + COLD_BLOCK_ROWS * columns);
+    for (unsigned i = 0; i < cb->columns; ++i) {
+      cb->decoded_ids[i] = -1;
+    }
+    for (unsigned i = 0; i < cold_blocks; ++i) {
+      cb->cold[i].id = -1;
+      cb->cold[i].data = NULL;
+      cb->cold[i].size = 0;
+      cb->cold[i].sealed = 0;
+    }
+    for (unsigned i = 0; i < cb->hot_rows * cb->columns; ++i) {
+      ((double*)cb->values)[i] = NAN;
+    }
+  } else if (sparse) {
+    memset(cb->sparse, 0, sizeof(sparse_row) * rows);
+  } else {
+    clear_rows(cb, rows);
+  }
+  if (running) {
+    cb->running = (running_stats*)(bytes + header_bytes + buffer_bytes);
+    for (unsigned column_idx = 0; column_idx < cb->columns; ++column_idx) {
+      running_reset(&cb->running[column_idx]);
+    }
+  }
+  if (prefix) {
+    char* p = bytes + header_bytes + buffer_bytes + running_bytes;
+    cb->prefix = (prefix_index*)p;
+    double* sums = (double*)(p + prefix_index_bytes);
+    for (unsigned column_idx = 0; column_idx < cb->columns; ++column_idx) {
+      prefix_index* pi = &cb->prefix[column_idx];
+      pi->shifted_sum = sums;
+      pi->shifted_sumsq = sums + rows + 1;
+      pi->count = sums + 2 * (rows + 1);
+      pi->shifted_sum[0] = pi->shifted_sumsq[0] = pi->count[0] = 0;
+      pi->shift = 0;
+      pi->valid = 0;
+      sums += 3 * (rows + 1);
+    }
+  }
+  return 1;
+}
+
+
+static int circular_buffer_new_tiered(lua_State* lua)
+{
+  int n = lua_gettop(lua);
+  luaL_argcheck(lua, n >= 2 && n <= 3, 0, "incorrect number of arguments");
+  int columns = luaL_checkint(lua, 1);
+  luaL_checktype(lua, 2, LUA_TTABLE);
+  int tiers = (int)lua_objlen(lua, 2);
+  luaL_argcheck(lua, 0 < tiers, 2, "at least one tier is required");
+
+  // create the tiers from the coarsest so each one can reference the next;
+  // the coarser tier is kept alive by the finer tier's environment table
+  circular_buffer* coarse = NULL;
+  for (int i = tiers; i >= 1; --i) {
+    lua_rawgeti(lua, 2, i);
+    luaL_argcheck(lua, lua_istable(lua, -1), 2,
+                  "tiers must be {rows, seconds_per_row} tables");
+    lua_pushcfunction(lua, circular_buffer_new);
+    lua_rawgeti(lua, -2, 1);
+    lua_pushinteger(lua, columns);
+    lua_rawgeti(lua, -4, 2);
+    if (3 == n) {
+      lua_pushvalue(lua, 3);
+    }
+    lua_call(lua, n + 1, 1);
+    circular_buffer* cb = (circular_buffer*)lua_touserdata(lua, -1);
+    if (coarse) {
+      luaL_argcheck(lua, cb->seconds_per_row < coarse->seconds_per_row
+                    && coarse->seconds_per_row % cb->seconds_per_row == 0, 2,
+                    "seconds_per_row must be a multiple of the finer tier");
+      lua_createtable(lua, 1, 0);
+      lua_pushvalue(lua, n + 1);
+      lua_rawseti(lua, -2, 1);
+      lua_setfenv(lua, -2);
+      cb->rollup = coarse;
+    }
+    lua_replace(lua, n + 1);
+    lua_settop(lua, n + 1);
+    coarse = cb;
+  }
   return 1;
 }
 
@@ -181,7 +1253,45 @@ static circular_buffer* check_circular_buffer(lua_State* lua, int min_args)
 }
 
 
-static int check_row(circular_buffer* cb, double ns, int advance)
+static void rollup_rows(lua_State* lua, circular_buffer* cb,
+                        unsigned num_rows);
+
+
+// Refits a MAD detector to the window of rows ending at end_row.
+static void fit_window(lua_State* lua, circular_buffer* cb, unsigned column,
+                       unsigned end_row)
+{
+  detector* d = cb->detectors[column];
+  double* values = get_scratch(lua, sizeof(double) * d->season);
+  size_t n = 0;
+  unsigned row = end_row;
+  for (unsigned i = 0; i < d->season; ++i) {
+    double value = read_value(cb, row, column);
+    if (!isnan(value)) values[n++] = value;
+    row = row ? row - 1 : cb->rows - 1;
+  }
+  detector_fit(d, values, n);
+}
+
+
+// Feeds the row being completed to the column detectors.
+static void detect_row(lua_State* lua, circular_buffer* cb)
+{
+  long long row = cb->current_time / cb->seconds_per_row;
+  for (unsigned c = 0; c < cb->columns; ++c) {
+    detector* d = cb->detectors[c];
+    if (!d) continue;
+    if (d->method == DETECTOR_MAD) {
+      fit_window(lua, cb, c, cb->current_row);
+    } else {
+      detector_update(d, row, read_value(cb, cb->current_row, c));
+    }
+  }
+}
+
+
+static int check_row(lua_State* lua, circular_buffer* cb, double ns,
+                     int advance)
 {
   time_t t = (time_t)(ns / 1e9);
   t = t - (t % cb->seconds_per_row);
@@ -192,9 +1302,25 @@ static int check_row(circular_buffer* cb, double ns, int advance)
   int row = requested_row % cb->rows;
 
   if (row_delta > 0 && advance) {
-    clear_rows(cb, row_delta);
+    if (cb->detector_columns) {
+      detect_row(lua, cb);
+    }
+    if (cb->rollup) {
+      rollup_rows(lua, cb, row_delta);
+    }
+    clear_sketch_rows(cb, row_delta);
+    if (cb->hot_rows) {
+      cold_advance(lua, cb, row_delta);
+    } else if (cb->sparse) {
+      sparse_clear_rows(lua, cb, row_delta);
+    } else {
+      clear_rows(cb, row_delta);
+    }
     cb->current_time = t;
     cb->current_row = row;
+    if (cb->hot_rows) {
+      cold_seal_blocks(lua, cb);
+    }
   } else if (requested_row > current_row
              || abs(row_delta) >= (int)cb->rows) {
     return -1;
@@ -203,6 +1329,27 @@ static int check_row(circular_buffer* cb, double ns, int advance)
 }
 
 
+// Locates the row of a written value like check_row; values too far past the
+// clock are rejected (-1). Every rejected or late write is counted.
+static int check_write_row(lua_State* lua, circular_buffer* cb, double ns)
+{
+  time_t t = (time_t)(ns / 1e9);
+  if (cb->future && t > time(NULL) + (time_t)cb->future) {
+    ++cb->future_writes;
+    return -1;
+  }
+  t = t - (t % cb->seconds_per_row);
+  int row = check_row(lua, cb, ns, 1); // advance the buffer forward if
+                                       // necessary
+  if (row == -1) {
+    ++cb->dropped_writes;
+  } else if (t < cb->current_time) {
+    ++cb->late_writes;
+  }
+  return row;
+}
+
+
 static int check_column(lua_State* lua, circular_buffer* cb, int arg)
 {
   unsigned column = luaL_checkint(lua, arg);
@@ -213,95 +1360,392 @@ static int check_column(lua_State* lua, circular_buffer* cb, int arg)
 }
 
 
+// Each delta row holds the row time, the column deltas and a bitmap of the
+// columns that have been modified.
+static size_t delta_row_size(circular_buffer* cb)
+{
+  return 1 + cb->columns + (cb->columns + 63) / 64;
+}
+
+
+static unsigned char* delta_dirty(circular_buffer* cb, double* row)
+{
+  return (unsigned char*)(row + 1 + cb->columns);
+}
+
+
+static double* find_delta_row(lua_State* lua, circular_buffer* cb, time_t t)
+{
+  size_t n = delta_row_size(cb);
+  if (cb->delta_rows && cb->deltas[cb->delta_last * n] == t) {
+    return cb->deltas + cb->delta_last * n;
+  }
+
+  size_t lo = 0, hi = cb->delta_rows;
+  while (lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    if (cb->deltas[mid * n] < t) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  cb->delta_last = lo;
+  if (lo < cb->delta_rows && cb->deltas[lo * n] == t) {
+    return cb->deltas + lo * n;
+  }
+
+  if (cb->delta_rows == cb->delta_capacity) {
+    // allocated through Lua so the memory is charged to the sandbox
+    void* ud;
+    lua_Alloc alloc = lua_getallocf(lua, &ud);
+    size_t capacity = cb->delta_capacity ? cb->delta_capacity * 2 : 4;
+    double* deltas = alloc(ud, cb->deltas,
+                           sizeof(double) * n * cb->delta_capacity,
+                           sizeof(double) * n * capacity);
+    if (!deltas) {
+      luaL_error(lua, "not enough memory");
+    }
+    cb->deltas = deltas;
+    cb->delta_capacity = capacity;
+  }
+  double* row = cb->deltas + lo * n;
+  memmove(row + n, row, sizeof(double) * n * (cb->delta_rows - lo));
+  memset(row, 0, sizeof(double) * n);
+  row[0] = (double)t;
+  ++cb->delta_rows;
+  return row;
+}
+
+
 static void circular_buffer_add_delta(lua_State* lua, circular_buffer* cb,
                                       double ns, int column, double value)
 {
-  // Storing the deltas in a Lua table allows the sandbox to account for the
-  // memory usage. todo: if too inefficient use a C data struct and report
-  // memory usage back to the sandbox
   time_t t = (time_t)(ns / 1e9);
   t = t - (t % cb->seconds_per_row);
-  lua_getglobal(lua, lsb_circular_buffer_table);
-  if (lua_istable(lua, -1)) {
-    if (cb->ref == LUA_NOREF) {
-      lua_newtable(lua);
-      cb->ref = luaL_ref(lua, -2);
-    }
-    // get the delta table for this cbuf
-    lua_rawgeti(lua, -1, cb->ref);
-    if (!lua_istable(lua, -1)) {
-      lua_pop(lua, 2); // remove bogus table and cbuf table
-      return;
-    }
+  double* row = find_delta_row(lua, cb, t);
+  unsigned char* dirty = delta_dirty(cb, row);
+  unsigned char bit = 1 << (column & 7);
+  if (dirty[column >> 3] & bit) {
+    value += row[1 + column];
+  } else {
+    dirty[column >> 3] |= bit;
+  }
+  row[1 + column] = value;
+}
+
 
-    // get the delta row using the timestamp
-    lua_rawgeti(lua, -1, (int)t);
-    if (!lua_istable(lua, -1)) {
-      lua_pop(lua, 1); // remove non table entry
-      lua_newtable(lua);
-      lua_rawseti(lua, -2, (int)t);
-      lua_rawgeti(lua, -1, (int)t);
+static int circular_buffer_gc(lua_State* lua)
+{
+  circular_buffer* cb = (circular_buffer*)lua_touserdata(lua, 1);
+  if (cb->deltas) {
+    void* ud;
+    lua_Alloc alloc = lua_getallocf(lua, &ud);
+    alloc(ud, cb->deltas,
+          sizeof(double) * delta_row_size(cb) * cb->delta_capacity, 0);
+    cb->deltas = NULL;
+    cb->delta_rows = 0;
+    cb->delta_capacity = 0;
+  }
+  for (unsigned i = 0; i < cb->cold_blocks; ++i) {
+    cold_release(lua, cb, &cb->cold[i]);
+  }
+  if (cb->sparse) {
+    for (unsigned i = 0; i < cb->rows; ++i) {
+      sparse_release(lua, &cb->sparse[i]);
+    }
+  }
+  for (unsigned c = 0; c < cb->columns; ++c) {
+    if (cb->sketches[c]) {
+      buffer_realloc(lua, cb->sketches[c], sizeof(quantile_sketch) * cb->rows,
+                     0);
+      cb->sketches[c] = NULL;
     }
+    if (cb->distinct[c]) {
+      buffer_realloc(lua, cb->distinct[c], sizeof(hyperloglog) * cb->rows, 0);
+      cb->distinct[c] = NULL;
+    }
+    if (cb->detectors[c]) {
+      detector* d = cb->detectors[c];
+      buffer_realloc(lua, d, detector_size(d->method, d->season), 0);
+      cb->detectors[c] = NULL;
+    }
+  }
+  cb->detector_columns = 0;
+  return 0;
+}
+
+
+// Updates a quantile column cell after samples were added to its sketch; the
+// cell holds the number of samples.
+static double store_sketch_count(lua_State* lua, circular_buffer* cb,
+                                 double ns, int row, int column,
+                                 double added)
+{
+  double count = cb->sketches[column][row].count;
+  store_value(lua, cb, row, column, count);
+  if (cb->delta && added != 0) {
+    circular_buffer_add_delta(lua, cb, ns, column, added);
+  }
+  return count;
+}
+
+
+// Updates a distinct column cell after its registers changed; the cell holds
+// the estimated number of distinct items.
+static double store_distinct_count(lua_State* lua, circular_buffer* cb,
+                                   double ns, int row, int column)
+{
+  double old = read_value(cb, row, column);
+  double count = hll_count(&cb->distinct[column][row]);
+  store_value(lua, cb, row, column, count);
+  if (cb->delta) {
+    circular_buffer_add_delta(lua, cb, ns, column,
+                              isnan(old) ? count : count - old);
+  }
+  return read_value(cb, row, column);
+}
 
-    // get the previous delta value
-    lua_rawgeti(lua, -1, column);
-    value += lua_tonumber(lua, -1);
-    lua_pop(lua, 1); // remove the old value
 
-    // push the new delta
+static double add_distinct(lua_State* lua, circular_buffer* cb, double ns,
+                           int row, int column, uint64_t hash)
+{
+  if (hll_insert(&cb->distinct[column][row], hash)
+      || isnan(read_value(cb, row, column))) {
+    return store_distinct_count(lua, cb, ns, row, column);
+  }
+  return read_value(cb, row, column);
+}
+
+
+// Adds the string at the stack index to a distinct column.
+static double add_string(lua_State* lua, circular_buffer* cb, double ns,
+                         int row, int column, int idx)
+{
+  size_t len;
+  const char* item = lua_tolstring(lua, idx, &len);
+  return add_distinct(lua, cb, ns, row, column, hll_hash(item, len));
+}
+
+
+static double add_value(lua_State* lua, circular_buffer* cb, double ns,
+                        int row, int column, double value)
+{
+  if (cb->headers[column].aggregation == AGGREGATION_QUANTILE) {
+    if (!isfinite(value)) return read_value(cb, row, column);
+    sketch_insert(&cb->sketches[column][row], value);
+    return store_sketch_count(lua, cb, ns, row, column, 1);
+  }
+  if (cb->headers[column].aggregation == AGGREGATION_DISTINCT) {
+    if (isnan(value)) return read_value(cb, row, column);
+    // numbers are hashed as their Lua string form so 1 and "1" are one item
     lua_pushnumber(lua, value);
-    lua_rawseti(lua, -2, column);
+    double count = add_string(lua, cb, ns, row, column, -1);
+    lua_pop(lua, 1);
+    return count;
+  }
+  double old = read_value(cb, row, column);
+  if (isnan(old)) {
+    store_value(lua, cb, row, column, value);
+  } else {
+    store_value(lua, cb, row, column, old + value);
+  }
+  if (cb->delta && value != 0) {
+    if (cb->headers[column].aggregation != AGGREGATION_SUM) {
+      value = read_value(cb, row, column);
+    }
+    circular_buffer_add_delta(lua, cb, ns, column, value);
+  }
+  return read_value(cb, row, column);
+}
+
+
+static int circular_buffer_add(lua_State* lua)
+{
+  circular_buffer* cb = check_circular_buffer(lua, 4);
+  double ns = luaL_checknumber(lua, 2);
+  int row             = check_write_row(lua, cb, ns);
+  int column          = check_column(lua, cb, 3);
+  int item            = cb->distinct[column]
+    && lua_type(lua, 4) == LUA_TSTRING;
+  double value        = item ? 0 : luaL_checknumber(lua, 4);
+  if (row != -1) {
+    lua_pushnumber(lua, item ? add_string(lua, cb, ns, row, column, 4)
+                   : add_value(lua, cb, ns, row, column, value));
+  } else {
+    lua_pushnil(lua);
+  }
+  return 1;
+}
+
 
-    lua_pop(lua, 2); // remove ref table, timestamped row
+static int circular_buffer_add_row(lua_State* lua)
+{
+  circular_buffer* cb = check_circular_buffer(lua, 3);
+  double ns = luaL_checknumber(lua, 2);
+  int n = lua_gettop(lua);
+  luaL_argcheck(lua, n - 2 <= (int)cb->columns, (int)cb->columns + 3,
+                "too many values");
+  // validate every value before the buffer is modified
+  for (int i = 3; i <= n; ++i) {
+    if (!lua_isnil(lua, i)) luaL_checknumber(lua, i);
+  }
+
+  int row = check_write_row(lua, cb, ns);
+  if (row != -1) {
+    for (int i = 3; i <= n; ++i) {
+      if (!lua_isnil(lua, i)) {
+        add_value(lua, cb, ns, row, i - 3, lua_tonumber(lua, i));
+      }
+    }
+    lua_pushboolean(lua, 1);
+  } else {
+    lua_pushnil(lua);
+  }
+  return 1;
+}
+
+
+static int circular_buffer_add_many(lua_State* lua)
+{
+  circular_buffer* cb = check_circular_buffer(lua, 3);
+  double ns = luaL_checknumber(lua, 2);
+  luaL_checktype(lua, 3, LUA_TTABLE);
+  // validate every column/value pair before the buffer is modified
+  lua_pushnil(lua);
+  while (lua_next(lua, 3) != 0) {
+    double column = lua_tonumber(lua, -2);
+    luaL_argcheck(lua, lua_type(lua, -2) == LUA_TNUMBER && column >= 1
+                  && column <= cb->columns && column == (int)column, 3,
+                  "column out of range");
+    luaL_argcheck(lua, lua_type(lua, -1) == LUA_TNUMBER, 3,
+                  "values must be numbers");
+    lua_pop(lua, 1);
+  }
+
+  int row = check_write_row(lua, cb, ns);
+  if (row != -1) {
+    lua_pushnil(lua);
+    while (lua_next(lua, 3) != 0) {
+      add_value(lua, cb, ns, row, (int)lua_tonumber(lua, -2) - 1,
+                lua_tonumber(lua, -1));
+      lua_pop(lua, 1);
+    }
+    lua_pushboolean(lua, 1);
   } else {
-    luaL_error(lua, "Could not find table %s", lsb_circular_buffer_table);
+    lua_pushnil(lua);
+  }
+  return 1;
+}
+
+
+static int circular_buffer_get(lua_State* lua)
+{
+  circular_buffer* cb = check_circular_buffer(lua, 3);
+  int row             = check_row(lua, cb,
+                                  luaL_checknumber(lua, 2),
+                                  0);
+  int column          = check_column(lua, cb, 3);
+
+  if (row != -1) {
+    lua_pushnumber(lua, read_value(cb, row, column));
+  } else {
+    lua_pushnil(lua);
+  }
+  return 1;
+}
+
+
+static int circular_buffer_tier(lua_State* lua)
+{
+  circular_buffer* cb = check_circular_buffer(lua, 2);
+  int tier = luaL_checkint(lua, 2);
+  luaL_argcheck(lua, 1 <= tier, 2, "tier out of range");
+
+  lua_pushvalue(lua, 1);
+  for (int i = 1; i < tier; ++i) {
+    luaL_argcheck(lua, cb->rollup, 2, "tier out of range");
+    lua_getfenv(lua, -1);
+    lua_rawgeti(lua, -1, 1);
+    lua_replace(lua, -3);
+    lua_pop(lua, 1);
+    cb = cb->rollup;
+  }
+  return 1;
+}
+
+
+static int circular_buffer_get_configuration(lua_State* lua)
+{
+  circular_buffer* cb = check_circular_buffer(lua, 1);
+
+  lua_pushnumber(lua, cb->rows);
+  lua_pushnumber(lua, cb->columns);
+  lua_pushnumber(lua, cb->seconds_per_row);
+  return 3;
+}
+
+
+// Overwrites the cell regardless of the column aggregation.
+static void replace_value(lua_State* lua, circular_buffer* cb, double ns,
+                          int row, int column, double value)
+{
+  double old = read_value(cb, row, column);
+  store_value(lua, cb, row, column, value);
+  if (cb->delta) {
+    if (!isnan(old)) {
+      value -= old;
+    }
+    circular_buffer_add_delta(lua, cb, ns, column, value);
   }
-  lua_pop(lua, 1); // remove the circular buffer table or failed nil
-  return;
 }
 
 
-static int circular_buffer_add(lua_State* lua)
+static double set_value(lua_State* lua, circular_buffer* cb, double ns,
+                        int row, int column, double value)
 {
-  circular_buffer* cb = check_circular_buffer(lua, 4);
-  double ns = luaL_checknumber(lua, 2);
-  int row             = check_row(cb,
-                                  ns,
-                                  1); // advance the buffer forward if
-                                      // necessary
-  int column          = check_column(lua, cb, 3);
-  double value        = luaL_checknumber(lua, 4);
-  if (row != -1) {
-    int i = (row * cb->columns) + column;
-    if (isnan(cb->values[i])) {
-      cb->values[i] = value;
-    } else {
-      cb->values[i] += value;
+  double old = read_value(cb, row, column);
+  switch (cb->headers[column].aggregation) {
+  case AGGREGATION_QUANTILE: // every value is a sample
+  case AGGREGATION_DISTINCT: // every value is an item
+    return add_value(lua, cb, ns, row, column, value);
+  case AGGREGATION_MIN:
+    if (isnan(old) || value < old) {
+      store_value(lua, cb, row, column, value);
+      if (cb->delta) {
+        circular_buffer_add_delta(lua, cb, ns, column, value);
+      }
     }
-    lua_pushnumber(lua, cb->values[i]);
-    if (cb->delta && value != 0) {
-      if (cb->headers[column].aggregation != AGGREGATION_SUM) {
-        value = cb->values[i];
+    break;
+  case AGGREGATION_MAX:
+    if (isnan(old) || value > old) {
+      store_value(lua, cb, row, column, value);
+      if (cb->delta) {
+        circular_buffer_add_delta(lua, cb, ns, column, value);
       }
-      circular_buffer_add_delta(lua, cb, ns, column, value);
     }
-  } else {
-    lua_pushnil(lua);
+    break;
+  default:
+    replace_value(lua, cb, ns, row, column, value);
+    break;
   }
-  return 1;
+  return read_value(cb, row, column);
 }
 
 
-static int circular_buffer_get(lua_State* lua)
+static int circular_buffer_set(lua_State* lua)
 {
-  circular_buffer* cb = check_circular_buffer(lua, 3);
-  int row             = check_row(cb,
-                                  luaL_checknumber(lua, 2),
-                                  0);
+  circular_buffer* cb = check_circular_buffer(lua, 4);
+  double ns = luaL_checknumber(lua, 2);
+  int row             = check_write_row(lua, cb, ns);
   int column          = check_column(lua, cb, 3);
+  int item            = cb->distinct[column]
+    && lua_type(lua, 4) == LUA_TSTRING;
+  double value        = item ? 0 : luaL_checknumber(lua, 4);
 
   if (row != -1) {
-    lua_pushnumber(lua, cb->values[(row * cb->columns) + column]);
+    lua_pushnumber(lua, item ? add_string(lua, cb, ns, row, column, 4)
+                   : set_value(lua, cb, ns, row, column, value));
   } else {
     lua_pushnil(lua);
   }
@@ -309,61 +1753,56 @@ static int circular_buffer_get(lua_State* lua)
 }
 
 
-static int circular_buffer_get_configuration(lua_State* lua)
+// Merges a source cell into dst using the dst column aggregation method; the
+// sketches and registers are merged when both columns keep them. src is NULL
+// for values parsed from text, which cannot be merged into quantile and
+// distinct columns.
+static void merge_cell(lua_State* lua, circular_buffer* dst, double ns,
+                       int row, circular_buffer* src, int src_row,
+                       unsigned column, double value)
 {
-  circular_buffer* cb = check_circular_buffer(lua, 1);
-
-  lua_pushnumber(lua, cb->rows);
-  lua_pushnumber(lua, cb->columns);
-  lua_pushnumber(lua, cb->seconds_per_row);
-  return 3;
+  if (src && dst->sketches[column] && src->sketches[column]) {
+    quantile_sketch* sketch = &src->sketches[column][src_row];
+    sketch_merge(&dst->sketches[column][row], sketch);
+    store_sketch_count(lua, dst, ns, row, column, sketch->count);
+  } else if (src && dst->distinct[column] && src->distinct[column]) {
+    hll_merge(&dst->distinct[column][row], &src->distinct[column][src_row]);
+    store_distinct_count(lua, dst, ns, row, column);
+  } else if (!src && (dst->sketches[column] || dst->distinct[column])) {
+    return;
+  } else if (dst->headers[column].aggregation == AGGREGATION_SUM) {
+    add_value(lua, dst, ns, row, column, value);
+  } else {
+    set_value(lua, dst, ns, row, column, value);
+  }
 }
 
 
-static int circular_buffer_set(lua_State* lua)
+// Aggregates the rows about to expire into the next coarser tier using the
+// column aggregation methods.
+static void rollup_rows(lua_State* lua, circular_buffer* cb,
+                        unsigned num_rows)
 {
-  circular_buffer* cb = check_circular_buffer(lua, 4);
-  double ns = luaL_checknumber(lua, 2);
-  int row             = check_row(cb, ns, 1); // advance the buffer forward if
-                                              // necessary
-  int column          = check_column(lua, cb, 3);
-  double value        = luaL_checknumber(lua, 4);
+  if (num_rows > cb->rows) num_rows = cb->rows;
+  circular_buffer* coarse = cb->rollup;
+  time_t t = get_start_time(cb);
+  unsigned row = cb->current_row + 1;
+  for (unsigned i = 0; i < num_rows; ++i, ++row, t += cb->seconds_per_row) {
+    if (row == cb->rows) row = 0;
+    double ns = t * 1e9;
+    int coarse_row = -2; // located on the first value
+    for (unsigned c = 0; c < cb->columns; ++c) {
+      double value = read_value(cb, row, c);
+      if (isnan(value)) continue;
 
-  if (row != -1) {
-    int i = (row * cb->columns) + column;
-    double old = cb->values[i];
-    switch (cb->headers[column].aggregation) {
-    case AGGREGATION_MIN:
-      if (isnan(cb->values[i]) || value < cb->values[i]) {
-        cb->values[i] = value;
-        if (cb->delta) {
-          circular_buffer_add_delta(lua, cb, ns, column, value);
-        }
-      }
-      break;
-    case AGGREGATION_MAX:
-      if (isnan(cb->values[i]) || value > cb->values[i]) {
-        cb->values[i] = value;
-        if (cb->delta) {
-          circular_buffer_add_delta(lua, cb, ns, column, value);
-        }
-      }
-      break;
-    default:
-      cb->values[i] = value;
-      if (cb->delta) {
-        if (!isnan(old)) {
-          value -= old;
-        }
-        circular_buffer_add_delta(lua, cb, ns, column, value);
+      if (coarse_row == -2) {
+        coarse_row = check_row(lua, coarse, ns, 1);
       }
-      break;
+      if (coarse_row == -1) break; // older than the coarser tier
+
+      merge_cell(lua, coarse, ns, coarse_row, cb, row, c, value);
     }
-    lua_pushnumber(lua, cb->values[i]);
-  } else {
-    lua_pushnil(lua);
   }
-  return 1;
 }
 
 
@@ -373,8 +1812,14 @@ static int circular_buffer_set_header(lua_State* lua)
   int column                      = check_column(lua, cb, 2);
   const char* name                = luaL_checkstring(lua, 3);
   const char* unit                = luaL_optstring(lua, 4, default_unit);
-  cb->headers[column].aggregation = luaL_checkoption(lua, 5, "sum",
+  COLUMN_AGGREGATION aggregation  = luaL_checkoption(lua, 5, "sum",
                                                      column_aggregation_methods);
+  double quantile                 = luaL_optnumber(lua, 6, 0.5);
+  luaL_argcheck(lua, quantile >= 0 && quantile <= 1, 6,
+                "quantile must be between 0 and 1");
+  for (circular_buffer* t = cb; t; t = t->rollup) {
+    set_aggregation(lua, t, column, aggregation, quantile);
+  }
 
   strncpy(cb->headers[column].name, name, COLUMN_NAME_SIZE - 1);
   char* n = cb->headers[column].name;
@@ -390,6 +1835,9 @@ static int circular_buffer_set_header(lua_State* lua)
       n[j] = '_';
     }
   }
+  for (circular_buffer* t = cb->rollup; t; t = t->rollup) {
+    t->headers[column] = cb->headers[column];
+  }
 
   lua_pushinteger(lua, column + 1); // return the 1 based Lua column
   return 1;
@@ -405,153 +1853,221 @@ static int circular_buffer_get_header(lua_State* lua)
   lua_pushstring(lua, cb->headers[column].unit);
   lua_pushstring(lua,
                  column_aggregation_methods[cb->headers[column].aggregation]);
+  if (cb->headers[column].aggregation == AGGREGATION_QUANTILE) {
+    lua_pushnumber(lua, cb->headers[column].quantile);
+    return 4;
+  }
   return 3;
 }
 
 
-static double compute_sum(circular_buffer* cb, unsigned column,
-                          unsigned start_row, unsigned end_row,
-                          unsigned* active_rows)
+// Replays the completed rows of the buffer into a new detector.
+static void prime_detector(lua_State* lua, circular_buffer* cb,
+                           unsigned column)
 {
-  double value = 0;
-  double result = 0;
-  unsigned row = start_row;
-  do {
-    if (row == cb->rows) {
-      row = 0;
-    }
-    value = cb->values[(row * cb->columns) + column];
-    if (isnan(value)) {
-      continue;
-    }
-    ++(*active_rows);
-    result += value;
+  detector* d = cb->detectors[column];
+  unsigned last = cb->current_row ? cb->current_row - 1 : cb->rows - 1;
+  if (d->method == DETECTOR_MAD) {
+    fit_window(lua, cb, column, last);
+    return;
+  }
+  long long row = get_start_time(cb) / cb->seconds_per_row;
+  unsigned idx = cb->current_row + 1;
+  for (unsigned i = 0; i < cb->rows - 1; ++i, ++idx, ++row) {
+    if (idx == cb->rows) idx = 0;
+    detector_update(d, row, read_value(cb, idx, column));
   }
-  while (row++ != end_row);
-  return result;
 }
 
 
-static double compute_avg(circular_buffer* cb, unsigned column,
-                          unsigned start_row, unsigned end_row,
-                          unsigned* active_rows)
+static double detector_option(lua_State* lua, const char* name, double dflt)
 {
-  double value = 0;
-  double result = 0;
-  unsigned row = start_row;
-  unsigned row_count = 0;
-
-  do {
-    if (row == cb->rows) {
-      row = 0;
-    }
-    value = cb->values[(row * cb->columns) + column];
-    if (!isnan(value)) {
-      result += value;
-      ++row_count;
-    }
+  double value = dflt;
+  if (lua_istable(lua, 4)) {
+    lua_getfield(lua, 4, name);
+    value = luaL_optnumber(lua, -1, dflt);
+    lua_pop(lua, 1);
   }
-  while (row++ != end_row);
-  *active_rows = row_count;
-  return result / row_count;
+  return value;
 }
 
 
-static double compute_variance(circular_buffer* cb, unsigned column,
-                               unsigned start_row, unsigned end_row,
-                               unsigned* active_rows)
+static int circular_buffer_set_detector(lua_State* lua)
 {
-  double avg = compute_avg(cb, column, start_row, end_row, active_rows);
-  if (isnan(avg)) return avg;
+  circular_buffer* cb     = check_circular_buffer(lua, 3);
+  int column              = check_column(lua, cb, 2);
+  DETECTOR_METHOD method  = luaL_checkoption(lua, 3, NULL, detector_methods);
+  luaL_argcheck(lua, lua_isnoneornil(lua, 4) || lua_istable(lua, 4), 4,
+                "options must be a table");
+  double alpha  = detector_option(lua, "alpha", 0.3);
+  double beta   = detector_option(lua, "beta", 0.1);
+  double gamma  = detector_option(lua, "gamma", 0.1);
+  double k      = detector_option(lua, "k", 3);
+  double season = detector_option(lua, "season", 0);
+  double window = detector_option(lua, "window", cb->rows - 1);
+  luaL_argcheck(lua, alpha > 0 && alpha <= 1, 4, "alpha must be in (0, 1]");
+  luaL_argcheck(lua, beta >= 0 && beta <= 1, 4,
+                "beta must be between 0 and 1");
+  luaL_argcheck(lua, gamma >= 0 && gamma <= 1, 4,
+                "gamma must be between 0 and 1");
+  luaL_argcheck(lua, k > 0, 4, "k must be > 0");
+  if (method == DETECTOR_HOLT_WINTERS) {
+    luaL_argcheck(lua, season >= 2 && season <= cb->rows, 4,
+                  "season must be between 2 and rows");
+  } else if (method == DETECTOR_MAD) {
+    luaL_argcheck(lua, window >= 3 && window < cb->rows, 4,
+                  "window must be between 3 and rows - 1");
+    season = window;
+  }
 
-  double sum_squares = 0;
-  double value = 0;
-  unsigned row = start_row;
-  unsigned row_count = 0;
-  do {
-    if (row == cb->rows) {
-      row = 0;
-    }
-    value = cb->values[(row * cb->columns) + column];
-    if (!isnan(value)) {
-      value -= avg;
-      sum_squares += value * value;
-      ++row_count;
-    }
+  detector* d = cb->detectors[column];
+  if (d) {
+    buffer_realloc(lua, d, detector_size(d->method, d->season), 0);
+    cb->detectors[column] = NULL;
+    --cb->detector_columns;
   }
-  while (row++ != end_row);
-  return sum_squares / row_count;
+  if (method != DETECTOR_NONE) {
+    d = buffer_realloc(lua, NULL, 0, detector_size(method, (unsigned)season));
+    detector_init(d, method, alpha, beta, gamma, (unsigned)season, k);
+    cb->detectors[column] = d;
+    ++cb->detector_columns;
+    prime_detector(lua, cb, column);
+  }
+
+  lua_pushinteger(lua, column + 1); // return the 1 based Lua column
+  return 1;
 }
 
 
-static double compute_sd(circular_buffer* cb, unsigned column,
-                         unsigned start_row, unsigned end_row,
-                         unsigned* active_rows)
+static int circular_buffer_detect(lua_State* lua)
 {
-  return sqrt(compute_variance(cb, column, start_row, end_row, active_rows));
+  circular_buffer* cb = check_circular_buffer(lua, 2);
+  int column          = check_column(lua, cb, 2);
+  detector* d         = cb->detectors[column];
+  luaL_argcheck(lua, d, 2, "no detector");
+  double value        = luaL_optnumber(lua, 3,
+                                       read_value(cb, cb->current_row, column));
+
+  double forecast, scale;
+  if (detector_forecast(d, cb->current_time / cb->seconds_per_row, &forecast,
+                        &scale)) {
+    lua_pushnil(lua);
+    return 1;
+  }
+  lua_pushnumber(lua, forecast);
+  lua_pushnumber(lua, forecast - d->k * scale);
+  lua_pushnumber(lua, forecast + d->k * scale);
+  if (isnan(value)) {
+    return 3;
+  }
+  double diff = value - forecast;
+  double z = diff == 0 ? 0 : copysign(INFINITY, diff);
+  if (scale > 0) {
+    z = diff / scale;
+  }
+  lua_pushnumber(lua, z);
+  lua_pushnumber(lua, 2 * ndtr(-fabs(z))); // two sided
+  return 5;
 }
 
 
-static double compute_min(circular_buffer* cb, unsigned column,
+static void compute_stats(circular_buffer* cb, unsigned column,
                           unsigned start_row, unsigned end_row,
-                          unsigned* active_rows)
+                          column_stats* stats)
 {
-  double result = DBL_MAX;
-  double value = 0;
-  unsigned row = start_row;
-  do {
-    if (row == cb->rows) {
-      row = 0;
-    }
-    value = cb->values[(row * cb->columns) + column];
-    if (!isnan(value)) {
-      ++(*active_rows);
-      if (value < result) {
-        result = value;
+  column_stats_init(stats);
+  if (start_row > end_row) { // the range wraps; aggregate it as two spans
+    column_stats_rows(cb, column, start_row, cb->rows - start_row, stats);
+    start_row = 0;
+  }
+  column_stats_rows(cb, column, start_row, end_row - start_row + 1, stats);
+}
+
+
+// Parses a quantile function name i.e. "p99" is 0.99, "p999" is 0.999 and
+// "p100" is 1, returns -1 if the name is not a quantile.
+static double quantile_function(const char* name)
+{
+  if (name[0] != 'p') return -1;
+  if (strcmp(name, "p100") == 0) return 1;
+  // require two digits; "p5" would otherwise read as the median. Trailing
+  // zeros past them are rejected too, "p1000" is not 0.1
+  size_t len = strlen(name);
+  if (len < 3 || (len > 3 && name[len - 1] == '0')) return -1;
+
+  double q = 0, scale = 0.1;
+  for (const char* p = name + 1; *p; ++p, scale /= 10) {
+    if (!isdigit((unsigned char)*p)) return -1;
+    q += (*p - '0') * scale;
+  }
+  return q;
+}
+
+
+// Merges the row sketches of the range and estimates the quantile.
+static int compute_quantile(lua_State* lua, circular_buffer* cb, int column,
+                            double q, int start_row, int end_row)
+{
+  luaL_argcheck(lua, cb->sketches[column], 3, "not a quantile column");
+  quantile_sketch merged;
+  sketch_clear(&merged);
+  unsigned active_rows = 0;
+  if (-1 != start_row && -1 != end_row) {
+    for (unsigned row = start_row;; ++row) {
+      if (row == cb->rows) row = 0;
+      const quantile_sketch* sketch = &cb->sketches[column][row];
+      if (sketch->count) {
+        sketch_merge(&merged, sketch);
+        ++active_rows;
       }
+      if (row == (unsigned)end_row) break;
     }
   }
-  while (row++ != end_row);
-  if (result == DBL_MAX) {
-    result = NAN;
+  if (active_rows) {
+    lua_pushnumber(lua, sketch_quantile(&merged, q));
+  } else {
+    lua_pushnil(lua);
   }
-  return result;
+  lua_pushinteger(lua, active_rows);
+  return 2;
 }
 
 
-static double compute_max(circular_buffer* cb, unsigned column,
-                          unsigned start_row, unsigned end_row,
-                          unsigned* active_rows)
+// Unions the row registers of the range and estimates the number of distinct
+// items.
+static int compute_distinct(lua_State* lua, circular_buffer* cb, int column,
+                            int start_row, int end_row)
 {
-  double result = DBL_MIN;
-  double value = 0;
-  unsigned row = start_row;
-  do {
-    if (row == cb->rows) {
-      row = 0;
-    }
-    value = cb->values[(row * cb->columns) + column];
-    if (!isnan(value)) {
-      ++(*active_rows);
-      if (value > result) {
-        result = value;
+  luaL_argcheck(lua, cb->distinct[column], 3, "not a distinct column");
+  hyperloglog merged;
+  hll_clear(&merged);
+  unsigned active_rows = 0;
+  if (-1 != start_row && -1 != end_row) {
+    for (unsigned row = start_row;; ++row) {
+      if (row == cb->rows) row = 0;
+      if (!isnan(read_value(cb, row, column))) {
+        hll_merge(&merged, &cb->distinct[column][row]);
+        ++active_rows;
       }
+      if (row == (unsigned)end_row) break;
     }
   }
-  while (row++ != end_row);
-  if (result == DBL_MIN) {
-    result = NAN;
+  if (active_rows) {
+    lua_pushnumber(lua, hll_count(&merged));
+  } else {
+    lua_pushnil(lua);
   }
-  return result;
+  lua_pushinteger(lua, active_rows);
+  return 2;
 }
 
 
 static int circular_buffer_compute(lua_State* lua)
 {
-  static const char* functions[] = { "sum", "avg", "sd", "min", "max",
-    "variance", NULL };
   circular_buffer* cb  = check_circular_buffer(lua, 3);
-  int function         = luaL_checkoption(lua, 2, NULL, functions);
+  double q             = quantile_function(luaL_checkstring(lua, 2));
+  COMPUTE_FUNCTION function = q < 0
+    ? luaL_checkoption(lua, 2, NULL, compute_functions) : MAX_COMPUTE;
   int column           = check_column(lua, cb, 3);
 
   // optional range arguments
@@ -559,96 +2075,496 @@ static int circular_buffer_compute(lua_State* lua)
   double end_ns   = luaL_optnumber(lua, 5, cb->current_time * 1e9);
   luaL_argcheck(lua, end_ns >= start_ns, 5, "end must be >= start");
 
-  unsigned active_rows = 0;
-  int start_row = check_row(cb, start_ns, 0);
-  int end_row   = check_row(cb, end_ns, 0);
-  if (-1 == start_row  || -1 == end_row) {
-    lua_pushnil(lua);
-    lua_pushinteger(lua, active_rows);
-    return 2;
+  unsigned active_rows = 0;
+  int start_row = check_row(lua, cb, start_ns, 0);
+  int end_row   = check_row(lua, cb, end_ns, 0);
+  if (q >= 0) {
+    return compute_quantile(lua, cb, column, q, start_row, end_row);
+  }
+  if (function == COMPUTE_DISTINCT) {
+    return compute_distinct(lua, cb, column, start_row, end_row);
+  }
+  if (-1 == start_row  || -1 == end_row) {
+    lua_pushnil(lua);
+    lua_pushinteger(lua, active_rows);
+    return 2;
+  }
+
+  column_stats stats;
+  unsigned first_row = cb->current_row + 1;
+  if (first_row == cb->rows) first_row = 0;
+  if (cb->running && (unsigned)start_row == first_row
+      && (unsigned)end_row == cb->current_row) {
+    running_stats* rs = &cb->running[column];
+    if (rs->stale && (function == COMPUTE_MIN || function == COMPUTE_MAX)) {
+      running_rebuild(cb, column);
+    }
+    stats.sum = rs->sum;
+    stats.shifted_sum = rs->shifted_sum;
+    stats.shifted_sumsq = rs->shifted_sumsq;
+    stats.shift = rs->shift;
+    stats.min = rs->min;
+    stats.max = rs->max;
+    stats.count = rs->count;
+  } else if (cb->prefix && function != COMPUTE_MIN
+             && function != COMPUTE_MAX) {
+    prefix_range(cb, column, start_row, end_row, &stats);
+  } else {
+    compute_stats(cb, column, start_row, end_row, &stats);
+  }
+  active_rows = (unsigned)stats.count;
+
+  double result = 0;
+  switch (function) {
+  case COMPUTE_SUM:
+    result = stats.sum;
+    break;
+  case COMPUTE_AVG:
+    result = stats.sum / stats.count;
+    break;
+  case COMPUTE_SD:
+    result = sqrt(column_stats_variance(&stats));
+    break;
+  case COMPUTE_MIN:
+    result = stats.count ? stats.min : NAN;
+    break;
+  case COMPUTE_MAX:
+    result = stats.count ? stats.max : NAN;
+    break;
+  case COMPUTE_VARIANCE:
+    result = column_stats_variance(&stats);
+    break;
+  default:
+    break;
+  }
+
+  lua_pushnumber(lua, result);
+  lua_pushinteger(lua, active_rows);
+  return 2;
+}
+
+
+static int circular_buffer_compute_expr(lua_State* lua)
+{
+  circular_buffer* cb = check_circular_buffer(lua, 2);
+  const char* source  = luaL_checkstring(lua, 2);
+  vexpr e;
+  size_t pos;
+  const char* error = vexpr_compile(&e, source, &pos);
+  if (error) {
+    return luaL_argerror(lua, 2, lua_pushfstring(lua, "%s at position %d",
+                                                 error, (int)pos + 1));
+  }
+  for (unsigned s = 0; s < e.slots; ++s) {
+    luaL_argcheck(lua, e.columns[s] < cb->columns, 2, "column out of range");
+  }
+  if (e.assign) {
+    luaL_argcheck(lua, e.destination < cb->columns, 2, "column out of range");
+    luaL_argcheck(lua, !cb->sketches[e.destination]
+                  && !cb->distinct[e.destination], 2,
+                  "destination cannot be a quantile or distinct column");
+  }
+
+  // optional range arguments
+  double start_ns = luaL_optnumber(lua, 3, get_start_time(cb) * 1e9);
+  double end_ns   = luaL_optnumber(lua, 4, cb->current_time * 1e9);
+  luaL_argcheck(lua, end_ns >= start_ns, 4, "end must be >= start");
+
+  int start_row = check_row(lua, cb, start_ns, 0);
+  int end_row   = check_row(lua, cb, end_ns, 0);
+  if (-1 == start_row  || -1 == end_row) {
+    lua_pushnil(lua);
+    return 1;
+  }
+  unsigned n = (end_row - start_row + cb->rows) % cb->rows + 1;
+  time_t t = (time_t)(start_ns / 1e9);
+  t -= t % cb->seconds_per_row;
+
+  double* slots = get_scratch(lua, sizeof(double) * VEXPR_BLOCK
+                              * (e.slots + 1));
+  double* out = slots + VEXPR_BLOCK * e.slots;
+  if (!e.assign) {
+    lua_createtable(lua, n, 0);
+  }
+  unsigned row = start_row;
+  for (unsigned i = 0; i < n; i += VEXPR_BLOCK) {
+    unsigned block = n - i < VEXPR_BLOCK ? n - i : VEXPR_BLOCK;
+    for (unsigned s = 0; s < e.slots; ++s) {
+      double* values = slots + s * VEXPR_BLOCK;
+      unsigned r = row;
+      for (unsigned j = 0; j < block; ++j, ++r) {
+        if (r == cb->rows) r = 0;
+        values[j] = read_value(cb, r, e.columns[s]);
+      }
+    }
+    vexpr_eval(&e, slots, out, block);
+    for (unsigned j = 0; j < block; ++j, ++row) {
+      if (row == cb->rows) row = 0;
+      if (e.assign) {
+        double ns = (t + (time_t)(i + j) * cb->seconds_per_row) * 1e9;
+        replace_value(lua, cb, ns, row, e.destination, out[j]);
+      } else {
+        lua_pushnumber(lua, out[j]);
+        lua_rawseti(lua, -2, i + j + 1);
+      }
+    }
+  }
+  return e.assign ? 0 : 1;
+}
+
+
+static int circular_buffer_combine(lua_State* lua)
+{
+  circular_buffer* cb     = check_circular_buffer(lua, 3);
+  circular_buffer* other  = luaL_checkudata(lua, 2, lsb_circular_buffer);
+  luaL_argcheck(lua, other != NULL, 2, "invalid userdata type");
+  COMBINE_OP op           = luaL_checkoption(lua, 3, NULL, combine_ops);
+  luaL_argcheck(lua, other != cb, 2, "cannot combine a buffer with itself");
+  luaL_argcheck(lua, other->columns == cb->columns, 2, "columns must match");
+  luaL_argcheck(lua, other->seconds_per_row == cb->seconds_per_row, 2,
+                "seconds_per_row must match");
+  for (unsigned c = 0; c < cb->columns; ++c) {
+    if (cb->sketches[c] || cb->distinct[c]) {
+      luaL_argcheck(lua, op == COMBINE_ADD
+                    && (cb->sketches[c] ? other->sketches[c] != NULL
+                        : other->distinct[c] != NULL), 3,
+                    "quantile and distinct columns only combine with add");
+    }
+  }
+
+  // optional range arguments
+  double start_ns = luaL_optnumber(lua, 4, get_start_time(cb) * 1e9);
+  double end_ns   = luaL_optnumber(lua, 5, cb->current_time * 1e9);
+  luaL_argcheck(lua, end_ns >= start_ns, 5, "end must be >= start");
+
+  int start_row = check_row(lua, cb, start_ns, 0);
+  int end_row   = check_row(lua, cb, end_ns, 0);
+  if (-1 == start_row  || -1 == end_row) {
+    return 0;
+  }
+  unsigned n = (end_row - start_row + cb->rows) % cb->rows + 1;
+  time_t t = (time_t)(start_ns / 1e9);
+  t -= t % cb->seconds_per_row;
+
+  unsigned row = start_row;
+  for (unsigned i = 0; i < n; ++i, ++row, t += cb->seconds_per_row) {
+    if (row == cb->rows) row = 0;
+    double ns = t * 1e9;
+    int other_row = check_row(lua, other, ns, 0);
+    if (other_row == -1) continue; // outside of the other buffer
+
+    for (unsigned c = 0; c < cb->columns; ++c) {
+      double value = read_value(other, other_row, c);
+      if (isnan(value)) continue;
+
+      if (cb->sketches[c]) {
+        quantile_sketch* sketch = &other->sketches[c][other_row];
+        sketch_merge(&cb->sketches[c][row], sketch);
+        store_sketch_count(lua, cb, ns, row, c, sketch->count);
+        continue;
+      }
+      if (cb->distinct[c]) {
+        hll_merge(&cb->distinct[c][row], &other->distinct[c][other_row]);
+        store_distinct_count(lua, cb, ns, row, c);
+        continue;
+      }
+
+      double old = read_value(cb, row, c);
+      switch (op) {
+      case COMBINE_ADD:
+        add_value(lua, cb, ns, row, c, value);
+        break;
+      case COMBINE_SUB:
+        if (!isnan(old)) replace_value(lua, cb, ns, row, c, old - value);
+        break;
+      case COMBINE_MUL:
+        if (!isnan(old)) replace_value(lua, cb, ns, row, c, old * value);
+        break;
+      case COMBINE_DIV:
+        if (!isnan(old)) replace_value(lua, cb, ns, row, c, old / value);
+        break;
+      case COMBINE_MIN:
+        if (isnan(old) || value < old) {
+          replace_value(lua, cb, ns, row, c, value);
+        }
+        break;
+      case COMBINE_MAX:
+        if (isnan(old) || value > old) {
+          replace_value(lua, cb, ns, row, c, value);
+        }
+        break;
+      default:
+        break;
+      }
+    }
+  }
+  return 0;
+}
+
+
+// Reads an integer field from the JSON header line.
+static int header_field(const char* header, const char* eol, const char* name,
+                        long long* value)
+{
+  char key[32];
+  snprintf(key, sizeof(key), "\"%s\":", name);
+  const char* p = strstr(header, key);
+  if (!p || p > eol) return 0;
+  char* end;
+  *value = strtoll(p + strlen(key), &end, 10);
+  return end != p + strlen(key);
+}
+
+
+// Reads one tab separated value of a text row; returns 0 at the end of the
+// row or on an invalid value. Plain decimals with up to 15 digits are
+// converted exactly without strtod (an integer divided by an exact power of
+// ten is correctly rounded).
+static int scan_value(const char** p, double* value)
+{
+  static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7,
+    1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15 };
+
+  while (**p == '\t' || **p == ' ') ++*p;
+  if (**p == '\n' || **p == 0) return 0;
+  if (strncmp(*p, not_a_number, 3) == 0) {
+    *p += 3;
+    *value = NAN;
+  } else {
+    const char* s = *p;
+    int negative = *s == '-';
+    s += negative;
+    uint64_t m = 0;
+    int digits = 0, decimals = -1;
+    for (;; ++s) {
+      if (*s >= '0' && *s <= '9') {
+        m = m * 10 + (*s - '0');
+        ++digits;
+        if (decimals >= 0) ++decimals;
+      } else if (*s == '.' && decimals < 0) {
+        decimals = 0;
+      } else {
+        break;
+      }
+    }
+    if (digits > 0 && digits <= 15 && decimals != 0
+        && (*s == '\t' || *s == ' ' || *s == '\n' || *s == 0)) {
+      double d = decimals > 0 ? (double)m / powers[decimals] : (double)m;
+      *value = negative ? -d : d;
+      *p = s;
+    } else {
+      char* end;
+      *value = strtod(*p, &end);
+      if (end == *p) return 0;
+      *p = end;
+    }
+  }
+  return **p == '\t' || **p == ' ' || **p == '\n' || **p == 0;
+}
+
+
+// Merges the cbuf or cbufd output of a buffer; cbufd rows are told apart by
+// their leading time column.
+static void merge_text(lua_State* lua, circular_buffer* cb, const char* s)
+{
+  long long t, rows, columns, spr;
+  const char* eol = strchr(s, '\n');
+  if (!eol || !header_field(s, eol, "time", &t)
+      || !header_field(s, eol, "rows", &rows)
+      || !header_field(s, eol, "columns", &columns)
+      || !header_field(s, eol, "seconds_per_row", &spr)
+      || rows < 1 || spr < 1) {
+    luaL_error(lua, "merge() invalid header");
+  }
+  if (columns != cb->columns) {
+    luaL_error(lua, "merge() columns must match");
+  }
+
+  // parse and validate every row before anything is merged
+  const char* p = eol + 1;
+  size_t lines = 1;
+  for (const char* q = p; (q = strchr(q, '\n')); ++q) ++lines;
+  size_t stride = cb->columns + 1;
+  // not the scratch buffer, advancing the buffer can fit the detectors
+  double* values = lua_newuserdata(lua, sizeof(double) * lines * stride);
+  size_t width = 0;
+  for (lines = 0; *p; ++lines) {
+    double* v = values + lines * stride;
+    size_t i = 0;
+    while (i < stride && scan_value(&p, &v[i])) ++i;
+    while (*p == '\t' || *p == ' ') ++p;
+    if (*p == '\n') {
+      ++p;
+    } else if (*p != 0) {
+      i = 0; // invalid value or too many values
+    }
+    if (i < cb->columns || (lines > 0 && i != width)) {
+      luaL_error(lua, "merge() invalid row %d", (int)lines + 1);
+    }
+    width = i;
+  }
+  int delta = width == stride;
+  if (!delta && lines != 0 && lines != (size_t)rows) {
+    luaL_error(lua, "merge() expected %d rows", (int)rows);
+  }
+
+  for (size_t i = 0; i < lines; ++i) {
+    double* v = values + i * stride;
+    double ns = (t + (long long)i * spr) * 1e9;
+    if (delta) {
+      ns = *v++ * 1e9;
+    }
+    int row = check_write_row(lua, cb, ns);
+    if (row == -1) continue;
+    for (unsigned c = 0; c < cb->columns; ++c) {
+      if (!isnan(v[c])) {
+        merge_cell(lua, cb, ns, row, NULL, 0, c, v[c]);
+      }
+    }
+  }
+}
+
+
+static void merge_buffer(lua_State* lua, circular_buffer* cb,
+                         circular_buffer* src)
+{
+  luaL_argcheck(lua, src != cb, 2, "cannot merge a buffer into itself");
+  luaL_argcheck(lua, src->columns == cb->columns, 2, "columns must match");
+
+  time_t t = get_start_time(src);
+  unsigned row = src->current_row + 1;
+  for (unsigned i = 0; i < src->rows; ++i, ++row, t += src->seconds_per_row) {
+    if (row == src->rows) row = 0;
+    double ns = t * 1e9;
+    int dst_row = -2; // located on the first value
+    for (unsigned c = 0; c < cb->columns; ++c) {
+      double value = read_value(src, row, c);
+      if (isnan(value)) continue;
+
+      if (dst_row == -2) {
+        dst_row = check_write_row(lua, cb, ns);
+      }
+      if (dst_row == -1) break; // outside of the accepted rows
+
+      merge_cell(lua, cb, ns, dst_row, src, row, c, value);
+    }
   }
+}
 
-  double result = 0;
-  switch (function) {
-  case 0:
-    result = compute_sum(cb, column, start_row, end_row, &active_rows);
-    break;
-  case 1:
-    result = compute_avg(cb, column, start_row, end_row, &active_rows);
-    break;
-  case 2:
-    result = compute_sd(cb, column, start_row, end_row, &active_rows);
-    break;
-  case 3:
-    result = compute_min(cb, column, start_row, end_row, &active_rows);
-    break;
-  case 4:
-    result = compute_max(cb, column, start_row, end_row, &active_rows);
+
+static int circular_buffer_merge(lua_State* lua)
+{
+  circular_buffer* cb = check_circular_buffer(lua, 2);
+  luaL_argcheck(lua, lua_gettop(lua) == 2, 0, "incorrect number of arguments");
+  switch (lua_type(lua, 2)) {
+  case LUA_TSTRING:
+    merge_text(lua, cb, lua_tostring(lua, 2));
     break;
-  case 5:
-    result = compute_variance(cb, column, start_row, end_row, &active_rows);
+  case LUA_TUSERDATA:
+    {
+      void* ud = luaL_checkudata(lua, 2, lsb_circular_buffer);
+      luaL_argcheck(lua, ud != NULL, 2, "invalid userdata type");
+      merge_buffer(lua, cb, (circular_buffer*)ud);
+    }
     break;
+  default:
+    return luaL_typerror(lua, 2, "string or circular_buffer");
   }
+  return 0;
+}
 
-  lua_pushnumber(lua, result);
-  lua_pushinteger(lua, active_rows);
-  return 2;
+
+// Maps a double to an unsigned key with the same ordering.
+static uint64_t order_key(double value)
+{
+  if (value == 0) value = 0; // -0 ties with 0
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  return bits >> 63 ? ~bits : bits | (1ULL << 63);
 }
 
 
-static void append_values(circular_buffer* cb, unsigned column,
+// Collects the order keys of the range skipping NaN, returns the number of
+// keys.
+static size_t append_keys(circular_buffer* cb, unsigned column,
                           unsigned start_row, unsigned end_row,
-                          double ranked[])
+                          uint64_t keys[])
 {
+  size_t stride;
+  size_t values = column_values(cb, column, &stride);
   unsigned row = start_row;
-  unsigned x = 0;
+  size_t n = 0;
   do {
     if (row == cb->rows) {
       row = 0;
     }
-    ranked[x++] = cb->values[(row * cb->columns) + column];
+    double value = cb->hot_rows || cb->sparse ? read_value(cb, row, column)
+      : get_value(cb, values + row * stride);
+    if (!isnan(value)) {
+      keys[n++] = order_key(value);
+    }
   }
   while (row++ != end_row);
+  return n;
 }
 
 
-static double rank_data(double* sorted[], size_t ranked_size)
+// LSD radix sort one byte per pass, passes where every key has the same byte
+// are skipped. tmp must hold n keys.
+static void radix_sort(uint64_t keys[], uint64_t tmp[], size_t n)
 {
-  size_t next = 0, dupe_count = 0;
-  double tie_correction = 0;
-  for (size_t i = 0; i < ranked_size; ++i) {
-    next = i + 1;
-    if (i == ranked_size - 1 || *sorted[i] != *sorted[next]) {
-      if (dupe_count) {
-        double tie_rank = next - 0.5 * dupe_count;
-        for (size_t j = i - dupe_count; j < next; ++j) {
-          *sorted[j] = tie_rank;
-        }
-        ++dupe_count;
-        tie_correction += pow(dupe_count, 3.0) - dupe_count;
-        dupe_count = 0;
-      } else {
-        *sorted[i] = next;
-      }
-    } else {
-      ++dupe_count;
+  size_t counts[256];
+  uint64_t* src = keys;
+  uint64_t* dst = tmp;
+  for (unsigned shift = 0; shift < 64 && n > 1; shift += 8) {
+    memset(counts, 0, sizeof(counts));
+    for (size_t i = 0; i < n; ++i) {
+      ++counts[(src[i] >> shift) & 0xff];
+    }
+    if (counts[(src[0] >> shift) & 0xff] == n) continue;
+
+    size_t pos = 0;
+    for (unsigned d = 0; d < 256; ++d) {
+      size_t c = counts[d];
+      counts[d] = pos;
+      pos += c;
     }
+    for (size_t i = 0; i < n; ++i) {
+      dst[counts[(src[i] >> shift) & 0xff]++] = src[i];
+    }
+    uint64_t* t = src;
+    src = dst;
+    dst = t;
+  }
+  if (src != keys) {
+    memcpy(keys, src, sizeof(uint64_t) * n);
   }
-  tie_correction = 1.0 - tie_correction / (pow(ranked_size, 3.0) - ranked_size);
-  return tie_correction;
 }
 
 
-static int double_pp_compare(const void* a, const void* b)
+// Ranks the two sorted samples together, ties receive their average rank.
+// Returns the rank sum of x and the tie correction factor.
+static double rank_sum(const uint64_t x[], size_t n1, const uint64_t y[],
+                       size_t n2, double* tie_correction)
 {
-  double* d1 = *(double**)a;
-  double* d2 = *(double**)b;
-
-  if (*d1 < *d2) return -1;
-  if (*d1 == *d2) return 0;
-  return 1;
+  size_t i = 0, j = 0;
+  double rank = 0, sum = 0, ties = 0;
+  while (i < n1 || j < n2) {
+    uint64_t key = j == n2 || (i < n1 && x[i] < y[j]) ? x[i] : y[j];
+    size_t cx = 0, cy = 0;
+    for (; i < n1 && x[i] == key; ++i) ++cx;
+    for (; j < n2 && y[j] == key; ++j) ++cy;
+    double t = (double)(cx + cy);
+    sum += cx * (rank + (t + 1) / 2);
+    rank += t;
+    ties += t * t * t - t;
+  }
+  double n = (double)(n1 + n2);
+  *tie_correction = 1.0 - ties / (n * n * n - n);
+  return sum;
 }
 
+
 // http://en.wikipedia.org/wiki/Mann-Whitney_U_test
 static int circular_buffer_mannwhitneyu(lua_State* lua)
 {
@@ -672,52 +2588,38 @@ static int circular_buffer_mannwhitneyu(lua_State* lua)
     use_continuity = lua_toboolean(lua, n);
   }
 
-  int start_x_row = check_row(cb, start_x, 0);
-  int end_x_row   = check_row(cb, end_x, 0);
+  int start_x_row = check_row(lua, cb, start_x, 0);
+  int end_x_row   = check_row(lua, cb, end_x, 0);
   if (-1 == start_x_row  || -1 == end_x_row) {
     return 0;
   }
-  int start_y_row = check_row(cb, start_y, 0);
-  int end_y_row   = check_row(cb, end_y, 0);
+  int start_y_row = check_row(lua, cb, start_y, 0);
+  int end_y_row   = check_row(lua, cb, end_y, 0);
   if (-1 == start_y_row  || -1 == end_y_row) {
     return 0;
   }
 
-  size_t n1 = ((end_x - start_x) / 1e9 / cb->seconds_per_row) + 1;
-  size_t n2 = ((end_y - start_y) / 1e9 / cb->seconds_per_row) + 1;
-  size_t ranked_size = n1 + n2;
-  // note: user could temporarily exceed the sandbox memory limit here without
-  // detection
-  double* ranked = (double*)malloc(sizeof(double) * ranked_size);
-  if (!ranked) {
-    return 0;
-  }
-  append_values(cb, column, start_x_row, end_x_row, ranked);
-  append_values(cb, column, start_y_row, end_y_row, ranked + n1);
-
-  double** sorted = (double**)malloc(sizeof(double*) * ranked_size);
-  if (!sorted) {
-    free(ranked);
+  unsigned x_rows = (end_x_row - start_x_row + cb->rows) % cb->rows + 1;
+  unsigned y_rows = (end_y_row - start_y_row + cb->rows) % cb->rows + 1;
+  uint64_t* x = get_scratch(lua, sizeof(uint64_t)
+                            * (x_rows + y_rows
+                               + (x_rows > y_rows ? x_rows : y_rows)));
+  uint64_t* y = x + x_rows;
+  uint64_t* tmp = y + y_rows;
+  size_t n1 = append_keys(cb, column, start_x_row, end_x_row, x);
+  size_t n2 = append_keys(cb, column, start_y_row, end_y_row, y);
+  if (!n1 || !n2) {
     return 0;
   }
-  for (size_t i = 0; i < ranked_size; ++i) {
-    sorted[i] = ranked + i;
-  }
+  radix_sort(x, tmp, n1);
+  radix_sort(y, tmp, n2);
 
-  qsort(sorted, ranked_size, sizeof(double*), double_pp_compare);
-  double tie_correction = rank_data(sorted, ranked_size);
-  free(sorted);
+  double tie_correction;
+  double sum = rank_sum(x, n1, y, n2, &tie_correction);
   if (!tie_correction) { // data sets are identical
-    free(ranked);
     return 0;
   }
 
-  double sum = 0;
-  for (size_t i = 0; i < n1; ++i) {
-    sum += ranked[i];
-  }
-  free(ranked);
-
   double u1 = sum - (n1 * (n1 + 1)) / 2.0;
   double u2 = n1 * n2 - u1;
   double u = u1 < u2 ? u1 : u2; // take the smaller value
@@ -747,9 +2649,19 @@ static int circular_buffer_current_time(lua_State* lua)
   return 1; // return the current time
 }
 
+
+static int circular_buffer_get_write_stats(lua_State* lua)
+{
+  circular_buffer* cb = check_circular_buffer(lua, 0);
+  lua_pushnumber(lua, (lua_Number)cb->late_writes);
+  lua_pushnumber(lua, (lua_Number)cb->dropped_writes);
+  lua_pushnumber(lua, (lua_Number)cb->future_writes);
+  return 3;
+}
+
 static int circular_buffer_format(lua_State* lua)
 {
-  static const char* output_types[] = { "cbuf", "cbufd", NULL };
+  static const char* output_types[] = { "cbuf", "cbufd", "cbufb", NULL };
   circular_buffer* cb = check_circular_buffer(lua, 2);
   luaL_argcheck(lua, 2 == lua_gettop(lua), 0,
                 "incorrect number of arguments");
@@ -765,6 +2677,8 @@ const char* get_output_format(circular_buffer* cb)
   switch (cb->format) {
   case OUTPUT_CBUFD:
     return "cbufd";
+  case OUTPUT_CBUFB:
+    return "cbufb";
   default:
     return "cbuf";
   }
@@ -838,8 +2752,41 @@ static int circular_buffer_fromstring(lua_State* lua)
   size_t pos = 0;
   size_t len = cb->rows * cb->columns;
   double value;
+  if (cb->hot_rows) {
+    for (unsigned i = 0; i < cb->cold_blocks; ++i) {
+      cold_release(lua, cb, &cb->cold[i]);
+    }
+    for (unsigned i = 0; i < cb->hot_rows * cb->columns; ++i) {
+      ((double*)cb->values)[i] = NAN;
+    }
+    while (pos < len && read_double(&p, &value)) {
+      if (!isnan(value)) { // empty cold rows are not stored
+        *cell_ref(lua, cb, pos / cb->columns, pos % cb->columns) = value;
+      }
+      ++pos;
+    }
+    cold_seal_blocks(lua, cb);
+  } else if (cb->sparse) {
+    for (unsigned i = 0; i < cb->rows; ++i) {
+      sparse_release(lua, &cb->sparse[i]);
+    }
+    while (pos < len && read_double(&p, &value)) {
+      sparse_set(lua, cb, pos / cb->columns, pos % cb->columns, value);
+      ++pos;
+    }
+  }
   while (pos < len && read_double(&p, &value)) {
-    cb->values[pos++] = value;
+    // the restoration data is always in row order
+    put_value(cb, value_index(cb, pos / cb->columns, pos % cb->columns), value);
+    ++pos;
+  }
+  if (cb->running) {
+    for (unsigned column_idx = 0; column_idx < cb->columns; ++column_idx) {
+      running_rebuild(cb, column_idx);
+    }
+  }
+  if (cb->prefix) {
+    prefix_invalidate(cb, 0);
   }
   if (pos == len) {
     if (cb->delta) {
@@ -855,6 +2802,280 @@ static int circular_buffer_fromstring(lua_State* lua)
 }
 
 
+// Binary restoration data (frombinary). The payload is little-endian and is
+// embedded in the preservation file as a Lua long string, every byte is XOR'ed
+// with BINARY_XOR (moving the common 0x00 bytes of doubles out of the escaped
+// set) and the bytes a long string cannot hold verbatim are written as
+// BINARY_ESCAPE followed by the byte XOR 0x20.
+#define BINARY_VERSION 1
+#define BINARY_XOR 0x80
+#define BINARY_ESCAPE 0x01
+
+static const char binary_magic[4] = { 'C', 'B', 'U', 'F' };
+
+static const unsigned char binary_escaped[256] = {
+  [0] = 1, ['\n'] = 1, ['\r'] = 1, [0x1a] = 1, [']'] = 1, [BINARY_ESCAPE] = 1
+};
+
+typedef struct binary_reader
+{
+  const unsigned char* p;
+  const unsigned char* end;
+} binary_reader;
+
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+static void swap_bytes(unsigned char* data, size_t size, size_t n)
+{
+  for (size_t i = 0; i < n; ++i, data += size) {
+    for (size_t j = 0; j < size / 2; ++j) {
+      unsigned char tmp = data[j];
+      data[j] = data[size - 1 - j];
+      data[size - 1 - j] = tmp;
+    }
+  }
+}
+#endif
+
+
+static int append_escaped(output_data* output, const unsigned char* data,
+                          size_t len)
+{
+  size_t needed = 2 * len + 1;
+  if (output->size - output->pos < needed) {
+    if (realloc_output(output, needed)) return 1;
+  }
+  unsigned char* d = (unsigned char*)output->data + output->pos;
+  for (size_t i = 0; i < len; ++i) {
+    unsigned char c = data[i] ^ BINARY_XOR;
+    if (binary_escaped[c]) {
+      *d++ = BINARY_ESCAPE;
+      c ^= 0x20;
+    }
+    *d++ = c;
+  }
+  output->pos = (char*)d - output->data;
+  output->data[output->pos] = 0;
+  return 0;
+}
+
+
+// Appends n values of the given size in little-endian byte order.
+static int append_binary(output_data* output, const void* data, size_t size,
+                         size_t n)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  unsigned char tmp[sizeof(double)];
+  for (size_t i = 0; i < n; ++i) {
+    memcpy(tmp, (const unsigned char*)data + i * size, size);
+    swap_bytes(tmp, size, 1);
+    if (append_escaped(output, tmp, size)) return 1;
+  }
+  return 0;
+#else
+  return append_escaped(output, data, size * n);
+#endif
+}
+
+
+// Reads n little-endian values of the given size, returns 1 if the data is
+// truncated.
+static int read_binary(binary_reader* r, void* data, size_t size, size_t n)
+{
+  unsigned char* d = data;
+  size_t len = size * n;
+  const unsigned char* p = r->p;
+  for (size_t i = 0; i < len; ++i) {
+    if (p == r->end) return 1;
+    unsigned char c = *p++;
+    if (c == BINARY_ESCAPE) {
+      if (p == r->end) return 1;
+      c = *p++ ^ 0x20;
+    }
+    d[i] = c ^ BINARY_XOR;
+  }
+  r->p = p;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  swap_bytes(d, size, n);
+#endif
+  return 0;
+}
+
+
+static int circular_buffer_frombinary(lua_State* lua)
+{
+  circular_buffer* cb = check_circular_buffer(lua, 2);
+  size_t len;
+  const char* data = luaL_checklstring(lua, 2, &len);
+  binary_reader r = { (const unsigned char*)data,
+    (const unsigned char*)data + len };
+
+  char magic[4];
+  unsigned char config[4]; // version, layout, storage, hot
+  uint32_t dims[4]; // rows, columns, current_row, delta_rows
+  int64_t current_time;
+  if (read_binary(&r, magic, 1, sizeof(magic))
+      || read_binary(&r, config, 1, sizeof(config))
+      || read_binary(&r, dims, sizeof(uint32_t), 4)
+      || read_binary(&r, &current_time, sizeof(int64_t), 1)
+      || memcmp(magic, binary_magic, sizeof(magic))
+      || config[0] != BINARY_VERSION
+      || config[1] >= MAX_LAYOUT
+      || config[2] >= MAX_STORAGE) {
+    luaL_error(lua, "frombinary() invalid header");
+  }
+  if (dims[0] != cb->rows || dims[1] != cb->columns || dims[2] >= cb->rows) {
+    luaL_error(lua, "frombinary() incompatible dimensions, expected %d rows "
+               "and %d columns", cb->rows, cb->columns);
+  }
+  cb->current_time = (time_t)current_time;
+  cb->current_row = dims[2];
+
+  size_t n = cb->rows * cb->columns;
+  int hot = config[3];
+  if (!hot && !cb->hot_rows && !cb->sparse && config[1] == cb->layout
+      && config[2] == cb->storage) {
+    if (read_binary(&r, cb->values, value_sizes[cb->storage], n)) {
+      luaL_error(lua, "frombinary() truncated values");
+    }
+  } else {
+    // the configuration changed; decode the stored values and convert them
+    circular_buffer stored;
+    memset(&stored, 0, sizeof(stored));
+    stored.rows = cb->rows;
+    stored.columns = cb->columns;
+    stored.layout = hot ? LAYOUT_ROW : config[1];
+    stored.storage = hot ? STORAGE_DOUBLE : config[2];
+    stored.values = lua_newuserdata(lua, value_sizes[stored.storage] * n);
+    if (read_binary(&r, stored.values, value_sizes[stored.storage], n)) {
+      luaL_error(lua, "frombinary() truncated values");
+    }
+    if (cb->hot_rows) {
+      for (unsigned i = 0; i < cb->cold_blocks; ++i) {
+        cold_release(lua, cb, &cb->cold[i]);
+      }
+      for (unsigned i = 0; i < cb->hot_rows * cb->columns; ++i) {
+        ((double*)cb->values)[i] = NAN;
+      }
+    } else if (cb->sparse) {
+      for (unsigned i = 0; i < cb->rows; ++i) {
+        sparse_release(lua, &cb->sparse[i]);
+      }
+    }
+    for (unsigned row_idx = 0; row_idx < cb->rows; ++row_idx) {
+      for (unsigned column_idx = 0; column_idx < cb->columns; ++column_idx) {
+        double value = get_value(&stored,
+                                 value_index(&stored, row_idx, column_idx));
+        if (cb->sparse) {
+          sparse_set(lua, cb, row_idx, column_idx, value);
+        } else if (!cb->hot_rows) {
+          put_value(cb, value_index(cb, row_idx, column_idx), value);
+        } else if (!isnan(value)) { // empty cold rows are not stored
+          *cell_ref(lua, cb, row_idx, column_idx) = value;
+        }
+      }
+    }
+    if (cb->hot_rows) {
+      cold_seal_blocks(lua, cb);
+    }
+    lua_pop(lua, 1);
+  }
+  if (cb->running) {
+    for (unsigned column_idx = 0; column_idx < cb->columns; ++column_idx) {
+      running_rebuild(cb, column_idx);
+    }
+  }
+  if (cb->prefix) {
+    prefix_invalidate(cb, 0);
+  }
+
+  for (uint32_t i = 0; i < dims[3]; ++i) {
+    double t, value;
+    if (read_binary(&r, &t, sizeof(double), 1)) {
+      luaL_error(lua, "frombinary() invalid delta");
+    }
+    for (unsigned column_idx = 0; column_idx < cb->columns; ++column_idx) {
+      if (read_binary(&r, &value, sizeof(double), 1)) {
+        luaL_error(lua, "frombinary() invalid delta");
+      }
+      if (cb->delta) {
+        circular_buffer_add_delta(lua, cb, t * 1e9, (int)column_idx, value);
+      }
+    }
+  }
+
+  uint32_t sketch_columns = 0;
+  if (r.p != r.end
+      && read_binary(&r, &sketch_columns, sizeof(uint32_t), 1)) {
+    luaL_error(lua, "frombinary() invalid sketch");
+  }
+  for (uint32_t i = 0; i < sketch_columns; ++i) {
+    uint32_t column_idx;
+    if (read_binary(&r, &column_idx, sizeof(uint32_t), 1)
+        || column_idx >= cb->columns) {
+      luaL_error(lua, "frombinary() invalid sketch");
+    }
+    for (unsigned row_idx = 0; row_idx < cb->rows; ++row_idx) {
+      quantile_sketch sketch;
+      sketch_clear(&sketch);
+      if (read_binary(&r, &sketch.count, sizeof(uint32_t), 1)
+          || (sketch.count
+              && (read_binary(&r, &sketch.offset, sizeof(int32_t), 1)
+                  || read_binary(&r, &sketch.zeros, sizeof(uint32_t), 1)
+                  || read_binary(&r, sketch.bins, sizeof(uint32_t),
+                                 SKETCH_BINS)))) {
+        luaL_error(lua, "frombinary() invalid sketch");
+      }
+      if (cb->sketches[column_idx]) { // dropped if no longer a quantile column
+        cb->sketches[column_idx][row_idx] = sketch;
+      }
+    }
+  }
+
+  uint32_t distinct_columns = 0;
+  if (r.p != r.end
+      && read_binary(&r, &distinct_columns, sizeof(uint32_t), 1)) {
+    luaL_error(lua, "frombinary() invalid registers");
+  }
+  for (uint32_t i = 0; i < distinct_columns; ++i) {
+    uint32_t column_idx;
+    if (read_binary(&r, &column_idx, sizeof(uint32_t), 1)
+        || column_idx >= cb->columns) {
+      luaL_error(lua, "frombinary() invalid registers");
+    }
+    for (unsigned row_idx = 0; row_idx < cb->rows; ++row_idx) {
+      unsigned char used;
+      hyperloglog h;
+      hll_clear(&h);
+      if (read_binary(&r, &used, 1, 1)
+          || (used && read_binary(&r, h.registers, 1, HLL_REGISTERS))) {
+        luaL_error(lua, "frombinary() invalid registers");
+      }
+      hll_refresh(&h);
+      if (cb->distinct[column_idx]) { // dropped if no longer a distinct column
+        cb->distinct[column_idx][row_idx] = h;
+      }
+    }
+  }
+  if (r.p != r.end) {
+    luaL_error(lua, "frombinary() too much data");
+  }
+  return 0;
+}
+
+
+// Returns the value written by the output formats; quantile columns report
+// the column's quantile instead of the sample count.
+static double output_value(circular_buffer* cb, unsigned row, unsigned column)
+{
+  if (cb->sketches[column]) {
+    return sketch_quantile(&cb->sketches[column][row],
+                           cb->headers[column].quantile);
+  }
+  return read_value(cb, row, column);
+}
+
+
 int output_circular_buffer_full(circular_buffer* cb, output_data* output)
 {
   unsigned column_idx;
@@ -865,8 +3086,7 @@ int output_circular_buffer_full(circular_buffer* cb, output_data* output)
       if (column_idx != 0) {
         if (appendc(output, '\t')) return 1;
       }
-      if (serialize_double(output,
-                           cb->values[(row_idx * cb->columns) + column_idx])) {
+      if (serialize_double(output, output_value(cb, row_idx, column_idx))) {
         return 1;
       }
     }
@@ -876,46 +3096,72 @@ int output_circular_buffer_full(circular_buffer* cb, output_data* output)
 }
 
 
+// Writes each column as a block of little-endian doubles, oldest row first.
+static int output_circular_buffer_binary(circular_buffer* cb,
+                                         output_data* output)
+{
+  size_t needed = sizeof(double) * cb->rows * cb->columns + 1;
+  if (output->size - output->pos < needed) {
+    if (realloc_output(output, needed)) return 1;
+  }
+  char* p = output->data + output->pos;
+  unsigned first_row = cb->current_row + 1;
+  if (first_row == cb->rows) first_row = 0;
+  for (unsigned column_idx = 0; column_idx < cb->columns; ++column_idx) {
+    if (cb->layout == LAYOUT_COLUMN && cb->storage == STORAGE_DOUBLE
+        && !cb->sketches[column_idx]) {
+      // the column is already contiguous; copy it in two spans
+      const double* values = (const double*)cb->values
+        + (size_t)column_idx * cb->rows;
+      size_t older = sizeof(double) * (cb->rows - first_row);
+      memcpy(p, values + first_row, older);
+      memcpy(p + older, values, sizeof(double) * first_row);
+      p += sizeof(double) * cb->rows;
+      continue;
+    }
+    unsigned row_idx = first_row;
+    for (unsigned i = 0; i < cb->rows; ++i, ++row_idx) {
+      if (row_idx == cb->rows) row_idx = 0;
+      double value = output_value(cb, row_idx, column_idx);
+      memcpy(p, &value, sizeof(double));
+      p += sizeof(double);
+    }
+  }
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  for (char* d = output->data + output->pos; d < p; d += sizeof(double)) {
+    for (int i = 0; i < 4; ++i) {
+      char tmp = d[i];
+      d[i] = d[7 - i];
+      d[7 - i] = tmp;
+    }
+  }
+#endif
+  output->pos = p - output->data;
+  output->data[output->pos] = 0;
+  return 0;
+}
+
+
 int output_circular_buffer_cbufd(lua_State* lua, circular_buffer* cb,
                                  output_data* output)
 {
-  lua_getglobal(lua, lsb_circular_buffer_table);
-  if (lua_istable(lua, -1)) {
-    // get the delta table for this cbuf
-    lua_rawgeti(lua, -1, cb->ref);
-    if (!lua_istable(lua, -1)) {
-      lua_pop(lua, 2); // remove bogus table and cbuf table
-      luaL_error(lua, "Could not find the delta table");
-    }
-    lua_pushnil(lua);
-    while (lua_next(lua, -2) != 0) {
-      if (!lua_istable(lua, -1)) {
-        luaL_error(lua, "Invalid delta table structure");
-      }
-      if (serialize_double(output, lua_tonumber(lua, -2))) return 1;
-      for (unsigned column_idx = 0; column_idx < cb->columns;
-           ++column_idx) {
-        if (appendc(output, '\t')) return 1;
-        lua_rawgeti(lua, -1, column_idx);
-        if (LUA_TNIL == lua_type(lua, -1)) {
-          if (appends(output, not_a_number)) return 1;
-        } else {
-          if (serialize_double(output, lua_tonumber(lua, -1))) return 1;
-        }
-        lua_pop(lua, 1); // remove the number
+  (void)lua;
+  size_t n = delta_row_size(cb);
+  for (size_t i = 0; i < cb->delta_rows; ++i) {
+    double* row = cb->deltas + i * n;
+    unsigned char* dirty = delta_dirty(cb, row);
+    if (serialize_double(output, row[0])) return 1;
+    for (unsigned column_idx = 0; column_idx < cb->columns; ++column_idx) {
+      if (appendc(output, '\t')) return 1;
+      if (dirty[column_idx >> 3] & (1 << (column_idx & 7))) {
+        if (serialize_double(output, row[1 + column_idx])) return 1;
+      } else {
+        if (appends(output, not_a_number)) return 1;
       }
-      if (appendc(output, '\n')) return 1;
-      lua_pop(lua, 1); // remove the value, keep the key
     }
-    lua_pop(lua, 1); // remove the delta table
-
-    // delete the delta table
-    luaL_unref(lua, -1, cb->ref);
-    cb->ref = LUA_NOREF;
-  } else {
-    luaL_error(lua, "Could not find table %s", lsb_circular_buffer_table);
+    if (appendc(output, '\n')) return 1;
   }
-  lua_pop(lua, 1); // remove the circular buffer table or failed nil
+  cb->delta_rows = 0;
   return 0;
 }
 
@@ -924,7 +3170,7 @@ int output_circular_buffer(lua_State* lua, circular_buffer* cb,
                            output_data* output)
 {
   if (OUTPUT_CBUFD == cb->format) {
-    if (cb->ref == LUA_NOREF) return 0;
+    if (cb->delta_rows == 0) return 0;
   }
 
   if (appendf(output,
@@ -941,61 +3187,148 @@ int output_circular_buffer(lua_State* lua, circular_buffer* cb,
     if (column_idx != 0) {
       if (appendc(output, ',')) return 1;
     }
-    if (appendf(output, "{\"name\":\"%s\",\"unit\":\"%s\",\"aggregation\":\"%s\"}",
+    if (appendf(output, "{\"name\":\"%s\",\"unit\":\"%s\",\"aggregation\":\"%s\"",
                 cb->headers[column_idx].name,
                 cb->headers[column_idx].unit,
                 column_aggregation_methods[cb->headers[column_idx].aggregation])) {
       return 1;
     }
+    if (cb->sketches[column_idx]
+        && appendf(output, ",\"quantile\":%g",
+                   cb->headers[column_idx].quantile)) {
+      return 1;
+    }
+    if (appendc(output, '}')) return 1;
   }
   if (appends(output, "]}\n")) return 1;
 
   if (OUTPUT_CBUFD == cb->format) {
     return output_circular_buffer_cbufd(lua, cb, output);
   }
+  if (OUTPUT_CBUFB == cb->format) {
+    return output_circular_buffer_binary(cb, output);
+  }
   return output_circular_buffer_full(cb, output);
 }
 
 
-int serialize_circular_buffer_delta(lua_State* lua, circular_buffer* cb,
-                                    output_data* output)
+static int serialize_circular_buffer_values(lua_State* lua,
+                                            circular_buffer* cb,
+                                            output_data* output)
 {
-  if (cb->ref == LUA_NOREF) return 0;
-  lua_getglobal(lua, lsb_circular_buffer_table);
-  if (lua_istable(lua, -1)) {
-    // get the delta table for this cbuf
-    lua_rawgeti(lua, -1, cb->ref);
-    if (!lua_istable(lua, -1)) {
-      lua_pop(lua, 2); // remove bogus table and cbuf table
-      luaL_error(lua, "Could not find the delta table");
+  (void)lua;
+  unsigned char config[4] = { BINARY_VERSION, cb->layout, cb->storage,
+    cb->hot_rows != 0 || cb->sparse != NULL };
+  uint32_t dims[4] = { cb->rows, cb->columns, cb->current_row,
+    cb->delta_rows };
+  int64_t current_time = cb->current_time;
+  if (appends(output, "frombinary([=[")
+      || append_binary(output, binary_magic, 1, sizeof(binary_magic))
+      || append_binary(output, config, 1, sizeof(config))
+      || append_binary(output, dims, sizeof(uint32_t), 4)
+      || append_binary(output, &current_time, sizeof(int64_t), 1)) {
+    return 1;
+  }
+  if (cb->hot_rows || cb->sparse) { // written as row order doubles
+    for (unsigned row_idx = 0; row_idx < cb->rows; ++row_idx) {
+      for (unsigned column_idx = 0; column_idx < cb->columns; ++column_idx) {
+        double value = read_value(cb, row_idx, column_idx);
+        if (append_binary(output, &value, sizeof(double), 1)) return 1;
+      }
     }
-    lua_pushnil(lua);
-    while (lua_next(lua, -2) != 0) {
-      if (!lua_istable(lua, -1))  {
-        luaL_error(lua, "Invalid delta table structure");
+  } else if (append_binary(output, cb->values, value_sizes[cb->storage],
+                           cb->rows * cb->columns)) {
+    return 1;
+  }
+
+  size_t n = delta_row_size(cb);
+  for (size_t i = 0; i < cb->delta_rows; ++i) {
+    double* row = cb->deltas + i * n;
+    unsigned char* dirty = delta_dirty(cb, row);
+    if (append_binary(output, row, sizeof(double), 1)) return 1;
+    for (unsigned column_idx = 0; column_idx < cb->columns; ++column_idx) {
+      double value = 0; // unmodified columns are restored as a zero delta
+      if (dirty[column_idx >> 3] & (1 << (column_idx & 7))) {
+        value = row[1 + column_idx];
+      }
+      if (append_binary(output, &value, sizeof(double), 1)) return 1;
+    }
+  }
+  cb->delta_rows = 0;
+
+  // the quantile column sketches, only the rows holding samples are written
+  uint32_t sketch_columns = 0;
+  for (unsigned column_idx = 0; column_idx < cb->columns; ++column_idx) {
+    if (cb->sketches[column_idx]) ++sketch_columns;
+  }
+  if (append_binary(output, &sketch_columns, sizeof(uint32_t), 1)) return 1;
+  for (uint32_t column_idx = 0; column_idx < cb->columns; ++column_idx) {
+    if (!cb->sketches[column_idx]) continue;
+    if (append_binary(output, &column_idx, sizeof(uint32_t), 1)) return 1;
+    for (unsigned row_idx = 0; row_idx < cb->rows; ++row_idx) {
+      quantile_sketch* sketch = &cb->sketches[column_idx][row_idx];
+      if (append_binary(output, &sketch->count, sizeof(uint32_t), 1)) {
+        return 1;
       }
-      if (appendc(output, ' ')) return 1;
-      if (serialize_double(output, lua_tonumber(lua, -2))) return 1;
-
-      for (unsigned column_idx = 0; column_idx < cb->columns;
-           ++column_idx) {
-        if (appends(output, " ")) return 1;
-        lua_rawgeti(lua, -1, column_idx);
-        if (serialize_double(output, lua_tonumber(lua, -1))) return 1;
-        lua_pop(lua, 1); // remove the number
+      if (sketch->count
+          && (append_binary(output, &sketch->offset, sizeof(int32_t), 1)
+              || append_binary(output, &sketch->zeros, sizeof(uint32_t), 1)
+              || append_binary(output, sketch->bins, sizeof(uint32_t),
+                               SKETCH_BINS))) {
+        return 1;
       }
-      lua_pop(lua, 1); // remove the value, keep the key
     }
-    lua_pop(lua, 1); // remove the delta table
+  }
 
-    // delete the delta table
-    lua_pushnil(lua);
-    lua_rawseti(lua, -2, cb->ref);
-    cb->ref = LUA_NOREF;
-  } else {
-    luaL_error(lua, "Could not find table %s", lsb_circular_buffer_table);
+  // the distinct column registers, only the rows holding items are written
+  uint32_t distinct_columns = 0;
+  for (unsigned column_idx = 0; column_idx < cb->columns; ++column_idx) {
+    if (cb->distinct[column_idx]) ++distinct_columns;
+  }
+  if (append_binary(output, &distinct_columns, sizeof(uint32_t), 1)) return 1;
+  for (uint32_t column_idx = 0; column_idx < cb->columns; ++column_idx) {
+    if (!cb->distinct[column_idx]) continue;
+    if (append_binary(output, &column_idx, sizeof(uint32_t), 1)) return 1;
+    for (unsigned row_idx = 0; row_idx < cb->rows; ++row_idx) {
+      unsigned char used = !isnan(read_value(cb, row_idx, column_idx));
+      if (append_binary(output, &used, 1, 1)
+          || (used && append_binary(output,
+                                    cb->distinct[column_idx][row_idx].registers,
+                                    1, HLL_REGISTERS))) {
+        return 1;
+      }
+    }
+  }
+  return appends(output, "]=])\n");
+}
+
+
+// Writes the detector configurations; they are primed from the restored rows.
+static int serialize_detectors(circular_buffer* cb, const char* key, int tier,
+                               output_data* output)
+{
+  for (unsigned column_idx = 0; column_idx < cb->columns; ++column_idx) {
+    detector* d = cb->detectors[column_idx];
+    if (!d) continue;
+    if (tier > 1 ? appendf(output, "%s:tier(%d):", key, tier)
+        : appendf(output, "%s:", key)) {
+      return 1;
+    }
+    if (appendf(output, "set_detector(%u, \"%s\", {alpha = ",
+                column_idx + 1, detector_methods[d->method])
+        || serialize_double(output, d->alpha)
+        || appends(output, ", beta = ")
+        || serialize_double(output, d->beta)
+        || appends(output, ", gamma = ")
+        || serialize_double(output, d->gamma)
+        || appends(output, ", k = ")
+        || serialize_double(output, d->k)
+        || appendf(output, ", %s = %u})\n",
+                   d->method == DETECTOR_MAD ? "window" : "season",
+                   d->season)) {
+      return 1;
+    }
   }
-  lua_pop(lua, 1); // remove the circular buffer table or failed nil
   return 0;
 }
 
@@ -1004,24 +3337,65 @@ int serialize_circular_buffer(lua_State* lua, const char* key,
                               circular_buffer* cb, output_data* output)
 {
   output->pos = 0;
-  char* delta = "";
-  if (cb->delta) {
-    delta = ", true";
-  }
-  if (appendf(output,
-              "if %s == nil then %s = circular_buffer.new(%d, %d, %d%s) end\n",
-              key,
-              key,
-              cb->rows,
-              cb->columns,
-              cb->seconds_per_row,
-              delta)) {
+  if (cb->rollup) {
+    if (appendf(output,
+                "if %s == nil then %s = circular_buffer.new_tiered(%d, {",
+                key,
+                key,
+                cb->columns)) {
+      return 1;
+    }
+    for (circular_buffer* t = cb; t; t = t->rollup) {
+      if (appendf(output, "%s{%d, %d}", t == cb ? "" : ", ", t->rows,
+                  t->seconds_per_row)) {
+        return 1;
+      }
+    }
+    if (appendc(output, '}')) return 1;
+  } else if (appendf(output,
+                     "if %s == nil then %s = circular_buffer.new(%d, %d, %d",
+                     key,
+                     key,
+                     cb->rows,
+                     cb->columns,
+                     cb->seconds_per_row)) {
     return 1;
   }
+  if (cb->layout != LAYOUT_ROW || cb->running || cb->prefix
+      || cb->storage != STORAGE_DOUBLE || cb->hot_rows || cb->sparse
+      || cb->future) {
+    // only the non default options are written
+    if (appendf(output, ", {delta = %s", cb->delta ? "true" : "false")) {
+      return 1;
+    }
+    if (cb->layout != LAYOUT_ROW
+        && appendf(output, ", layout = \"%s\"", value_layouts[cb->layout])) {
+      return 1;
+    }
+    if (cb->running && appends(output, ", running = true")) return 1;
+    if (cb->prefix && appends(output, ", prefix = true")) return 1;
+    if (cb->storage != STORAGE_DOUBLE
+        && appendf(output, ", storage = \"%s\"",
+                   value_storage_types[cb->storage])) {
+      return 1;
+    }
+    if (cb->hot_rows
+        && appendf(output, ", hot_rows = %u", cb->hot_rows)) {
+      return 1;
+    }
+    if (cb->sparse && appends(output, ", sparse = true")) return 1;
+    if (cb->future && appendf(output, ", future = %u", cb->future)) {
+      return 1;
+    }
+    if (appendc(output, '}')) return 1;
+  } else if (cb->delta) {
+    if (appends(output, ", true")) return 1;
+  }
+  if (appends(output, ") end\n")) return 1;
 
   unsigned column_idx;
   for (column_idx = 0; column_idx < cb->columns; ++column_idx) {
-    if (appendf(output, "%s:set_header(%d, \"%s\", \"%s\", \"%s\")\n",
+    if (appendf(output, "%s:set_header(%d, \"%s\", \"%s\", \"%s\"",
                 key,
                 column_idx + 1,
                 cb->headers[column_idx].name,
@@ -1029,52 +3403,89 @@ int serialize_circular_buffer(lua_State* lua, const char* key,
                 column_aggregation_methods[cb->headers[column_idx].aggregation])) {
       return 1;
     }
+    if (cb->sketches[column_idx]
+        && (appends(output, ", ")
+            || serialize_double(output, cb->headers[column_idx].quantile))) {
+      return 1;
+    }
+    if (appends(output, ")\n")) return 1;
   }
 
-  if (appendf(output, "%s:fromstring(\"%lld %d",
-              key,
-              (long long)cb->current_time,
-              cb->current_row)) {
-    return 1;
-  }
-  for (unsigned row_idx = 0; row_idx < cb->rows; ++row_idx) {
-    for (column_idx = 0; column_idx < cb->columns; ++column_idx) {
-      if (appendc(output, ' ')) return 1;
-      if (serialize_double(output,
-                           cb->values[(row_idx * cb->columns) + column_idx])) {
-        return 1;
-      }
-    }
+  if (appendf(output, "%s:", key)) return 1;
+  if (serialize_circular_buffer_values(lua, cb, output)) return 1;
+  if (serialize_detectors(cb, key, 1, output)) return 1;
+  int tier = 2;
+  for (circular_buffer* t = cb->rollup; t; t = t->rollup, ++tier) {
+    if (appendf(output, "%s:tier(%d):", key, tier)) return 1;
+    if (serialize_circular_buffer_values(lua, t, output)) return 1;
+    if (serialize_detectors(t, key, tier, output)) return 1;
   }
-  if (serialize_circular_buffer_delta(lua, cb, output)) {
-    return 1;
+  return 0;
+}
+
+
+double* check_circular_buffer_column(lua_State* lua, int arg, size_t* n)
+{
+  void* ud = luaL_checkudata(lua, arg, lsb_circular_buffer);
+  luaL_argcheck(lua, ud != NULL, arg, "invalid userdata type");
+  circular_buffer* cb = (circular_buffer*)ud;
+  int column = check_column(lua, cb, arg + 1);
+
+  // optional range arguments
+  double start_ns = luaL_optnumber(lua, arg + 2, get_start_time(cb) * 1e9);
+  double end_ns   = luaL_optnumber(lua, arg + 3, cb->current_time * 1e9);
+  luaL_argcheck(lua, end_ns >= start_ns, arg + 3, "end must be >= start");
+
+  *n = 0;
+  int start_row = check_row(lua, cb, start_ns, 0);
+  int end_row   = check_row(lua, cb, end_ns, 0);
+  if (-1 == start_row  || -1 == end_row) {
+    return NULL;
   }
-  if (appends(output, "\")\n")) {
-    return 1;
+
+  *n = (end_row - start_row + cb->rows) % cb->rows + 1;
+  double* values = get_scratch(lua, sizeof(double) * *n);
+  unsigned row = start_row;
+  for (size_t i = 0; i < *n; ++i, ++row) {
+    if (row == cb->rows) {
+      row = 0;
+    }
+    values[i] = read_value(cb, row, column);
   }
-  return 0;
+  return values;
 }
 
 
 static const struct luaL_reg circular_bufferlib_f[] =
 {
   { "new", circular_buffer_new }
+  , { "new_tiered", circular_buffer_new_tiered }
   , { NULL, NULL }
 };
 
 static const struct luaL_reg circular_bufferlib_m[] =
 {
   { "add", circular_buffer_add }
+  , { "add_row", circular_buffer_add_row }
+  , { "add_many", circular_buffer_add_many }
   , { "get", circular_buffer_get }
   , { "get_configuration", circular_buffer_get_configuration }
+  , { "tier", circular_buffer_tier }
   , { "set", circular_buffer_set }
   , { "set_header", circular_buffer_set_header }
   , { "get_header", circular_buffer_get_header }
   , { "compute", circular_buffer_compute }
+  , { "compute_expr", circular_buffer_compute_expr }
+  , { "combine", circular_buffer_combine }
+  , { "merge", circular_buffer_merge }
   , { "mannwhitneyu", circular_buffer_mannwhitneyu }
+  , { "set_detector", circular_buffer_set_detector }
+  , { "detect", circular_buffer_detect }
   , { "current_time", circular_buffer_current_time }
+  , { "get_write_stats", circular_buffer_get_write_stats }
   , { "format", circular_buffer_format }
   , { "fromstring", circular_buffer_fromstring } // used for data restoration
+  , { "frombinary", circular_buffer_frombinary } // used for data restoration
   , { NULL, NULL }
 };
 
@@ -1085,6 +3496,8 @@ int luaopen_circular_buffer(lua_State* lua)
   lua_pushvalue(lua, -1);
   lua_setfield(lua, -2, "__index");
   luaL_register(lua, NULL, circular_bufferlib_m);
+  lua_pushcfunction(lua, circular_buffer_gc);
+  lua_setfield(lua, -2, "__gc");
   luaL_register(lua, lsb_circular_buffer_table, circular_bufferlib_f);
   return 1;
 }
@@ -49,6 +49,20 @@ const char* get_output_format(circular_buffer* cb);
 int serialize_circular_buffer(lua_State* lua, const char* key,
                               circular_buffer* cb, output_data* output);
 
+/**
+ * Copy a column range out of the circular buffer argument. The column and the
+ * optional start/end nanosecond arguments follow the buffer on the stack.
+ *
+ * @param lua Lua state.
+ * @param arg Stack index of the circular buffer.
+ * @param n Receives the number of rows copied.
+ *
+ * @return double* Row values, oldest first, in a scratch buffer valid until
+ *         the next circular buffer call; NULL if the range is outside of the
+ *         buffer.
+ */
+double* check_circular_buffer_column(lua_State* lua, int arg, size_t* n);
+
 /**
  * Circular buffer library loader
  *
@@ -0,0 +1,370 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/// @brief Lua sandbox Heka protobuf deserialization @file
+
+#include "lua_deserialize_protobuf.h"
+
+#include <lauxlib.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef enum {
+  PB_WT_VARINT  = 0,
+  PB_WT_FIXED64 = 1,
+  PB_WT_LENGTH  = 2,
+  PB_WT_FIXED32 = 5
+} pb_wire_type;
+
+typedef enum {
+  FIELD_STRING  = 0,
+  FIELD_BYTES   = 1,
+  FIELD_INTEGER = 2,
+  FIELD_DOUBLE  = 3,
+  FIELD_BOOL    = 4
+} field_value_type;
+
+typedef enum {
+  HEADER_UUID         = 1,
+  HEADER_TIMESTAMP    = 2,
+  HEADER_TYPE         = 3,
+  HEADER_LOGGER       = 4,
+  HEADER_SEVERITY     = 5,
+  HEADER_PAYLOAD      = 6,
+  HEADER_ENV_VERSION  = 7,
+  HEADER_PID          = 8,
+  HEADER_HOSTNAME     = 9,
+  HEADER_FIELDS       = 10
+} message_header_id;
+
+static const char* header_names[] = { "", "Uuid", "Timestamp", "Type",
+  "Logger", "Severity", "Payload", "EnvVersion", "Pid", "Hostname", NULL };
+
+static const int default_severity = 7;
+
+
+const char* pb_read_varint(const char* p, const char* e, long long* vi)
+{
+  unsigned long long v = 0;
+  for (int shift = 0; shift < 64 && p < e; shift += 7) {
+    unsigned char b = (unsigned char)*p++;
+    v |= (unsigned long long)(b & 0x7F) << shift;
+    if (!(b & 0x80)) {
+      *vi = (long long)v;
+      return p;
+    }
+  }
+  return NULL;
+}
+
+
+const char* pb_skip_value(const char* p, const char* e, int wiretype)
+{
+  long long vi;
+  switch (wiretype) {
+  case PB_WT_VARINT:
+    return pb_read_varint(p, e, &vi);
+  case PB_WT_FIXED64:
+    return e - p < 8 ? NULL : p + 8;
+  case PB_WT_LENGTH:
+    p = pb_read_varint(p, e, &vi);
+    if (!p || vi < 0 || vi > e - p) return NULL;
+    return p + vi;
+  case PB_WT_FIXED32:
+    return e - p < 4 ? NULL : p + 4;
+  }
+  return NULL;
+}
+
+
+static const char* read_length(const char* p, const char* e, const char** s,
+                               size_t* len)
+{
+  long long vi;
+  p = pb_read_varint(p, e, &vi);
+  if (!p || vi < 0 || vi > e - p) return NULL;
+  *s = p;
+  *len = (size_t)vi;
+  return p + vi;
+}
+
+
+static message_field* add_field(message_index* m)
+{
+  if (m->fields_pos == m->fields_size) {
+    size_t newsize = m->fields_size ? m->fields_size * 2 : 8;
+    void* p = realloc(m->fields, newsize * sizeof(message_field));
+    if (!p) return NULL;
+    m->fields = p;
+    m->fields_size = newsize;
+  }
+  message_field* f = &m->fields[m->fields_pos++];
+  memset(f, 0, sizeof(message_field));
+  return f;
+}
+
+
+static int index_field(message_field* f, const char* p, const char* e)
+{
+  long long tag, vi;
+  f->start = p;
+  f->end = e;
+  while (p && p < e) {
+    p = pb_read_varint(p, e, &tag);
+    if (!p) return 1;
+    int wiretype = (int)(tag & 7);
+    switch (tag >> 3) {
+    case 1:
+      if (wiretype != PB_WT_LENGTH) return 1;
+      p = read_length(p, e, &f->name, &f->name_len);
+      break;
+    case 2:
+      if (wiretype != PB_WT_VARINT) return 1;
+      p = pb_read_varint(p, e, &vi);
+      f->value_type = (int)vi;
+      break;
+    case 3:
+      if (wiretype != PB_WT_LENGTH) return 1;
+      p = read_length(p, e, &f->representation, &f->representation_len);
+      break;
+    default: // values are located on demand
+      p = pb_skip_value(p, e, wiretype);
+      break;
+    }
+  }
+  return p == NULL || f->name == NULL;
+}
+
+
+void free_message_index(message_index* m)
+{
+  free(m->fields);
+  memset(m, 0, sizeof(message_index));
+}
+
+
+int index_message(lua_sandbox* lsb, const char* msg, size_t len)
+{
+  message_index* m = &lsb->message;
+  m->msg = NULL;
+  m->len = 0;
+  m->fields_pos = 0;
+  memset(m->header, 0, sizeof(m->header));
+  if (!msg) return 0;
+
+  long long tag;
+  const char* p = msg;
+  const char* e = msg + len;
+  while (p && p < e) {
+    p = pb_read_varint(p, e, &tag);
+    if (!p) break;
+    int id = (int)(tag >> 3);
+    int wiretype = (int)(tag & 7);
+    if (id == HEADER_FIELDS && wiretype == PB_WT_LENGTH) {
+      const char* s;
+      size_t slen;
+      p = read_length(p, e, &s, &slen);
+      if (!p) break;
+      message_field* f = add_field(m);
+      if (!f) {
+        snprintf(lsb->error_message, LSB_ERROR_SIZE,
+                 "index_message out of memory");
+        return 1;
+      }
+      if (index_field(f, s, s + slen)) {
+        p = NULL;
+      }
+    } else if (id > 0 && id < HEADER_FIELDS) {
+      message_value* v = &m->header[id];
+      if (wiretype == PB_WT_LENGTH) {
+        p = read_length(p, e, &v->s, &v->len);
+      } else if (wiretype == PB_WT_VARINT) {
+        p = pb_read_varint(p, e, &v->i);
+      } else {
+        p = NULL;
+      }
+      v->found = 1;
+    } else {
+      p = pb_skip_value(p, e, wiretype);
+    }
+  }
+
+  if (!p || !m->header[HEADER_UUID].found
+      || !m->header[HEADER_TIMESTAMP].found) {
+    m->fields_pos = 0;
+    memset(m->header, 0, sizeof(m->header));
+    snprintf(lsb->error_message, LSB_ERROR_SIZE, "invalid protobuf message");
+    return 1;
+  }
+  m->msg = msg;
+  m->len = len;
+  return 0;
+}
+
+
+static message_field* find_field(message_index* m, const char* name,
+                                 size_t len, int field_index)
+{
+  for (size_t i = 0; i < m->fields_pos; ++i) {
+    message_field* f = &m->fields[i];
+    if (f->name_len == len && memcmp(f->name, name, len) == 0) {
+      if (field_index-- == 0) return f;
+    }
+  }
+  return NULL;
+}
+
+
+static int push_value(lua_State* lua, int value_type, const char** p,
+                      const char* e)
+{
+  long long vi;
+  double d;
+  const char* s;
+  size_t len;
+
+  switch (value_type) {
+  case FIELD_STRING:
+  case FIELD_BYTES:
+    *p = read_length(*p, e, &s, &len);
+    if (!*p) return 0;
+    lua_pushlstring(lua, s, len);
+    break;
+  case FIELD_INTEGER:
+    *p = pb_read_varint(*p, e, &vi);
+    if (!*p) return 0;
+    lua_pushnumber(lua, (lua_Number)vi);
+    break;
+  case FIELD_DOUBLE:
+    // todo add big endian support if necessary
+    if (e - *p < (ptrdiff_t)sizeof(double)) return 0;
+    memcpy(&d, *p, sizeof(double));
+    *p += sizeof(double);
+    lua_pushnumber(lua, d);
+    break;
+  case FIELD_BOOL:
+    *p = pb_read_varint(*p, e, &vi);
+    if (!*p) return 0;
+    lua_pushboolean(lua, vi != 0);
+    break;
+  default:
+    return 0;
+  }
+  return 1;
+}
+
+
+static int read_field_value(lua_State* lua, message_field* f, int array_index)
+{
+  long long tag, vi;
+  int value_id = f->value_type + 4;
+  const char* p = f->start;
+  const char* e = f->end;
+
+  while (p && p < e) {
+    p = pb_read_varint(p, e, &tag);
+    if (!p) break;
+    int wiretype = (int)(tag & 7);
+    if ((int)(tag >> 3) != value_id) {
+      p = pb_skip_value(p, e, wiretype);
+      continue;
+    }
+    if (wiretype == PB_WT_LENGTH && f->value_type >= FIELD_INTEGER) {
+      // packed numeric array
+      p = pb_read_varint(p, e, &vi);
+      if (!p || vi < 0 || vi > e - p) break;
+      const char* pe = p + vi;
+      if (f->value_type == FIELD_DOUBLE) {
+        size_t cnt = (size_t)vi / sizeof(double);
+        if ((size_t)array_index < cnt) {
+          p += array_index * sizeof(double);
+          return push_value(lua, FIELD_DOUBLE, &p, pe);
+        }
+        array_index -= (int)cnt;
+        p = pe;
+        continue;
+      }
+      while (p && p < pe) {
+        if (array_index-- == 0) {
+          return push_value(lua, f->value_type, &p, pe);
+        }
+        p = pb_read_varint(p, pe, &vi);
+      }
+    } else if (array_index-- == 0) {
+      return push_value(lua, f->value_type, &p, e);
+    } else {
+      p = pb_skip_value(p, e, wiretype);
+    }
+  }
+  return 0;
+}
+
+
+int read_message(lua_State* lua)
+{
+  void* luserdata = lua_touserdata(lua, lua_upvalueindex(1));
+  if (NULL == luserdata) {
+    luaL_error(lua, "read_message() invalid lightuserdata");
+  }
+  lua_sandbox* lsb = (lua_sandbox*)luserdata;
+
+  int n = lua_gettop(lua);
+  luaL_argcheck(lua, n >= 1 && n <= 3, 0, "incorrect number of arguments");
+  size_t len;
+  const char* name = luaL_checklstring(lua, 1, &len);
+  int field_index = luaL_optint(lua, 2, 0);
+  luaL_argcheck(lua, field_index >= 0, 2, "field index must be >= 0");
+  int array_index = luaL_optint(lua, 3, 0);
+  luaL_argcheck(lua, array_index >= 0, 3, "array index must be >= 0");
+
+  message_index* m = &lsb->message;
+  if (!m->msg) {
+    lua_pushnil(lua);
+    return 1;
+  }
+
+  if (len > 8 && strncmp(name, "Fields[", 7) == 0 && name[len - 1] == ']') {
+    message_field* f = find_field(m, name + 7, len - 8, field_index);
+    if (!f || !read_field_value(lua, f, array_index)) {
+      lua_pushnil(lua);
+    }
+    return 1;
+  }
+
+  if (strcmp(name, "raw") == 0) {
+    lua_pushlstring(lua, m->msg, m->len);
+    return 1;
+  }
+
+  for (int id = HEADER_UUID; header_names[id]; ++id) {
+    if (strcmp(name, header_names[id]) != 0) continue;
+
+    message_value* v = &m->header[id];
+    switch (id) {
+    case HEADER_TIMESTAMP:
+    case HEADER_PID:
+      if (v->found) {
+        lua_pushnumber(lua, (lua_Number)v->i);
+      } else {
+        lua_pushnil(lua);
+      }
+      break;
+    case HEADER_SEVERITY:
+      lua_pushinteger(lua, v->found ? (lua_Integer)v->i : default_severity);
+      break;
+    default:
+      if (v->found) {
+        lua_pushlstring(lua, v->s, v->len);
+      } else {
+        lua_pushnil(lua);
+      }
+      break;
+    }
+    return 1;
+  }
+  lua_pushnil(lua);
+  return 1;
+}
@@ -0,0 +1,68 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/// Lua sandbox Heka protobuf deserialization @file
+#ifndef lua_deserialize_protobuf_h_
+#define lua_deserialize_protobuf_h_
+
+#include "lua_sandbox_private.h"
+
+/**
+ * Indexes a Heka protobuf message so its fields can be accessed without
+ * decoding the entire message. The message buffer is referenced (not copied)
+ * and must remain valid until the next call or until the index is cleared.
+ *
+ * @param lsb Pointer to the sandbox.
+ * @param msg Pointer to the protobuf encoded message (NULL clears the index).
+ * @param len Length of the message.
+ *
+ * @return int Zero on success, non-zero on failure.
+ */
+int index_message(lua_sandbox* lsb, const char* msg, size_t len);
+
+/**
+ * Releases the memory used by the message index.
+ *
+ * @param m Pointer to the message index.
+ */
+void free_message_index(message_index* m);
+
+/**
+ * Reads a varint from the buffer.
+ *
+ * @param p Pointer to the start of the varint.
+ * @param e Pointer to the end of the buffer.
+ * @param vi Pointer to where the decoded value is written.
+ *
+ * @return const char* Pointer past the varint or NULL if it is malformed.
+ */
+const char* pb_read_varint(const char* p, const char* e, long long* vi);
+
+/**
+ * Skips over a field value of the specified wire type.
+ *
+ * @param p Pointer to the start of the field value.
+ * @param e Pointer to the end of the buffer.
+ * @param wiretype Protobuf wire type of the value.
+ *
+ * @return const char* Pointer past the value or NULL if it is malformed.
+ */
+const char* pb_skip_value(const char* p, const char* e, int wiretype);
+
+////////////////////////////////////////////////////////////////////////////////
+/// Lua to C function interface
+////////////////////////////////////////////////////////////////////////////////
+/**
+ * Provides access to the currently indexed message.
+ *
+ * @param lua Pointer to the Lua state.
+ *
+ * @return int Returns one value on the stack; the requested message variable
+ *         or nil if it does not exist.
+ */
+int read_message(lua_State* lua);
+
+#endif
@@ -0,0 +1,363 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/// @brief Lua message template implementation @file
+
+#include "lua_message_template.h"
+#include "lua_serialize_protobuf.h"
+
+#include <lauxlib.h>
+#include <stdlib.h>
+#include <string.h>
+
+const char* lsb_message_template = "lsb.message_template";
+const char* lsb_message_template_table = "message_template";
+
+typedef enum {
+  FIELD_STRING  = 0,
+  FIELD_BYTES   = 1,
+  FIELD_INTEGER = 2,
+  FIELD_DOUBLE  = 3,
+  FIELD_BOOL    = 4
+} field_value_type;
+
+static const char* field_value_types[] = { "string", "bytes", "integer",
+  "double", "bool", NULL };
+
+static const char* field_lua_types[] = { "string", "string", "number",
+  "number", "boolean" };
+
+typedef struct
+{
+  const char* name;
+  int         id;
+  int         is_string;
+} static_header;
+
+// The static headers are split around the Payload to keep the message fields
+// in tag order.
+static const static_header static_headers[2][3] = {
+  { { "Type", 3, 1 }, { "Logger", 4, 1 }, { "Severity", 5, 0 } },
+  { { "EnvVersion", 7, 1 }, { "Pid", 8, 0 }, { "Hostname", 9, 1 } }
+};
+
+typedef struct
+{
+  size_t prefix;      // blob offset of the encoded name/type/representation
+  size_t prefix_len;
+  size_t name;        // blob offset of the field name (for error reporting)
+  size_t name_len;
+  int    value_type;
+} template_field;
+
+struct message_template
+{
+  size_t          fields;
+  size_t          header_len[2];
+  template_field* field;
+  char*           blob;
+  char            bytes[1];
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+/// Template compilation; each put function returns the number of bytes
+/// required and only writes the output when p is not NULL.
+////////////////////////////////////////////////////////////////////////////////
+static size_t put_varint(char* p, unsigned long long v)
+{
+  return p ? pb_encode_varint(p, v) : pb_varint_size(v);
+}
+
+
+static size_t put_string(char* p, int id, const char* s, size_t len)
+{
+  size_t n = put_varint(p, (id << 3) | 2);
+  n += put_varint(p ? p + n : NULL, len);
+  if (p) memcpy(p + n, s, len);
+  return n + len;
+}
+
+
+static size_t put_int(char* p, int id, long long i)
+{
+  size_t n = put_varint(p, id << 3);
+  return n + put_varint(p ? p + n : NULL, (unsigned long long)i);
+}
+
+
+static size_t put_headers(lua_State* lua, const static_header* h, char* p)
+{
+  size_t n = 0, len;
+  for (int i = 0; i < 3; ++i) {
+    lua_getfield(lua, 1, h[i].name);
+    int t = lua_type(lua, -1);
+    if (t != LUA_TNIL) {
+      if (h[i].is_string) {
+        if (t != LUA_TSTRING) {
+          luaL_error(lua, "%s must be a string", h[i].name);
+        }
+        const char* s = lua_tolstring(lua, -1, &len);
+        n += put_string(p ? p + n : NULL, h[i].id, s, len);
+      } else {
+        if (t != LUA_TNUMBER) {
+          luaL_error(lua, "%s must be a number", h[i].name);
+        }
+        n += put_int(p ? p + n : NULL, h[i].id,
+                     (long long)lua_tonumber(lua, -1));
+      }
+    }
+    lua_pop(lua, 1);
+  }
+  return n;
+}
+
+
+static size_t put_field(lua_State* lua, int idx, template_field* f, char* p)
+{
+  lua_rawgeti(lua, -1, idx);
+  if (!lua_istable(lua, -1)) {
+    luaL_error(lua, "Fields[%d] must be a table", idx);
+  }
+
+  size_t len, rlen = 0;
+  lua_getfield(lua, -1, "name");
+  if (lua_type(lua, -1) != LUA_TSTRING) {
+    luaL_error(lua, "Fields[%d] name must be a string", idx);
+  }
+  const char* name = lua_tolstring(lua, -1, &len);
+
+  int value_type = FIELD_DOUBLE;
+  lua_getfield(lua, -2, "type");
+  if (!lua_isnil(lua, -1)) {
+    const char* type = lua_tostring(lua, -1);
+    for (value_type = 0; field_value_types[value_type]; ++value_type) {
+      if (type && strcmp(type, field_value_types[value_type]) == 0) break;
+    }
+    if (!field_value_types[value_type]) {
+      luaL_error(lua, "Fields[%d] invalid type '%s'", idx,
+                 type ? type : "nil");
+    }
+  }
+
+  const char* representation = NULL;
+  lua_getfield(lua, -3, "representation");
+  if (!lua_isnil(lua, -1)) {
+    if (lua_type(lua, -1) != LUA_TSTRING) {
+      luaL_error(lua, "Fields[%d] representation must be a string", idx);
+    }
+    representation = lua_tolstring(lua, -1, &rlen);
+  }
+
+  size_t n = put_string(p, 1, name, len);
+  if (value_type != FIELD_STRING) {
+    n += put_int(p ? p + n : NULL, 2, value_type);
+  }
+  if (representation) {
+    n += put_string(p ? p + n : NULL, 3, representation, rlen);
+  }
+  if (f) {
+    f->prefix_len = n;
+    f->name_len = len;
+    f->name = f->prefix + 1 + put_varint(NULL, len);
+    f->value_type = value_type;
+  }
+  lua_pop(lua, 4); // remove the field table, name, type and representation
+  return n;
+}
+
+
+static size_t put_template(lua_State* lua, message_template* mt)
+{
+  size_t n = 0;
+  for (int i = 0; i < 2; ++i) {
+    size_t len = put_headers(lua, static_headers[i],
+                             mt ? mt->blob + n : NULL);
+    if (mt) mt->header_len[i] = len;
+    n += len;
+  }
+
+  lua_getfield(lua, 1, "Fields");
+  size_t fields = lua_objlen(lua, -1);
+  for (size_t i = 0; i < fields; ++i) {
+    template_field* f = NULL;
+    if (mt) {
+      f = &mt->field[i];
+      f->prefix = n;
+    }
+    n += put_field(lua, (int)i + 1, f, mt ? mt->blob + n : NULL);
+  }
+  lua_pop(lua, 1); // remove the Fields table
+  return n;
+}
+
+
+static int message_template_new(lua_State* lua)
+{
+  luaL_argcheck(lua, lua_gettop(lua) == 1, 0, "incorrect number of arguments");
+  luaL_checktype(lua, 1, LUA_TTABLE);
+
+  lua_getfield(lua, 1, "Fields");
+  int t = lua_type(lua, -1);
+  luaL_argcheck(lua, t == LUA_TTABLE || t == LUA_TNIL, 1,
+                "Fields must be an array");
+  size_t fields = t == LUA_TTABLE ? lua_objlen(lua, -1) : 0;
+  lua_pop(lua, 1);
+
+  // the first pass validates the template and sizes the blob so any error is
+  // raised before the userdata is allocated
+  size_t blob_bytes = put_template(lua, NULL);
+  size_t field_bytes = sizeof(template_field) * fields;
+  size_t struct_bytes = sizeof(message_template) - 1; // subtract 1 for the
+                                                      // byte already included
+                                                      // in the struct
+  size_t nbytes = struct_bytes + field_bytes + blob_bytes;
+  message_template* mt = (message_template*)lua_newuserdata(lua, nbytes);
+  mt->fields = fields;
+  mt->field = (template_field*)&mt->bytes[0];
+  mt->blob = &mt->bytes[field_bytes];
+
+  luaL_getmetatable(lua, lsb_message_template);
+  lua_setmetatable(lua, -2);
+
+  put_template(lua, mt);
+  return 1;
+}
+
+
+static int message_template_fields(lua_State* lua)
+{
+  message_template* mt = luaL_checkudata(lua, 1, lsb_message_template);
+  luaL_argcheck(lua, lua_gettop(lua) == 1, 0, "incorrect number of arguments");
+  lua_pushnumber(lua, (lua_Number)mt->fields);
+  return 1;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+/// Template encoding
+////////////////////////////////////////////////////////////////////////////////
+static int encode_template_value(lua_sandbox* lsb, output_data* d,
+                                 int value_type)
+{
+  lua_State* lua = lsb->lua;
+  size_t len;
+  const char* s;
+
+  switch (value_type) {
+  case FIELD_STRING:
+  case FIELD_BYTES:
+    s = lua_tolstring(lua, -1, &len);
+    return pb_write_string(d, value_type + 4, s, len);
+  case FIELD_INTEGER:
+    return pb_write_int(d, 6, (long long)lua_tonumber(lua, -1));
+  case FIELD_DOUBLE:
+    return encode_double(lsb, d, 7);
+  case FIELD_BOOL:
+    return pb_write_int(d, 8, lua_toboolean(lua, -1));
+  }
+  return 1;
+}
+
+
+static int type_error(lua_sandbox* lsb, message_template* mt,
+                      template_field* f)
+{
+  snprintf(lsb->error_message, LSB_ERROR_SIZE,
+           "field '%.*s' expected %s", (int)f->name_len, mt->blob + f->name,
+           field_lua_types[f->value_type]);
+  return 1;
+}
+
+
+static int encode_template_field(lua_sandbox* lsb, output_data* d,
+                                 message_template* mt, template_field* f)
+{
+  static const int lua_types[] = { LUA_TSTRING, LUA_TSTRING, LUA_TNUMBER,
+    LUA_TNUMBER, LUA_TBOOLEAN };
+  lua_State* lua = lsb->lua;
+  int expected = lua_types[f->value_type];
+  int t = lua_type(lua, -1);
+  size_t cnt = 1;
+  if (t == LUA_TTABLE) {
+    cnt = lua_objlen(lua, -1);
+    if (cnt == 0) return 0;
+  } else if (t != expected) {
+    return type_error(lsb, mt, f);
+  }
+
+  if (pb_write_tag(d, 10, 2)) return 1;
+  size_t len_pos = d->pos;
+  if (pb_write_varint(d, 0)) return 1;  // length tbd later
+  if (pb_write_raw(d, mt->blob + f->prefix, f->prefix_len)) return 1;
+  if (t == LUA_TTABLE) {
+    for (size_t i = 1; i <= cnt; ++i) {
+      lua_rawgeti(lua, -1, (int)i);
+      if (lua_type(lua, -1) != expected) {
+        lua_pop(lua, 1);
+        return type_error(lsb, mt, f);
+      }
+      int result = encode_template_value(lsb, d, f->value_type);
+      lua_pop(lua, 1);
+      if (result) return 1;
+    }
+  } else {
+    if (encode_template_value(lsb, d, f->value_type)) return 1;
+  }
+  return update_field_length(d, len_pos);
+}
+
+
+int serialize_template_as_pb(lua_sandbox* lsb, message_template* mt,
+                             int index)
+{
+  if (index < 0) {
+    index = lua_gettop(lsb->lua) + index + 1;
+  }
+  output_data* d = &lsb->output;
+  if (encode_uuid_timestamp(lsb, d, index)) return 1;
+  if (pb_write_raw(d, mt->blob, mt->header_len[0])) return 1;
+  if (encode_string(lsb, d, 6, "Payload", index)) return 1;
+  if (pb_write_raw(d, mt->blob + mt->header_len[0], mt->header_len[1])) {
+    return 1;
+  }
+
+  lua_checkstack(lsb->lua, 2);
+  for (size_t i = 0; i < mt->fields; ++i) {
+    lua_rawgeti(lsb->lua, index, (int)i + 1);
+    int result = 0;
+    if (!lua_isnil(lsb->lua, -1)) {
+      result = encode_template_field(lsb, d, mt, &mt->field[i]);
+    }
+    lua_pop(lsb->lua, 1);
+    if (result) return 1;
+  }
+  return pb_terminate(d);
+}
+
+
+static const struct luaL_reg message_templatelib_f[] =
+{
+  { "new", message_template_new }
+  , { NULL, NULL }
+};
+
+static const struct luaL_reg message_templatelib_m[] =
+{
+  { "fields", message_template_fields }
+  , { NULL, NULL }
+};
+
+
+int luaopen_message_template(lua_State* lua)
+{
+  luaL_newmetatable(lua, lsb_message_template);
+  lua_pushvalue(lua, -1);
+  lua_setfield(lua, -2, "__index");
+  luaL_register(lua, NULL, message_templatelib_m);
+  luaL_register(lua, lsb_message_template_table, message_templatelib_f);
+  return 1;
+}
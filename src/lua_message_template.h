@@ -0,0 +1,43 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/// @brief Lua message template - precompiled Heka protobuf encoder @file
+#ifndef lua_message_template_h_
+#define lua_message_template_h_
+
+#include <lua.h>
+#include "lua_sandbox_private.h"
+
+extern const char* lsb_message_template;
+extern const char* lsb_message_template_table;
+typedef struct message_template message_template;
+
+/**
+ * Serialize a Lua array of values as a Heka protobuf message using the
+ * template. The static headers and the field metadata are copied from the
+ * template, the field values are taken positionally from the array and the
+ * optional Timestamp and Payload entries are looked up by name.
+ *
+ * @param lsb Pointer to the sandbox.
+ * @param mt Message template userdata object.
+ * @param index Lua stack index of the value array.
+ *
+ * @return int Zero on success, non-zero on failure.
+ */
+int serialize_template_as_pb(lua_sandbox* lsb, message_template* mt,
+                             int index);
+
+/**
+ * Message template library loader
+ *
+ * @param lua Lua state.
+ *
+ * @return 1 on success
+ *
+ */
+int luaopen_message_template(lua_State* lua);
+
+#endif
@@ -9,14 +9,15 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
-#include <time.h>
 #include <lua.h>
 #include <lauxlib.h>
 #include <lualib.h>
 #include "lua_sandbox_private.h"
 #include "lua_serialize.h"
 #include "lua_serialize_protobuf.h"
+#include "lua_deserialize_protobuf.h"
 #include "lua_circular_buffer.h"
+#include "lua_message_template.h"
 
 static const char* disable_base_functions[] = { "collectgarbage", "coroutine",
   "dofile", "load", "loadfile", "loadstring", "module", "print", "require", NULL };
@@ -80,6 +81,8 @@ lua_sandbox* lsb_create(void* parent,
   lsb->output.maxsize = output_limit;
   lsb->output.size = OUTPUT_SIZE;
   lsb->output.data = malloc(lsb->output.size);
+  memset(&lsb->batch, 0, sizeof(lsb->batch));
+  memset(&lsb->message, 0, sizeof(lsb->message));
   size_t len = strlen(lua_file);
   lsb->lua_file = malloc(len + 1);
   lsb->require_path = NULL;
@@ -100,7 +103,7 @@ lua_sandbox* lsb_create(void* parent,
   if (lsb->require_path) {
     strcpy(lsb->require_path, require_path);
   }
-  srand((unsigned int)time(NULL));
+  prng_seed(&lsb->prng);
   return lsb;
 }
 
@@ -146,6 +149,15 @@ int lsb_init(lua_sandbox* lsb, const char* data_file)
   lua_pushcclosure(lsb->lua, &output, 1);
   lua_setglobal(lsb->lua, "output");
 
+  // keep a read_message() the host added before initialization
+  lua_getglobal(lsb->lua, "read_message");
+  if (lua_isnil(lsb->lua, -1)) {
+    lua_pushlightuserdata(lsb->lua, (void*)lsb);
+    lua_pushcclosure(lsb->lua, &read_message, 1);
+    lua_setglobal(lsb->lua, "read_message");
+  }
+  lua_pop(lsb->lua, 1);
+
   lua_sethook(lsb->lua, instruction_manager, LUA_MASKCOUNT,
               lsb->usage[LSB_UT_INSTRUCTION][LSB_US_LIMIT]);
 #ifdef LUA_JIT
@@ -200,6 +212,8 @@ char* lsb_destroy(lua_sandbox* lsb, const char* data_file)
     }
   }
   sandbox_terminate(lsb);
+  free_message_index(&lsb->message);
+  free(lsb->batch.offsets);
   free(lsb->output.data);
   free(lsb->lua_file);
   free(lsb->require_path);
@@ -279,14 +293,29 @@ const char* lsb_get_output(lua_sandbox* lsb, size_t* len)
   if (lsb->output.pos == 0) return "";
 
   lsb->output.pos = 0;
+  lsb->batch.count = 0;
   return lsb->output.data;
 }
 
 
+const char* lsb_get_output_batch(lua_sandbox* lsb, size_t* len, size_t* count,
+                                 const size_t** offsets)
+{
+  if (count) {
+    *count = lsb->batch.count;
+  }
+  if (offsets) {
+    *offsets = lsb->batch.offsets;
+  }
+  return lsb_get_output(lsb, len);
+}
+
+
 const char* lsb_output_userdata(lua_sandbox* lsb, int index, int append)
 {
   if (!append) {
     lsb->output.pos = 0;
+    lsb->batch.count = 0;
   }
 
   void* ud = lua_touserdata(lsb->lua, index);
@@ -311,6 +340,7 @@ int lsb_output_protobuf(lua_sandbox* lsb, int index, int append)
 {
   if (!append) {
     lsb->output.pos = 0;
+    lsb->batch.count = 0;
   }
 
   size_t last_pos = lsb->output.pos;
@@ -324,6 +354,70 @@ int lsb_output_protobuf(lua_sandbox* lsb, int index, int append)
 }
 
 
+int lsb_output_protobuf_template(lua_sandbox* lsb, int tindex, int vindex,
+                                 int append)
+{
+  void* ud = lua_touserdata(lsb->lua, tindex);
+  if (lsb_message_template != userdata_type(lsb->lua, ud, tindex)) {
+    snprintf(lsb->error_message, LSB_ERROR_SIZE, "invalid message_template");
+    return 1;
+  }
+  if (!lua_istable(lsb->lua, vindex)) {
+    snprintf(lsb->error_message, LSB_ERROR_SIZE, "values must be a table");
+    return 1;
+  }
+
+  if (!append) {
+    lsb->output.pos = 0;
+    lsb->batch.count = 0;
+  }
+
+  size_t last_pos = lsb->output.pos;
+  if (serialize_template_as_pb(lsb, (message_template*)ud, vindex) != 0) {
+    lsb->output.pos = last_pos;
+    return 1;
+  }
+
+  update_output_stats(lsb);
+  return 0;
+}
+
+
+int lsb_output_protobuf_batch(lua_sandbox* lsb, int index)
+{
+  batch_data* b = &lsb->batch;
+  if (b->count == 0) {
+    lsb->output.pos = 0;
+  }
+  if (b->count == b->size) {
+    size_t newsize = b->size ? b->size * 2 : 16;
+    void* p = realloc(b->offsets, newsize * sizeof(size_t));
+    if (!p) {
+      snprintf(lsb->error_message, LSB_ERROR_SIZE, "batch out of memory");
+      return 1;
+    }
+    b->offsets = p;
+    b->size = newsize;
+  }
+
+  size_t last_pos = lsb->output.pos;
+  if (serialize_table_as_framed_pb(lsb, index) != 0) {
+    lsb->output.pos = last_pos;
+    return 1;
+  }
+  b->offsets[b->count++] = last_pos;
+
+  update_output_stats(lsb);
+  return 0;
+}
+
+
+int lsb_decode_protobuf(lua_sandbox* lsb, const char* msg, size_t len)
+{
+  return index_message(lsb, msg, len);
+}
+
+
 int lsb_pcall_setup(lua_sandbox* lsb, const char* func_name)
 {
 
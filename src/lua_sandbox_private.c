@@ -18,6 +18,8 @@
 #include "lua_serialize_json.h"
 #include "lua_serialize_protobuf.h"
 #include "lua_circular_buffer.h"
+#include "lua_message_template.h"
+#include "lua_stats.h"
 
 
 #ifdef _WIN32
@@ -86,6 +88,60 @@ void* memory_manager(void* ud, void* ptr, size_t osize, size_t nsize)
 }
 #endif
 
+static unsigned long long splitmix64(unsigned long long* x)
+{
+  unsigned long long z = (*x += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+
+static unsigned long long rotl(unsigned long long x, int k)
+{
+  return (x << k) | (x >> (64 - k));
+}
+
+
+void prng_seed(prng_state* ps)
+{
+  static unsigned long long sequence = 0;
+  size_t n = 0;
+  FILE* fh = fopen("/dev/urandom", "rb");
+  if (fh) {
+    n = fread(ps->s, sizeof(ps->s), 1, fh);
+    fclose(fh);
+  }
+  if (n != 1) {
+    unsigned long long x = (unsigned long long)time(NULL);
+    x ^= (unsigned long long)clock() << 32;
+    x ^= (unsigned long long)(size_t)ps;
+    x ^= ++sequence << 48;
+    for (int i = 0; i < 4; ++i) {
+      ps->s[i] = splitmix64(&x);
+    }
+  }
+  if (!(ps->s[0] | ps->s[1] | ps->s[2] | ps->s[3])) {
+    ps->s[0] = 1; // the all zero state is a fixed point
+  }
+}
+
+
+unsigned long long prng_next(prng_state* ps)
+{
+  unsigned long long* s = ps->s;
+  unsigned long long result = rotl(s[1] * 5, 7) * 9;
+  unsigned long long t = s[1] << 17;
+  s[2] ^= s[0];
+  s[3] ^= s[1];
+  s[1] ^= s[2];
+  s[0] ^= s[3];
+  s[2] ^= t;
+  s[3] = rotl(s[3], 45);
+  return result;
+}
+
+
 void instruction_manager(lua_State* lua, lua_Debug* ar)
 {
   if (LUA_HOOKCOUNT == ar->event) {
@@ -338,6 +394,10 @@ int require_library(lua_State* lua)
     load_library(lua, name, luaopen_os, disable);
   } else if (strcmp(name, lsb_circular_buffer_table) == 0) {
     load_library(lua, name, luaopen_circular_buffer, disable_none);
+  } else if (strcmp(name, lsb_message_template_table) == 0) {
+    load_library(lua, name, luaopen_message_template, disable_none);
+  } else if (strcmp(name, lsb_stats_table) == 0) {
+    load_library(lua, name, luaopen_stats, disable_none);
   } else if (strcmp(name, "lpeg") == 0) {
     load_library(lua, name, luaopen_lpeg, disable_none);
   } else if (strcmp(name, "cjson") == 0) {
@@ -26,11 +26,57 @@ typedef struct
   char*  data;
 } output_data;
 
+typedef struct
+{
+  const char* s;
+  size_t      len;
+  long long   i;
+  int         found;
+} message_value;
+
+typedef struct
+{
+  const char* name;
+  size_t      name_len;
+  int         value_type;
+  const char* representation;
+  size_t      representation_len;
+  const char* start;
+  const char* end;
+} message_field;
+
+typedef struct
+{
+  size_t  size;
+  size_t  count;
+  size_t* offsets;
+} batch_data;
+
+typedef struct
+{
+  unsigned long long s[4];
+} prng_state;
+
+#define MESSAGE_HEADERS 10
+
+typedef struct
+{
+  const char*     msg;
+  size_t          len;
+  message_value   header[MESSAGE_HEADERS]; // indexed by the protobuf tag id
+  message_field*  fields;
+  size_t          fields_size;
+  size_t          fields_pos;
+} message_index;
+
 struct lua_sandbox {
   lua_State*      lua;
   void*           parent;
   lsb_state       state;
   output_data     output;
+  batch_data      batch;
+  message_index   message;
+  prng_state      prng;
   char*           lua_file;
   char*           require_path;
   unsigned        usage[LSB_UT_MAX][LSB_US_MAX];
@@ -71,6 +117,24 @@ void* memory_manager(void* ud, void* ptr, size_t osize, size_t nsize);
 #endif
 
 
+/**
+ * Seeds the pseudo random number generator from the system entropy source
+ * (falling back to the time, clock and address of the state when none is
+ * available).
+ *
+ * @param ps Pointer to the generator state.
+ */
+void prng_seed(prng_state* ps);
+
+/**
+ * Returns the next 64 bit value from the xoshiro256** generator.
+ *
+ * @param ps Pointer to the generator state.
+ *
+ * @return unsigned long long Pseudo random value.
+ */
+unsigned long long prng_next(prng_state* ps);
+
 /**
  * Lua hook to monitor the instruction usage of the sandbox.
  *
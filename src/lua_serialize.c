@@ -13,6 +13,7 @@
 #include <string.h>
 #include "lua_serialize.h"
 #include "lua_circular_buffer.h"
+#include "lua_message_template.h"
 
 const char* not_a_number = "nan";
 
@@ -239,6 +240,12 @@ const char* userdata_type(lua_State* lua, void* ud, int index)
     lua_getfield(lua, LUA_REGISTRYINDEX, lsb_circular_buffer);
     if (lua_rawequal(lua, -1, -2)) {
       table = lsb_circular_buffer;
+    } else {
+      lua_pop(lua, 1); // field
+      lua_getfield(lua, LUA_REGISTRYINDEX, lsb_message_template);
+      if (lua_rawequal(lua, -1, -2)) {
+        table = lsb_message_template;
+      }
     }
   }
   lua_pop(lua, 2); // metatable and field
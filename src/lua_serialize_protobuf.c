@@ -16,20 +16,65 @@
 int serialize_table_as_pb(lua_sandbox* lsb, int index)
 {
   output_data* d = &lsb->output;
-  d->pos = 0;
+  if (encode_uuid_timestamp(lsb, d, index)) return 1;
+  if (encode_string(lsb, d, 3, "Type", index)) return 1;
+  if (encode_string(lsb, d, 4, "Logger", index)) return 1;
+  if (encode_int(lsb, d, 5, "Severity", index)) return 1;
+  if (encode_string(lsb, d, 6, "Payload", index)) return 1;
+  if (encode_string(lsb, d, 7, "EnvVersion", index)) return 1;
+  if (encode_int(lsb, d, 8, "Pid", index)) return 1;
+  if (encode_string(lsb, d, 9, "Hostname", index)) return 1;
+  if (encode_fields(lsb, d, 10, "Fields", index)) return 1;
+  return pb_terminate(d);
+}
+
+
+int serialize_table_as_framed_pb(lua_sandbox* lsb, int index)
+{
+  // Heka stream framing: record separator, header length, header (protobuf
+  // with the message length), unit separator, message
+  static const size_t max_header = 14;
+  output_data* d = &lsb->output;
+  size_t start = d->pos;
+  if (max_header > d->size - d->pos) {
+    if (realloc_output(d, max_header)) return 1;
+  }
+  d->pos += max_header;
+  if (serialize_table_as_pb(lsb, index)) return 1;
+
+  size_t msg_pos = start + max_header;
+  size_t len = d->pos - msg_pos;
+  d->pos = start + 3;
+  if (pb_write_varint(d, len)) return 1;
+  size_t header_len = d->pos - start - 2;
+  d->data[start] = 0x1E;
+  d->data[start + 1] = (char)header_len;
+  d->data[start + 2] = 1 << 3; // message_length tag
+  d->data[d->pos++] = 0x1F;
+  memmove(d->data + d->pos, d->data + msg_pos, len + 1); // include the NUL
+  d->pos += len;
+  return 0;
+}
+
+
+int encode_uuid_timestamp(lua_sandbox* lsb, output_data* d, int index)
+{
+  size_t start = d->pos;
   size_t needed = 18;
-  if (needed > d->size) {
+  if (needed > d->size - d->pos) {
     if (realloc_output(d, needed)) return 1;
   }
 
   // create a type 4 uuid
   d->data[d->pos++] = 2 | (1 << 3);
   d->data[d->pos++] = 16;
-  for (int x = 0; x < 16; ++x) {
-    d->data[d->pos++] = rand() % 255;
-  }
-  d->data[8] = (d->data[8] & 0x0F) | 0x40;
-  d->data[10] = (d->data[10] & 0x0F) | 0xA0;
+  unsigned long long uuid[2];
+  uuid[0] = prng_next(&lsb->prng);
+  uuid[1] = prng_next(&lsb->prng);
+  memcpy(d->data + d->pos, uuid, sizeof(uuid));
+  d->pos += sizeof(uuid);
+  d->data[start + 8] = (d->data[start + 8] & 0x0F) | 0x40;
+  d->data[start + 10] = (d->data[start + 10] & 0x0F) | 0xA0;
 
   // use existing or create a timestamp
   lua_getfield(lsb->lua, index, "Timestamp");
@@ -40,46 +85,95 @@ int serialize_table_as_pb(lua_sandbox* lsb, int index)
     ts = (long long)(time(NULL) * 1e9);
   }
   lua_pop(lsb->lua, 1);
-  if (pb_write_tag(d, 2, 0)) return 1;
-  if (pb_write_varint(d, ts)) return 1;
+  return pb_write_int(d, 2, ts);
+}
 
-  if (encode_string(lsb, d, 3, "Type", index)) return 1;
-  if (encode_string(lsb, d, 4, "Logger", index)) return 1;
-  if (encode_int(lsb, d, 5, "Severity", index)) return 1;
-  if (encode_string(lsb, d, 6, "Payload", index)) return 1;
-  if (encode_string(lsb, d, 7, "EnvVersion", index)) return 1;
-  if (encode_int(lsb, d, 8, "Pid", index)) return 1;
-  if (encode_string(lsb, d, 9, "Hostname", index)) return 1;
-  if (encode_fields(lsb, d, 10, "Fields", index)) return 1;
-  // if we go above 15 pb_write_tag will need to start varint encoding
-  needed = 1;
+
+int pb_terminate(output_data* d)
+{
+  size_t needed = 1;
   if (needed > d->size - d->pos) {
     if (realloc_output(d, needed)) return 1;
   }
   d->data[d->pos] = 0; // NULL terminate incase someone tries to treat this
                        // as a string
-
   return 0;
 }
 
 
-int pb_write_varint(output_data* d, long long i)
+int pb_write_raw(output_data* d, const char* s, size_t len)
 {
-  size_t needed = 10;
+  size_t needed = len;
   if (needed > d->size - d->pos) {
     if (realloc_output(d, needed)) return 1;
   }
+  memcpy(&d->data[d->pos], s, len);
+  d->pos += len;
+  return 0;
+}
 
-  if (i == 0) {
-    d->data[d->pos++] = 0;
-    return 0;
+
+static int pb_reserve(output_data* d, size_t needed)
+{
+  if (needed > d->size - d->pos) {
+    return realloc_output(d, needed);
+  }
+  return 0;
+}
+
+
+size_t pb_varint_size(unsigned long long i)
+{
+#ifdef __GNUC__
+  // number of significant bits (at least one) divided into 7 bit groups
+  return 1 + (63 - __builtin_clzll(i | 1)) / 7;
+#else
+  size_t n = 1;
+  while (i >= 0x80) {
+    i >>= 7;
+    ++n;
   }
+  return n;
+#endif
+}
+
 
-  while (i) {
-    d->data[d->pos++] = (i & 0x7F) | 0x80;
+size_t pb_encode_varint(char* p, unsigned long long i)
+{
+  // tags, lengths, and most integer values fit in one or two bytes
+  if (i < 0x80) {
+    p[0] = (char)i;
+    return 1;
+  }
+  if (i < 0x4000) {
+    p[0] = (char)(i | 0x80);
+    p[1] = (char)(i >> 7);
+    return 2;
+  }
+  size_t n = 0;
+  do {
+    p[n++] = (char)(i | 0x80);
     i >>= 7;
   }
-  d->data[d->pos - 1] &= 0x7F; // end the varint
+  while (i >= 0x80);
+  p[n++] = (char)i;
+  return n;
+}
+
+
+int pb_write_varint(output_data* d, unsigned long long i)
+{
+  if (pb_reserve(d, 10)) return 1;
+  d->pos += pb_encode_varint(&d->data[d->pos], i);
+  return 0;
+}
+
+
+int pb_write_int(output_data* d, unsigned id, unsigned long long i)
+{
+  if (pb_reserve(d, 20)) return 1;
+  d->pos += pb_encode_varint(&d->data[d->pos], id << 3);
+  d->pos += pb_encode_varint(&d->data[d->pos], i);
   return 0;
 }
 
@@ -87,9 +181,7 @@ int pb_write_varint(output_data* d, long long i)
 int pb_write_double(output_data* d, double i)
 {
   size_t needed = sizeof(double);
-  if (needed > d->size - d->pos) {
-    if (realloc_output(d, needed)) return 1;
-  }
+  if (pb_reserve(d, needed)) return 1;
 
   memcpy(&d->data[d->pos], &i, needed);
   d->pos += needed;
@@ -99,10 +191,7 @@ int pb_write_double(output_data* d, double i)
 
 int pb_write_bool(output_data* d, int i)
 {
-  size_t needed = 1;
-  if (needed > d->size - d->pos) {
-    if (realloc_output(d, needed)) return 1;
-  }
+  if (pb_reserve(d, 1)) return 1;
 
   if (i) {
     d->data[d->pos++] = 1;
@@ -113,32 +202,19 @@ int pb_write_bool(output_data* d, int i)
 }
 
 
-int pb_write_tag(output_data* d, char id, char wire_type)
+int pb_write_tag(output_data* d, unsigned id, int wire_type)
 {
-  size_t needed = 1;
-  if (needed > d->size - d->pos) {
-    if (realloc_output(d, needed)) return 1;
-  }
-
-  d->data[d->pos++] = wire_type | (id << 3);
+  if (pb_reserve(d, 10)) return 1;
+  d->pos += pb_encode_varint(&d->data[d->pos], (id << 3) | wire_type);
   return 0;
 }
 
 
-int pb_write_string(output_data* d, char id, const char* s, size_t len)
+int pb_write_string(output_data* d, unsigned id, const char* s, size_t len)
 {
-
-  if (pb_write_tag(d, id, 2)) {
-    return 1;
-  }
-  if (pb_write_varint(d, len)) {
-    return 1;
-  }
-
-  size_t needed = len;
-  if (needed > d->size - d->pos) {
-    if (realloc_output(d, needed)) return 1;
-  }
+  if (pb_reserve(d, 20 + len)) return 1;
+  d->pos += pb_encode_varint(&d->data[d->pos], (id << 3) | 2);
+  d->pos += pb_encode_varint(&d->data[d->pos], len);
   memcpy(&d->data[d->pos], s, len);
   d->pos += len;
   return 0;
@@ -167,9 +243,7 @@ int encode_int(lua_sandbox* lsb, output_data* d, char id, const char* name,
   lua_getfield(lsb->lua, index, name);
   if (lua_isnumber(lsb->lua, -1)) {
     long long i = (long long)lua_tonumber(lsb->lua, -1);
-    if (!(result = pb_write_tag(d, id, 0))) {
-      result = pb_write_varint(d, i);
-    }
+    result = pb_write_int(d, id, i);
   }
   lua_pop(lsb->lua, 1);
   return result;
@@ -180,8 +254,11 @@ int encode_double(lua_sandbox* lsb, output_data* d, char id)
 {
   // todo add big endian support if necessary
   double n = lua_tonumber(lsb->lua, -1);
-  if (pb_write_tag(d, id, 1)) return 1;
-  return pb_write_double(d, n);
+  if (pb_reserve(d, 10 + sizeof(double))) return 1;
+  d->pos += pb_encode_varint(&d->data[d->pos], (id << 3) | 1);
+  memcpy(&d->data[d->pos], &n, sizeof(double));
+  d->pos += sizeof(double);
+  return 0;
 }
 
 
@@ -244,8 +321,7 @@ int encode_field_value(lua_sandbox* lsb, output_data* d, int first,
     break;
   case LUA_TNUMBER:
     if (first) {
-      if (pb_write_tag(d, 2, 0)) return 1;
-      if (pb_write_varint(d, 3)) return 1;
+      if (pb_write_int(d, 2, 3)) return 1;
       if (representation) {
         if (pb_write_string(d, 3, representation,
                             strlen(representation))) {
@@ -257,8 +333,7 @@ int encode_field_value(lua_sandbox* lsb, output_data* d, int first,
     break;
   case LUA_TBOOLEAN:
     if (first) {
-      if (pb_write_tag(d, 2, 0)) return 1;
-      if (pb_write_varint(d, 4)) return 1;
+      if (pb_write_int(d, 2, 4)) return 1;
       if (representation) {
         if (pb_write_string(d, 3, representation,
                             strlen(representation))) {
@@ -266,8 +341,7 @@ int encode_field_value(lua_sandbox* lsb, output_data* d, int first,
         }
       }
     }
-    if (pb_write_tag(d, 8, 0)) return 1;
-    result = pb_write_bool(d, lua_toboolean(lsb->lua, -1));
+    result = pb_write_int(d, 8, lua_toboolean(lsb->lua, -1));
     break;
   case LUA_TTABLE:
     {
@@ -296,20 +370,11 @@ int update_field_length(output_data* d, size_t len_pos)
     d->data[len_pos] = (char)len;
     return 0;
   }
-  size_t l = len, cnt = 0;
-  while (l) {
-    l >>= 7;
-    ++cnt;  // compute the number of bytes needed for the varint length
-  }
-  size_t needed = cnt - 1;
-  if (needed > d->size - d->pos) {
-    if (realloc_output(d, needed)) return 1;
-  }
-  size_t end_pos = d->pos + needed;
+  size_t cnt = pb_varint_size(len);
+  if (pb_reserve(d, cnt - 1)) return 1;
   memmove(&d->data[len_pos + cnt], &d->data[len_pos + 1], len);
-  d->pos = len_pos;
-  if (pb_write_varint(d, len)) return 1;
-  d->pos = end_pos;
+  pb_encode_varint(&d->data[len_pos], len);
+  d->pos += cnt - 1;
   return 0;
 }
 
@@ -21,14 +21,93 @@
 int serialize_table_as_pb(lua_sandbox* lsb, int index);
 
 /**
- * Writes a varint encoded number to the output buffer.
+ * Serialize a specific Lua table structure as Protobuf prefixed with the Heka
+ * stream framing header (record separator, header length, header, unit
+ * separator). The message is appended to the output buffer.
+ *
+ * @param lsb Pointer to the sandbox.
+ * @param index Lua stack index of the table.
+ *
+ * @return int Zero on success, non-zero on failure.
+ */
+int serialize_table_as_framed_pb(lua_sandbox* lsb, int index);
+
+/**
+ * Writes a random type 4 Uuid and the message Timestamp to the output buffer.
+ * The Timestamp entry of the Lua table is used when it is a number, otherwise
+ * the current time is encoded.
+ *
+ * @param lsb Pointer to the sandbox.
+ * @param d  Pointer to the output data buffer.
+ * @param index Lua stack index of the table.
+ *
+ * @return int Zero on success, non-zero if out of memory.
+ */
+int encode_uuid_timestamp(lua_sandbox* lsb, output_data* d, int index);
+
+/**
+ * NUL terminates the encoded message without advancing the output position
+ * (in case someone tries to treat the output as a string).
  *
  * @param d Pointer to the output data buffer.
+ *
+ * @return int Zero on success, non-zero if out of memory.
+ */
+int pb_terminate(output_data* d);
+
+/**
+ * Writes pre-encoded bytes to the output buffer.
+ *
+ * @param d Pointer to the output data buffer.
+ * @param s Bytes to output.
+ * @param len Length of s.
+ *
+ * @return int Zero on success, non-zero if out of memory.
+ */
+int pb_write_raw(output_data* d, const char* s, size_t len);
+
+/**
+ * Computes the number of bytes needed to varint encode a number.
+ *
+ * @param i Number to be encoded.
+ *
+ * @return size_t Encoded size (1-10 bytes).
+ */
+size_t pb_varint_size(unsigned long long i);
+
+/**
+ * Varint encodes a number without any capacity check; the caller must ensure
+ * ten bytes are available.
+ *
+ * @param p Pointer to the destination.
+ * @param i Number to be encoded.
+ *
+ * @return size_t Number of bytes written.
+ */
+size_t pb_encode_varint(char* p, unsigned long long i);
+
+/**
+ * Writes a varint encoded number to the output buffer. Negative int64 values
+ * should be cast to unsigned (encoded as ten bytes).
+ *
+ * @param d Pointer to the output data buffer.
+ * @param i Number to be encoded.
+ *
+ * @return int Zero on success, non-zero if out of memory.
+ */
+int pb_write_varint(output_data* d, unsigned long long i);
+
+/**
+ * Writes a varint field (tag and value) to the output buffer with a single
+ * capacity check.
+ *
+ * @param d Pointer to the output data buffer.
+ * @param id Field identifier.
  * @param i Number to be encoded.
  *
  * @return int Zero on success, non-zero if out of memory.
  */
-int pb_write_varint(output_data* d, long long i);
+int pb_write_int(output_data* d, unsigned id, unsigned long long i);
 
 /**
  * Writes a double to the output buffer.
@@ -59,7 +138,7 @@ int pb_write_bool(output_data* d, int i);
  *
  * @return int Zero on success, non-zero if out of memory.
  */
-int pb_write_tag(output_data* d, char id, char wire_type);
+int pb_write_tag(output_data* d, unsigned id, int wire_type);
 
 /**
  * Writes a string to the output buffer.
@@ -71,7 +150,7 @@ int pb_write_tag(output_data* d, char id, char wire_type);
  *
  * @return int Zero on success, non-zero if out of memory.
  */
-int pb_write_string(output_data* d, char id, const char* s, size_t len);
+int pb_write_string(output_data* d, unsigned id, const char* s, size_t len);
 
 /**
  * Retrieve the string value for a Lua table entry (the table should be on top
@@ -0,0 +1,170 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/// @brief Lua stats implementation @file
+
+#include "lua_stats.h"
+
+#include <lauxlib.h>
+
+#include "cephes.h"
+#include "lua_circular_buffer.h"
+
+const char* lsb_stats_table = "stats";
+
+// Evaluates a distribution function over n values, y may alias x.
+typedef void (*batch_function)(double param, const double* x, double* y,
+                               size_t n);
+
+
+static void batch_erfc(double param, const double* x, double* y, size_t n)
+{
+  (void)param;
+  erfc_array(x, y, n);
+}
+
+
+static void batch_ndtr(double param, const double* x, double* y, size_t n)
+{
+  (void)param;
+  ndtr_array(x, y, n);
+}
+
+
+static void batch_ndtri(double param, const double* x, double* y, size_t n)
+{
+  (void)param;
+  for (size_t i = 0; i < n; ++i) y[i] = ndtri(x[i]);
+}
+
+
+static void batch_chdtr(double df, const double* x, double* y, size_t n)
+{
+  for (size_t i = 0; i < n; ++i) y[i] = chdtr(df, x[i]);
+}
+
+
+static void batch_chdtrc(double df, const double* x, double* y, size_t n)
+{
+  for (size_t i = 0; i < n; ++i) y[i] = chdtrc(df, x[i]);
+}
+
+
+static void batch_stdtr(double df, const double* x, double* y, size_t n)
+{
+  for (size_t i = 0; i < n; ++i) y[i] = stdtr(df, x[i]);
+}
+
+
+// Applies the function to the values at arg: a number returns a number, an
+// array or a circular buffer column range (column, start, end) returns an
+// array of results. A range outside of the buffer returns nil.
+static int apply(lua_State* lua, int arg, batch_function f, double param)
+{
+  double* values = NULL;
+  size_t n = 0;
+
+  switch (lua_type(lua, arg)) {
+  case LUA_TNUMBER:
+    {
+      double x = lua_tonumber(lua, arg);
+      f(param, &x, &x, 1);
+      lua_pushnumber(lua, x);
+      return 1;
+    }
+  case LUA_TTABLE:
+    n = lua_objlen(lua, arg);
+    values = lua_newuserdata(lua, sizeof(double) * (n ? n : 1));
+    for (size_t i = 0; i < n; ++i) {
+      lua_rawgeti(lua, arg, (int)i + 1);
+      luaL_argcheck(lua, lua_type(lua, -1) == LUA_TNUMBER, arg,
+                    "array values must be numbers");
+      values[i] = lua_tonumber(lua, -1);
+      lua_pop(lua, 1);
+    }
+    break;
+  case LUA_TUSERDATA:
+    values = check_circular_buffer_column(lua, arg, &n);
+    if (!values) {
+      lua_pushnil(lua);
+      return 1;
+    }
+    break;
+  default:
+    return luaL_typerror(lua, arg, "number, array or circular_buffer");
+  }
+
+  f(param, values, values, n);
+  lua_createtable(lua, (int)n, 0);
+  for (size_t i = 0; i < n; ++i) {
+    lua_pushnumber(lua, values[i]);
+    lua_rawseti(lua, -2, (int)i + 1);
+  }
+  return 1;
+}
+
+
+static double check_df(lua_State* lua)
+{
+  double df = luaL_checknumber(lua, 1);
+  luaL_argcheck(lua, df > 0, 1, "df must be > 0");
+  return df;
+}
+
+
+static int stats_erfc(lua_State* lua)
+{
+  return apply(lua, 1, batch_erfc, 0);
+}
+
+
+static int stats_ndtr(lua_State* lua)
+{
+  return apply(lua, 1, batch_ndtr, 0);
+}
+
+
+static int stats_ndtri(lua_State* lua)
+{
+  return apply(lua, 1, batch_ndtri, 0);
+}
+
+
+static int stats_chdtr(lua_State* lua)
+{
+  return apply(lua, 2, batch_chdtr, check_df(lua));
+}
+
+
+static int stats_chdtrc(lua_State* lua)
+{
+  return apply(lua, 2, batch_chdtrc, check_df(lua));
+}
+
+
+static int stats_stdtr(lua_State* lua)
+{
+  return apply(lua, 2, batch_stdtr, check_df(lua));
+}
+
+
+static const struct luaL_reg statslib_f[] =
+{
+  { "erfc", stats_erfc }
+  , { "ndtr", stats_ndtr }
+  , { "ndtri", stats_ndtri }
+  , { "chdtr", stats_chdtr }
+  , { "chdtrc", stats_chdtrc }
+  , { "stdtr", stats_stdtr }
+  , { NULL, NULL }
+};
+
+
+int luaopen_stats(lua_State* lua)
+{
+  luaL_register(lua, lsb_stats_table, statslib_f);
+  return 1;
+}
@@ -0,0 +1,153 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/// @brief Fixed size mergeable quantile sketch implementation @file
+
+#include "quantile_sketch.h"
+
+#include <math.h>
+#include <string.h>
+
+// gamma = (1 + a) / (1 - a) for a relative accuracy a of 2%
+static const double gamma_ln = 0.040005334613699206;
+// buckets below this index (values < ~1e-9) are counted as zeros
+static const int32_t min_key = -518;
+
+
+// Finite values map to keys within +/-18600; the clamp only keeps the
+// conversion (and the window arithmetic) defined.
+static int32_t bucket_key(double value)
+{
+  double key = ceil(log(value) / gamma_ln);
+  if (key < min_key) return min_key;
+  if (key > INT32_MAX - SKETCH_BINS) return INT32_MAX - SKETCH_BINS;
+  return (int32_t)key;
+}
+
+
+static double bucket_value(int32_t key)
+{
+  // the midpoint of (gamma^(key - 1), gamma^key] in relative terms
+  return 2 * exp(key * gamma_ln) / (exp(gamma_ln) + 1);
+}
+
+
+// Moves the window so it starts at bucket index offset, buckets falling below
+// the new window are collapsed into its first bin.
+static void shift_window(quantile_sketch* s, int32_t offset)
+{
+  int32_t shift = offset - s->offset;
+  if (shift > 0) {
+    uint32_t collapsed = 0;
+    int32_t n = shift < SKETCH_BINS ? shift : SKETCH_BINS;
+    for (int32_t i = 0; i < n; ++i) {
+      collapsed += s->bins[i];
+    }
+    if (shift < SKETCH_BINS) {
+      memmove(s->bins, s->bins + shift,
+              sizeof(uint32_t) * (SKETCH_BINS - shift));
+      memset(s->bins + SKETCH_BINS - shift, 0, sizeof(uint32_t) * shift);
+      s->bins[0] += collapsed;
+    } else {
+      memset(s->bins, 0, sizeof(s->bins));
+      s->bins[0] = collapsed;
+    }
+  } else if (shift < 0) { // only called when the top bins are empty
+    shift = -shift;
+    memmove(s->bins + shift, s->bins,
+            sizeof(uint32_t) * (SKETCH_BINS - shift));
+    memset(s->bins, 0, sizeof(uint32_t) * shift);
+  }
+  s->offset = offset;
+}
+
+
+static int32_t highest_key(const quantile_sketch* s)
+{
+  for (int32_t i = SKETCH_BINS - 1; i > 0; --i) {
+    if (s->bins[i]) return s->offset + i;
+  }
+  return s->offset;
+}
+
+
+static void add_key(quantile_sketch* s, int32_t key, uint32_t n)
+{
+  if (s->count == s->zeros) { // no buckets in use; center the window
+    s->offset = key - SKETCH_BINS / 2;
+    memset(s->bins, 0, sizeof(s->bins));
+  } else if (key >= s->offset + SKETCH_BINS) {
+    shift_window(s, key - SKETCH_BINS + 1);
+  } else if (key < s->offset) {
+    // extend downwards as far as the highest bucket allows
+    int32_t lowest = highest_key(s) - SKETCH_BINS + 1;
+    shift_window(s, key > lowest ? key : lowest);
+    if (key < s->offset) key = s->offset;
+  }
+  s->bins[key - s->offset] += n;
+  s->count += n;
+}
+
+
+void sketch_clear(quantile_sketch* s)
+{
+  s->offset = 0;
+  s->zeros = 0;
+  s->count = 0;
+  memset(s->bins, 0, sizeof(s->bins));
+}
+
+
+void sketch_insert(quantile_sketch* s, double value)
+{
+  if (!isfinite(value)) return;
+
+  int32_t key = value > 0 ? bucket_key(value) : min_key;
+  if (key <= min_key) {
+    ++s->zeros;
+    ++s->count;
+    return;
+  }
+  add_key(s, key, 1);
+}
+
+
+void sketch_merge(quantile_sketch* dst, const quantile_sketch* src)
+{
+  if (src->count == src->zeros) {
+    dst->zeros += src->zeros;
+    dst->count += src->zeros;
+    return;
+  }
+  // add the highest bucket first so the window only has to move once
+  int32_t top = highest_key(src);
+  add_key(dst, top, src->bins[top - src->offset]);
+  for (int32_t i = top - src->offset - 1; i >= 0; --i) {
+    if (src->bins[i]) {
+      add_key(dst, src->offset + i, src->bins[i]);
+    }
+  }
+  dst->zeros += src->zeros;
+  dst->count += src->zeros;
+}
+
+
+double sketch_quantile(const quantile_sketch* s, double q)
+{
+  if (s->count == 0) return NAN;
+
+  double rank = q * (s->count - 1);
+  if (rank < s->zeros) return 0;
+
+  double seen = s->zeros;
+  for (int32_t i = 0; i < SKETCH_BINS; ++i) {
+    seen += s->bins[i];
+    if (seen > rank) {
+      return bucket_value(s->offset + i);
+    }
+  }
+  return bucket_value(highest_key(s));
+}
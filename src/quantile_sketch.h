@@ -0,0 +1,62 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/// @brief Fixed size mergeable quantile sketch (DDSketch) @file
+#ifndef quantile_sketch_h_
+#define quantile_sketch_h_
+
+#include <stdint.h>
+
+#define SKETCH_BINS 256
+
+/**
+ * Logarithmic bucket histogram with a 2% relative accuracy guarantee. The
+ * bins cover a sliding window of SKETCH_BINS consecutive buckets (a ~28000x
+ * value range); when a sample falls outside the window the lowest buckets are
+ * collapsed so the upper quantiles stay exact. Samples <= 0 are counted as 0.
+ */
+typedef struct quantile_sketch
+{
+  int32_t   offset;   // bucket index of bins[0]
+  uint32_t  zeros;    // samples <= 0
+  uint32_t  count;    // total samples
+  uint32_t  bins[SKETCH_BINS];
+} quantile_sketch;
+
+/**
+ * Empties the sketch.
+ *
+ * @param s Sketch to clear.
+ */
+void sketch_clear(quantile_sketch* s);
+
+/**
+ * Records a sample, NaN and infinite samples are ignored.
+ *
+ * @param s Sketch to update.
+ * @param value Sample value.
+ */
+void sketch_insert(quantile_sketch* s, double value);
+
+/**
+ * Adds all samples of one sketch to another.
+ *
+ * @param dst Sketch receiving the samples.
+ * @param src Sketch to merge.
+ */
+void sketch_merge(quantile_sketch* dst, const quantile_sketch* src);
+
+/**
+ * Estimates a quantile.
+ *
+ * @param s Sketch to query.
+ * @param q Quantile in the range [0, 1].
+ *
+ * @return double The estimated value or NaN if the sketch is empty.
+ */
+double sketch_quantile(const quantile_sketch* s, double q);
+
+#endif
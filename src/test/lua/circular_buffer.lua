@@ -116,6 +116,49 @@ function report(tc)
         if 8 ~= t then
             error(string.format("no range avg = %G", t))
         end
+        stats:set(4e9, 1, -2)
+        local t, c = stats:compute("max", 1)
+        if 8 ~= t or 3 ~= c then
+            error(string.format("no range max = %G active_rows = %d", t, c))
+        end
+        t = stats:compute("max", 1, 4e9, 4e9)
+        if -2 ~= t then
+            error(string.format("negative max = %G", t))
+        end
+        t, c = stats:compute("variance", 1)
+        if math.abs(t - 200 / 9) > 1e-12 or 3 ~= c then
+            error(string.format("no range variance = %G active_rows = %d", t, c))
+        end
+        local wide = circular_buffer.new(11, 1, 1) -- exercises the vector kernels
+        for i = 1, 11 do
+            wide:set(i * 1e9, 1, i % 3 == 0 and 0/0 or -i)
+        end
+        t, c = wide:compute("min", 1)
+        if -11 ~= t or 8 ~= c then
+            error(string.format("wide min = %G active_rows = %d", t, c))
+        end
+        t = wide:compute("max", 1)
+        if -1 ~= t then
+            error(string.format("wide max = %G", t))
+        end
+        t = wide:compute("sum", 1)
+        if -48 ~= t then
+            error(string.format("wide sum = %G", t))
+        end
+        local batch = circular_buffer.new(2, 3, 1)
+        if not batch:add_row(1e9, 1, nil, 5) or not batch:add_row(1e9, 2, 3) then
+            error("add_row failed")
+        end
+        if not batch:add_many(1e9, {[2] = 4, [3] = 2}) then
+            error("add_many failed")
+        end
+        if batch:get(1e9, 1) ~= 3 or batch:get(1e9, 2) ~= 7 or batch:get(1e9, 3) ~= 7 then
+            error(string.format("batch add %G %G %G", batch:get(1e9, 1),
+                                batch:get(1e9, 2), batch:get(1e9, 3)))
+        end
+        if batch:add_row(-1e9, 1) ~= nil or batch:add_many(-1e9, {1}) ~= nil then
+            error("batch add outside of the buffer")
+        end
     elseif tc == 5 then
         local stats = circular_buffer.new(2, 1, 1)
         local nan = stats:get(0, 1)
@@ -169,8 +212,8 @@ function report(tc)
         end
     elseif tc == 8 then
         local cb = circular_buffer.new(20,1,1)
-        u, p = cb:mannwhitneyu(1, 0e9, 9e9, 10e9, 19e9)
-        if u ~= 0 or math.floor(p * 100000) ~=  9 then
+        u, p = cb:mannwhitneyu(1, 0e9, 9e9, 10e9, 19e9) -- NaN is not ranked
+        if u ~= nil or p ~= nil then
             error(string.format("u is %g p is %g", u, p))
         end
     elseif tc == 9 then -- default
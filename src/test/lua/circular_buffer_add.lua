@@ -4,9 +4,31 @@
 
 require "circular_buffer"
 
-data = circular_buffer.new(1440, 10, 1)
+data = circular_buffer.new(1440, 20, 1)
+deltas = circular_buffer.new(1440, 20, 1, true)
+local mode = 0
+local values = {}
+for c = 1, 20 do values[c] = c end
 
 function process(ts)
-    data:add(ts, 4, 1)
+    if mode == 0 then
+        data:add(ts, 4, 1)
+    elseif mode == 1 then
+        for c = 1, 20 do
+            data:add(ts, c, c)
+        end
+    elseif mode == 2 then
+        data:add_row(ts, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16,
+                     17, 18, 19, 20)
+    elseif mode == 3 then
+        data:add_many(ts, values)
+    elseif mode == 4 then -- a new delta row every 1000 calls
+        deltas:add_row(ts / 1000 - ts / 1000 % 1e9, 1, 2, 3, 4, 5, 6, 7, 8, 9,
+                       10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20)
+    end
     return 0
 end
+
+function report(tc)
+    mode = tc
+end
@@ -0,0 +1,24 @@
+-- This Source Code Form is subject to the terms of the Mozilla Public
+-- License, v. 2.0. If a copy of the MPL was not distributed with this
+-- file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+require "circular_buffer"
+require "math"
+
+-- one day at one minute resolution; the last hour is tested against the rest
+local cb = circular_buffer.new(1440, 1, 60)
+local seed = 1
+
+local function random(n)
+    seed = (seed * 1103515245 + 12345) % 2147483648
+    return math.floor(seed / 65536) % n
+end
+
+for i = 0, 1439 do
+    cb:set(i * 60e9, 1, 14000 + random(1500))
+end
+
+function process(tc)
+    local u, p = cb:mannwhitneyu(1, 0, 1379 * 60e9, 1380 * 60e9, 1439 * 60e9)
+    return 0
+end
@@ -0,0 +1,53 @@
+-- This Source Code Form is subject to the terms of the Mozilla Public
+-- License, v. 2.0. If a copy of the MPL was not distributed with this
+-- file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+require "circular_buffer"
+require "string"
+local cbufb = require "cbufb"
+
+local rows = circular_buffer.new(3, 2, 1)
+local cols = circular_buffer.new(3, 2, 1, {layout = "column"})
+local cold = circular_buffer.new(3, 2, 1, {hot_rows = 1})
+local buffers = {rows, cols, cold}
+for i, cb in ipairs(buffers) do
+    cb:set_header(1, "Values")
+    cb:format("cbufb")
+end
+
+local function equal(a, b)
+    return a == b or (a ~= a and b ~= b)
+end
+
+function process(ts)
+    local s = ts / 1e9
+    for i, cb in ipairs(buffers) do
+        cb:set(ts, 1, s + 0.5)
+        if s ~= 3 then
+            cb:set(ts, 2, -s * 1e300)
+        end
+    end
+    return 0
+end
+
+function report(tc)
+    write(buffers[tc + 1])
+end
+
+function decode(payload)
+    local t = cbufb.decode(payload)
+    if not t then error("invalid payload") end
+    if t.rows ~= 3 or t.columns ~= 2 or t.seconds_per_row ~= 1
+    or t.time ~= rows:current_time() - 2e9 then
+        error("invalid header: " .. t.header)
+    end
+    for c = 1, 2 do
+        for r = 1, 3 do
+            local expected = rows:get(t.time + (r - 1) * 1e9, c)
+            if not equal(t[c][r], expected) then
+                error(string.format("column: %d row: %d expected: %g received: %g",
+                                    c, r, expected, t[c][r]))
+            end
+        end
+    end
+end
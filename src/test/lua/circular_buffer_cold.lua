@@ -0,0 +1,83 @@
+-- This Source Code Form is subject to the terms of the Mozilla Public
+-- License, v. 2.0. If a copy of the MPL was not distributed with this
+-- file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+require "circular_buffer"
+require "math"
+require "string"
+
+plain = circular_buffer.new(200, 3, 1)
+cold = circular_buffer.new(200, 3, 1, {hot_rows = 10})
+local buffers = {plain, cold}
+for i, cb in ipairs(buffers) do
+    cb:set_header(3, "Max", "count", "max")
+end
+
+local functions = {"sum", "avg", "sd", "min", "max", "variance"}
+local seed = 1
+
+local function random(n)
+    seed = (seed * 1103515245 + 12345) % 2147483648
+    return seed % n
+end
+
+local function equal(a, b)
+    return a == b or (a ~= a and b ~= b)
+end
+
+function process(ts)
+    local s = ts / 1e9
+    local latency = 100 + random(1000) / 8
+    local late = random(7) == 0
+    local max = random(50)
+    for i, cb in ipairs(buffers) do
+        cb:add(ts, 1, s % 5)
+        cb:set(ts, 2, latency)
+        if s % 4 ~= 0 then
+            cb:set(ts, 3, max)
+        end
+        if late then -- update a cold row
+            cb:add(ts - 150e9, 1, 1)
+            cb:set(ts - 120e9, 3, max)
+        end
+    end
+    return 0
+end
+
+function report(tc)
+    if tc == 0 then
+        local t = plain:current_time()
+        for r = 0, 199 do
+            local ns = t - r * 1e9
+            for c = 1, 3 do
+                local a, b = plain:get(ns, c), cold:get(ns, c)
+                if not equal(a, b) then
+                    error(string.format("row: %d column: %d expected: %g received: %g", r, c, a, b))
+                end
+            end
+        end
+        local ranges = {{t - 199e9, t}, {t - 199e9, t - 100e9}, {t - 20e9, t},
+            {t - 63e9, t - 5e9}}
+        for c = 1, 3 do
+            for i, f in ipairs(functions) do
+                for j, range in ipairs(ranges) do
+                    local a, an = plain:compute(f, c, range[1], range[2])
+                    local b, bn = cold:compute(f, c, range[1], range[2])
+                    if not equal(a, b) or an ~= bn then
+                        error(string.format("column: %d %s range: %d expected: %g received: %g",
+                                            c, f, j, a, b))
+                    end
+                end
+            end
+        end
+        local u, p = plain:mannwhitneyu(2, t - 199e9, t - 100e9, t - 99e9, t)
+        local cu, cp = cold:mannwhitneyu(2, t - 199e9, t - 100e9, t - 99e9, t)
+        if u ~= cu or p ~= cp then
+            error(string.format("mannwhitneyu expected: %g received: %g", u, cu))
+        end
+    elseif tc == 1 then
+        write(plain)
+    elseif tc == 2 then
+        write(cold)
+    end
+end
@@ -0,0 +1,36 @@
+-- This Source Code Form is subject to the terms of the Mozilla Public
+-- License, v. 2.0. If a copy of the MPL was not distributed with this
+-- file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+require "circular_buffer"
+
+local buffers = {
+    circular_buffer.new(1440, 64, 60),
+    circular_buffer.new(1440, 64, 60, {layout = "column"}),
+    circular_buffer.new(1440, 64, 60, {running = true}),
+    circular_buffer.new(1440, 64, 60),
+    circular_buffer.new(1440, 64, 60, {prefix = true})
+}
+
+function process(tc)
+    if tc < 3 then -- full window
+        local cb = buffers[tc + 1]
+        for c = 1, 64 do
+            cb:compute("sum", c)
+        end
+    elseif tc < 5 then -- sub ranges
+        local cb = buffers[tc + 1]
+        local t = cb:current_time()
+        for c = 1, 64 do
+            cb:compute("sum", c, t - 720 * 60e9, t - 60 * 60e9)
+        end
+    else -- populate row tc - 5
+        local r = tc - 5
+        for i, cb in ipairs(buffers) do
+            for c = 1, 64 do
+                cb:set(r * 60e9, c, r + c)
+            end
+        end
+    end
+    return 0
+end
@@ -0,0 +1,136 @@
+-- This Source Code Form is subject to the terms of the Mozilla Public
+-- License, v. 2.0. If a copy of the MPL was not distributed with this
+-- file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+require "circular_buffer"
+require "math"
+require "string"
+require "table"
+
+cb = circular_buffer.new(120, 3, 1)
+cb:set_detector(1, "ewma", {alpha = 0.5})
+cb:set_detector(2, "holt_winters", {alpha = 0.5, beta = 0.1, gamma = 0.5,
+                                    season = 10, k = 2})
+cb:set_detector(3, "mad", {window = 30})
+
+local function value(s, c)
+    if c == 1 then return 100 + s % 7 end
+    if c == 2 then return 50 + 10 * math.sin(2 * math.pi * (s % 10) / 10) + s * 0.1 end
+    if s % 17 == 0 then return 90 end -- outliers
+    return 20 + s % 5
+end
+
+-- reference implementations fed with the completed rows
+local ewma = {count = 0, level = 0, variance = 0}
+local hw = {count = 0, level = 0, trend = 0, variance = 0, seasonal = {}}
+local season, alpha, beta, gamma = 10, 0.5, 0.1, 0.5
+
+local function update(s)
+    local v = value(s, 1)
+    if ewma.count == 0 then
+        ewma.level = v
+    else
+        local diff = v - ewma.level
+        local incr = 0.5 * diff
+        ewma.level = ewma.level + incr
+        ewma.variance = 0.5 * (ewma.variance + diff * incr)
+    end
+    ewma.count = ewma.count + 1
+
+    v = value(s, 2)
+    local i = s % season
+    if hw.count < season then
+        hw.seasonal[i] = v
+        hw.level = hw.level + v
+        if hw.count + 1 == season then
+            hw.level = hw.level / season
+            for j = 0, season - 1 do hw.seasonal[j] = hw.seasonal[j] - hw.level end
+        end
+    else
+        local err = v - (hw.level + hw.trend + hw.seasonal[i])
+        hw.variance = (1 - alpha) * (hw.variance + alpha * err * err)
+        local prev = hw.level
+        hw.level = alpha * (v - hw.seasonal[i]) + (1 - alpha) * (hw.level + hw.trend)
+        hw.trend = beta * (hw.level - prev) + (1 - beta) * hw.trend
+        hw.seasonal[i] = gamma * (v - hw.level) + (1 - gamma) * hw.seasonal[i]
+    end
+    hw.count = hw.count + 1
+end
+
+local function median(t)
+    table.sort(t)
+    local n = #t
+    if n % 2 == 1 then return t[(n + 1) / 2] end
+    return (t[n / 2] + t[n / 2 + 1]) / 2
+end
+
+local function check(name, received, expected)
+    if not received or math.abs(received - expected) > 1e-9 * math.max(1, math.abs(expected)) then
+        error(string.format("%s expected: %.17g received: %s", name, expected,
+                            tostring(received)))
+    end
+end
+
+function process(ts)
+    local s = ts / 1e9
+    if s > 120 then update(s - 1) end -- the buffer starts at row 120
+    for c = 1, 3 do
+        cb:add(ts, c, value(s, c))
+    end
+    return 0
+end
+
+function report(tc)
+    local s = cb:current_time() / 1e9
+    if tc == 0 then
+        local f, lower, upper, z, p = cb:detect(1)
+        local scale = math.sqrt(ewma.variance)
+        check("ewma forecast", f, ewma.level)
+        check("ewma lower", lower, ewma.level - 3 * scale)
+        check("ewma upper", upper, ewma.level + 3 * scale)
+        check("ewma z", z, (value(s, 1) - ewma.level) / scale)
+        local zx, px = select(4, cb:detect(1, ewma.level + 4 * scale))
+        check("ewma z value", zx, 4)
+        check("ewma p value", px, 6.3342483666239957e-05)
+
+        f, lower, upper = cb:detect(2)
+        local hf = hw.level + hw.trend + hw.seasonal[s % season]
+        check("hw forecast", f, hf)
+        check("hw upper", upper, hf + 2 * math.sqrt(hw.variance))
+
+        local window, deviations = {}, {}
+        for i = s - 30, s - 1 do window[#window + 1] = value(i, 3) end
+        local m = median(window)
+        for i, v in ipairs(window) do deviations[i] = math.abs(v - m) end
+        local mad = 1.4826 * median(deviations)
+        f, lower, upper, z, p = cb:detect(3, 90)
+        check("mad median", f, m)
+        check("mad upper", upper, m + 3 * mad)
+        check("mad z", z, (90 - m) / mad)
+        if p > 1e-6 then error("outlier p: " .. p) end
+    elseif tc == 1 then
+        -- not enough rows yet, then replayed from the existing rows
+        local fresh = circular_buffer.new(20, 1, 1)
+        fresh:set_detector(1, "ewma")
+        if fresh:detect(1) ~= nil then error("primed") end
+        fresh:set(20e9, 1, 1)
+        fresh:set(21e9, 1, 3)
+        fresh:set(22e9, 1, 0/0)
+        fresh:set(23e9, 1, 5)
+        check("forecast", fresh:detect(1), 1 + 0.3 * 2)
+        fresh:set_detector(1, "ewma", {alpha = 1})
+        if fresh:detect(1) ~= 3 then error("replay") end
+        local f, lower, upper, z = fresh:detect(1, 0/0)
+        if z ~= nil then error("nan z") end
+        fresh:set_detector(1, "none")
+    elseif tc == 2 then
+        local values = {}
+        for c = 1, 3 do
+            local r = {cb:detect(c)}
+            for i, v in ipairs(r) do r[i] = string.format("%.17g", v) end
+            values[c] = table.concat(r, " ")
+        end
+        output(table.concat(values, "\n"))
+        write()
+    end
+end
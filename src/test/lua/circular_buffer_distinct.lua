@@ -0,0 +1,88 @@
+-- This Source Code Form is subject to the terms of the Mozilla Public
+-- License, v. 2.0. If a copy of the MPL was not distributed with this
+-- file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+require "circular_buffer"
+require "math"
+require "string"
+require "table"
+
+clients = circular_buffer.new(10, 2, 1)
+clients:set_header(1, "Requests")
+clients:set_header(2, "Clients", "count", "distinct")
+
+tiered = circular_buffer.new_tiered(1, {{4, 1}, {4, 10}})
+tiered:set_header(1, "Clients", "count", "distinct")
+
+local function check(name, received, expected)
+    if not received or math.abs(received - expected) > expected * 0.1 then
+        error(string.format("%s expected: %d received: %s", name, expected,
+                            tostring(received)))
+    end
+end
+
+-- each row sees 500 clients, 250 of them shared with the previous row and
+-- every client makes two requests
+function process(ts)
+    local s = ts / 1e9
+    for i = 0, 499 do
+        local ip = string.format("10.%d.%d.1", math.floor((s * 250 + i) / 256),
+                                 (s * 250 + i) % 256)
+        for j = 1, 2 do
+            clients:add(ts, 1, 1)
+            clients:add(ts, 2, ip)
+            tiered:set(ts, 1, ip)
+        end
+    end
+    return 0
+end
+
+function report(tc)
+    if tc == 0 then
+        local t = clients:current_time()
+        check("row", clients:get(t, 2), 500)
+        check("row compute", clients:compute("distinct", 2, t, t), 500)
+        local distinct, rows = clients:compute("distinct", 2)
+        check("window", distinct, 250 * 9 + 500)
+        if rows ~= 10 then error("rows: " .. rows) end
+        check("range", clients:compute("distinct", 2, t - 3e9, t), 250 * 3 + 500)
+        if clients:compute("sum", 1) ~= 10000 then error("requests") end
+        -- rolled up into the coarse tier
+        local coarse = tiered:tier(2)
+        local ct = coarse:current_time() - 10e9
+        check("tier", coarse:compute("distinct", 1, ct, ct), 250 * 9 + 500)
+    elseif tc == 1 then
+        local cb = circular_buffer.new(2, 1, 1)
+        cb:set_header(1, "Users", "count", "distinct")
+        cb:add(0, 1, 7)
+        cb:add(0, 1, "7")
+        cb:set(0, 1, 7)
+        cb:add(0, 1, 0/0)
+        cb:add(0, 1, "user")
+        if cb:get(0, 1) ~= 2 then error("items: " .. tostring(cb:get(0, 1))) end
+        if cb:compute("distinct", 1, 1e9, 1e9) ~= nil then error("empty row") end
+        local name, unit, aggregation = cb:get_header(1)
+        if aggregation ~= "distinct" then error("header") end
+        -- the registers are cleared when the row is reused
+        cb:add(2e9, 1, "other")
+        if cb:get(2e9, 1) ~= 1 then error("reused row") end
+    elseif tc == 2 then
+        write(clients)
+    elseif tc == 3 then
+        local t = clients:current_time()
+        local values = {}
+        for i = 1, 3 do
+            values[i] = string.format("%.17g", clients:compute("distinct", 2, t - i * 1e9, t))
+        end
+        values[4] = string.format("%.17g", clients:get(t, 2))
+        output(table.concat(values, " "))
+        write()
+    elseif tc == 4 then -- the delta is the change in the estimate
+        local cb = circular_buffer.new(2, 1, 1, true)
+        cb:set_header(1, "Users", "count", "distinct")
+        for i, user in ipairs({"a", "b", "a", "c", "b"}) do
+            cb:add(0, 1, user)
+        end
+        write(cb:format("cbufd"))
+    end
+end
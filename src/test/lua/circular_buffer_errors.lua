@@ -111,6 +111,57 @@ function process(tc)
     elseif tc == 37 then
         local cb = circular_buffer.new(10, 1, 1)
         cb:get_header(99) -- out of range column
+    elseif tc == 38 then
+        local cb = circular_buffer.new(2, 1, 1)
+        cb:add_row(0, 1, 2) -- too many values
+    elseif tc == 39 then
+        local cb = circular_buffer.new(2, 1, 1)
+        cb:add_row(0, "a") -- non numeric value
+    elseif tc == 40 then
+        local cb = circular_buffer.new(2, 1, 1)
+        cb:add_many(0, 1) -- non table values
+    elseif tc == 41 then
+        local cb = circular_buffer.new(2, 1, 1)
+        cb:add_many(0, {[2] = 1}) -- out of range column
+    elseif tc == 42 then
+        local cb = circular_buffer.new(2, 1, 1)
+        cb:add_many(0, {"a"}) -- non numeric value
+    elseif tc == 43 then
+        local cb = circular_buffer.new(2, 1, 1, {hot_rows = 2}) -- out of range hot_rows
+    elseif tc == 44 then
+        local cb = circular_buffer.new(10, 1, 1, {hot_rows = 2, running = true}) -- hot_rows with running
+    elseif tc == 45 then
+        local cb = circular_buffer.new_tiered(1, {{10, 2}, {10, 3}}) -- seconds_per_row not a multiple
+    elseif tc == 46 then
+        local cb = circular_buffer.new_tiered(1, {{10, 1}, {10, 60}})
+        cb:tier(3) -- out of range tier
+    elseif tc == 47 then
+        local cb = circular_buffer.new(2, 1, 1)
+        cb:frombinary("") -- truncated header
+    elseif tc == 48 then
+        local cb = circular_buffer.new(2, 1, 1) -- 3 rows, 1 column
+        cb:frombinary("\195\194\213\198\129\128\128\128\131\128\128\128\129"
+                      .. "\128\128\128\128\128\128\128\128\128\128\128"
+                      .. "\128\128\128\128\128\128\128\128")
+    elseif tc == 49 then
+        local cb = circular_buffer.new(2, 1, 1)
+        cb:compute("p99", 1) -- not a quantile column
+    elseif tc == 50 then
+        local cb = circular_buffer.new(2, 1, 1)
+        cb:set_header(1, "Latency", "ms", "quantile", 2) -- out of range quantile
+    elseif tc == 51 then
+        local cb = circular_buffer.new(2, 1, 1)
+        cb:compute("distinct", 1) -- not a distinct column
+    elseif tc == 52 then
+        local cb = circular_buffer.new(2, 1, 1)
+        cb:set_header(1, "Users", "count", "distinct")
+        cb:add(0, 1, {}) -- not a string or number
+    elseif tc == 53 then
+        local cb = circular_buffer.new(2, 1, 1)
+        cb:detect(1) -- no detector
+    elseif tc == 54 then
+        local cb = circular_buffer.new(5, 1, 1)
+        cb:set_detector(1, "holt_winters", {season = 6}) -- season longer than the buffer
     end
 return 0
 end
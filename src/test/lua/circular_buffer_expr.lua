@@ -0,0 +1,147 @@
+-- This Source Code Form is subject to the terms of the Mozilla Public
+-- License, v. 2.0. If a copy of the MPL was not distributed with this
+-- file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+require "circular_buffer"
+require "math"
+require "string"
+
+local function equal(a, b)
+    return a == b or (a ~= a and b ~= b)
+end
+
+local function check(name, received, expected)
+    if not equal(received, expected) then
+        error(string.format("%s expected: %.17g received: %.17g", name, expected,
+                            received))
+    end
+end
+
+local function check_error(f, expected)
+    local ok, err = pcall(f)
+    if ok or not string.find(err, expected, 1, true) then
+        error(string.format("expected error: %s received: %s", expected,
+                            tostring(err)))
+    end
+end
+
+-- 100 rows so the expressions span more than one evaluation block
+local rows = 100
+local function fill(cb, seed)
+    for r = 0, rows - 1 do
+        local ns = r * 1e9
+        if r % 7 ~= 3 then cb:set(ns, 1, 100 + (r * seed) % 17) end
+        if r % 5 ~= 1 then cb:set(ns, 2, (r * seed) % 11) end
+    end
+end
+
+function process(tc)
+    if tc == 0 then -- expressions
+        local cb = circular_buffer.new(rows, 3, 1)
+        local cold = circular_buffer.new(rows, 3, 1, {hot_rows = 10})
+        fill(cb, 3)
+        fill(cold, 3)
+        cb:compute_expr("c3 = c2 / c1")
+        cold:compute_expr(" c3=c2/c1 ")
+        for r = 0, rows - 1 do
+            local ns = r * 1e9
+            local expected = cb:get(ns, 2) / cb:get(ns, 1)
+            check("ratio", cb:get(ns, 3), expected)
+            check("cold ratio", cold:get(ns, 3), expected)
+        end
+
+        local t = cb:compute_expr("max(c1, c2) * 2 - abs(-c2) + sqrt(4) / (1 + 1)"
+                                  .. " - min(c1, 0.5e1)", 10e9, 79e9)
+        if #t ~= 70 then error("result length: " .. #t) end
+        for i = 1, #t do
+            local ns = (i + 9) * 1e9
+            local c1, c2 = cb:get(ns, 1), cb:get(ns, 2)
+            local mx, mn = c1, c1
+            if c1 ~= c1 or c2 > c1 then mx = c2 end
+            if c1 ~= c1 or 5 < c1 then mn = 5 end
+            check("expression", t[i], mx * 2 - math.abs(-c2) + math.sqrt(4) / 2 - mn)
+        end
+        if cb:compute_expr("c1", 200e9, 300e9) ~= nil then
+            error("range outside of the buffer")
+        end
+    elseif tc == 1 then -- combine
+        local a, b = circular_buffer.new(rows, 2, 1), circular_buffer.new(rows, 2, 1)
+        fill(a, 3)
+        fill(b, 5)
+        b:set(110e9, 1, 1) -- b is 10 rows ahead of a
+        local ops = {
+            add = function(x, y) if x ~= x then return y end return x + y end,
+            sub = function(x, y) return x - y end,
+            mul = function(x, y) return x * y end,
+            div = function(x, y) return x / y end,
+            min = function(x, y) if x ~= x or y < x then return y end return x end,
+            max = function(x, y) if x ~= x or y > x then return y end return x end,
+        }
+        local orig = circular_buffer.new(rows, 2, 1)
+        fill(orig, 7)
+        for name, f in pairs(ops) do
+            local dst = circular_buffer.new(rows, 2, 1)
+            fill(dst, 7)
+            dst:combine(a, name)
+            dst:combine(b, name, 20e9, 99e9)
+            for r = 0, rows - 1 do
+                local ns = r * 1e9
+                for c = 1, 2 do
+                    local expected = orig:get(ns, c)
+                    local x, y = a:get(ns, c), b:get(ns, c)
+                    if x == x then expected = f(expected, x) end
+                    if r >= 20 and y == y then expected = f(expected, y) end
+                    check(name .. " row " .. r .. " column " .. c,
+                          dst:get(ns, c), expected)
+                end
+            end
+        end
+    elseif tc == 2 then -- sketches and registers merge
+        local total = circular_buffer.new(4, 2, 1)
+        local hosts = {circular_buffer.new(4, 2, 1), circular_buffer.new(4, 2, 1)}
+        local ref = circular_buffer.new(4, 2, 1)
+        for i, cb in ipairs({total, hosts[1], hosts[2], ref}) do
+            cb:set_header(1, "Latency", "ms", "quantile", 0.9)
+            cb:set_header(2, "Users", "count", "distinct")
+        end
+        for i, cb in ipairs(hosts) do
+            for v = 1, 50 do
+                cb:add(3e9, 1, v * i)
+                ref:add(3e9, 1, v * i)
+                cb:add(3e9, 2, "user" .. (v + i * 25))
+                ref:add(3e9, 2, "user" .. (v + i * 25))
+            end
+            total:combine(cb, "add")
+        end
+        check("samples", total:get(3e9, 1), 100)
+        check("p90", total:compute("p90", 1), ref:compute("p90", 1))
+        check("distinct", total:get(3e9, 2), ref:get(3e9, 2))
+    elseif tc == 3 then -- errors
+        local cb = circular_buffer.new(4, 2, 1)
+        check_error(function() cb:compute_expr("c1 +* c2") end,
+                    "bad argument #1 to 'compute_expr' (unexpected symbol at position 5)")
+        check_error(function() cb:compute_expr("c3 = c1") end,
+                    "bad argument #1 to 'compute_expr' (column out of range)")
+        check_error(function() cb:compute_expr("c0 * 2") end,
+                    "bad argument #1 to 'compute_expr' (column out of range at position 1)")
+        check_error(function() cb:compute_expr("pow(c1, 2)") end,
+                    "bad argument #1 to 'compute_expr' (unexpected symbol at position 1)")
+        check_error(function() cb:compute_expr("abs(c1") end,
+                    "bad argument #1 to 'compute_expr' (')' expected at position 7)")
+        check_error(function() cb:compute_expr(string.rep("(", 1e6)) end,
+                    "bad argument #1 to 'compute_expr' (expression too deeply nested")
+        check_error(function() cb:compute_expr(string.rep("-", 1e6) .. "c1") end,
+                    "bad argument #1 to 'compute_expr' (expression too deeply nested")
+        check_error(function() cb:combine(circular_buffer.new(4, 3, 1), "add") end,
+                    "bad argument #1 to 'combine' (columns must match)")
+        check_error(function() cb:combine(cb, "add") end,
+                    "bad argument #1 to 'combine' (cannot combine a buffer with itself)")
+        local q = circular_buffer.new(4, 2, 1)
+        q:set_header(1, "Latency", "ms", "quantile")
+        check_error(function() q:combine(cb, "add") end,
+                    "bad argument #2 to 'combine' (quantile and distinct columns only combine with add)")
+        check_error(function() q:compute_expr("c1 = c2") end,
+                    "bad argument #1 to 'compute_expr' (destination cannot be a quantile or distinct column)")
+    end
+    return 0
+end
@@ -0,0 +1,45 @@
+-- This Source Code Form is subject to the terms of the Mozilla Public
+-- License, v. 2.0. If a copy of the MPL was not distributed with this
+-- file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+require "circular_buffer"
+require "string"
+require "table"
+
+-- fan-in of 10 shard outputs (cbuf text, 1440 one minute rows, a sum and a
+-- max column) merged natively vs. parsed and re-added in Lua
+local rows, shards = 1440, 10
+local agg = circular_buffer.new(rows, 2, 60)
+agg:set_header(2, "Max", "ms", "max")
+
+local payloads = {}
+for s = 1, shards do
+    local t = {'{"time":0,"rows":1440,"columns":2,"seconds_per_row":60,'
+        .. '"column_info":[{"name":"Requests","unit":"count","aggregation":"sum"},'
+        .. '{"name":"Max","unit":"ms","aggregation":"max"}]}'}
+    for r = 0, rows - 1 do
+        t[#t + 1] = string.format("%d\t%d", (r * s) % 97, (r + s) % 31)
+    end
+    payloads[s] = table.concat(t, "\n") .. "\n"
+end
+
+function process(method)
+    if method == 0 then
+        for s = 1, shards do
+            agg:merge(payloads[s])
+        end
+    else
+        for s = 1, shards do
+            local payload = payloads[s]
+            local eol = string.find(payload, "\n", 1, true)
+            local t = tonumber(string.match(payload, '"time":(%d+)')) * 1e9
+            local spr = tonumber(string.match(payload, '"seconds_per_row":(%d+)')) * 1e9
+            for a, b in string.gmatch(string.sub(payload, eol + 1), "([^\t\n]+)\t([^\t\n]+)\n") do
+                agg:add(t, 1, tonumber(a))
+                agg:set(t, 2, tonumber(b))
+                t = t + spr
+            end
+        end
+    end
+    return 0
+end
@@ -0,0 +1,84 @@
+-- This Source Code Form is subject to the terms of the Mozilla Public
+-- License, v. 2.0. If a copy of the MPL was not distributed with this
+-- file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+require "circular_buffer"
+require "math"
+
+-- 20 columns at one minute resolution scored every tick; built-in detectors
+-- vs. the same EWMA and Holt-Winters filters written in Lua
+local columns, season = 20, 60
+local cb = circular_buffer.new(1440, columns, 60)
+local plain = circular_buffer.new(1440, columns, 60)
+for c = 1, columns do
+    if c % 2 == 1 then
+        cb:set_detector(c, "ewma", {alpha = 0.1})
+    else
+        cb:set_detector(c, "holt_winters", {season = season})
+    end
+end
+
+local state = {}
+for c = 1, columns do
+    state[c] = {count = 0, level = 0, trend = 0, variance = 0, seasonal = {}}
+end
+local ts = 0
+
+local function ewma(st, v)
+    if st.count == 0 then
+        st.level = v
+    else
+        local diff = v - st.level
+        local incr = 0.1 * diff
+        st.level = st.level + incr
+        st.variance = 0.9 * (st.variance + diff * incr)
+    end
+    st.count = st.count + 1
+    return st.level, math.sqrt(st.variance)
+end
+
+local function holt_winters(st, row, v)
+    local i = row % season
+    if st.count < season then
+        st.seasonal[i] = v
+        st.level = st.level + v
+        if st.count + 1 == season then
+            st.level = st.level / season
+            for j = 0, season - 1 do st.seasonal[j] = st.seasonal[j] - st.level end
+        end
+    else
+        local err = v - (st.level + st.trend + st.seasonal[i])
+        st.variance = 0.7 * (st.variance + 0.3 * err * err)
+        local prev = st.level
+        st.level = 0.3 * (v - st.seasonal[i]) + 0.7 * (st.level + st.trend)
+        st.trend = 0.1 * (st.level - prev) + 0.9 * st.trend
+        st.seasonal[i] = 0.1 * (v - st.level) + 0.9 * st.seasonal[i]
+    end
+    st.count = st.count + 1
+    local n = (row + 1) % season
+    return st.level + st.trend + (st.seasonal[n] or 0), math.sqrt(st.variance)
+end
+
+function process(tc)
+    ts = ts + 60e9
+    local row = ts / 60e9
+    if tc == 0 then
+        for c = 1, columns do
+            cb:add(ts, c, 100 + (row * c) % 17)
+            local forecast, lower, upper = cb:detect(c)
+        end
+    else
+        for c = 1, columns do
+            local v = 100 + (row * c) % 17
+            plain:add(ts, c, v)
+            local forecast, scale
+            if c % 2 == 1 then
+                forecast, scale = ewma(state[c], v)
+            else
+                forecast, scale = holt_winters(state[c], row, v)
+            end
+            local lower, upper = forecast - 3 * scale, forecast + 3 * scale
+        end
+    end
+    return 0
+end
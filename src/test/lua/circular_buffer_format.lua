@@ -0,0 +1,19 @@
+-- This Source Code Form is subject to the terms of the Mozilla Public
+-- License, v. 2.0. If a copy of the MPL was not distributed with this
+-- file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+require "circular_buffer"
+
+local formats = {"cbuf", "cbufb"}
+local cb = circular_buffer.new(1440, 3, 60)
+for r = 0, 1439 do
+    local ts = (r + 1440) * 60e9
+    cb:add_row(ts, r, r * 1.25, 1e6 / (r + 1))
+end
+
+function process(tc)
+    cb:format(formats[tc + 1])
+    output(cb)
+    write()
+    return 0
+end
@@ -0,0 +1,63 @@
+-- This Source Code Form is subject to the terms of the Mozilla Public
+-- License, v. 2.0. If a copy of the MPL was not distributed with this
+-- file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+require "circular_buffer"
+require "string"
+
+rows = circular_buffer.new(4, 3, 1)
+cols = circular_buffer.new(4, 3, 1, {layout = "column"})
+rows:set_header(3, "Max", "count", "max")
+cols:set_header(3, "Max", "count", "max")
+
+local functions = {"sum", "avg", "sd", "min", "max", "variance"}
+
+local function equal(a, b)
+    return a == b or (a ~= a and b ~= b)
+end
+
+function process(ts)
+    for c = 1, 3 do
+        local v = ts / 1e9 + c
+        rows:add(ts, c, v)
+        cols:add(ts, c, v)
+        rows:set(ts, 3, v * 2)
+        cols:set(ts, 3, v * 2)
+    end
+    return 0
+end
+
+function report(tc)
+    if tc == 0 then
+        write(rows)
+    elseif tc == 1 then
+        write(cols)
+    elseif tc == 2 then
+        local t = cols:current_time()
+        for c = 1, 3 do
+            for i, f in ipairs(functions) do
+                local a, an = rows:compute(f, c)
+                local b, bn = cols:compute(f, c)
+                if not equal(a, b) or an ~= bn then
+                    error(string.format("column: %d %s row: %g col: %g", c, f, a, b))
+                end
+                a = rows:compute(f, c, t - 1e9, t)
+                b = cols:compute(f, c, t - 1e9, t)
+                if not equal(a, b) then
+                    error(string.format("column: %d range %s row: %g col: %g", c, f, a, b))
+                end
+            end
+            for i = 0, 3 do
+                local a, b = rows:get(t - i * 1e9, c), cols:get(t - i * 1e9, c)
+                if not equal(a, b) then
+                    error(string.format("column: %d get: %d row: %g col: %g", c, i, a, b))
+                end
+            end
+        end
+        local u1, p1 = rows:mannwhitneyu(1, t - 3e9, t - 2e9, t - 1e9, t)
+        local u2, p2 = cols:mannwhitneyu(1, t - 3e9, t - 2e9, t - 1e9, t)
+        if u1 ~= u2 or p1 ~= p2 then
+            error("mannwhitneyu mismatch")
+        end
+    end
+end
@@ -0,0 +1,64 @@
+-- This Source Code Form is subject to the terms of the Mozilla Public
+-- License, v. 2.0. If a copy of the MPL was not distributed with this
+-- file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+require "circular_buffer"
+require "math"
+require "string"
+
+local function value(i)
+    if i < 20 then return i % 7 - 3 end
+    return i % 5 - 1.5
+end
+
+local plain = circular_buffer.new(40, 1, 1)
+local cold = circular_buffer.new(40, 1, 1, {hot_rows = 8})
+local sparse = circular_buffer.new(60, 1, 1) -- the same values with gaps
+for i = 0, 39 do
+    plain:set(i * 1e9, 1, value(i))
+    cold:set(i * 1e9, 1, value(i))
+end
+for i = 0, 59 do
+    local v = 0/0
+    if i % 3 ~= 2 then v = value(i - math.floor(i / 3)) end
+    sparse:set(i * 1e9, 1, v)
+end
+sparse:set(4e9, 1, -0.0) -- ties with the 0 it replaces
+
+-- reference values from the tie corrected normal approximation
+local U, P, P_NC = 160, 0.1418022654300316, 0.13877709167465524
+
+local function check(name, received, expected)
+    if not received or math.abs(received - expected) > math.abs(expected) * 1e-9 then
+        error(string.format("%s expected: %.17g received: %s", name, expected,
+                            tostring(received)))
+    end
+end
+
+function process(tc)
+    if tc == 0 then
+        -- x = rows 0-19, y = rows 20-39
+        local u, p = plain:mannwhitneyu(1, 0, 19e9, 20e9, 39e9)
+        check("u", u, U)
+        check("p", p, P)
+        u, p = plain:mannwhitneyu(1, 0, 19e9, 20e9, 39e9, false)
+        check("u no continuity", u, U)
+        check("p no continuity", p, P_NC)
+        u, p = cold:mannwhitneyu(1, 0, 19e9, 20e9, 39e9)
+        check("hot_rows u", u, U)
+        check("hot_rows p", p, P)
+    elseif tc == 1 then
+        -- NaN rows are not ranked
+        local u, p = sparse:mannwhitneyu(1, 0, 29e9, 30e9, 59e9)
+        check("sparse u", u, U)
+        check("sparse p", p, P)
+    elseif tc == 2 then
+        local cb = circular_buffer.new(10, 1, 1)
+        for i = 0, 9 do cb:set(i * 1e9, 1, 5) end
+        if cb:mannwhitneyu(1, 0, 4e9, 5e9, 9e9) then error("identical") end
+        cb = circular_buffer.new(10, 1, 1)
+        cb:set(0, 1, 1)
+        if cb:mannwhitneyu(1, 0, 4e9, 5e9, 9e9) then error("empty y") end
+    end
+    return 0
+end
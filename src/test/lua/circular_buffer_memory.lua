@@ -0,0 +1,35 @@
+-- This Source Code Form is subject to the terms of the Mozilla Public
+-- License, v. 2.0. If a copy of the MPL was not distributed with this
+-- file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+require "circular_buffer"
+
+-- one week of one minute rows
+local cb
+local seed = 1
+
+local function random(n)
+    seed = (seed * 1103515245 + 12345) % 2147483648
+    return seed % n
+end
+
+function process(ts)
+    if ts < 0 then
+        cb:compute("avg", 2)
+        return 0
+    end
+    local requests = 1000 + random(200)
+    cb:add(ts, 1, requests)
+    cb:add(ts, 2, random(5))
+    cb:set(ts, 3, 120 + random(40) / 4)
+    cb:set(ts, 4, 1)
+    return 0
+end
+
+function report(tc)
+    if tc == 0 then
+        cb = circular_buffer.new(10080, 4, 60)
+    else
+        cb = circular_buffer.new(10080, 4, 60, {hot_rows = 60})
+    end
+end
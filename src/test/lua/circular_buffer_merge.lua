@@ -0,0 +1,102 @@
+-- This Source Code Form is subject to the terms of the Mozilla Public
+-- License, v. 2.0. If a copy of the MPL was not distributed with this
+-- file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+require "circular_buffer"
+require "string"
+
+local function new_buffer(delta)
+    local cb = circular_buffer.new(10, 4, 1, delta)
+    cb:set_header(1, "Requests")
+    cb:set_header(2, "Min", "ms", "min")
+    cb:set_header(3, "Max", "ms", "max")
+    cb:set_header(4, "Users", "count", "distinct")
+    return cb
+end
+
+-- the first shard is output as cbuf, the second as cbufd
+local shards = {new_buffer(), new_buffer(true)}
+shards[2]:format("cbufd")
+local ref = new_buffer()        -- receives every value
+local from_text = new_buffer()  -- merges the shard output
+local from_buffer = new_buffer() -- merges the shard buffers
+
+local function equal(a, b)
+    return a == b or (a ~= a and b ~= b)
+end
+
+local function check_error(f, expected)
+    local ok, err = pcall(f)
+    if ok or not string.find(err, expected, 1, true) then
+        error(string.format("expected error: %s received: %s", expected,
+                            tostring(err)))
+    end
+end
+
+function process(ts)
+    local s = ts / 1e9
+    for k, cb in ipairs(shards) do
+        local v = s * k
+        for i, dst in ipairs({cb, ref}) do
+            dst:add(ts, 1, v % 3 + 1)
+            dst:set(ts, 2, v % 7)
+            dst:set(ts, 3, v % 5)
+            dst:add(ts, 4, "user" .. v % 6)
+        end
+    end
+    return 0
+end
+
+function report(tc)
+    if tc < 2 then
+        write(shards[tc + 1])
+        return
+    end
+
+    for k, cb in ipairs(shards) do
+        from_buffer:merge(cb)
+    end
+    local t = ref:current_time()
+    if from_text:current_time() ~= t or from_buffer:current_time() ~= t then
+        error("the merged buffers were not advanced")
+    end
+    for r = 0, 9 do
+        local ns = t - r * 1e9
+        for c = 1, 4 do
+            local expected = ref:get(ns, c)
+            local received = from_buffer:get(ns, c)
+            if not equal(received, expected) then
+                error(string.format("buffer row: %d column: %d expected: %g received: %g",
+                                    r, c, expected, received))
+            end
+            received = from_text:get(ns, c)
+            if c == 4 then expected = 0/0 end -- registers are not in the text
+            if not equal(received, expected) then
+                error(string.format("text row: %d column: %d expected: %g received: %g",
+                                    r, c, expected, received))
+            end
+        end
+    end
+
+    local cb = circular_buffer.new(10, 4, 1)
+    local header = '{"time":0,"rows":2,"columns":4,"seconds_per_row":1,"column_info":[]}\n'
+    check_error(function() cb:merge("1\t2\t3\t4\n") end, "merge() invalid header")
+    check_error(function() cb:merge('{"time":0,"rows":2,"columns":3,"seconds_per_row":1}\n') end,
+                "merge() columns must match")
+    check_error(function() cb:merge(header .. "1\t2\t3\t4\n1\t2\t3\n") end,
+                "merge() invalid row 2")
+    check_error(function() cb:merge(header .. "1\t2\tx\t4\n") end,
+                "merge() invalid row 1")
+    check_error(function() cb:merge(header .. "1\t2\t3\t4\n") end,
+                "merge() expected 2 rows")
+    check_error(function() cb:merge(circular_buffer.new(10, 3, 1)) end,
+                "bad argument #1 to 'merge' (columns must match)")
+    check_error(function() cb:merge(cb) end,
+                "bad argument #1 to 'merge' (cannot merge a buffer into itself)")
+    check_error(function() cb:merge(1) end,
+                "bad argument #1 to 'merge' (string or circular_buffer expected, got number)")
+end
+
+function decode(payload)
+    from_text:merge(payload)
+end
@@ -0,0 +1,37 @@
+-- This Source Code Form is subject to the terms of the Mozilla Public
+-- License, v. 2.0. If a copy of the MPL was not distributed with this
+-- file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+require "circular_buffer"
+require "math"
+require "table"
+
+-- 1000 latency samples per row; sketch column vs. raw samples in a table
+local cb = circular_buffer.new(60, 1, 1)
+cb:set_header(1, "Latency", "ms", "quantile", 0.99)
+local samples = {}
+local seed = 1
+local ts = 0
+
+local function random(n)
+    seed = (seed * 1103515245 + 12345) % 2147483648
+    return seed % n
+end
+
+function process(tc)
+    ts = ts + 1e9
+    if tc == 0 then
+        for i = 1, 1000 do
+            cb:add(ts, 1, 1 + random(5000) / 10)
+        end
+        cb:compute("p99", 1, ts, ts)
+    else
+        samples = {}
+        for i = 1, 1000 do
+            samples[i] = 1 + random(5000) / 10
+        end
+        table.sort(samples)
+        local p99 = samples[math.floor(0.99 * 999) + 1]
+    end
+    return 0
+end
@@ -0,0 +1,22 @@
+-- This Source Code Form is subject to the terms of the Mozilla Public
+-- License, v. 2.0. If a copy of the MPL was not distributed with this
+-- file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+require "circular_buffer"
+require "string"
+
+-- one day of one minute rows
+data = circular_buffer.new(1440, 3, 60)
+
+function process(tc)
+    if tc == 0 then
+        for r = 0, 1439 do
+            local ts = (r + 1440) * 60e9
+            data:add_row(ts, r, r * 1.25, 1e6 / (r + 1))
+        end
+    else
+        output(data)
+        write()
+    end
+    return 0
+end
@@ -0,0 +1,117 @@
+-- This Source Code Form is subject to the terms of the Mozilla Public
+-- License, v. 2.0. If a copy of the MPL was not distributed with this
+-- file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+require "circular_buffer"
+require "math"
+require "string"
+require "table"
+
+latency = circular_buffer.new(10, 2, 1)
+latency:set_header(1, "Requests")
+latency:set_header(2, "Latency", "ms", "quantile", 0.99)
+
+tiered = circular_buffer.new_tiered(1, {{4, 1}, {4, 10}})
+tiered:set_header(1, "Latency", "ms", "quantile", 0.5)
+
+local samples = {} -- every latency sample, for the exact quantiles
+
+local function exact(values, q)
+    table.sort(values)
+    return values[math.floor(q * (#values - 1)) + 1]
+end
+
+local function check(name, received, expected)
+    if not received or math.abs(received - expected) > expected * 0.02 then
+        error(string.format("%s expected: %.17g received: %s", name, expected,
+                            tostring(received)))
+    end
+end
+
+function process(ts)
+    local s = ts / 1e9
+    for i = 1, 200 do
+        -- a long tail spanning several orders of magnitude
+        local v = (i % 50 + 1) * 0.1 * (1 + s % 3)
+        if i % 40 == 0 then v = v * 100 end
+        latency:add(ts, 1, 1)
+        latency:add(ts, 2, v)
+        tiered:set(ts, 1, v)
+        samples[#samples + 1] = v
+    end
+    return 0
+end
+
+function report(tc)
+    if tc == 0 then
+        local t = latency:current_time()
+        -- the latest row
+        local row = {}
+        for i = #samples - 199, #samples do row[#row + 1] = samples[i] end
+        check("p99 row", latency:compute("p99", 2, t, t), exact(row, 0.99))
+        check("p50 row", latency:compute("p50", 2, t, t), exact(row, 0.5))
+        check("p05 row", latency:compute("p05", 2, t, t), exact(row, 0.05))
+        for i, name in ipairs({"p5", "p1000"}) do
+            local ok, err = pcall(latency.compute, latency, name, 2, t, t)
+            if ok or not string.find(err, "invalid option '" .. name .. "'", 1, true) then
+                error(name .. " accepted: " .. tostring(err))
+            end
+        end
+        -- the cell holds the sample count
+        if latency:get(t, 2) ~= 200 then
+            error("count: " .. tostring(latency:get(t, 2)))
+        end
+        -- merged over the window
+        local all = {}
+        for i = #samples - 1999, #samples do all[#all + 1] = samples[i] end
+        local p999, rows = latency:compute("p999", 2)
+        check("p999", p999, exact(all, 0.999))
+        check("p90", latency:compute("p90", 2), exact(all, 0.9))
+        if rows ~= 10 then error("rows: " .. rows) end
+        local sum = latency:compute("sum", 2)
+        if sum ~= 2000 then error("sum: " .. sum) end
+        -- rolled up into the coarse tier
+        local coarse = tiered:tier(2)
+        local ct = coarse:current_time() - 10e9
+        local rolled = {}
+        local first = #samples - (latency:current_time() - ct) / 1e9 * 200 - 199
+        for i = first, first + 1999 do rolled[#rolled + 1] = samples[i] end
+        check("tier p50", coarse:compute("p50", 1, ct, ct), exact(rolled, 0.5))
+    elseif tc == 1 then
+        local cb = circular_buffer.new(2, 1, 1)
+        cb:set_header(1, "Zeros", "ms", "quantile")
+        cb:add(0, 1, 0)
+        cb:add(0, 1, -5)
+        cb:add(0, 1, 0/0)
+        cb:add(0, 1, math.huge) -- infinite samples are ignored
+        cb:add(0, 1, -math.huge)
+        cb:add(0, 1, 8)
+        cb:set(0, 1, 8)
+        if cb:compute("p00", 1) ~= 0 or cb:get(0, 1) ~= 4 then
+            error("zeros")
+        end
+        check("p99 zeros", cb:compute("p99", 1), 8)
+        check("p100 zeros", cb:compute("p100", 1), 8)
+        if cb:compute("p50", 1, 1e9, 1e9) ~= nil then error("empty row") end
+        -- a range wider than the sketch window collapses the lowest samples
+        local wide = {}
+        for i = 0, 900 do
+            wide[#wide + 1] = 10^(i / 100 - 3)
+            cb:add(1e9, 1, wide[#wide])
+        end
+        check("p99 wide", cb:compute("p99", 1, 1e9, 1e9), exact(wide, 0.99))
+        check("p90 wide", cb:compute("p90", 1, 1e9, 1e9), exact(wide, 0.9))
+        local name, unit, aggregation, q = cb:get_header(1)
+        if aggregation ~= "quantile" or q ~= 0.5 then error("header") end
+    elseif tc == 2 then
+        write(latency)
+    elseif tc == 3 then
+        local t = latency:current_time()
+        local values = {}
+        for i = 1, 2 do
+            values[i] = string.format("%.17g", latency:compute("p99", 2, t - i * 1e9, t))
+        end
+        output(table.concat(values, " "))
+        write()
+    end
+end
@@ -0,0 +1,50 @@
+-- This Source Code Form is subject to the terms of the Mozilla Public
+-- License, v. 2.0. If a copy of the MPL was not distributed with this
+-- file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+require "circular_buffer"
+
+-- a day of one minute rows: an error rate column and the sum of 10 hosts,
+-- computed in C vs. a per cell loop in Lua
+local rows, hosts = 1440, 10
+local cb = circular_buffer.new(rows, 3, 60)
+local total = circular_buffer.new(rows, 2, 60)
+local host = {}
+for h = 1, hosts do
+    host[h] = circular_buffer.new(rows, 2, 60)
+end
+for r = 0, rows - 1 do
+    local ns = r * 60e9
+    cb:set(ns, 1, 1000 + r % 97)
+    cb:set(ns, 2, r % 13)
+    for h = 1, hosts do
+        host[h]:set(ns, 1, r % (h + 10))
+        host[h]:set(ns, 2, h)
+    end
+end
+local start = cb:current_time() - (rows - 1) * 60e9
+
+function process(method)
+    if method == 0 then
+        cb:compute_expr("c3 = c2 / c1")
+    elseif method == 1 then
+        for r = 0, rows - 1 do
+            local ns = start + r * 60e9
+            cb:set(ns, 3, cb:get(ns, 2) / cb:get(ns, 1))
+        end
+    elseif method == 2 then
+        for h = 1, hosts do
+            total:combine(host[h], "add")
+        end
+    else
+        for h = 1, hosts do
+            local hb = host[h]
+            for r = 0, rows - 1 do
+                local ns = start + r * 60e9
+                total:add(ns, 1, hb:get(ns, 1))
+                total:add(ns, 2, hb:get(ns, 2))
+            end
+        end
+    end
+    return 0
+end
@@ -0,0 +1,25 @@
+-- This Source Code Form is subject to the terms of the Mozilla Public
+-- License, v. 2.0. If a copy of the MPL was not distributed with this
+-- file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+require "circular_buffer"
+require "string"
+
+cb = circular_buffer.new(200, 2, 1, {delta = true, hot_rows = 2})
+
+function process(ts)
+    local s = ts / 1e9
+    cb:add(ts, 1, s % 7)
+    if s % 5 ~= 0 then
+        cb:set(ts, 2, s * 1000)
+    end
+    return 0
+end
+
+function report(tc)
+    if tc == 0 then
+        write(cb:format("cbuf"))
+    else
+        write(cb:format("cbufd"))
+    end
+end
@@ -0,0 +1,79 @@
+-- This Source Code Form is subject to the terms of the Mozilla Public
+-- License, v. 2.0. If a copy of the MPL was not distributed with this
+-- file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+require "circular_buffer"
+require "math"
+require "string"
+
+scanned = circular_buffer.new(8, 3, 1)
+running = circular_buffer.new(8, 3, 1, {running = true})
+indexed = circular_buffer.new(8, 3, 1, {running = true, prefix = true})
+local buffers = {scanned, running, indexed}
+for i, cb in ipairs(buffers) do
+    cb:set_header(2, "Min", "count", "min")
+    cb:set_header(3, "Max", "count", "max")
+end
+
+local functions = {"sum", "avg", "sd", "min", "max", "variance"}
+local seed = 1
+
+local function rand(n)
+    seed = (seed * 16807) % 2147483647
+    return seed % n
+end
+
+local function equal(a, b)
+    if a == nil or a ~= a then return a == b or b ~= b end
+    return math.abs(a - b) <= 1e-9 * math.max(1, math.abs(a))
+end
+
+local function check(c, f, a, an, b, bn, range)
+    if not equal(a, b) or an ~= bn then
+        error(string.format("column: %d %s%s scanned: %s/%d received: %s/%d",
+                            c, f, range, tostring(a), an, tostring(b), bn))
+    end
+end
+
+local function compare()
+    local t = scanned:current_time()
+    for c = 1, 3 do
+        for i, f in ipairs(functions) do
+            local a, an = scanned:compute(f, c)
+            for j = 2, 3 do
+                local b, bn = buffers[j]:compute(f, c)
+                check(c, f, a, an, b, bn, "")
+            end
+            for j = 1, 4 do
+                local e = t - rand(8) * 1e9
+                local s = e - rand(8) * 1e9
+                a, an = scanned:compute(f, c, s, e)
+                local b, bn = indexed:compute(f, c, s, e)
+                check(c, f, a, an, b, bn, string.format(" range: %g-%g", s, e))
+            end
+        end
+    end
+end
+
+function process(ts)
+    for i = 1, 20 do
+        local c = rand(3) + 1
+        local t = ts - rand(10) * 1e9
+        local v = rand(1000) - 500 + rand(100) / 8
+        if rand(8) == 0 then v = 0/0 end
+        local add = rand(2) == 0
+        for j, cb in ipairs(buffers) do
+            if add then
+                cb:add(t, c, v)
+            else
+                cb:set(t, c, v)
+            end
+        end
+    end
+    compare()
+    return 0
+end
+
+function report(tc)
+    compare()
+end
@@ -0,0 +1,83 @@
+-- This Source Code Form is subject to the terms of the Mozilla Public
+-- License, v. 2.0. If a copy of the MPL was not distributed with this
+-- file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+require "circular_buffer"
+require "math"
+require "string"
+
+plain = circular_buffer.new(200, 8, 1)
+sparse = circular_buffer.new(200, 8, 1, {sparse = true})
+local buffers = {plain, sparse}
+for i, cb in ipairs(buffers) do
+    cb:set_header(8, "Max", "count", "max")
+end
+
+local functions = {"sum", "avg", "sd", "min", "max", "variance"}
+local seed = 1
+
+local function random(n)
+    seed = (seed * 1103515245 + 12345) % 2147483648
+    return math.floor(seed / 65536) % n
+end
+
+local function equal(a, b)
+    return a == b or (a ~= a and b ~= b)
+end
+
+-- up to eight populated cells per row so the rows grow past their initial
+-- capacity, written in random column order
+function process(ts)
+    local cells = {}
+    for i = 1, 6 do
+        cells[i] = {1 + random(7), random(1000) / 8}
+    end
+    local clear = 1 + random(7)
+    for i, cb in ipairs(buffers) do
+        for j, cell in ipairs(cells) do
+            cb:add(ts, cell[1], cell[2])
+        end
+        cb:set(ts, 8, cells[1][2])
+        -- remove a cell from an older row
+        cb:set(ts - 30e9, clear, 0/0)
+    end
+    return 0
+end
+
+function report(tc)
+    if tc == 0 then
+        local t = plain:current_time()
+        for r = 0, 199 do
+            local ns = t - r * 1e9
+            for c = 1, 8 do
+                local a, b = plain:get(ns, c), sparse:get(ns, c)
+                if not equal(a, b) then
+                    error(string.format("row: %d column: %d expected: %g received: %g", r, c, a, b))
+                end
+            end
+        end
+        local ranges = {{t - 199e9, t}, {t - 199e9, t - 100e9}, {t - 20e9, t},
+            {t - 63e9, t - 5e9}}
+        for c = 1, 8 do
+            for i, f in ipairs(functions) do
+                for j, range in ipairs(ranges) do
+                    local a, an = plain:compute(f, c, range[1], range[2])
+                    local b, bn = sparse:compute(f, c, range[1], range[2])
+                    if not equal(a, b) or an ~= bn then
+                        error(string.format("column: %d %s range: %d expected: %g received: %g",
+                                            c, f, j, a, b))
+                    end
+                end
+            end
+        end
+        local u, p = plain:mannwhitneyu(8, t - 199e9, t - 100e9, t - 99e9, t)
+        local su, sp = sparse:mannwhitneyu(8, t - 199e9, t - 100e9, t - 99e9, t)
+        if u ~= su or p ~= sp then
+            error(string.format("mannwhitneyu expected: %g received: %g", u, su))
+        end
+    elseif tc == 1 then
+        write(plain)
+    elseif tc == 2 then
+        write(sparse)
+    end
+end
@@ -0,0 +1,36 @@
+-- This Source Code Form is subject to the terms of the Mozilla Public
+-- License, v. 2.0. If a copy of the MPL was not distributed with this
+-- file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+require "circular_buffer"
+require "math"
+
+-- one day of one minute rows for 256 series, 5% of the cells populated
+local cb
+local seed = 1
+
+local function random(n)
+    seed = (seed * 1103515245 + 12345) % 2147483648
+    return math.floor(seed / 65536) % n
+end
+
+function process(ts)
+    if ts < 0 then
+        for c = 1, 256, 16 do
+            cb:compute("avg", c)
+        end
+        return 0
+    end
+    for i = 1, 13 do
+        cb:add(ts, 1 + random(256), 1 + random(100))
+    end
+    return 0
+end
+
+function report(tc)
+    if tc == 0 then
+        cb = circular_buffer.new(1440, 256, 60)
+    else
+        cb = circular_buffer.new(1440, 256, 60, {sparse = true})
+    end
+end
@@ -0,0 +1,95 @@
+-- This Source Code Form is subject to the terms of the Mozilla Public
+-- License, v. 2.0. If a copy of the MPL was not distributed with this
+-- file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+require "circular_buffer"
+require "math"
+require "string"
+
+dbl = circular_buffer.new(4, 3, 1)
+flt = circular_buffer.new(4, 3, 1, {storage = "float", layout = "column"})
+i32 = circular_buffer.new(4, 3, 1, {storage = "int32", running = true})
+i64 = circular_buffer.new(4, 3, 1, {storage = "int64", prefix = true})
+local buffers = {dbl, flt, i32, i64}
+for i, cb in ipairs(buffers) do
+    cb:set_header(3, "Min", "count", "min")
+end
+
+local functions = {"sum", "avg", "sd", "min", "max", "variance"}
+
+local function equal(a, b)
+    return a == b or (a ~= a and b ~= b)
+end
+
+local function check(cb, ns, column, expected)
+    local v = cb:get(ns, column)
+    if not equal(v, expected) then
+        error(string.format("column: %d expected: %.17g received: %.17g", column, expected, v))
+    end
+end
+
+function process(ts)
+    local s = ts / 1e9
+    for i, cb in ipairs(buffers) do
+        cb:add(ts, 1, s % 7)
+        cb:set(ts, 2, s * 1000)
+        if s % 3 ~= 0 then
+            cb:set(ts, 3, 100 - s)
+        end
+    end
+    return 0
+end
+
+function report(tc)
+    if tc == 0 then
+        local t = dbl:current_time()
+        for c = 1, 3 do
+            for i, f in ipairs(functions) do
+                local a, an = dbl:compute(f, c)
+                local ra = dbl:compute(f, c, t - 1e9, t)
+                for j = 2, #buffers do
+                    local b, bn = buffers[j]:compute(f, c)
+                    local rb = buffers[j]:compute(f, c, t - 1e9, t)
+                    if not equal(a, b) or an ~= bn or not equal(ra, rb) then
+                        error(string.format("buffer: %d column: %d %s expected: %g received: %g",
+                                            j, c, f, a, b))
+                    end
+                end
+            end
+        end
+    elseif tc == 1 then
+        local cb = circular_buffer.new(2, 3, 1, {storage = "int32"})
+        cb:set(0, 1, 1.6)
+        check(cb, 0, 1, 2)
+        cb:add(0, 1, -0.4)
+        check(cb, 0, 1, 2)
+        cb:set(0, 2, 3e10)
+        check(cb, 0, 2, 2147483647)
+        cb:set(0, 3, -3e10)
+        check(cb, 0, 3, -2147483647)
+        cb:add(0, 3, 0/0)
+        check(cb, 0, 3, 0/0)
+        check(cb, 1e9, 1, 0/0)
+
+        cb = circular_buffer.new(2, 2, 1, {storage = "int64"})
+        cb:set(0, 1, 2^52 + 1)
+        check(cb, 0, 1, 2^52 + 1)
+        cb:set(0, 2, -2^70)
+        check(cb, 0, 2, -9223372036854775807)
+
+        cb = circular_buffer.new(2, 1, 1, {storage = "float"})
+        cb:set(0, 1, 0.1)
+        local v = cb:get(0, 1)
+        if v == 0.1 or math.abs(v - 0.1) > 1e-8 then
+            error(string.format("float: %.17g", v))
+        end
+        cb:set(0, 1, 0/0)
+        check(cb, 0, 1, 0/0)
+    elseif tc == 2 then
+        write(dbl)
+    elseif tc == 3 then
+        write(i32)
+    elseif tc == 4 then
+        write(flt)
+    end
+end
@@ -0,0 +1,68 @@
+-- This Source Code Form is subject to the terms of the Mozilla Public
+-- License, v. 2.0. If a copy of the MPL was not distributed with this
+-- file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+require "circular_buffer"
+require "string"
+
+tiered = circular_buffer.new_tiered(2, {{10, 1}, {6, 5}, {4, 30}})
+tiered:set_header(1, "Requests")
+tiered:set_header(2, "Max", "ms", "max")
+
+-- reference buffers receiving every value at each resolution
+local refs = {circular_buffer.new(400, 2, 1), circular_buffer.new(100, 2, 5),
+    circular_buffer.new(100, 2, 30)}
+for i, cb in ipairs(refs) do
+    cb:set_header(2, "Max", "ms", "max")
+end
+
+local function equal(a, b)
+    return a == b or (a ~= a and b ~= b)
+end
+
+local function check_tier(tier)
+    local cb = tiered:tier(tier)
+    local finer = tiered:tier(tier - 1)
+    local rows, columns, spr = cb:get_configuration()
+    local frows, fcolumns, fspr = finer:get_configuration()
+    local t = cb:current_time()
+    local finer_start = finer:current_time() - (frows - 1) * fspr * 1e9
+    for r = 0, rows - 1 do
+        local ns = t - r * spr * 1e9
+        local row_end = ns + (spr - 1) * 1e9
+        for c = 1, columns do
+            local v = cb:get(ns, c)
+            local expected
+            if row_end < finer_start then -- fully rolled up
+                expected = refs[tier]:get(ns, c)
+            elseif ns >= finer_start then -- still held by the finer tier
+                expected = 0/0
+            end
+            if expected and not equal(v, expected) then
+                error(string.format("tier: %d time: %d column: %d expected: %g received: %g",
+                                    tier, ns / 1e9, c, expected, v))
+            end
+        end
+    end
+end
+
+function process(ts)
+    local s = ts / 1e9
+    local v1, v2 = 1 + s % 3, (s * 7) % 13
+    tiered:add(ts, 1, v1)
+    tiered:set(ts, 2, v2)
+    for i, cb in ipairs(refs) do
+        cb:add(ts, 1, v1)
+        cb:set(ts, 2, v2)
+    end
+    return 0
+end
+
+function report(tc)
+    if tc == 0 then
+        check_tier(2)
+        check_tier(3)
+    else
+        write(tiered:tier(tc))
+    end
+end
@@ -0,0 +1,47 @@
+-- This Source Code Form is subject to the terms of the Mozilla Public
+-- License, v. 2.0. If a copy of the MPL was not distributed with this
+-- file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+require "circular_buffer"
+require "math"
+require "string"
+
+-- 1000 client addresses per row over a 60 row window; distinct column vs. a
+-- Lua set per row
+local cb = circular_buffer.new(60, 1, 1)
+cb:set_header(1, "Clients", "count", "distinct")
+local sets = {}
+local seed = 1
+local ts = 0
+
+local function random(n)
+    seed = (seed * 1103515245 + 12345) % 2147483648
+    return math.floor(seed / 65536) % n
+end
+
+function process(tc)
+    ts = ts + 1e9
+    if tc == 0 then
+        for i = 1, 1000 do
+            cb:add(ts, 1, string.format("10.%d.%d.%d", random(256), random(256), random(256)))
+        end
+        cb:compute("distinct", 1)
+    else
+        local row = ts / 1e9 % 60
+        local set = {}
+        sets[row] = set
+        for i = 1, 1000 do
+            set[string.format("10.%d.%d.%d", random(256), random(256), random(256))] = true
+        end
+        local union, distinct = {}, 0
+        for r, s in pairs(sets) do
+            for ip in pairs(s) do
+                if not union[ip] then
+                    union[ip] = true
+                    distinct = distinct + 1
+                end
+            end
+        end
+    end
+    return 0
+end
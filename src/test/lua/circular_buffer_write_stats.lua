@@ -0,0 +1,64 @@
+-- This Source Code Form is subject to the terms of the Mozilla Public
+-- License, v. 2.0. If a copy of the MPL was not distributed with this
+-- file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+require "circular_buffer"
+require "string"
+
+cb = circular_buffer.new(10, 1, 1, {future = 3600})
+local plain = circular_buffer.new(10, 1, 1)
+
+local function check(b, late, dropped, future)
+    local l, d, f = b:get_write_stats()
+    if l ~= late or d ~= dropped or f ~= future then
+        error(string.format("expected: %d %d %d received: %d %d %d",
+                            late, dropped, future, l, d, f))
+    end
+end
+
+function report(tc)
+    if cb:add(9e9, 1, 1) ~= 1 then error("current row") end
+    check(cb, 0, 0, 0)
+    if cb:add(7e9, 1, 2) ~= 2 then error("late row") end
+    check(cb, 1, 0, 0)
+    if cb:add(0, 1, 3) ~= 3 then error("oldest row") end
+    check(cb, 2, 0, 0)
+    if cb:add(-1e9, 1, 4) then error("older than the buffer") end
+    if cb:set(-1e9, 1, 4) then error("older than the buffer") end
+    check(cb, 2, 2, 0)
+    if cb:add(4e18, 1, 5) then error("future timestamp") end -- 2096
+    check(cb, 2, 2, 1)
+    if cb:current_time() ~= 9e9 then error("future timestamp advanced the buffer") end
+    if cb:add(12e9, 1, 6) ~= 6 then error("next row") end
+    if cb:get(9e9, 1) ~= 1 then error("advance cleared an old row") end
+    if cb:add(2e9, 1, 1) then error("older than the buffer") end
+    check(cb, 2, 3, 1)
+
+    if not cb:add_row(11e9, 7) then error("add_row late row") end
+    if cb:add_row(2e9, 7) then error("add_row older than the buffer") end
+    check(cb, 3, 4, 1)
+    if not cb:add_many(10e9, {[1] = 1}) then error("add_many late row") end
+    if cb:add_many(4e18, {[1] = 1}) then error("add_many future timestamp") end
+    check(cb, 4, 4, 2)
+
+    -- rows 1-2 are older than the buffer and 3-10 are late
+    local src = circular_buffer.new(10, 1, 1)
+    for s = 1, 10 do src:add(s * 1e9, 1, 1) end
+    cb:merge(src)
+    check(cb, 12, 6, 2)
+    if cb:get(9e9, 1) ~= 2 or cb:get(3e9, 1) ~= 1 then error("merge") end
+    if cb:current_time() ~= 12e9 then error("merge moved the buffer") end
+
+    for j, v in ipairs({-1, 1e12, 0/0}) do
+        local ok, err = pcall(circular_buffer.new, 10, 1, 1, {future = v})
+        if ok or not string.find(err, "future is out of range", 1, true) then
+            error(string.format("future = %g accepted: %s", v, tostring(err)))
+        end
+    end
+
+    -- without the guard a future timestamp advances the buffer
+    if plain:add(2e18, 1, 1) ~= 1 or plain:current_time() ~= 2e18 then -- 2033
+        error("future timestamp")
+    end
+    check(plain, 0, 0, 0)
+end
@@ -0,0 +1,66 @@
+-- This Source Code Form is subject to the terms of the Mozilla Public
+-- License, v. 2.0. If a copy of the MPL was not distributed with this
+-- file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+require "message_template"
+require "string"
+
+local tmpl = message_template.new({Type = "metric", Logger = "logger", Severity = 6, Hostname = "hostname",
+    Fields = {
+        {name = "count", type = "integer", representation = "count"},
+        {name = "avg"},
+        {name = "status", type = "string"},
+        {name = "ok", type = "bool"},
+        {name = "counts", type = "integer"}
+    }})
+
+local int_fields = {}
+local int_values = {}
+for i = 1, 16 do
+    int_fields[i] = {name = "i" .. i, type = "integer"}
+    int_values[i] = i - 2
+end
+local ints = message_template.new({Type = "ints", Severity = 6, Pid = 1234, Fields = int_fields})
+
+local errors = {
+    {{Type = 1}, "Type must be a string"},
+    {{Pid = "1"}, "Pid must be a number"},
+    {{Fields = "count"}, "Fields must be an array"},
+    {{Fields = {"count"}}, "Fields[1] must be a table"},
+    {{Fields = {{type = "double"}}}, "Fields[1] name must be a string"},
+    {{Fields = {{name = "a"}, {name = "b", type = "float"}}}, "Fields[2] invalid type 'float'"},
+    {{Fields = {{name = "a", representation = true}}}, "Fields[1] representation must be a string"},
+}
+
+function process(tc)
+    if tc == 0 then
+        if tmpl:fields() ~= 5 then return 1 end
+        write(tmpl, {5, 1.5, "up", true, {1, 2}, Timestamp = 1e9})
+    elseif tc == 1 then -- missing values and empty arrays are skipped
+        write(tmpl, {nil, 2, nil, nil, {}, Timestamp = 1e9, Payload = "payload"})
+    elseif tc == 2 then -- invalid templates
+        for i, v in ipairs(errors) do
+            local ok, err = pcall(message_template.new, v[1])
+            if ok or not string.find(err, v[2], 1, true) then
+                error(string.format("test: %d received: %s", i, tostring(err)))
+            end
+        end
+    elseif tc == 3 then
+        write(tmpl, {"five"})
+    elseif tc == 4 then
+        write(tmpl, {1, 2, "up", true, {1, "two"}})
+    elseif tc == 5 then
+        write(tmpl, "values")
+    elseif tc == 6 then -- many small integers
+        int_values.Timestamp = 1e9
+        write(ints, int_values)
+    elseif tc == 7 then -- verify the decoded integers
+        for i = 1, 16 do
+            local v = read_message(string.format("Fields[i%d]", i))
+            if v ~= i - 2 then
+                error(string.format("Fields[i%d] received: %s", i, tostring(v)))
+            end
+        end
+    end
+    return 0
+end
@@ -0,0 +1,11 @@
+-- This Source Code Form is subject to the terms of the Mozilla Public
+-- License, v. 2.0. If a copy of the MPL was not distributed with this
+-- file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+function process(tc)
+    for i=1, tc do
+        write_batch({Timestamp = i * 1e9, Type = "metric", Fields = {count = i}})
+    end
+    write_batch()
+    return 0
+end
@@ -0,0 +1,47 @@
+-- This Source Code Form is subject to the terms of the Mozilla Public
+-- License, v. 2.0. If a copy of the MPL was not distributed with this
+-- file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+require "string"
+
+local hm = {Timestamp = 1e9, Type="type", Logger="logger", Payload="payload", EnvVersion="env_version", Hostname="hostname", Severity=9, Pid=123,
+Fields = {number=1,numbers={value={1,2,3}, representation="count"},string="string",strings={"s1","s2","s3"}, bool=true, bools={true,false,false}}}
+
+function process(tc)
+    if tc == 0 then -- encode the message for the host to decode
+        write(hm)
+    elseif tc == 1 then -- headers and fields
+        assert(read_message("Timestamp") == 1e9, "Timestamp")
+        assert(string.len(read_message("Uuid")) == 16, "Uuid")
+        for i,k in ipairs({"Type", "Logger", "Payload", "EnvVersion", "Hostname", "Severity", "Pid"}) do
+            local v = read_message(k)
+            assert(v == hm[k], string.format("%s = %s", k, tostring(v)))
+        end
+        assert(read_message("Fields[number]") == 1, "Fields[number]")
+        for i=1,3 do
+            assert(read_message("Fields[numbers]", 0, i-1) == hm.Fields.numbers.value[i], "Fields[numbers]")
+            assert(read_message("Fields[strings]", 0, i-1) == hm.Fields.strings[i], "Fields[strings]")
+            assert(read_message("Fields[bools]", 0, i-1) == hm.Fields.bools[i], "Fields[bools]")
+        end
+        assert(read_message("Fields[string]") == "string", "Fields[string]")
+        assert(read_message("Fields[bool]") == true, "Fields[bool]")
+        assert(read_message("Fields[numbers]", 0, 3) == nil, "array index out of range")
+        assert(read_message("Fields[number]", 1) == nil, "field index out of range")
+        assert(read_message("Fields[missing]") == nil, "Fields[missing]")
+        assert(read_message("Missing") == nil, "Missing")
+        assert(string.len(read_message("raw")) > 0, "raw")
+    elseif tc == 2 then -- packed integers and repeated field names
+        assert(read_message("Fields[packed]") == 1, "Fields[packed][0]")
+        assert(read_message("Fields[packed]", 0, 1) == 300, "Fields[packed][1]")
+        assert(read_message("Fields[packed]", 0, 2) == nil, "Fields[packed][2]")
+        assert(read_message("Fields[packed]", 1) == 2.5, "Fields[packed] second field")
+        assert(read_message("Severity") == 7, "default Severity")
+        assert(read_message("Type") == nil, "missing Type")
+    elseif tc == 3 then -- nothing indexed
+        assert(read_message("Timestamp") == nil, "Timestamp")
+        assert(read_message("raw") == nil, "raw")
+    elseif tc == 4 then -- the host function registered before lsb_init
+        assert(read_message("Type") == "host", "host read_message")
+    end
+    return 0
+end
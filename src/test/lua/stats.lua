@@ -0,0 +1,91 @@
+-- This Source Code Form is subject to the terms of the Mozilla Public
+-- License, v. 2.0. If a copy of the MPL was not distributed with this
+-- file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+require "circular_buffer"
+require "math"
+require "stats"
+require "string"
+
+local function check(name, received, expected, tolerance)
+    tolerance = tolerance or 1e-12
+    if received ~= expected and not (expected ~= expected and received ~= received)
+    and not (math.abs(received - expected) <= math.abs(expected) * tolerance) then
+        error(string.format("%s expected: %.17g received: %.17g", name, expected,
+                            received))
+    end
+end
+
+local function check_error(f, expected)
+    local ok, err = pcall(f)
+    if ok or not string.find(err, expected, 1, true) then
+        error(string.format("expected error: %s received: %s", expected,
+                            tostring(err)))
+    end
+end
+
+-- includes the special values and enough entries to exercise the SIMD lanes
+-- and the scalar tail
+local x = {0/0, math.huge, -math.huge, 0, -0.0, 1, -1, 0.5, -0.5, 8, -8, 9.5,
+    -40, 40}
+for i = 1, 27 do x[#x + 1] = (i - 14) * 0.37 end
+
+local cb = circular_buffer.new(#x, 1, 1)
+for i, v in ipairs(x) do
+    cb:set((i - 1) * 1e9, 1, v)
+end
+
+function process(tc)
+    if tc == 0 then -- known values
+        check("ndtr(0)", stats.ndtr(0), 0.5)
+        check("ndtr(1.96)", stats.ndtr(1.959963984540054), 0.975)
+        check("ndtri(0.975)", stats.ndtri(0.975), 1.959963984540054)
+        check("ndtri(0.5)", stats.ndtri(0.5), 0)
+        check("ndtri(0)", stats.ndtri(0), -math.huge)
+        check("ndtri(1.5)", stats.ndtri(1.5), 0/0)
+        check("erfc(1)", stats.erfc(1), 0.15729920705028513)
+        check("chdtrc(5, 11.07)", stats.chdtrc(5, 11.070497693516351), 0.05, 1e-10)
+        check("chdtr(2, 3)", stats.chdtr(2, 3), 1 - math.exp(-1.5))
+        check("stdtr(10, 2.228)", stats.stdtr(10, 2.2281388519649385), 0.975, 1e-10)
+        check("stdtr(1, -3)", stats.stdtr(1, -3), 0.5 + math.atan(-3) / math.pi)
+        check("stdtr(2, 1e3)", stats.stdtr(2, 1e3), 0.5 + 1e3 / (2 * math.sqrt(2 + 1e6)))
+    elseif tc == 1 then -- the batched results match the scalar ones
+        local functions = {"ndtr", "erfc", "ndtri"}
+        for i, name in ipairs(functions) do
+            local f = stats[name]
+            local a, b = f(x), f(cb, 1)
+            if #a ~= #x or #b ~= #x then error(name .. " wrong result length") end
+            for j, v in ipairs(x) do
+                local expected = f(v)
+                check(name .. "(" .. v .. ")", a[j], expected, 0)
+                check(name .. "(" .. v .. ")", b[j], expected, 0)
+            end
+        end
+        functions = {"chdtr", "chdtrc", "stdtr"}
+        for i, name in ipairs(functions) do
+            local f = stats[name]
+            local a = f(3, x)
+            for j, v in ipairs(x) do
+                check(name .. "(" .. v .. ")", a[j], f(3, v), 0)
+            end
+        end
+    elseif tc == 2 then -- circular buffer ranges
+        local p = stats.ndtr(cb, 1, 5e9, 7e9)
+        if #p ~= 3 then error("range length: " .. #p) end
+        check("range", p[3], stats.ndtr(x[8]), 0)
+        if stats.ndtr(cb, 1, 100e9, 200e9) ~= nil then error("range outside of the buffer") end
+        if #stats.ndtr({}) ~= 0 then error("empty array") end
+    elseif tc == 3 then -- errors
+        check_error(function() stats.ndtr("a") end,
+                    "bad argument #1 to 'ndtr' (number, array or circular_buffer expected, got string)")
+        check_error(function() stats.ndtr({1, "a"}) end,
+                    "bad argument #1 to 'ndtr' (array values must be numbers)")
+        check_error(function() stats.stdtr(0, 1) end,
+                    "bad argument #1 to 'stdtr' (df must be > 0)")
+        check_error(function() stats.chdtr(1, cb, 2) end,
+                    "bad argument #3 to 'chdtr' (column out of range)")
+        check_error(function() stats.ndtr(cb, 1, 5e9, 4e9) end,
+                    "bad argument #4 to 'ndtr' (end must be >= start)")
+    end
+    return 0
+end
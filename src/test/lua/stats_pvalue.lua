@@ -0,0 +1,34 @@
+-- This Source Code Form is subject to the terms of the Mozilla Public
+-- License, v. 2.0. If a copy of the MPL was not distributed with this
+-- file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+require "circular_buffer"
+require "math"
+require "stats"
+
+-- two sided p-values for a day of one minute z-scores; one batched call over
+-- the column vs. a scalar call per row
+local rows = 1440
+local cb = circular_buffer.new(rows, 1, 60)
+local seed = 1
+for r = 0, rows - 1 do
+    seed = (seed * 1103515245 + 12345) % 2147483648
+    cb:set(r * 60e9, 1, (math.floor(seed / 65536) % 1000) / 100 - 5)
+end
+local start = cb:current_time() - (rows - 1) * 60e9
+
+function process(method)
+    local sum = 0
+    if method == 0 then
+        local p = stats.ndtr(cb, 1)
+        for i = 1, rows do
+            sum = sum + p[i]
+        end
+    else
+        local ndtr = stats.ndtr
+        for r = 0, rows - 1 do
+            sum = sum + ndtr(cb:get(start + r * 60e9, 1))
+        end
+    end
+    return 0
+end
@@ -11,6 +11,7 @@
 #include <errno.h>
 #include <lua.h>
 #include <lauxlib.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -49,6 +50,8 @@ char mu_err[MU_ERR_LEN] = { 0 };
 char* e = NULL;
 const char* written_data = NULL;
 size_t written_data_len = 0;
+size_t written_count = 0;
+const size_t* written_offsets = NULL;
 
 
 int file_exists(const char* fn)
@@ -156,6 +159,31 @@ int report(lua_sandbox* lsb, double tc)
 }
 
 
+int decode(lua_sandbox* lsb, const char* data, size_t len)
+{
+  static const char* func_name = "decode";
+  lua_State* lua = lsb_get_lua(lsb);
+  if (!lua) return 1;
+
+  if (lsb_pcall_setup(lsb, func_name)) return 1;
+
+  lua_pushlstring(lua, data, len);
+  if (lua_pcall(lua, 1, 0, 0) != 0) {
+    char err[LSB_ERROR_SIZE];
+    int len = snprintf(err, LSB_ERROR_SIZE, "%s() %s", func_name,
+                       lua_tostring(lua, -1));
+    if (len >= LSB_ERROR_SIZE || len < 0) {
+      err[LSB_ERROR_SIZE - 1] = 0;
+    }
+    lsb_terminate(lsb, err);
+    return 1;
+  }
+
+  lsb_pcall_teardown(lsb);
+  return 0;
+}
+
+
 int write_output(lua_State* lua)
 {
   void* luserdata = lua_touserdata(lua, lua_upvalueindex(1));
@@ -186,8 +214,14 @@ int write_output(lua_State* lua)
       break;
     }
     break;
+  case 2:
+    if (lsb_output_protobuf_template(lsb, 1, 2, 0) != 0) {
+      luaL_error(lua, "write() could not encode protobuf - %s",
+                 lsb_get_error(lsb));
+    }
+    break;
   default:
-    luaL_error(lua, "write() takes a maximum of 1 argument");
+    luaL_error(lua, "write() takes a maximum of 2 arguments");
     break;
   }
   written_data = lsb_get_output(lsb, &written_data_len);
@@ -195,6 +229,34 @@ int write_output(lua_State* lua)
 }
 
 
+int write_batch(lua_State* lua)
+{
+  void* luserdata = lua_touserdata(lua, lua_upvalueindex(1));
+  if (NULL == luserdata) {
+    luaL_error(lua, "write_batch() invalid lightuserdata");
+  }
+  lua_sandbox* lsb = (lua_sandbox*)luserdata;
+
+  switch (lua_gettop(lua)) {
+  case 0:
+    written_data = lsb_get_output_batch(lsb, &written_data_len,
+                                        &written_count, &written_offsets);
+    break;
+  case 1:
+    luaL_checktype(lua, 1, LUA_TTABLE);
+    if (lsb_output_protobuf_batch(lsb, 1) != 0) {
+      luaL_error(lua, "write_batch() could not encode protobuf - %s",
+                 lsb_get_error(lsb));
+    }
+    break;
+  default:
+    luaL_error(lua, "write_batch() takes a maximum of 1 argument");
+    break;
+  }
+  return 0;
+}
+
+
 static char* test_create_error()
 {
   lua_sandbox* sb = lsb_create(NULL, "lua/simple.lua", "../../modules", LSB_MEMORY + 1,
@@ -483,6 +545,274 @@ static char* test_output_errors()
 }
 
 
+static char* test_output_batch()
+{
+  lua_sandbox* sb = lsb_create(NULL, "lua/output_batch.lua", "../../modules",
+                               100000, 1000, 1024);
+  mu_assert(sb, "lsb_create() received: NULL");
+
+  int result = lsb_init(sb, NULL);
+  mu_assert(result == 0, "lsb_init() received: %d %s", result,
+            lsb_get_error(sb));
+  lsb_add_function(sb, &write_batch, "write_batch");
+
+  for (int n = 0; n < 4; ++n) {
+    result = process(sb, n);
+    mu_assert(result == 0, "process() received: %d %s", result,
+              lsb_get_error(sb));
+    mu_assert(written_count == (size_t)n, "received: %d messages",
+              (int)written_count);
+    size_t end = written_data_len;
+    for (int i = n - 1; i >= 0; --i) {
+      const char* frame = written_data + written_offsets[i];
+      mu_assert(frame[0] == 0x1E, "test: %d message: %d missing record separator",
+                n, i);
+      size_t header_len = (unsigned char)frame[1];
+      mu_assert(frame[2] == 0x08, "test: %d message: %d invalid header", n, i);
+      mu_assert(frame[header_len + 2] == 0x1F,
+                "test: %d message: %d missing unit separator", n, i);
+      size_t msg_len = (unsigned char)frame[3];
+      const char* msg = frame + header_len + 3;
+      mu_assert(msg + msg_len == written_data + end,
+                "test: %d message: %d invalid length %d", n, i, (int)msg_len);
+      result = lsb_decode_protobuf(sb, msg, msg_len);
+      mu_assert(result == 0, "test: %d message: %d received: %s", n, i,
+                lsb_get_error(sb));
+      end = written_offsets[i];
+    }
+    mu_assert(end == 0, "test: %d first offset: %d", n, (int)end);
+  }
+  lsb_decode_protobuf(sb, NULL, 0);
+
+  // exceed the output limit
+  result = process(sb, 100);
+  mu_assert(result == 1, "process() received: %d", result);
+  mu_assert(strstr(lsb_get_error(sb), "write_batch() could not encode protobuf"),
+            "received: %s", lsb_get_error(sb));
+
+  e = lsb_destroy(sb, NULL);
+  mu_assert(!e, "lsb_destroy() received: %s", e);
+
+  return NULL;
+}
+
+
+static char* test_message_template()
+{
+  static const char msg0[] = "\x10\x80\x94\xeb\xdc\x03\x1a\x06metric"
+    "\x22\x06logger\x28\x06\x4a\x08hostname"
+    "\x52\x12\x0a\x05\x63ount\x10\x02\x1a\x05\x63ount\x30\x05"
+    "\x52\x10\x0a\x03\x61vg\x10\x03\x39\x00\x00\x00\x00\x00\x00\xf8\x3f"
+    "\x52\x0c\x0a\x06status\x22\x02up"
+    "\x52\x08\x0a\x02ok\x10\x04\x40\x01"
+    "\x52\x0e\x0a\x06\x63ounts\x10\x02\x30\x01\x30\x02";
+  static const char msg1[] = "\x10\x80\x94\xeb\xdc\x03\x1a\x06metric"
+    "\x22\x06logger\x28\x06\x32\x07payload\x4a\x08hostname"
+    "\x52\x10\x0a\x03\x61vg\x10\x03\x39\x00\x00\x00\x00\x00\x00\x00\x40";
+  const char* expected[] = { msg0, msg1 };
+  size_t expected_len[] = { sizeof(msg0) - 1, sizeof(msg1) - 1 };
+
+  lua_sandbox* sb = lsb_create(NULL, "lua/message_template.lua",
+                               "../../modules", 100000, 1000, 1024);
+  mu_assert(sb, "lsb_create() received: NULL");
+
+  int result = lsb_init(sb, NULL);
+  mu_assert(result == 0, "lsb_init() received: %d %s", result,
+            lsb_get_error(sb));
+  lsb_add_function(sb, &write_output, "write");
+
+  for (int i = 0; i < 2; ++i) {
+    result = process(sb, i);
+    mu_assert(result == 0, "test: %d received: %d %s", i, result,
+              lsb_get_error(sb));
+    mu_assert(written_data_len == expected_len[i] + 18,
+              "test: %d received length: %d", i, (int)written_data_len);
+    mu_assert(memcmp(written_data + 18, expected[i], expected_len[i]) == 0,
+              "test: %d received unexpected encoding", i);
+    result = lsb_decode_protobuf(sb, written_data, written_data_len);
+    mu_assert(result == 0, "test: %d received: %s", i, lsb_get_error(sb));
+  }
+
+  // negative integers are int64 (ten byte) varints
+  result = process(sb, 6);
+  mu_assert(result == 0, "process() received: %d %s", result,
+            lsb_get_error(sb));
+  result = lsb_decode_protobuf(sb, written_data, written_data_len);
+  mu_assert(result == 0, "lsb_decode_protobuf() received: %s",
+            lsb_get_error(sb));
+  result = process(sb, 7);
+  mu_assert(result == 0, "process() received: %d %s", result,
+            lsb_get_error(sb));
+  lsb_decode_protobuf(sb, NULL, 0);
+
+  result = process(sb, 2);
+  mu_assert(result == 0, "process() received: %d %s", result,
+            lsb_get_error(sb));
+
+  e = lsb_destroy(sb, NULL);
+  mu_assert(!e, "lsb_destroy() received: %s", e);
+
+  const char* tests[] =
+  {
+    "process() lua/message_template.lua:49: write() could not encode protobuf - field 'count' expected number"
+    , "process() lua/message_template.lua:51: write() could not encode protobuf - field 'counts' expected number"
+    , "process() lua/message_template.lua:53: write() could not encode protobuf - values must be a table"
+    , NULL
+  };
+
+  for (int i = 0; tests[i]; ++i) {
+    sb = lsb_create(NULL, "lua/message_template.lua", "../../modules",
+                    100000, 1000, 1024);
+    mu_assert(sb, "lsb_create() received: NULL");
+
+    result = lsb_init(sb, NULL);
+    mu_assert(result == 0, "lsb_init() received: %d %s", result,
+              lsb_get_error(sb));
+    lsb_add_function(sb, &write_output, "write");
+
+    result = process(sb, i + 3);
+    mu_assert(result == 1, "test: %d received: %d", i, result);
+
+    const char* le = lsb_get_error(sb);
+    mu_assert(le, "test: %d received NULL", i);
+    mu_assert(strcmp(tests[i], le) == 0, "test: %d received: %s", i, le);
+
+    e = lsb_destroy(sb, NULL);
+    mu_assert(!e, "lsb_destroy() received: %s", e);
+  }
+
+  return NULL;
+}
+
+
+static char* test_read_message()
+{
+  static const char packed[] = "\x0a\x10\x00\x00\x00\x00\x00\x00\x00\x00"
+    "\x00\x00\x00\x00\x00\x00\x00\x00\x10\x01"
+    "\x52\x0f\x0a\x06packed\x10\x02\x32\x03\x01\xac\x02"
+    "\x52\x13\x0a\x06packed\x10\x03\x39\x00\x00\x00\x00\x00\x00\x04\x40";
+
+  lua_sandbox* sb = lsb_create(NULL, "lua/read_message.lua", "../../modules",
+                               100000, 1000, 1024);
+  mu_assert(sb, "lsb_create() received: NULL");
+
+  int result = lsb_init(sb, NULL);
+  mu_assert(result == 0, "lsb_init() received: %d %s", result,
+            lsb_get_error(sb));
+  lsb_add_function(sb, &write_output, "write");
+
+  result = process(sb, 0);
+  mu_assert(result == 0, "process() received: %d %s", result,
+            lsb_get_error(sb));
+  size_t len = written_data_len;
+  char* msg = malloc(len);
+  mu_assert(msg, "malloc failed");
+  memcpy(msg, written_data, len);
+
+  result = lsb_decode_protobuf(sb, msg, len);
+  mu_assert(result == 0, "lsb_decode_protobuf() received: %d %s", result,
+            lsb_get_error(sb));
+  result = process(sb, 1);
+  mu_assert(result == 0, "process() received: %d %s", result,
+            lsb_get_error(sb));
+
+  result = lsb_decode_protobuf(sb, packed, sizeof(packed) - 1);
+  mu_assert(result == 0, "lsb_decode_protobuf() received: %d %s", result,
+            lsb_get_error(sb));
+  result = process(sb, 2);
+  mu_assert(result == 0, "process() received: %d %s", result,
+            lsb_get_error(sb));
+
+  result = lsb_decode_protobuf(sb, msg, len - 1);
+  mu_assert(result == 1, "lsb_decode_protobuf() truncated received: %d",
+            result);
+  mu_assert(strcmp("invalid protobuf message", lsb_get_error(sb)) == 0,
+            "received: %s", lsb_get_error(sb));
+  result = process(sb, 3);
+  mu_assert(result == 0, "process() received: %d %s", result,
+            lsb_get_error(sb));
+  free(msg);
+
+  e = lsb_destroy(sb, NULL);
+  mu_assert(!e, "lsb_destroy() received: %s", e);
+
+  return NULL;
+}
+
+
+static int host_read_message(lua_State* lua)
+{
+  lua_pushstring(lua, "host");
+  return 1;
+}
+
+
+static char* test_read_message_host()
+{
+  lua_sandbox* sb = lsb_create(NULL, "lua/read_message.lua", "../../modules",
+                               100000, 1000, 1024);
+  mu_assert(sb, "lsb_create() received: NULL");
+  lsb_add_function(sb, &host_read_message, "read_message");
+
+  int result = lsb_init(sb, NULL);
+  mu_assert(result == 0, "lsb_init() received: %d %s", result,
+            lsb_get_error(sb));
+  result = process(sb, 4);
+  mu_assert(result == 0, "process() received: %d %s", result,
+            lsb_get_error(sb));
+
+  e = lsb_destroy(sb, NULL);
+  mu_assert(!e, "lsb_destroy() received: %s", e);
+
+  return NULL;
+}
+
+
+static char* test_uuid()
+{
+  const int cnt = 100;
+  const size_t uuid_size = 16;
+  lua_sandbox* sbs[100];
+  char uuids[100][16];
+
+  for (int i = 0; i < cnt; ++i) {
+    sbs[i] = lsb_create(NULL, "lua/output.lua", "../../modules", 100000, 1000,
+                        1024);
+    mu_assert(sbs[i], "lsb_create() received: NULL");
+    int result = lsb_init(sbs[i], NULL);
+    mu_assert(result == 0, "lsb_init() received: %d %s", result,
+              lsb_get_error(sbs[i]));
+    lsb_add_function(sbs[i], &write_output, "write");
+  }
+
+  for (int i = 0; i < cnt; ++i) {
+    int result = process(sbs[i], 9);
+    mu_assert(result == 0, "process() received: %d %s", result,
+              lsb_get_error(sbs[i]));
+    mu_assert(written_data_len > uuid_size + 2, "received: %d bytes",
+              (int)written_data_len);
+    mu_assert(written_data[0] == 0x0a && written_data[1] == 0x10,
+              "invalid uuid tag");
+    memcpy(uuids[i], written_data + 2, uuid_size);
+    mu_assert((uuids[i][6] & 0xF0) == 0x40, "invalid version %02x",
+              (unsigned char)uuids[i][6]);
+    mu_assert((uuids[i][8] & 0xC0) == 0x80, "invalid variant %02x",
+              (unsigned char)uuids[i][8]);
+    for (int j = 0; j < i; ++j) {
+      mu_assert(memcmp(uuids[i], uuids[j], uuid_size) != 0,
+                "duplicate uuid sandbox: %d and %d", i, j);
+    }
+  }
+
+  for (int i = 0; i < cnt; ++i) {
+    e = lsb_destroy(sbs[i], NULL);
+    mu_assert(!e, "lsb_destroy() received: %s", e);
+  }
+
+  return NULL;
+}
+
+
 static char* test_cbuf_errors()
 {
   const char* tests[] =
@@ -525,6 +855,23 @@ static char* test_cbuf_errors()
     , "process() lua/circular_buffer_errors.lua:107: bad argument #6 to 'mannwhitneyu' (use_continuity must be a boolean)"
     , "process() lua/circular_buffer_errors.lua:110: bad argument #-1 to 'get_header' (incorrect number of arguments)"
     , "process() lua/circular_buffer_errors.lua:113: bad argument #1 to 'get_header' (column out of range)"
+    , "process() lua/circular_buffer_errors.lua:116: bad argument #3 to 'add_row' (too many values)"
+    , "process() lua/circular_buffer_errors.lua:119: bad argument #2 to 'add_row' (number expected, got string)"
+    , "process() lua/circular_buffer_errors.lua:122: bad argument #2 to 'add_many' (table expected, got number)"
+    , "process() lua/circular_buffer_errors.lua:125: bad argument #2 to 'add_many' (column out of range)"
+    , "process() lua/circular_buffer_errors.lua:128: bad argument #2 to 'add_many' (values must be numbers)"
+    , "process() lua/circular_buffer_errors.lua:130: bad argument #4 to 'new' (hot_rows is out of range)"
+    , "process() lua/circular_buffer_errors.lua:132: bad argument #4 to 'new' (hot_rows requires the default layout and storage)"
+    , "process() lua/circular_buffer_errors.lua:134: bad argument #2 to 'new_tiered' (seconds_per_row must be a multiple of the finer tier)"
+    , "process() lua/circular_buffer_errors.lua:137: bad argument #1 to 'tier' (tier out of range)"
+    , "process() lua/circular_buffer_errors.lua:140: frombinary() invalid header"
+    , "process() lua/circular_buffer_errors.lua:143: frombinary() incompatible dimensions, expected 2 rows and 1 columns"
+    , "process() lua/circular_buffer_errors.lua:148: bad argument #2 to 'compute' (not a quantile column)"
+    , "process() lua/circular_buffer_errors.lua:151: bad argument #5 to 'set_header' (quantile must be between 0 and 1)"
+    , "process() lua/circular_buffer_errors.lua:154: bad argument #2 to 'compute' (not a distinct column)"
+    , "process() lua/circular_buffer_errors.lua:158: bad argument #3 to 'add' (number expected, got table)"
+    , "process() lua/circular_buffer_errors.lua:161: bad argument #1 to 'detect' (no detector)"
+    , "process() lua/circular_buffer_errors.lua:164: bad argument #3 to 'set_detector' (season must be between 2 and rows)"
     , NULL
   };
 
@@ -617,11 +964,7 @@ static char* test_cbuf_delta()
 {
   const char* outputs[] = {
     "{\"time\":0,\"rows\":3,\"columns\":3,\"seconds_per_row\":1,\"column_info\":[{\"name\":\"Add_column\",\"unit\":\"count\",\"aggregation\":\"sum\"},{\"name\":\"Set_column\",\"unit\":\"count\",\"aggregation\":\"sum\"},{\"name\":\"Get_column\",\"unit\":\"count\",\"aggregation\":\"sum\"}]}\n1\t1\t1\n2\t1\t2\n3\t1\t3\n"
-#ifdef LUA_JIT
     , "{\"time\":0,\"rows\":3,\"columns\":3,\"seconds_per_row\":1,\"column_info\":[{\"name\":\"Add_column\",\"unit\":\"count\",\"aggregation\":\"sum\"},{\"name\":\"Set_column\",\"unit\":\"count\",\"aggregation\":\"sum\"},{\"name\":\"Get_column\",\"unit\":\"count\",\"aggregation\":\"sum\"}]}\n0\t1\t1\t1\n1\t2\t1\t2\n2\t3\t1\t3\n"
-#else
-    , "{\"time\":0,\"rows\":3,\"columns\":3,\"seconds_per_row\":1,\"column_info\":[{\"name\":\"Add_column\",\"unit\":\"count\",\"aggregation\":\"sum\"},{\"name\":\"Set_column\",\"unit\":\"count\",\"aggregation\":\"sum\"},{\"name\":\"Get_column\",\"unit\":\"count\",\"aggregation\":\"sum\"}]}\n1\t2\t1\t2\n2\t3\t1\t3\n0\t1\t1\t1\n"
-#endif
     , "{\"time\":0,\"rows\":3,\"columns\":3,\"seconds_per_row\":1,\"column_info\":[{\"name\":\"Add_column\",\"unit\":\"count\",\"aggregation\":\"sum\"},{\"name\":\"Set_column\",\"unit\":\"count\",\"aggregation\":\"sum\"},{\"name\":\"Get_column\",\"unit\":\"count\",\"aggregation\":\"sum\"}]}\n1\t1\t1\n2\t1\t2\n3\t1\t3\n"
     , ""
     , "{\"time\":0,\"rows\":3,\"columns\":3,\"seconds_per_row\":1,\"column_info\":[{\"name\":\"Add_column\",\"unit\":\"count\",\"aggregation\":\"sum\"},{\"name\":\"Set_column\",\"unit\":\"count\",\"aggregation\":\"sum\"},{\"name\":\"Get_column\",\"unit\":\"count\",\"aggregation\":\"sum\"}]}\n2\tnan\tnan\tnan\n"
@@ -674,95 +1017,1030 @@ static char* test_cbuf_delta()
 }
 
 
-static char* test_cjson()
+static char* test_cbuf_layout()
 {
-
-  lua_sandbox* sb = lsb_create(NULL, "lua/cjson.lua", "../../modules", 32767, 1000,
-                               32767);
+  const char* state_file = "circular_buffer_layout.preserve";
+  lua_sandbox* sb = lsb_create(NULL, "lua/circular_buffer_layout.lua",
+                               "../../modules", 64000, 100000, 32767);
   mu_assert(sb, "lsb_create() received: NULL");
 
   int result = lsb_init(sb, NULL);
   mu_assert(result == 0, "lsb_init() received: %d %s", result,
             lsb_get_error(sb));
+  lsb_add_function(sb, &write_output, "write");
 
-  result = process(sb, 0);
-  mu_assert(result == 0, "process() received: %d %s", result,
-            lsb_get_error(sb));
+  double ts[] = { 0, 1e9, 1e9, 2e9, 5e9, 6e9 };
+  for (unsigned i = 0; i < sizeof(ts) / sizeof(ts[0]); ++i) {
+    result = process(sb, ts[i]);
+    mu_assert(result == 0, "process() received: %d %s", result,
+              lsb_get_error(sb));
+  }
 
-  e = lsb_destroy(sb, NULL);
-  mu_assert(!e, "lsb_destroy() received: %s", e);
+  result = report(sb, 0);
+  mu_assert(result == 0, "report() received: %d %s", result,
+            lsb_get_error(sb));
+  char* expected = malloc(written_data_len + 1);
+  mu_assert(expected, "malloc failed");
+  memcpy(expected, written_data, written_data_len + 1);
 
-  return NULL;
-}
+  result = report(sb, 1);
+  mu_assert(result == 0, "report() received: %d %s", result,
+            lsb_get_error(sb));
+  mu_assert(strcmp(expected, written_data) == 0, "received: %s",
+            written_data);
 
+  result = report(sb, 2);
+  mu_assert(result == 0, "report() received: %d %s", result,
+            lsb_get_error(sb));
 
-static char* test_errors()
-{
-  const char* tests[] = {
-#ifdef _WIN32
-    "process() lua/errors.lua:9: cannot open lua\\unknown.lua: No such file or directory"
-#else
-    "process() lua/errors.lua:9: cannot open lua/unknown.lua: No such file or directory"
-#endif
-    , "process() lua/errors.lua:11: output() must have at least one argument"
-    , "process() not enough memory"
-    , "process() instruction_limit exceeded"
-    , "process() lua/errors.lua:20: attempt to perform arithmetic on global 'x' (a nil value)"
-    , "process() must return a single numeric value"
-    , "process() must return a single numeric value"
-    , "process() lua/errors.lua:27: output_limit exceeded"
-#ifdef _WIN32
-    , "process() lua/errors.lua:30: lua\\bad_module.lua:1: attempt to perform arithmetic on global 'nilvalue' (a nil value)"
-#else
-    , "process() lua/errors.lua:30: lua/bad_module.lua:1: attempt to perform arithmetic on global 'nilvalue' (a nil value)"
-#endif
-    , "process() lua/errors.lua:32: invalid module name '../invalid'"
-    , "process() lua/errors.lua:34: require_path exceeded 255"
-    , "process() lua/errors.lua:37: package table is missing"
-    , "process() lua/errors.lua:40: package.loaded table is missing"
-    , NULL
-  };
+  e = lsb_destroy(sb, state_file);
+  mu_assert(!e, "lsb_destroy() received: %s", e);
 
-  for (int i = 0; tests[i]; ++i) {
-    lua_sandbox* sb = lsb_create(NULL, "lua/errors.lua", "lua", 32767, 1000,
-                                 128);
-    mu_assert(sb, "lsb_create() received: NULL");
+  char* state = read_file(state_file);
+  mu_assert(strstr(state, "circular_buffer.new(4, 3, 1, {delta = false, layout = \"column\"})"),
+            "received: %s", state);
+  free(state);
 
-    int result = lsb_init(sb, NULL);
-    mu_assert(result == 0, "lsb_init() received: %d %s", result,
-              lsb_get_error(sb));
+  sb = lsb_create(NULL, "lua/circular_buffer_layout.lua", "../../modules",
+                  64000, 100000, 32767);
+  mu_assert(sb, "lsb_create() received: NULL");
+  result = lsb_init(sb, state_file);
+  mu_assert(result == 0, "lsb_init() received: %d %s", result,
+            lsb_get_error(sb));
+  lsb_add_function(sb, &write_output, "write");
 
-    result = process(sb, i);
-    mu_assert(result == 1, "test: %d received: %d", i, result);
+  result = report(sb, 1);
+  mu_assert(result == 0, "report() received: %d %s", result,
+            lsb_get_error(sb));
+  mu_assert(strcmp(expected, written_data) == 0, "received: %s",
+            written_data);
+  free(expected);
 
-    const char* le = lsb_get_error(sb);
-    mu_assert(le, "test: %d received NULL", i);
-    mu_assert(strcmp(tests[i], le) == 0, "test: %d received: %s", i, le);
+  result = report(sb, 2);
+  mu_assert(result == 0, "report() received: %d %s", result,
+            lsb_get_error(sb));
 
-    e = lsb_destroy(sb, NULL);
-    mu_assert(!e, "lsb_destroy() received: %s", e);
-  }
+  e = lsb_destroy(sb, NULL);
+  mu_assert(!e, "lsb_destroy() received: %s", e);
 
   return NULL;
 }
 
 
-static char* test_lpeg()
+static char* test_cbuf_running()
 {
-  const char* expected = "[\"1\",\"string with spaces\","
-    "\"quoted string, with comma and \\\"quoted\\\" text\"]\n";
+  const char* state_file = "circular_buffer_running.preserve";
+  lua_sandbox* sb = lsb_create(NULL, "lua/circular_buffer_running.lua",
+                               "../../modules", 64000, 100000, 32767);
+  mu_assert(sb, "lsb_create() received: NULL");
+
+  int result = lsb_init(sb, NULL);
+  mu_assert(result == 0, "lsb_init() received: %d %s", result,
+            lsb_get_error(sb));
+
+  double ts[] = { 0, 1e9, 2e9, 3e9, 5e9, 9e9, 10e9, 11e9, 12e9, 13e9, 20e9,
+    21e9, 22e9, 40e9, 41e9, 42e9, 43e9, 44e9, 45e9 };
+  for (unsigned i = 0; i < sizeof(ts) / sizeof(ts[0]); ++i) {
+    result = process(sb, ts[i]);
+    mu_assert(result == 0, "process() received: %d %s", result,
+              lsb_get_error(sb));
+  }
+
+  e = lsb_destroy(sb, state_file);
+  mu_assert(!e, "lsb_destroy() received: %s", e);
+
+  sb = lsb_create(NULL, "lua/circular_buffer_running.lua", "../../modules",
+                  64000, 100000, 32767);
+  mu_assert(sb, "lsb_create() received: NULL");
+  result = lsb_init(sb, state_file);
+  mu_assert(result == 0, "lsb_init() received: %d %s", result,
+            lsb_get_error(sb));
+
+  result = report(sb, 0);
+  mu_assert(result == 0, "report() received: %d %s", result,
+            lsb_get_error(sb));
+  result = process(sb, 46e9);
+  mu_assert(result == 0, "process() received: %d %s", result,
+            lsb_get_error(sb));
+
+  e = lsb_destroy(sb, NULL);
+  mu_assert(!e, "lsb_destroy() received: %s", e);
+
+  return NULL;
+}
+
+
+static char* test_cbuf_storage()
+{
+  const char* state_file = "circular_buffer_storage.preserve";
+  lua_sandbox* sb = lsb_create(NULL, "lua/circular_buffer_storage.lua",
+                               "../../modules", 64000, 100000, 32767);
+  mu_assert(sb, "lsb_create() received: NULL");
+
+  int result = lsb_init(sb, NULL);
+  mu_assert(result == 0, "lsb_init() received: %d %s", result,
+            lsb_get_error(sb));
+  lsb_add_function(sb, &write_output, "write");
+
+  for (int i = 0; i < 7; ++i) {
+    result = process(sb, i * 1e9);
+    mu_assert(result == 0, "process() received: %d %s", result,
+              lsb_get_error(sb));
+  }
+  for (int i = 0; i < 2; ++i) {
+    result = report(sb, i);
+    mu_assert(result == 0, "report() received: %d %s", result,
+              lsb_get_error(sb));
+  }
+
+  result = report(sb, 2);
+  mu_assert(result == 0, "report() received: %d %s", result,
+            lsb_get_error(sb));
+  char* expected = malloc(written_data_len + 1);
+  mu_assert(expected, "malloc failed");
+  memcpy(expected, written_data, written_data_len + 1);
+  for (int i = 3; i < 5; ++i) {
+    result = report(sb, i);
+    mu_assert(result == 0, "report() received: %d %s", result,
+              lsb_get_error(sb));
+    mu_assert(strcmp(expected, written_data) == 0, "received: %s",
+              written_data);
+  }
+
+  e = lsb_destroy(sb, state_file);
+  mu_assert(!e, "lsb_destroy() received: %s", e);
+
+  char* state = read_file(state_file);
+  mu_assert(strstr(state, "circular_buffer.new(4, 3, 1, {delta = false, running = true, storage = \"int32\"})"),
+            "received: %s", state);
+  free(state);
+
+  sb = lsb_create(NULL, "lua/circular_buffer_storage.lua", "../../modules",
+                  64000, 100000, 32767);
+  mu_assert(sb, "lsb_create() received: NULL");
+  result = lsb_init(sb, state_file);
+  mu_assert(result == 0, "lsb_init() received: %d %s", result,
+            lsb_get_error(sb));
+  lsb_add_function(sb, &write_output, "write");
+
+  result = report(sb, 0);
+  mu_assert(result == 0, "report() received: %d %s", result,
+            lsb_get_error(sb));
+  result = report(sb, 3);
+  mu_assert(result == 0, "report() received: %d %s", result,
+            lsb_get_error(sb));
+  mu_assert(strcmp(expected, written_data) == 0, "received: %s",
+            written_data);
+  free(expected);
+
+  e = lsb_destroy(sb, NULL);
+  mu_assert(!e, "lsb_destroy() received: %s", e);
+
+  return NULL;
+}
+
+
+static char* test_cbuf_cold()
+{
+  const char* state_file = "circular_buffer_cold.preserve";
+  lua_sandbox* sb = lsb_create(NULL, "lua/circular_buffer_cold.lua",
+                               "../../modules", 64000, 100000, 32767);
+  mu_assert(sb, "lsb_create() received: NULL");
+
+  int result = lsb_init(sb, NULL);
+  mu_assert(result == 0, "lsb_init() received: %d %s", result,
+            lsb_get_error(sb));
+  lsb_add_function(sb, &write_output, "write");
+
+  // wrap the buffer several times with a gap and a jump past the window
+  for (int i = 0; i < 1300; ++i) {
+    if (i > 600 && i < 630) continue;
+    double ns = (i < 900 ? i : i + 500) * 1e9;
+    result = process(sb, ns);
+    mu_assert(result == 0, "process() received: %d %s", result,
+              lsb_get_error(sb));
+    if (i % 97 == 0) {
+      result = report(sb, 0);
+      mu_assert(result == 0, "report() received: %d %s", result,
+                lsb_get_error(sb));
+    }
+  }
+
+  result = report(sb, 1);
+  mu_assert(result == 0, "report() received: %d %s", result,
+            lsb_get_error(sb));
+  char* expected = malloc(written_data_len + 1);
+  mu_assert(expected, "malloc failed");
+  memcpy(expected, written_data, written_data_len + 1);
+  result = report(sb, 2);
+  mu_assert(result == 0, "report() received: %d %s", result,
+            lsb_get_error(sb));
+  mu_assert(strcmp(expected, written_data) == 0, "received: %s",
+            written_data);
+
+  e = lsb_destroy(sb, state_file);
+  mu_assert(!e, "lsb_destroy() received: %s", e);
+
+  char* state = read_file(state_file);
+  mu_assert(strstr(state, "circular_buffer.new(200, 3, 1, {delta = false, hot_rows = 10})"),
+            "received: %s", state);
+  free(state);
+
+  sb = lsb_create(NULL, "lua/circular_buffer_cold.lua", "../../modules",
+                  64000, 100000, 32767);
+  mu_assert(sb, "lsb_create() received: NULL");
+  result = lsb_init(sb, state_file);
+  mu_assert(result == 0, "lsb_init() received: %d %s", result,
+            lsb_get_error(sb));
+  lsb_add_function(sb, &write_output, "write");
+
+  result = report(sb, 0);
+  mu_assert(result == 0, "report() received: %d %s", result,
+            lsb_get_error(sb));
+  result = report(sb, 2);
+  mu_assert(result == 0, "report() received: %d %s", result,
+            lsb_get_error(sb));
+  mu_assert(strcmp(expected, written_data) == 0, "received: %s",
+            written_data);
+  free(expected);
+
+  e = lsb_destroy(sb, NULL);
+  mu_assert(!e, "lsb_destroy() received: %s", e);
+
+  return NULL;
+}
+
+
+static char* test_cbuf_sparse()
+{
+  const char* state_file = "circular_buffer_sparse.preserve";
+  lua_sandbox* sb = lsb_create(NULL, "lua/circular_buffer_sparse.lua",
+                               "../../modules", 256000, 100000, 32767);
+  mu_assert(sb, "lsb_create() received: NULL");
+
+  int result = lsb_init(sb, NULL);
+  mu_assert(result == 0, "lsb_init() received: %d %s", result,
+            lsb_get_error(sb));
+  lsb_add_function(sb, &write_output, "write");
+
+  // wrap the buffer several times with a gap and a jump past the window
+  for (int i = 0; i < 1300; ++i) {
+    if (i > 600 && i < 630) continue;
+    double ns = (i < 900 ? i : i + 500) * 1e9;
+    result = process(sb, ns);
+    mu_assert(result == 0, "process() received: %d %s", result,
+              lsb_get_error(sb));
+    if (i % 97 == 0) {
+      result = report(sb, 0);
+      mu_assert(result == 0, "report() received: %d %s", result,
+                lsb_get_error(sb));
+    }
+  }
+
+  result = report(sb, 1);
+  mu_assert(result == 0, "report() received: %d %s", result,
+            lsb_get_error(sb));
+  char* expected = malloc(written_data_len + 1);
+  mu_assert(expected, "malloc failed");
+  memcpy(expected, written_data, written_data_len + 1);
+  result = report(sb, 2);
+  mu_assert(result == 0, "report() received: %d %s", result,
+            lsb_get_error(sb));
+  mu_assert(strcmp(expected, written_data) == 0, "received: %s",
+            written_data);
+
+  e = lsb_destroy(sb, state_file);
+  mu_assert(!e, "lsb_destroy() received: %s", e);
+
+  char* state = read_file(state_file);
+  mu_assert(strstr(state, "circular_buffer.new(200, 8, 1, {delta = false, sparse = true})"),
+            "received: %s", state);
+  free(state);
+
+  sb = lsb_create(NULL, "lua/circular_buffer_sparse.lua", "../../modules",
+                  256000, 100000, 32767);
+  mu_assert(sb, "lsb_create() received: NULL");
+  result = lsb_init(sb, state_file);
+  mu_assert(result == 0, "lsb_init() received: %d %s", result,
+            lsb_get_error(sb));
+  lsb_add_function(sb, &write_output, "write");
+
+  result = report(sb, 0);
+  mu_assert(result == 0, "report() received: %d %s", result,
+            lsb_get_error(sb));
+  result = report(sb, 2);
+  mu_assert(result == 0, "report() received: %d %s", result,
+            lsb_get_error(sb));
+  mu_assert(strcmp(expected, written_data) == 0, "received: %s",
+            written_data);
+  free(expected);
+
+  e = lsb_destroy(sb, NULL);
+  mu_assert(!e, "lsb_destroy() received: %s", e);
+
+  return NULL;
+}
+
+
+static char* test_cbuf_write_stats()
+{
+  const char* state_file = "circular_buffer_write_stats.preserve";
+  lua_sandbox* sb = lsb_create(NULL, "lua/circular_buffer_write_stats.lua",
+                               "../../modules", 64000, 100000, 32767);
+  mu_assert(sb, "lsb_create() received: NULL");
+
+  int result = lsb_init(sb, NULL);
+  mu_assert(result == 0, "lsb_init() received: %d %s", result,
+            lsb_get_error(sb));
+  result = report(sb, 0);
+  mu_assert(result == 0, "report() received: %d %s", result,
+            lsb_get_error(sb));
+
+  e = lsb_destroy(sb, state_file);
+  mu_assert(!e, "lsb_destroy() received: %s", e);
+
+  char* state = read_file(state_file);
+  mu_assert(strstr(state, "circular_buffer.new(10, 1, 1, {delta = false, future = 3600})"),
+            "received: %s", state);
+  free(state);
+
+  return NULL;
+}
+
+
+static char* test_cbuf_restore()
+{
+  const char* state_file = "circular_buffer_restore.preserve";
+  lua_sandbox* sb = lsb_create(NULL, "lua/circular_buffer_restore.lua",
+                               "../../modules", 64000, 100000, 32767);
+  mu_assert(sb, "lsb_create() received: NULL");
+
+  int result = lsb_init(sb, NULL);
+  mu_assert(result == 0, "lsb_init() received: %d %s", result,
+            lsb_get_error(sb));
+  lsb_add_function(sb, &write_output, "write");
+
+  for (int i = 0; i < 350; ++i) {
+    result = process(sb, i * 1e9);
+    mu_assert(result == 0, "process() received: %d %s", result,
+              lsb_get_error(sb));
+  }
+  result = report(sb, 0);
+  mu_assert(result == 0, "report() received: %d %s", result,
+            lsb_get_error(sb));
+  char* expected = malloc(written_data_len + 1);
+  mu_assert(expected, "malloc failed");
+  memcpy(expected, written_data, written_data_len + 1);
+
+  e = lsb_destroy(sb, state_file);
+  mu_assert(!e, "lsb_destroy() received: %s", e);
+
+  char* state = read_file(state_file);
+  mu_assert(strstr(state, "_G[\"cb\"]:frombinary([=["), "received: %s", state);
+  free(state);
+
+  // restore into the same configuration and into a hot_rows double buffer
+  const char* scripts[] = { "lua/circular_buffer_restore.lua",
+    "lua/circular_buffer_restore_hot.lua" };
+  char* deltas = NULL;
+  for (int i = 0; i < 2; ++i) {
+    sb = lsb_create(NULL, scripts[i], "../../modules", 64000, 100000, 32767);
+    mu_assert(sb, "lsb_create() received: NULL");
+    result = lsb_init(sb, state_file);
+    mu_assert(result == 0, "lsb_init() received: %d %s", result,
+              lsb_get_error(sb));
+    lsb_add_function(sb, &write_output, "write");
+
+    result = report(sb, 0);
+    mu_assert(result == 0, "report() received: %d %s", result,
+              lsb_get_error(sb));
+    mu_assert(strcmp(expected, written_data) == 0, "script: %s received: %s",
+              scripts[i], written_data);
+
+    result = report(sb, 1);
+    mu_assert(result == 0, "report() received: %d %s", result,
+              lsb_get_error(sb));
+    mu_assert(strstr(written_data, "\n349\t6\t349000\n"), "received: %s",
+              written_data);
+    if (deltas) {
+      mu_assert(strcmp(deltas, written_data) == 0, "received: %s",
+                written_data);
+    } else {
+      deltas = malloc(written_data_len + 1);
+      mu_assert(deltas, "malloc failed");
+      memcpy(deltas, written_data, written_data_len + 1);
+    }
+
+    e = lsb_destroy(sb, NULL);
+    mu_assert(!e, "lsb_destroy() received: %s", e);
+  }
+  free(deltas);
+  free(expected);
+
+  return NULL;
+}
+
+
+static char* test_cbuf_tiered()
+{
+  const char* state_file = "circular_buffer_tiered.preserve";
+  lua_sandbox* sb = lsb_create(NULL, "lua/circular_buffer_tiered.lua",
+                               "../../modules", 64000, 100000, 32767);
+  mu_assert(sb, "lsb_create() received: NULL");
+
+  int result = lsb_init(sb, NULL);
+  mu_assert(result == 0, "lsb_init() received: %d %s", result,
+            lsb_get_error(sb));
+  lsb_add_function(sb, &write_output, "write");
+
+  for (int i = 0; i < 300; ++i) {
+    if (i > 150 && i < 170) continue;
+    result = process(sb, i * 1e9);
+    mu_assert(result == 0, "process() received: %d %s", result,
+              lsb_get_error(sb));
+    result = report(sb, 0);
+    mu_assert(result == 0, "report() received: %d %s", result,
+              lsb_get_error(sb));
+  }
+
+  char* expected[3];
+  for (int i = 0; i < 3; ++i) {
+    result = report(sb, i + 1);
+    mu_assert(result == 0, "report() received: %d %s", result,
+              lsb_get_error(sb));
+    expected[i] = malloc(written_data_len + 1);
+    mu_assert(expected[i], "malloc failed");
+    memcpy(expected[i], written_data, written_data_len + 1);
+  }
+
+  e = lsb_destroy(sb, state_file);
+  mu_assert(!e, "lsb_destroy() received: %s", e);
+
+  char* state = read_file(state_file);
+  mu_assert(strstr(state, "circular_buffer.new_tiered(2, {{10, 1}, {6, 5}, {4, 30}}) end"),
+            "received: %s", state);
+  free(state);
+
+  sb = lsb_create(NULL, "lua/circular_buffer_tiered.lua", "../../modules",
+                  64000, 100000, 32767);
+  mu_assert(sb, "lsb_create() received: NULL");
+  result = lsb_init(sb, state_file);
+  mu_assert(result == 0, "lsb_init() received: %d %s", result,
+            lsb_get_error(sb));
+  lsb_add_function(sb, &write_output, "write");
+
+  for (int i = 0; i < 3; ++i) {
+    result = report(sb, i + 1);
+    mu_assert(result == 0, "report() received: %d %s", result,
+              lsb_get_error(sb));
+    mu_assert(strcmp(expected[i], written_data) == 0, "received: %s",
+              written_data);
+    free(expected[i]);
+  }
+
+  e = lsb_destroy(sb, NULL);
+  mu_assert(!e, "lsb_destroy() received: %s", e);
+
+  return NULL;
+}
+
+
+static char* test_cbuf_mannwhitneyu()
+{
+  lua_sandbox* sb = lsb_create(NULL, "lua/circular_buffer_mannwhitneyu.lua",
+                               "../../modules", 100000, 100000, 128);
+  mu_assert(sb, "lsb_create() received: NULL");
+
+  int result = lsb_init(sb, NULL);
+  mu_assert(result == 0, "lsb_init() received: %d %s", result,
+            lsb_get_error(sb));
+
+  for (int i = 0; i < 3; ++i) {
+    result = process(sb, i);
+    mu_assert(result == 0, "test: %d received: %d %s", i, result,
+              lsb_get_error(sb));
+  }
+
+  e = lsb_destroy(sb, NULL);
+  mu_assert(!e, "lsb_destroy() received: %s", e);
+
+  return NULL;
+}
+
+
+static char* test_cbuf_merge()
+{
+  lua_sandbox* sb = lsb_create(NULL, "lua/circular_buffer_merge.lua",
+                               "../../modules", 1000000, 1000000, 32767);
+  mu_assert(sb, "lsb_create() received: NULL");
+
+  int result = lsb_init(sb, NULL);
+  mu_assert(result == 0, "lsb_init() received: %d %s", result,
+            lsb_get_error(sb));
+  lsb_add_function(sb, &write_output, "write");
+
+  for (int i = 0; i < 20; ++i) {
+    result = process(sb, i * 1e9);
+    mu_assert(result == 0, "process() received: %d %s", result,
+              lsb_get_error(sb));
+  }
+  for (int i = 0; i < 2; ++i) { // cbuf and cbufd
+    result = report(sb, i);
+    mu_assert(result == 0, "report() received: %d %s", result,
+              lsb_get_error(sb));
+    result = decode(sb, written_data, written_data_len);
+    mu_assert(result == 0, "decode() received: %d %s", result,
+              lsb_get_error(sb));
+  }
+  result = report(sb, 2);
+  mu_assert(result == 0, "report() received: %d %s", result,
+            lsb_get_error(sb));
+
+  e = lsb_destroy(sb, NULL);
+  mu_assert(!e, "lsb_destroy() received: %s", e);
+
+  return NULL;
+}
+
+
+static char* test_cbuf_expr()
+{
+  lua_sandbox* sb = lsb_create(NULL, "lua/circular_buffer_expr.lua",
+                               "../../modules", 8000000, 1000000, 128);
+  mu_assert(sb, "lsb_create() received: NULL");
+
+  int result = lsb_init(sb, NULL);
+  mu_assert(result == 0, "lsb_init() received: %d %s", result,
+            lsb_get_error(sb));
+
+  for (int i = 0; i < 4; ++i) {
+    result = process(sb, i);
+    mu_assert(result == 0, "test: %d received: %d %s", i, result,
+              lsb_get_error(sb));
+  }
+
+  e = lsb_destroy(sb, NULL);
+  mu_assert(!e, "lsb_destroy() received: %s", e);
+
+  return NULL;
+}
+
+
+static char* test_stats()
+{
+  lua_sandbox* sb = lsb_create(NULL, "lua/stats.lua", "../../modules", 100000,
+                               100000, 128);
+  mu_assert(sb, "lsb_create() received: NULL");
+
+  int result = lsb_init(sb, NULL);
+  mu_assert(result == 0, "lsb_init() received: %d %s", result,
+            lsb_get_error(sb));
+
+  for (int i = 0; i < 4; ++i) {
+    result = process(sb, i);
+    mu_assert(result == 0, "test: %d received: %d %s", i, result,
+              lsb_get_error(sb));
+  }
+
+  e = lsb_destroy(sb, NULL);
+  mu_assert(!e, "lsb_destroy() received: %s", e);
+
+  return NULL;
+}
+
+
+static char* test_cbuf_detector()
+{
+  const char* state_file = "circular_buffer_detector.preserve";
+  lua_sandbox* sb = lsb_create(NULL, "lua/circular_buffer_detector.lua",
+                               "../../modules", 8000000, 1000000, 32767);
+  mu_assert(sb, "lsb_create() received: NULL");
+
+  int result = lsb_init(sb, NULL);
+  mu_assert(result == 0, "lsb_init() received: %d %s", result,
+            lsb_get_error(sb));
+  lsb_add_function(sb, &write_output, "write");
+
+  for (int i = 0; i < 90; ++i) {
+    result = process(sb, (120 + i) * 1e9);
+    mu_assert(result == 0, "process() received: %d %s", result,
+              lsb_get_error(sb));
+  }
+  for (int i = 0; i < 2; ++i) {
+    result = report(sb, i);
+    mu_assert(result == 0, "report() received: %d %s", result,
+              lsb_get_error(sb));
+  }
+  result = report(sb, 2);
+  mu_assert(result == 0, "report() received: %d %s", result,
+            lsb_get_error(sb));
+  char* expected = malloc(written_data_len + 1);
+  mu_assert(expected, "malloc failed");
+  memcpy(expected, written_data, written_data_len + 1);
+
+  e = lsb_destroy(sb, state_file);
+  mu_assert(!e, "lsb_destroy() received: %s", e);
+
+  char* state = read_file(state_file);
+  mu_assert(strstr(state, "_G[\"cb\"]:set_detector(2, \"holt_winters\", "
+                   "{alpha = 0.5, beta = 0.1, gamma = 0.5, k = 2, "
+                   "season = 10})"), "received: %s", state);
+  free(state);
+
+  sb = lsb_create(NULL, "lua/circular_buffer_detector.lua", "../../modules",
+                  8000000, 1000000, 32767);
+  mu_assert(sb, "lsb_create() received: NULL");
+  result = lsb_init(sb, state_file);
+  mu_assert(result == 0, "lsb_init() received: %d %s", result,
+            lsb_get_error(sb));
+  lsb_add_function(sb, &write_output, "write");
+
+  result = report(sb, 2);
+  mu_assert(result == 0, "report() received: %d %s", result,
+            lsb_get_error(sb));
+  mu_assert(strcmp(expected, written_data) == 0, "expected: %s received: %s",
+            expected, written_data);
+  free(expected);
+
+  e = lsb_destroy(sb, NULL);
+  mu_assert(!e, "lsb_destroy() received: %s", e);
+
+  return NULL;
+}
+
+
+static char* test_cbuf_quantile()
+{
+  const char* state_file = "circular_buffer_quantile.preserve";
+  lua_sandbox* sb = lsb_create(NULL, "lua/circular_buffer_quantile.lua",
+                               "../../modules", 8000000, 1000000, 32767);
+  mu_assert(sb, "lsb_create() received: NULL");
+
+  int result = lsb_init(sb, NULL);
+  mu_assert(result == 0, "lsb_init() received: %d %s", result,
+            lsb_get_error(sb));
+  lsb_add_function(sb, &write_output, "write");
+
+  for (int i = 0; i < 37; ++i) {
+    result = process(sb, i * 1e9);
+    mu_assert(result == 0, "process() received: %d %s", result,
+              lsb_get_error(sb));
+  }
+  for (int i = 0; i < 2; ++i) {
+    result = report(sb, i);
+    mu_assert(result == 0, "report() received: %d %s", result,
+              lsb_get_error(sb));
+  }
+  result = report(sb, 2);
+  mu_assert(result == 0, "report() received: %d %s", result,
+            lsb_get_error(sb));
+  mu_assert(strstr(written_data, "{\"name\":\"Latency\",\"unit\":\"ms\","
+                   "\"aggregation\":\"quantile\",\"quantile\":0.99}"),
+            "received: %s", written_data);
+  result = report(sb, 3);
+  mu_assert(result == 0, "report() received: %d %s", result,
+            lsb_get_error(sb));
+  char* expected = malloc(written_data_len + 1);
+  mu_assert(expected, "malloc failed");
+  memcpy(expected, written_data, written_data_len + 1);
+
+  e = lsb_destroy(sb, state_file);
+  mu_assert(!e, "lsb_destroy() received: %s", e);
+
+  char* state = read_file(state_file);
+  mu_assert(strstr(state, "_G[\"latency\"]:set_header(2, \"Latency\", \"ms\", "
+                   "\"quantile\", 0.99)"), "received: %s", state);
+  free(state);
+
+  sb = lsb_create(NULL, "lua/circular_buffer_quantile.lua", "../../modules",
+                  8000000, 1000000, 32767);
+  mu_assert(sb, "lsb_create() received: NULL");
+  result = lsb_init(sb, state_file);
+  mu_assert(result == 0, "lsb_init() received: %d %s", result,
+            lsb_get_error(sb));
+  lsb_add_function(sb, &write_output, "write");
+
+  result = report(sb, 3);
+  mu_assert(result == 0, "report() received: %d %s", result,
+            lsb_get_error(sb));
+  mu_assert(strcmp(expected, written_data) == 0, "received: %s",
+            written_data);
+  free(expected);
+
+  e = lsb_destroy(sb, NULL);
+  mu_assert(!e, "lsb_destroy() received: %s", e);
+
+  return NULL;
+}
+
+
+static char* test_cbuf_distinct()
+{
+  const char* state_file = "circular_buffer_distinct.preserve";
+  lua_sandbox* sb = lsb_create(NULL, "lua/circular_buffer_distinct.lua",
+                               "../../modules", 8000000, 1000000, 32767);
+  mu_assert(sb, "lsb_create() received: NULL");
+
+  int result = lsb_init(sb, NULL);
+  mu_assert(result == 0, "lsb_init() received: %d %s", result,
+            lsb_get_error(sb));
+  lsb_add_function(sb, &write_output, "write");
+
+  for (int i = 0; i < 37; ++i) {
+    result = process(sb, i * 1e9);
+    mu_assert(result == 0, "process() received: %d %s", result,
+              lsb_get_error(sb));
+  }
+  for (int i = 0; i < 2; ++i) {
+    result = report(sb, i);
+    mu_assert(result == 0, "report() received: %d %s", result,
+              lsb_get_error(sb));
+  }
+  result = report(sb, 2);
+  mu_assert(result == 0, "report() received: %d %s", result,
+            lsb_get_error(sb));
+  mu_assert(strstr(written_data, "{\"name\":\"Clients\",\"unit\":\"count\","
+                   "\"aggregation\":\"distinct\"}"),
+            "received: %s", written_data);
+  result = report(sb, 3);
+  mu_assert(result == 0, "report() received: %d %s", result,
+            lsb_get_error(sb));
+  char* expected = malloc(written_data_len + 1);
+  mu_assert(expected, "malloc failed");
+  memcpy(expected, written_data, written_data_len + 1);
+  result = report(sb, 4);
+  mu_assert(result == 0, "report() received: %d %s", result,
+            lsb_get_error(sb));
+  mu_assert(strcmp("{\"time\":0,\"rows\":2,\"columns\":1,\"seconds_per_row\":1,\"column_info\":[{\"name\":\"Users\",\"unit\":\"count\",\"aggregation\":\"distinct\"}]}\n0\t3\n",
+                   written_data) == 0, "received: %s", written_data);
+
+  e = lsb_destroy(sb, state_file);
+  mu_assert(!e, "lsb_destroy() received: %s", e);
+
+  sb = lsb_create(NULL, "lua/circular_buffer_distinct.lua", "../../modules",
+                  8000000, 1000000, 32767);
+  mu_assert(sb, "lsb_create() received: NULL");
+  result = lsb_init(sb, state_file);
+  mu_assert(result == 0, "lsb_init() received: %d %s", result,
+            lsb_get_error(sb));
+  lsb_add_function(sb, &write_output, "write");
+
+  result = report(sb, 3);
+  mu_assert(result == 0, "report() received: %d %s", result,
+            lsb_get_error(sb));
+  mu_assert(strcmp(expected, written_data) == 0, "received: %s",
+            written_data);
+  free(expected);
+
+  e = lsb_destroy(sb, NULL);
+  mu_assert(!e, "lsb_destroy() received: %s", e);
+
+  return NULL;
+}
+
+
+static char* test_cbuf_binary()
+{
+  const char* header = "{\"time\":2,\"rows\":3,\"columns\":2,\"seconds_per_row\":1,\"column_info\":[{\"name\":\"Values\",\"unit\":\"count\",\"aggregation\":\"sum\"},{\"name\":\"Column_2\",\"unit\":\"count\",\"aggregation\":\"sum\"}]}\n";
+  double values[] = { 2.5, 3.5, 4.5, -2e300, NAN, -4e300 };
+  size_t header_len = strlen(header);
+
+  lua_sandbox* sb = lsb_create(NULL, "lua/circular_buffer_binary.lua",
+                               "../../modules", 64000, 100000, 32767);
+  mu_assert(sb, "lsb_create() received: NULL");
+
+  int result = lsb_init(sb, NULL);
+  mu_assert(result == 0, "lsb_init() received: %d %s", result,
+            lsb_get_error(sb));
+  lsb_add_function(sb, &write_output, "write");
+
+  for (int i = 0; i < 5; ++i) {
+    result = process(sb, i * 1e9);
+    mu_assert(result == 0, "process() received: %d %s", result,
+              lsb_get_error(sb));
+  }
+
+  result = report(sb, 0);
+  mu_assert(result == 0, "report() received: %d %s", result,
+            lsb_get_error(sb));
+  mu_assert(written_data_len == header_len + sizeof(values),
+            "received: %zu", written_data_len);
+  mu_assert(strncmp(header, written_data, header_len) == 0, "received: %s",
+            written_data);
+  for (int i = 0; i < 6; ++i) {
+    double d;
+    memcpy(&d, written_data + header_len + i * sizeof(double), sizeof(d));
+    mu_assert(d == values[i] || (isnan(d) && isnan(values[i])),
+              "value: %d received: %g", i, d);
+  }
+  char* expected = malloc(written_data_len);
+  mu_assert(expected, "malloc failed");
+  memcpy(expected, written_data, written_data_len);
+  size_t expected_len = written_data_len;
+
+  result = decode(sb, expected, expected_len);
+  mu_assert(result == 0, "decode() received: %d %s", result,
+            lsb_get_error(sb));
+
+  for (int i = 1; i < 3; ++i) { // column layout and compressed rows
+    result = report(sb, i);
+    mu_assert(result == 0, "report() received: %d %s", result,
+              lsb_get_error(sb));
+    mu_assert(written_data_len == expected_len
+              && memcmp(expected, written_data, expected_len) == 0,
+              "buffer: %d output differs", i);
+  }
+  free(expected);
+
+  e = lsb_destroy(sb, NULL);
+  mu_assert(!e, "lsb_destroy() received: %s", e);
+
+  return NULL;
+}
+
+
+static char* test_cjson()
+{
+
+  lua_sandbox* sb = lsb_create(NULL, "lua/cjson.lua", "../../modules", 32767, 1000,
+                               32767);
+  mu_assert(sb, "lsb_create() received: NULL");
+
+  int result = lsb_init(sb, NULL);
+  mu_assert(result == 0, "lsb_init() received: %d %s", result,
+            lsb_get_error(sb));
+
+  result = process(sb, 0);
+  mu_assert(result == 0, "process() received: %d %s", result,
+            lsb_get_error(sb));
+
+  e = lsb_destroy(sb, NULL);
+  mu_assert(!e, "lsb_destroy() received: %s", e);
+
+  return NULL;
+}
+
+
+static char* test_errors()
+{
+  const char* tests[] = {
+#ifdef _WIN32
+    "process() lua/errors.lua:9: cannot open lua\\unknown.lua: No such file or directory"
+#else
+    "process() lua/errors.lua:9: cannot open lua/unknown.lua: No such file or directory"
+#endif
+    , "process() lua/errors.lua:11: output() must have at least one argument"
+    , "process() not enough memory"
+    , "process() instruction_limit exceeded"
+    , "process() lua/errors.lua:20: attempt to perform arithmetic on global 'x' (a nil value)"
+    , "process() must return a single numeric value"
+    , "process() must return a single numeric value"
+    , "process() lua/errors.lua:27: output_limit exceeded"
+#ifdef _WIN32
+    , "process() lua/errors.lua:30: lua\\bad_module.lua:1: attempt to perform arithmetic on global 'nilvalue' (a nil value)"
+#else
+    , "process() lua/errors.lua:30: lua/bad_module.lua:1: attempt to perform arithmetic on global 'nilvalue' (a nil value)"
+#endif
+    , "process() lua/errors.lua:32: invalid module name '../invalid'"
+    , "process() lua/errors.lua:34: require_path exceeded 255"
+    , "process() lua/errors.lua:37: package table is missing"
+    , "process() lua/errors.lua:40: package.loaded table is missing"
+    , NULL
+  };
+
+  for (int i = 0; tests[i]; ++i) {
+    lua_sandbox* sb = lsb_create(NULL, "lua/errors.lua", "lua", 32767, 1000,
+                                 128);
+    mu_assert(sb, "lsb_create() received: NULL");
+
+    int result = lsb_init(sb, NULL);
+    mu_assert(result == 0, "lsb_init() received: %d %s", result,
+              lsb_get_error(sb));
+
+    result = process(sb, i);
+    mu_assert(result == 1, "test: %d received: %d", i, result);
+
+    const char* le = lsb_get_error(sb);
+    mu_assert(le, "test: %d received NULL", i);
+    mu_assert(strcmp(tests[i], le) == 0, "test: %d received: %s", i, le);
+
+    e = lsb_destroy(sb, NULL);
+    mu_assert(!e, "lsb_destroy() received: %s", e);
+  }
+
+  return NULL;
+}
+
+
+static char* test_lpeg()
+{
+  const char* expected = "[\"1\",\"string with spaces\","
+    "\"quoted string, with comma and \\\"quoted\\\" text\"]\n";
+
+  lua_sandbox* sb = lsb_create(NULL, "lua/lpeg.lua", "../../modules", 100000, 1000,
+                               8000);
+  mu_assert(sb, "lsb_create() received: NULL");
+
+  int result = lsb_init(sb, NULL);
+  mu_assert(result == 0, "lsb_init() received: %d %s", result, lsb_get_error(sb));
+  lsb_add_function(sb, &write_output, "write");
+
+  result = process(sb, 0);
+  mu_assert(result == 0, "process() received: %d %s", result, lsb_get_error(sb));
+  mu_assert(strcmp(expected, written_data) == 0, "received: %s", written_data);
+
+  e = lsb_destroy(sb, NULL);
+  mu_assert(!e, "lsb_destroy() received: %s", e);
+
+  return NULL;
+}
+
+
+static char* test_lpeg_clf()
+{
+  const char* tests[] = {
+    "ok"
+    , "{\"body_bytes_sent\":{\"value\":0,\"representation\":\"B\"},\"remote_addr\":{\"value\":\"127.0.0.1\",\"representation\":\"ipv4\"},\"time\":1392050801000,\"http_user_agent\":\"Mozilla\\/5.0 (X11; Ubuntu; Linux x86_64; rv:26.0) Gecko\\/20100101 Firefox\\/26.0\",\"request\":\"GET \\/ HTTP\\/1.1\",\"remote_user\":\"-\",\"status\":304,\"http_referer\":\"-\"}\n"
+    , "{\"body_bytes_sent\":{\"value\":0,\"representation\":\"B\"},\"remote_addr\":{\"value\":\"127.0.0.1\",\"representation\":\"ipv4\"},\"time\":1391794831755,\"status\":304,\"http_user_agent\":\"Mozilla\\/5.0 (X11; Ubuntu; Linux x86_64; rv:26.0) Gecko\\/20100101 Firefox\\/26.0\",\"request\":\"GET \\/ HTTP\\/1.1\",\"http_referer\":\"-\"}\n"
+    , "ok"
+    , "ok"
+    , "{\"server_addr\":{\"value\":\"::1\",\"representation\":\"ipv6\"},\"pid\":1234,\"total_length\":{\"value\":809,\"representation\":\"B\"},\"server_port\":80,\"request_length\":{\"value\":311,\"representation\":\"B\"},\"connection_requests\":2,\"connection_status\":\"+\",\"body_bytes_sent\":{\"value\":235,\"representation\":\"B\"},\"remote_addr\":{\"value\":\"127.0.0.1\",\"representation\":\"ipv4\"},\"time\":1395330986000,\"response_length\":{\"value\":498,\"representation\":\"B\"},\"request_time\":{\"value\":0,\"representation\":\"s\"},\"request_filename\":\"test.txt\",\"status\":404,\"server_name\":{\"value\":\"example.com\",\"representation\":\"hostname\"}}\n"
+    , "{\"remote_addr\":{\"value\":\"127.0.0.1\",\"representation\":\"ipv4\"},\"time\":1392050801000,\"response_length\":{\"value\":0,\"representation\":\"B\"},\"request\":\"GET \\/ HTTP\\/1.1\",\"remote_user\":\"-\",\"status\":304}\n"
+    , "{\"remote_user\":\"-\",\"server_port\":80,\"http_referer\":\"-\",\"remote_addr\":{\"value\":\"127.0.0.1\",\"representation\":\"ipv4\"},\"time\":1395344314000,\"response_length\":{\"value\":492,\"representation\":\"B\"},\"request\":\"GET \\/ HTTP\\/1.1\",\"http_user_agent\":\"Mozilla\\/5.0 (X11; Ubuntu; Linux x86_64; rv:27.0) Gecko\\/20100101 Firefox\\/27.0\",\"status\":404,\"server_name\":{\"value\":\"127.0.1.1\",\"representation\":\"ipv4\"}}\n"
+    , "{\"http_user_agent\":\"Mozilla\\/5.0 (X11; Ubuntu; Linux x86_64; rv:27.0) Gecko\\/20100101 Firefox\\/27.0\",\"remote_addr\":{\"value\":\"127.0.0.1\",\"representation\":\"ipv4\"},\"time\":1395344397000,\"response_length\":{\"value\":492,\"representation\":\"B\"},\"request\":\"GET \\/ HTTP\\/1.1\",\"remote_user\":\"-\",\"status\":404,\"http_referer\":\"-\"}\n"
+    , "{\"uri\":\"\\/\",\"http_referer\":\"-\"}\n"
+    , NULL
+  };
+
+  lua_sandbox* sb = lsb_create(NULL, "lua/lpeg_clf.lua", "../../modules", 8e6, 1e6, 63 * 1024);
+  mu_assert(sb, "lsb_create() received: NULL");
+
+  int result = lsb_init(sb, NULL);
+  mu_assert(result == 0, "lsb_init() received: %d %s", result, lsb_get_error(sb));
+  lsb_add_function(sb, &write_output, "write");
+
+  for (int i = 0; tests[i]; ++i) {
+    result = process(sb, i);
+    mu_assert(result == 0, "process() received: %d %s", result, lsb_get_error(sb));
+    mu_assert(strcmp(tests[i], written_data) == 0, "test: %d received: %s", i, written_data);
+  }
+
+  e = lsb_destroy(sb, NULL);
+  mu_assert(!e, "lsb_destroy() received: %s", e);
+
+  return NULL;
+}
+
+
+static char* test_lpeg_cbufd()
+{
+  lua_sandbox* sb = lsb_create(NULL, "lua/lpeg_cbufd.lua", "../../modules", 100000, 1000, 8000);
+  mu_assert(sb, "lsb_create() received: NULL");
+
+  int result = lsb_init(sb, NULL);
+  mu_assert(result == 0, "lsb_init() received: %d %s", result, lsb_get_error(sb));
+
+  result = process(sb, 0);
+  mu_assert(result == 0, "process() received: %d %s", result, lsb_get_error(sb));
+
+  e = lsb_destroy(sb, NULL);
+  mu_assert(!e, "lsb_destroy() received: %s", e);
+
+  return NULL;
+}
+
+
+static char* test_lpeg_date_time()
+{
+  lua_sandbox* sb = lsb_create(NULL, "lua/lpeg_date_time.lua", "../../modules", 8e6, 1e6, 63 * 1024);
+  mu_assert(sb, "lsb_create() received: NULL");
+
+  int result = lsb_init(sb, NULL);
+  mu_assert(result == 0, "lsb_init() received: %d %s", result, lsb_get_error(sb));
+
+  for (int i = 0; i < 9; ++i) {
+    result = process(sb, i);
+    mu_assert(result == 0, "process() received: %d %s", result, lsb_get_error(sb));
+  }
 
-  lua_sandbox* sb = lsb_create(NULL, "lua/lpeg.lua", "../../modules", 100000, 1000,
-                               8000);
+  e = lsb_destroy(sb, NULL);
+  mu_assert(!e, "lsb_destroy() received: %s", e);
+
+  return NULL;
+}
+
+static char* test_lpeg_ip_address()
+{
+  lua_sandbox* sb = lsb_create(NULL, "lua/lpeg_ip_address.lua", "../../modules", 8e6, 1e6, 63 * 1024);
   mu_assert(sb, "lsb_create() received: NULL");
 
   int result = lsb_init(sb, NULL);
   mu_assert(result == 0, "lsb_init() received: %d %s", result, lsb_get_error(sb));
-  lsb_add_function(sb, &write_output, "write");
 
-  result = process(sb, 0);
-  mu_assert(result == 0, "process() received: %d %s", result, lsb_get_error(sb));
-  mu_assert(strcmp(expected, written_data) == 0, "received: %s", written_data);
+  for (int i = 0; i < 4; ++i) {
+    result = process(sb, i);
+    mu_assert(result == 0, "process() received: %d %s", result, lsb_get_error(sb));
+  }
 
   e = lsb_destroy(sb, NULL);
   mu_assert(!e, "lsb_destroy() received: %s", e);
@@ -771,23 +2049,18 @@ static char* test_lpeg()
 }
 
 
-static char* test_lpeg_clf()
+static char* test_lpeg_syslog()
 {
   const char* tests[] = {
-    "ok"
-    , "{\"body_bytes_sent\":{\"value\":0,\"representation\":\"B\"},\"remote_addr\":{\"value\":\"127.0.0.1\",\"representation\":\"ipv4\"},\"time\":1392050801000,\"http_user_agent\":\"Mozilla\\/5.0 (X11; Ubuntu; Linux x86_64; rv:26.0) Gecko\\/20100101 Firefox\\/26.0\",\"request\":\"GET \\/ HTTP\\/1.1\",\"remote_user\":\"-\",\"status\":304,\"http_referer\":\"-\"}\n"
-    , "{\"body_bytes_sent\":{\"value\":0,\"representation\":\"B\"},\"remote_addr\":{\"value\":\"127.0.0.1\",\"representation\":\"ipv4\"},\"time\":1391794831755,\"status\":304,\"http_user_agent\":\"Mozilla\\/5.0 (X11; Ubuntu; Linux x86_64; rv:26.0) Gecko\\/20100101 Firefox\\/26.0\",\"request\":\"GET \\/ HTTP\\/1.1\",\"http_referer\":\"-\"}\n"
-    , "ok"
-    , "ok"
-    , "{\"server_addr\":{\"value\":\"::1\",\"representation\":\"ipv6\"},\"pid\":1234,\"total_length\":{\"value\":809,\"representation\":\"B\"},\"server_port\":80,\"request_length\":{\"value\":311,\"representation\":\"B\"},\"connection_requests\":2,\"connection_status\":\"+\",\"body_bytes_sent\":{\"value\":235,\"representation\":\"B\"},\"remote_addr\":{\"value\":\"127.0.0.1\",\"representation\":\"ipv4\"},\"time\":1395330986000,\"response_length\":{\"value\":498,\"representation\":\"B\"},\"request_time\":{\"value\":0,\"representation\":\"s\"},\"request_filename\":\"test.txt\",\"status\":404,\"server_name\":{\"value\":\"example.com\",\"representation\":\"hostname\"}}\n"
-    , "{\"remote_addr\":{\"value\":\"127.0.0.1\",\"representation\":\"ipv4\"},\"time\":1392050801000,\"response_length\":{\"value\":0,\"representation\":\"B\"},\"request\":\"GET \\/ HTTP\\/1.1\",\"remote_user\":\"-\",\"status\":304}\n"
-    , "{\"remote_user\":\"-\",\"server_port\":80,\"http_referer\":\"-\",\"remote_addr\":{\"value\":\"127.0.0.1\",\"representation\":\"ipv4\"},\"time\":1395344314000,\"response_length\":{\"value\":492,\"representation\":\"B\"},\"request\":\"GET \\/ HTTP\\/1.1\",\"http_user_agent\":\"Mozilla\\/5.0 (X11; Ubuntu; Linux x86_64; rv:27.0) Gecko\\/20100101 Firefox\\/27.0\",\"status\":404,\"server_name\":{\"value\":\"127.0.1.1\",\"representation\":\"ipv4\"}}\n"
-    , "{\"http_user_agent\":\"Mozilla\\/5.0 (X11; Ubuntu; Linux x86_64; rv:27.0) Gecko\\/20100101 Firefox\\/27.0\",\"remote_addr\":{\"value\":\"127.0.0.1\",\"representation\":\"ipv4\"},\"time\":1395344397000,\"response_length\":{\"value\":492,\"representation\":\"B\"},\"request\":\"GET \\/ HTTP\\/1.1\",\"remote_user\":\"-\",\"status\":404,\"http_referer\":\"-\"}\n"
-    , "{\"uri\":\"\\/\",\"http_referer\":\"-\"}\n"
+    "{\"msg\":\"(root) CMD (   cd \\/ && run-parts --report \\/etc\\/cron.hourly)\",\"timestamp\":1391955421000,\"syslogtag\":{\"pid\":20758,\"programname\":\"CRON\"},\"hostname\":\"trink-x230\"}\n"
+    , "{\"msg\":\"Kernel logging (proc) stopped.\",\"timestamp\":1392049319111.5369,\"syslogtag\":{\"programname\":\"kernel\"},\"hostname\":\"trink-x230\"}\n"
+    , "{\"hostname\":\"trink-x230\",\"msg\":\"imklog 5.8.6, log source = \\/proc\\/kmsg started.\",\"timestamp\":1392049995407.9351,\"syslogtag\":{\"programname\":\"kernel\"},\"pri\":{\"severity\":6,\"facility\":0}}\n"
+    , "{\"hostname\":\"trink-x230\",\"msg\":\"imklog 5.8.6, log source = \\/proc\\/kmsg started.\",\"timestamp\":1392021527000,\"syslogtag\":{\"programname\":\"kernel\"},\"pri\":{\"severity\":6,\"facility\":0}}\n"
+    , "{\"syslogfacility\":0,\"$year\":\"2014\",\"source\":\"trink-x230\",\"syslogpriority-text\":6,\"syslogfacility-text\":0,\"msg\":\"imklog 5.8.6, log source = \\/proc\\/kmsg started.\",\"procid\":\"-\",\"structured-data\":\"-\",\"hostname\":\"trink-x230\",\"app-name\":\"kernel\",\"programname\":\"kernel\",\"$minute\":\"20\",\"$qhour\":\"01\",\"msgid\":\"imklog\",\"$hhour\":\"00\",\"pri-text\":0,\"fromhost-ip\":\"127.0.0.1\",\"$hour\":\"09\",\"pri\":{\"severity\":6,\"facility\":0},\"$day\":\"10\",\"$month\":\"02\",\"$now\":\"2014-02-10\",\"protocol-version\":\"0\",\"timegenerated\":1.392024053e+18,\"timestamp\":1392052853559.9338,\"syslogpriority\":6,\"iut\":\"1\",\"syslogtag\":{\"programname\":\"kernel\"},\"fromhost\":\"trink-x230\"}\n"
     , NULL
   };
 
-  lua_sandbox* sb = lsb_create(NULL, "lua/lpeg_clf.lua", "../../modules", 8e6, 1e6, 63 * 1024);
+  lua_sandbox* sb = lsb_create(NULL, "lua/lpeg_syslog.lua", "../../modules", 8e6, 1e6, 63 * 1024);
   mu_assert(sb, "lsb_create() received: NULL");
 
   int result = lsb_init(sb, NULL);
@@ -807,16 +2080,25 @@ static char* test_lpeg_clf()
 }
 
 
-static char* test_lpeg_cbufd()
+static char* test_util()
 {
-  lua_sandbox* sb = lsb_create(NULL, "lua/lpeg_cbufd.lua", "../../modules", 100000, 1000, 8000);
+  const char* tests[] = {
+    "{\"toplevel\":0,\"struct.item1\":1,\"struct.item0\":0,\"struct.item2.nested\":\"n1\"}\n"
+    , NULL
+  };
+
+  lua_sandbox* sb = lsb_create(NULL, "lua/util_test.lua", "../../modules", 8e6, 1e6, 63 * 1024);
   mu_assert(sb, "lsb_create() received: NULL");
 
   int result = lsb_init(sb, NULL);
   mu_assert(result == 0, "lsb_init() received: %d %s", result, lsb_get_error(sb));
+  lsb_add_function(sb, &write_output, "write");
 
-  result = process(sb, 0);
-  mu_assert(result == 0, "process() received: %d %s", result, lsb_get_error(sb));
+  for (int i = 0; tests[i]; ++i) {
+    result = process(sb, i);
+    mu_assert(result == 0, "process() received: %d %s", result, lsb_get_error(sb));
+    mu_assert(strcmp(tests[i], written_data) == 0, "test: %d received: %s", i, written_data);
+  }
 
   e = lsb_destroy(sb, NULL);
   mu_assert(!e, "lsb_destroy() received: %s", e);
@@ -825,69 +2107,309 @@ static char* test_lpeg_cbufd()
 }
 
 
-static char* test_lpeg_date_time()
+static char* test_serialize()
 {
-  lua_sandbox* sb = lsb_create(NULL, "lua/lpeg_date_time.lua", "../../modules", 8e6, 1e6, 63 * 1024);
+  const char* output_file = "serialize.preserve";
+  lua_sandbox* sb = lsb_create(NULL, "lua/serialize.lua", "../../modules", 64000, 1000, 64000);
   mu_assert(sb, "lsb_create() received: NULL");
 
   int result = lsb_init(sb, NULL);
-  mu_assert(result == 0, "lsb_init() received: %d %s", result, lsb_get_error(sb));
+  mu_assert(result == 0, "lsb_init() received: %d %s", result,
+            lsb_get_error(sb));
+  e = lsb_destroy(sb, output_file);
+  mu_assert(!e, "lsb_destroy() received: %s", e);
+
+#ifdef LUA_JIT
+  char* expected = read_file("output/serialize.data");
+#else
+  char* expected = read_file("output/serialize.lua51.data");
+#endif
+  char* actual = read_file(output_file);
+  mu_assert(strcmp(expected, actual) == 0, "serialization mismatch");
+  free(expected);
+  free(actual);
+
+  return NULL;
+}
+
+static char* test_serialize_failure()
+{
+  const char* output_file = "serialize_failure.preserve";
+  const char* expected = "serialize_data cannot preserve type 'function'";
+
+  lua_sandbox* sb = lsb_create(NULL, "lua/serialize_failure.lua", "../../modules", 32767,
+                               1000, 1024);
+  mu_assert(sb, "lsb_create() received: NULL");
+
+  int result = lsb_init(sb, NULL);
+  mu_assert(result == 0, "lsb_init() received: %d %s", result,
+            lsb_get_error(sb));
+  e = lsb_destroy(sb, output_file);
+  mu_assert(e, "lsb_destroy() received: no error");
+  mu_assert(strcmp(e, expected) == 0, "lsb_destroy() received: %s", e);
+  free(e);
+  mu_assert(file_exists(output_file) == 0, "output file was not cleaned up");
+
+  return NULL;
+}
+
+
+static char* test_serialize_noglobal()
+{
+  const char* output_file = "serialize_noglobal.preserve";
+  const char* expected = "preserve_global_data cannot access the global table";
+
+  lua_sandbox* sb = lsb_create(NULL, "lua/serialize_noglobal.lua", "../../modules",
+                               32767, 1000, 1024);
+  mu_assert(sb, "lsb_create() received: NULL");
+
+  int result = lsb_init(sb, NULL);
+  mu_assert(result == 0, "lsb_init() received: %d %s", result,
+            lsb_get_error(sb));
+  e = lsb_destroy(sb, output_file);
+  mu_assert(e, "lsb_destroy() received: no error");
+  mu_assert(strcmp(e, expected) == 0, "lsb_destroy() received: %s", e);
+  free(e);
+  mu_assert(file_exists(output_file) == 0, "output file was not cleaned up");
+
+  return NULL;
+}
+
+
+static char* benchmark_counter()
+{
+  int iter = 10000000;
+
+  lua_sandbox* sb = lsb_create(NULL, "lua/counter.lua", "../../modules", 32000, 10, 0);
+  mu_assert(sb, "lsb_create() received: NULL");
+  int result = lsb_init(sb, NULL);
+  mu_assert(result == 0, "lsb_init() received: %d %s", result,
+            lsb_get_error(sb));
+  clock_t t = clock();
+  for (int x = 0; x < iter; ++x) {
+    process(sb, 0);
+  }
+  t = clock() - t;
+  e = lsb_destroy(sb, NULL);
+  mu_assert(!e, "lsb_destroy() received: %s", e);
+  printf("benchmark_counter() %g seconds\n", ((float)t) / CLOCKS_PER_SEC / iter);
+
+  return NULL;
+}
+
+
+static char* benchmark_serialize()
+{
+  int iter = 1000;
+  const char* output_file = "serialize.preserve";
+
+  clock_t t = clock();
+  for (int x = 0; x < iter; ++x) {
+    lua_sandbox* sb = lsb_create(NULL, "lua/serialize.lua", "../../modules", 64000, 1000,
+                                 1024);
+    mu_assert(sb, "lsb_create() received: NULL");
+
+    int result = lsb_init(sb, NULL);
+    mu_assert(result == 0, "lsb_init() received: %d %s", result,
+              lsb_get_error(sb));
+    e = lsb_destroy(sb, output_file);
+    mu_assert(!e, "lsb_destroy() received: %s", e);
+  }
+  t = clock() - t;
+  printf("benchmark_serialize() %g seconds\n", ((float)t) / CLOCKS_PER_SEC / iter);
+
+  return NULL;
+}
+
+
+static char* benchmark_deserialize()
+{
+  int iter = 1000;
+
+  clock_t t = clock();
+  for (int x = 0; x < iter; ++x) {
+    lua_sandbox* sb = lsb_create(NULL, "lua/serialize.lua", "../../modules", 64000, 1000,
+                                 1024);
+    mu_assert(sb, "lsb_create() received: NULL");
+
+    int result = lsb_init(sb, "output/serialize.data");
+    mu_assert(result == 0, "lsb_init() received: %d %s", result,
+              lsb_get_error(sb));
+    e = lsb_destroy(sb, NULL);
+    mu_assert(!e, "lsb_destroy() received: %s", e);
+  }
+  t = clock() - t;
+  printf("benchmark_deserialize() %g seconds\n", ((float)t) / CLOCKS_PER_SEC / iter);
+
+  return NULL;
+}
+
+
+static char* benchmark_cbuf_restore()
+{
+  int iter = 1000;
+  const char* state_files[] = { "circular_buffer_preserve_text.preserve",
+    "circular_buffer_preserve.preserve" };
+
+  lua_sandbox* sb = lsb_create(NULL, "lua/circular_buffer_preserve.lua",
+                               "../../modules", 8000000, 100000, 1024 * 63);
+  mu_assert(sb, "lsb_create() received: NULL");
+  int result = lsb_init(sb, NULL);
+  mu_assert(result == 0, "lsb_init() received: %d %s", result,
+            lsb_get_error(sb));
+  lsb_add_function(sb, &write_output, "write");
+  result = process(sb, 0);
+  mu_assert(result == 0, "process() received: %d %s", result,
+            lsb_get_error(sb));
+  result = process(sb, 1);
+  mu_assert(result == 0, "process() received: %d %s", result,
+            lsb_get_error(sb));
+  char* expected = malloc(written_data_len + 1);
+  mu_assert(expected, "malloc failed");
+  memcpy(expected, written_data, written_data_len + 1);
+  e = lsb_destroy(sb, state_files[1]);
+  mu_assert(!e, "lsb_destroy() received: %s", e);
+
+  // the same state in the text restoration format
+  FILE* fh = fopen(state_files[0], "w");
+  mu_assert(fh, "fopen failed");
+  fprintf(fh, "_G[\"data\"]:fromstring(\"172740 1439");
+  for (int r = 0; r < 1440; ++r) {
+    fprintf(fh, " %d %.17g %.17g", r, r * 1.25, 1e6 / (r + 1));
+  }
+  fprintf(fh, "\")\n");
+  fclose(fh);
+
+  for (int i = 0; i < 2; ++i) {
+    clock_t t = clock();
+    for (int x = 0; x < iter; ++x) {
+      sb = lsb_create(NULL, "lua/circular_buffer_preserve.lua",
+                      "../../modules", 8000000, 100000, 1024 * 63);
+      mu_assert(sb, "lsb_create() received: NULL");
+      result = lsb_init(sb, state_files[i]);
+      mu_assert(result == 0, "lsb_init() received: %d %s", result,
+                lsb_get_error(sb));
+      if (x == 0) {
+        lsb_add_function(sb, &write_output, "write");
+        result = process(sb, 1);
+        mu_assert(result == 0, "process() received: %d %s", result,
+                  lsb_get_error(sb));
+        mu_assert(strcmp(expected, written_data) == 0, "received: %s",
+                  written_data);
+      }
+      e = lsb_destroy(sb, NULL);
+      mu_assert(!e, "lsb_destroy() received: %s", e);
+    }
+    t = clock() - t;
+    printf("benchmark_cbuf_restore() %s %g seconds\n", i ? "binary" : "text",
+           ((float)t) / CLOCKS_PER_SEC / iter);
+  }
+  free(expected);
+
+  return NULL;
+}
+
+
+static char* benchmark_lpeg_decoder()
+{
+  int iter = 10000;
+
+  lua_sandbox* sb = lsb_create(NULL, "lua/decoder.lua", "../../modules", 8 * 1024 * 1024, 1000000,
+                               1024 * 63);
+  mu_assert(sb, "lsb_create() received: NULL");
+  int result = lsb_init(sb, NULL);
+  mu_assert(result == 0, "lsb_init() received: %d %s", result,
+            lsb_get_error(sb));
+  lsb_add_function(sb, &write_output, "write");
+
+  clock_t t = clock();
+  for (int x = 0; x < iter; ++x) {
+    process(sb, 0);
+  }
+  t = clock() - t;
+  e = lsb_destroy(sb, NULL);
+  mu_assert(!e, "lsb_destroy() received: %s", e);
+  printf("benchmark_lpeg_decoder() %g seconds\n", ((float)t) / CLOCKS_PER_SEC / iter);
+
+  return NULL;
+}
+
+
+static char* benchmark_lua_types_output()
+{
+  int iter = 10000;
+
+  lua_sandbox* sb = lsb_create(NULL, "lua/output.lua", "../../modules", 100000, 1000,
+                               1024 * 63);
+  mu_assert(sb, "lsb_create() received: NULL");
+  int result = lsb_init(sb, NULL);
+  mu_assert(result == 0, "lsb_init() received: %d %s", result,
+            lsb_get_error(sb));
+  lsb_add_function(sb, &write_output, "write");
 
-  for (int i = 0; i < 9; ++i) {
-    result = process(sb, i);
-    mu_assert(result == 0, "process() received: %d %s", result, lsb_get_error(sb));
+  clock_t t = clock();
+  for (int x = 0; x < iter; ++x) {
+    process(sb, 0);
   }
-
+  t = clock() - t;
   e = lsb_destroy(sb, NULL);
   mu_assert(!e, "lsb_destroy() received: %s", e);
+  printf("benchmark_lua_types_output() %g seconds\n", ((float)t) / CLOCKS_PER_SEC / iter);
 
   return NULL;
 }
 
-static char* test_lpeg_ip_address()
+
+static char* benchmark_cbuf_output()
 {
-  lua_sandbox* sb = lsb_create(NULL, "lua/lpeg_ip_address.lua", "../../modules", 8e6, 1e6, 63 * 1024);
-  mu_assert(sb, "lsb_create() received: NULL");
+  int iter = 10000;
 
+  lua_sandbox* sb = lsb_create(NULL, "lua/output.lua", "../../modules", 100000, 1000,
+                               1024 * 63);
+  mu_assert(sb, "lsb_create() received: NULL");
   int result = lsb_init(sb, NULL);
-  mu_assert(result == 0, "lsb_init() received: %d %s", result, lsb_get_error(sb));
+  mu_assert(result == 0, "lsb_init() received: %d %s", result,
+            lsb_get_error(sb));
+  lsb_add_function(sb, &write_output, "write");
 
-  for (int i = 0; i < 4; ++i) {
-    result = process(sb, i);
-    mu_assert(result == 0, "process() received: %d %s", result, lsb_get_error(sb));
+  clock_t t = clock();
+  for (int x = 0; x < iter; ++x) {
+    process(sb, 1);
   }
-
+  t = clock() - t;
   e = lsb_destroy(sb, NULL);
   mu_assert(!e, "lsb_destroy() received: %s", e);
+  printf("benchmark_cbuf_output() %g seconds\n", ((float)t) / CLOCKS_PER_SEC / iter);
 
   return NULL;
 }
 
 
-static char* test_lpeg_syslog()
+static char* benchmark_cbuf_format()
 {
-  const char* tests[] = {
-    "{\"msg\":\"(root) CMD (   cd \\/ && run-parts --report \\/etc\\/cron.hourly)\",\"timestamp\":1391955421000,\"syslogtag\":{\"pid\":20758,\"programname\":\"CRON\"},\"hostname\":\"trink-x230\"}\n"
-    , "{\"msg\":\"Kernel logging (proc) stopped.\",\"timestamp\":1392049319111.5369,\"syslogtag\":{\"programname\":\"kernel\"},\"hostname\":\"trink-x230\"}\n"
-    , "{\"hostname\":\"trink-x230\",\"msg\":\"imklog 5.8.6, log source = \\/proc\\/kmsg started.\",\"timestamp\":1392049995407.9351,\"syslogtag\":{\"programname\":\"kernel\"},\"pri\":{\"severity\":6,\"facility\":0}}\n"
-    , "{\"hostname\":\"trink-x230\",\"msg\":\"imklog 5.8.6, log source = \\/proc\\/kmsg started.\",\"timestamp\":1392021527000,\"syslogtag\":{\"programname\":\"kernel\"},\"pri\":{\"severity\":6,\"facility\":0}}\n"
-    , "{\"syslogfacility\":0,\"$year\":\"2014\",\"source\":\"trink-x230\",\"syslogpriority-text\":6,\"syslogfacility-text\":0,\"msg\":\"imklog 5.8.6, log source = \\/proc\\/kmsg started.\",\"procid\":\"-\",\"structured-data\":\"-\",\"hostname\":\"trink-x230\",\"app-name\":\"kernel\",\"programname\":\"kernel\",\"$minute\":\"20\",\"$qhour\":\"01\",\"msgid\":\"imklog\",\"$hhour\":\"00\",\"pri-text\":0,\"fromhost-ip\":\"127.0.0.1\",\"$hour\":\"09\",\"pri\":{\"severity\":6,\"facility\":0},\"$day\":\"10\",\"$month\":\"02\",\"$now\":\"2014-02-10\",\"protocol-version\":\"0\",\"timegenerated\":1.392024053e+18,\"timestamp\":1392052853559.9338,\"syslogpriority\":6,\"iut\":\"1\",\"syslogtag\":{\"programname\":\"kernel\"},\"fromhost\":\"trink-x230\"}\n"
-    , NULL
-  };
+  int iter = 10000;
+  const char* formats[] = { "cbuf", "cbufb" };
 
-  lua_sandbox* sb = lsb_create(NULL, "lua/lpeg_syslog.lua", "../../modules", 8e6, 1e6, 63 * 1024);
+  lua_sandbox* sb = lsb_create(NULL, "lua/circular_buffer_format.lua",
+                               "../../modules", 8000000, 100000, 1024 * 63);
   mu_assert(sb, "lsb_create() received: NULL");
-
   int result = lsb_init(sb, NULL);
-  mu_assert(result == 0, "lsb_init() received: %d %s", result, lsb_get_error(sb));
+  mu_assert(result == 0, "lsb_init() received: %d %s", result,
+            lsb_get_error(sb));
   lsb_add_function(sb, &write_output, "write");
 
-  for (int i = 0; tests[i]; ++i) {
-    result = process(sb, i);
-    mu_assert(result == 0, "process() received: %d %s", result, lsb_get_error(sb));
-    mu_assert(strcmp(tests[i], written_data) == 0, "test: %d received: %s", i, written_data);
+  for (int format = 0; format < 2; ++format) {
+    clock_t t = clock();
+    for (int x = 0; x < iter; ++x) {
+      process(sb, format);
+    }
+    t = clock() - t;
+    mu_assert(lsb_get_state(sb) == LSB_RUNNING,
+              "benchmark_cbuf_format() failed %s", lsb_get_error(sb));
+    printf("benchmark_cbuf_format() %s %zu bytes %g seconds\n",
+           formats[format], written_data_len,
+           ((float)t) / CLOCKS_PER_SEC / iter);
   }
-
   e = lsb_destroy(sb, NULL);
   mu_assert(!e, "lsb_destroy() received: %s", e);
 
@@ -895,26 +2417,26 @@ static char* test_lpeg_syslog()
 }
 
 
-static char* test_util()
+static char* benchmark_cbuf_mannwhitneyu()
 {
-  const char* tests[] = {
-    "{\"toplevel\":0,\"struct.item1\":1,\"struct.item0\":0,\"struct.item2.nested\":\"n1\"}\n"
-    , NULL
-  };
+  int iter = 10000;
 
-  lua_sandbox* sb = lsb_create(NULL, "lua/util_test.lua", "../../modules", 8e6, 1e6, 63 * 1024);
+  lua_sandbox* sb = lsb_create(NULL, "lua/circular_buffer_anomaly.lua",
+                               "../../modules", 8000000, 1000000, 1024 * 63);
   mu_assert(sb, "lsb_create() received: NULL");
-
   int result = lsb_init(sb, NULL);
-  mu_assert(result == 0, "lsb_init() received: %d %s", result, lsb_get_error(sb));
-  lsb_add_function(sb, &write_output, "write");
+  mu_assert(result == 0, "lsb_init() received: %d %s", result,
+            lsb_get_error(sb));
 
-  for (int i = 0; tests[i]; ++i) {
-    result = process(sb, i);
-    mu_assert(result == 0, "process() received: %d %s", result, lsb_get_error(sb));
-    mu_assert(strcmp(tests[i], written_data) == 0, "test: %d received: %s", i, written_data);
+  clock_t t = clock();
+  for (int x = 0; x < iter; ++x) {
+    process(sb, 0);
   }
-
+  t = clock() - t;
+  mu_assert(lsb_get_state(sb) == LSB_RUNNING,
+            "benchmark_cbuf_mannwhitneyu() failed %s", lsb_get_error(sb));
+  printf("benchmark_cbuf_mannwhitneyu() 1440 rows %g seconds\n",
+         ((float)t) / CLOCKS_PER_SEC / iter);
   e = lsb_destroy(sb, NULL);
   mu_assert(!e, "lsb_destroy() received: %s", e);
 
@@ -922,149 +2444,194 @@ static char* test_util()
 }
 
 
-static char* test_serialize()
+static char* benchmark_cbuf_detector()
 {
-  const char* output_file = "serialize.preserve";
-  lua_sandbox* sb = lsb_create(NULL, "lua/serialize.lua", "../../modules", 64000, 1000, 64000);
-  mu_assert(sb, "lsb_create() received: NULL");
+  int iter = 1000;
+  const char* methods[] = { "built-in", "lua" };
 
+  lua_sandbox* sb = lsb_create(NULL, "lua/circular_buffer_forecast.lua",
+                               "../../modules", 8000000, 1000000, 1024 * 63);
+  mu_assert(sb, "lsb_create() received: NULL");
   int result = lsb_init(sb, NULL);
   mu_assert(result == 0, "lsb_init() received: %d %s", result,
             lsb_get_error(sb));
-  e = lsb_destroy(sb, output_file);
-  mu_assert(!e, "lsb_destroy() received: %s", e);
 
-#ifdef LUA_JIT
-  char* expected = read_file("output/serialize.data");
-#else
-  char* expected = read_file("output/serialize.lua51.data");
-#endif
-  char* actual = read_file(output_file);
-  mu_assert(strcmp(expected, actual) == 0, "serialization mismatch");
-  free(expected);
-  free(actual);
+  for (int method = 0; method < 2; ++method) {
+    clock_t t = clock();
+    for (int x = 0; x < iter; ++x) {
+      process(sb, method);
+    }
+    t = clock() - t;
+    mu_assert(lsb_get_state(sb) == LSB_RUNNING,
+              "benchmark_cbuf_detector() failed %s", lsb_get_error(sb));
+    printf("benchmark_cbuf_detector() %s 20 columns per tick %g seconds\n",
+           methods[method], ((float)t) / CLOCKS_PER_SEC / iter);
+  }
+  e = lsb_destroy(sb, NULL);
+  mu_assert(!e, "lsb_destroy() received: %s", e);
 
   return NULL;
 }
 
-static char* test_serialize_failure()
+
+static char* benchmark_cbuf_merge()
 {
-  const char* output_file = "serialize_failure.preserve";
-  const char* expected = "serialize_data cannot preserve type 'function'";
+  int iter = 100;
+  const char* methods[] = { "merge", "lua parse + add" };
 
-  lua_sandbox* sb = lsb_create(NULL, "lua/serialize_failure.lua", "../../modules", 32767,
-                               1000, 1024);
+  lua_sandbox* sb = lsb_create(NULL, "lua/circular_buffer_fanin.lua",
+                               "../../modules", 8000000, 1000000, 1024 * 63);
   mu_assert(sb, "lsb_create() received: NULL");
-
   int result = lsb_init(sb, NULL);
   mu_assert(result == 0, "lsb_init() received: %d %s", result,
             lsb_get_error(sb));
-  e = lsb_destroy(sb, output_file);
-  mu_assert(e, "lsb_destroy() received: no error");
-  mu_assert(strcmp(e, expected) == 0, "lsb_destroy() received: %s", e);
-  free(e);
-  mu_assert(file_exists(output_file) == 0, "output file was not cleaned up");
+
+  for (int method = 0; method < 2; ++method) {
+    clock_t t = clock();
+    for (int x = 0; x < iter; ++x) {
+      process(sb, method);
+    }
+    t = clock() - t;
+    mu_assert(lsb_get_state(sb) == LSB_RUNNING,
+              "benchmark_cbuf_merge() failed %s", lsb_get_error(sb));
+    printf("benchmark_cbuf_merge() %s 10 x 1440 rows %g seconds\n",
+           methods[method], ((float)t) / CLOCKS_PER_SEC / iter);
+  }
+  e = lsb_destroy(sb, NULL);
+  mu_assert(!e, "lsb_destroy() received: %s", e);
 
   return NULL;
 }
 
 
-static char* test_serialize_noglobal()
+static char* benchmark_cbuf_expr()
 {
-  const char* output_file = "serialize_noglobal.preserve";
-  const char* expected = "preserve_global_data cannot access the global table";
+  int iter = 100;
+  const char* methods[] = { "compute_expr error rate", "lua error rate",
+    "combine 10 hosts", "lua 10 hosts" };
 
-  lua_sandbox* sb = lsb_create(NULL, "lua/serialize_noglobal.lua", "../../modules",
-                               32767, 1000, 1024);
+  lua_sandbox* sb = lsb_create(NULL, "lua/circular_buffer_ratio.lua",
+                               "../../modules", 8000000, 1000000, 1024 * 63);
   mu_assert(sb, "lsb_create() received: NULL");
-
   int result = lsb_init(sb, NULL);
   mu_assert(result == 0, "lsb_init() received: %d %s", result,
             lsb_get_error(sb));
-  e = lsb_destroy(sb, output_file);
-  mu_assert(e, "lsb_destroy() received: no error");
-  mu_assert(strcmp(e, expected) == 0, "lsb_destroy() received: %s", e);
-  free(e);
-  mu_assert(file_exists(output_file) == 0, "output file was not cleaned up");
+
+  for (int method = 0; method < 4; ++method) {
+    clock_t t = clock();
+    for (int x = 0; x < iter; ++x) {
+      process(sb, method);
+    }
+    t = clock() - t;
+    mu_assert(lsb_get_state(sb) == LSB_RUNNING,
+              "benchmark_cbuf_expr() failed %s", lsb_get_error(sb));
+    printf("benchmark_cbuf_expr() %s 1440 rows %g seconds\n",
+           methods[method], ((float)t) / CLOCKS_PER_SEC / iter);
+  }
+  e = lsb_destroy(sb, NULL);
+  mu_assert(!e, "lsb_destroy() received: %s", e);
 
   return NULL;
 }
 
 
-static char* benchmark_counter()
+static char* benchmark_stats_ndtr()
 {
-  int iter = 10000000;
+  int iter = 1000;
+  const char* methods[] = { "batched", "scalar" };
 
-  lua_sandbox* sb = lsb_create(NULL, "lua/counter.lua", "../../modules", 32000, 10, 0);
+  lua_sandbox* sb = lsb_create(NULL, "lua/stats_pvalue.lua", "../../modules",
+                               8000000, 1000000, 1024 * 63);
   mu_assert(sb, "lsb_create() received: NULL");
   int result = lsb_init(sb, NULL);
   mu_assert(result == 0, "lsb_init() received: %d %s", result,
             lsb_get_error(sb));
-  clock_t t = clock();
-  for (int x = 0; x < iter; ++x) {
-    process(sb, 0);
+
+  for (int method = 0; method < 2; ++method) {
+    clock_t t = clock();
+    for (int x = 0; x < iter; ++x) {
+      process(sb, method);
+    }
+    t = clock() - t;
+    mu_assert(lsb_get_state(sb) == LSB_RUNNING,
+              "benchmark_stats_ndtr() failed %s", lsb_get_error(sb));
+    printf("benchmark_stats_ndtr() %s 1440 rows %g seconds\n",
+           methods[method], ((float)t) / CLOCKS_PER_SEC / iter);
   }
-  t = clock() - t;
   e = lsb_destroy(sb, NULL);
   mu_assert(!e, "lsb_destroy() received: %s", e);
-  printf("benchmark_counter() %g seconds\n", ((float)t) / CLOCKS_PER_SEC / iter);
 
   return NULL;
 }
 
 
-static char* benchmark_serialize()
+static char* benchmark_cbuf_quantile()
 {
   int iter = 1000;
-  const char* output_file = "serialize.preserve";
+  const char* methods[] = { "sketch", "lua table" };
 
-  clock_t t = clock();
-  for (int x = 0; x < iter; ++x) {
-    lua_sandbox* sb = lsb_create(NULL, "lua/serialize.lua", "../../modules", 64000, 1000,
-                                 1024);
-    mu_assert(sb, "lsb_create() received: NULL");
+  lua_sandbox* sb = lsb_create(NULL, "lua/circular_buffer_percentile.lua",
+                               "../../modules", 8000000, 1000000, 1024 * 63);
+  mu_assert(sb, "lsb_create() received: NULL");
+  int result = lsb_init(sb, NULL);
+  mu_assert(result == 0, "lsb_init() received: %d %s", result,
+            lsb_get_error(sb));
 
-    int result = lsb_init(sb, NULL);
-    mu_assert(result == 0, "lsb_init() received: %d %s", result,
-              lsb_get_error(sb));
-    e = lsb_destroy(sb, output_file);
-    mu_assert(!e, "lsb_destroy() received: %s", e);
+  for (int method = 0; method < 2; ++method) {
+    clock_t t = clock();
+    for (int x = 0; x < iter; ++x) {
+      process(sb, method);
+    }
+    t = clock() - t;
+    mu_assert(lsb_get_state(sb) == LSB_RUNNING,
+              "benchmark_cbuf_quantile() failed %s", lsb_get_error(sb));
+    printf("benchmark_cbuf_quantile() %s 1000 samples + p99 %g seconds\n",
+           methods[method], ((float)t) / CLOCKS_PER_SEC / iter);
   }
-  t = clock() - t;
-  printf("benchmark_serialize() %g seconds\n", ((float)t) / CLOCKS_PER_SEC / iter);
+  e = lsb_destroy(sb, NULL);
+  mu_assert(!e, "lsb_destroy() received: %s", e);
 
   return NULL;
 }
 
 
-static char* benchmark_deserialize()
+static char* benchmark_cbuf_distinct()
 {
   int iter = 1000;
+  const char* methods[] = { "distinct column", "lua set" };
 
-  clock_t t = clock();
-  for (int x = 0; x < iter; ++x) {
-    lua_sandbox* sb = lsb_create(NULL, "lua/serialize.lua", "../../modules", 64000, 1000,
-                                 1024);
+  for (int method = 0; method < 2; ++method) {
+    lua_sandbox* sb = lsb_create(NULL, "lua/circular_buffer_unique.lua",
+                                 "../../modules", 8000000, 1000000,
+                                 1024 * 63);
     mu_assert(sb, "lsb_create() received: NULL");
-
-    int result = lsb_init(sb, "output/serialize.data");
+    int result = lsb_init(sb, NULL);
     mu_assert(result == 0, "lsb_init() received: %d %s", result,
               lsb_get_error(sb));
+
+    clock_t t = clock();
+    for (int x = 0; x < iter; ++x) {
+      process(sb, method);
+    }
+    t = clock() - t;
+    mu_assert(lsb_get_state(sb) == LSB_RUNNING,
+              "benchmark_cbuf_distinct() failed %s", lsb_get_error(sb));
+    printf("benchmark_cbuf_distinct() %s 1000 items + 60 row union %g seconds"
+           " %u bytes\n", methods[method], ((float)t) / CLOCKS_PER_SEC / iter,
+           lsb_usage(sb, LSB_UT_MEMORY, LSB_US_MAXIMUM));
     e = lsb_destroy(sb, NULL);
     mu_assert(!e, "lsb_destroy() received: %s", e);
   }
-  t = clock() - t;
-  printf("benchmark_deserialize() %g seconds\n", ((float)t) / CLOCKS_PER_SEC / iter);
 
   return NULL;
 }
 
 
-static char* benchmark_lpeg_decoder()
+static char* benchmark_table_output()
 {
   int iter = 10000;
 
-  lua_sandbox* sb = lsb_create(NULL, "lua/decoder.lua", "../../modules", 8 * 1024 * 1024, 1000000,
+  lua_sandbox* sb = lsb_create(NULL, "lua/output.lua", "../../modules", 100000, 1000,
                                1024 * 63);
   mu_assert(sb, "lsb_create() received: NULL");
   int result = lsb_init(sb, NULL);
@@ -1074,22 +2641,21 @@ static char* benchmark_lpeg_decoder()
 
   clock_t t = clock();
   for (int x = 0; x < iter; ++x) {
-    process(sb, 0);
+    process(sb, 2);
   }
   t = clock() - t;
   e = lsb_destroy(sb, NULL);
   mu_assert(!e, "lsb_destroy() received: %s", e);
-  printf("benchmark_lpeg_decoder() %g seconds\n", ((float)t) / CLOCKS_PER_SEC / iter);
+  printf("benchmark_table_output() %g seconds\n", ((float)t) / CLOCKS_PER_SEC / iter);
 
   return NULL;
 }
 
-
-static char* benchmark_lua_types_output()
+static char* benchmark_message_output()
 {
-  int iter = 10000;
+  int iter = 100000;
 
-  lua_sandbox* sb = lsb_create(NULL, "lua/output.lua", "../../modules", 100000, 1000,
+  lua_sandbox* sb = lsb_create(NULL, "lua/output.lua", "../../modules", 1024 * 1024, 1000,
                                1024 * 63);
   mu_assert(sb, "lsb_create() received: NULL");
   int result = lsb_init(sb, NULL);
@@ -1099,23 +2665,24 @@ static char* benchmark_lua_types_output()
 
   clock_t t = clock();
   for (int x = 0; x < iter; ++x) {
-    process(sb, 0);
+    process(sb, 9);
   }
   t = clock() - t;
+  mu_assert(lsb_get_state(sb) == LSB_RUNNING, "benchmark_message_output() failed %s", lsb_get_error(sb));
   e = lsb_destroy(sb, NULL);
   mu_assert(!e, "lsb_destroy() received: %s", e);
-  printf("benchmark_lua_types_output() %g seconds\n", ((float)t) / CLOCKS_PER_SEC / iter);
+  printf("benchmark_message_output() %g seconds\n", ((float)t) / CLOCKS_PER_SEC / iter);
 
   return NULL;
 }
 
 
-static char* benchmark_cbuf_output()
+static char* benchmark_template_output()
 {
-  int iter = 10000;
+  int iter = 100000;
 
-  lua_sandbox* sb = lsb_create(NULL, "lua/output.lua", "../../modules", 100000, 1000,
-                               1024 * 63);
+  lua_sandbox* sb = lsb_create(NULL, "lua/message_template.lua", "../../modules",
+                               1024 * 1024, 1000, 1024 * 63);
   mu_assert(sb, "lsb_create() received: NULL");
   int result = lsb_init(sb, NULL);
   mu_assert(result == 0, "lsb_init() received: %d %s", result,
@@ -1124,23 +2691,24 @@ static char* benchmark_cbuf_output()
 
   clock_t t = clock();
   for (int x = 0; x < iter; ++x) {
-    process(sb, 1);
+    process(sb, 0);
   }
   t = clock() - t;
+  mu_assert(lsb_get_state(sb) == LSB_RUNNING, "benchmark_template_output() failed %s", lsb_get_error(sb));
   e = lsb_destroy(sb, NULL);
   mu_assert(!e, "lsb_destroy() received: %s", e);
-  printf("benchmark_cbuf_output() %g seconds\n", ((float)t) / CLOCKS_PER_SEC / iter);
+  printf("benchmark_template_output() %g seconds\n", ((float)t) / CLOCKS_PER_SEC / iter);
 
   return NULL;
 }
 
 
-static char* benchmark_table_output()
+static char* benchmark_integer_output()
 {
-  int iter = 10000;
+  int iter = 100000;
 
-  lua_sandbox* sb = lsb_create(NULL, "lua/output.lua", "../../modules", 100000, 1000,
-                               1024 * 63);
+  lua_sandbox* sb = lsb_create(NULL, "lua/message_template.lua", "../../modules",
+                               1024 * 1024, 1000, 1024 * 63);
   mu_assert(sb, "lsb_create() received: NULL");
   int result = lsb_init(sb, NULL);
   mu_assert(result == 0, "lsb_init() received: %d %s", result,
@@ -1149,19 +2717,23 @@ static char* benchmark_table_output()
 
   clock_t t = clock();
   for (int x = 0; x < iter; ++x) {
-    process(sb, 2);
+    process(sb, 6);
   }
   t = clock() - t;
+  mu_assert(lsb_get_state(sb) == LSB_RUNNING, "benchmark_integer_output() failed %s", lsb_get_error(sb));
   e = lsb_destroy(sb, NULL);
   mu_assert(!e, "lsb_destroy() received: %s", e);
-  printf("benchmark_table_output() %g seconds\n", ((float)t) / CLOCKS_PER_SEC / iter);
+  printf("benchmark_integer_output() %g seconds\n", ((float)t) / CLOCKS_PER_SEC / iter);
 
   return NULL;
 }
 
+
 static char* benchmark_cbuf_add()
 {
   int iter = 1000000;
+  const char* modes[] = { "add", "add x20", "add_row x20", "add_many x20",
+    "delta add_row x20" };
 
   lua_sandbox* sb = lsb_create(NULL, "lua/circular_buffer_add.lua", "../../modules", 8000000, 1000,
                                1024 * 63);
@@ -1171,16 +2743,122 @@ static char* benchmark_cbuf_add()
             lsb_get_error(sb));
 
   double ts = 0;
-  clock_t t = clock();
-  for (int x = 0; x < iter; ++x) {
-    process(sb, ts);
-    ts += 1e9;
+  for (int mode = 0; mode < 5; ++mode) {
+    report(sb, mode);
+    clock_t t = clock();
+    for (int x = 0; x < iter; ++x) {
+      process(sb, ts);
+      ts += 1e9;
+    }
+    t = clock() - t;
+    mu_assert(lsb_get_state(sb) == LSB_RUNNING, "benchmark_cbuf_add() failed %s", lsb_get_error(sb));
+    printf("benchmark_cbuf_add() %s %g seconds\n", modes[mode],
+           ((float)t) / CLOCKS_PER_SEC / iter);
+  }
+  e = lsb_destroy(sb, NULL);
+  mu_assert(!e, "lsb_destroy() received: %s", e);
+
+  return NULL;
+}
+
+
+static char* benchmark_cbuf_cold()
+{
+  int iter = 100;
+  const char* modes[] = { "uncompressed", "hot_rows = 60" };
+
+  for (int mode = 0; mode < 2; ++mode) {
+    lua_sandbox* sb = lsb_create(NULL, "lua/circular_buffer_memory.lua",
+                                 "../../modules", 8000000, 100000, 1024 * 63);
+    mu_assert(sb, "lsb_create() received: NULL");
+    int result = lsb_init(sb, NULL);
+    mu_assert(result == 0, "lsb_init() received: %d %s", result,
+              lsb_get_error(sb));
+    report(sb, mode);
+    for (int r = 10080; r < 20160; ++r) { // start after the initial window
+      process(sb, r * 60e9);
+    }
+    unsigned memory = lsb_usage(sb, LSB_UT_MEMORY, LSB_US_CURRENT);
+
+    clock_t t = clock();
+    for (int x = 0; x < iter; ++x) {
+      process(sb, -1);
+    }
+    t = clock() - t;
+    mu_assert(lsb_get_state(sb) == LSB_RUNNING,
+              "benchmark_cbuf_cold() failed %s", lsb_get_error(sb));
+    printf("benchmark_cbuf_cold() %s memory %u bytes compute %g seconds\n",
+           modes[mode], memory, ((float)t) / CLOCKS_PER_SEC / iter);
+    e = lsb_destroy(sb, NULL);
+    mu_assert(!e, "lsb_destroy() received: %s", e);
+  }
+  return NULL;
+}
+
+
+static char* benchmark_cbuf_sparse()
+{
+  int iter = 100;
+  const char* modes[] = { "dense", "sparse" };
+
+  for (int mode = 0; mode < 2; ++mode) {
+    lua_sandbox* sb = lsb_create(NULL, "lua/circular_buffer_sparse_memory.lua",
+                                 "../../modules", 8000000, 100000, 1024 * 63);
+    mu_assert(sb, "lsb_create() received: NULL");
+    int result = lsb_init(sb, NULL);
+    mu_assert(result == 0, "lsb_init() received: %d %s", result,
+              lsb_get_error(sb));
+    report(sb, mode);
+    for (int r = 1440; r < 2880; ++r) { // start after the initial window
+      process(sb, r * 60e9);
+    }
+    unsigned memory = lsb_usage(sb, LSB_UT_MEMORY, LSB_US_CURRENT);
+
+    clock_t t = clock();
+    for (int x = 0; x < iter; ++x) {
+      process(sb, -1);
+    }
+    t = clock() - t;
+    mu_assert(lsb_get_state(sb) == LSB_RUNNING,
+              "benchmark_cbuf_sparse() failed %s", lsb_get_error(sb));
+    printf("benchmark_cbuf_sparse() %s memory %u bytes compute %g seconds\n",
+           modes[mode], memory, ((float)t) / CLOCKS_PER_SEC / iter);
+    e = lsb_destroy(sb, NULL);
+    mu_assert(!e, "lsb_destroy() received: %s", e);
+  }
+  return NULL;
+}
+
+
+static char* benchmark_cbuf_compute()
+{
+  int iter = 1000;
+  const char* layouts[] = { "row layout", "column layout",
+    "running row layout", "row layout range", "prefix row layout range" };
+
+  lua_sandbox* sb = lsb_create(NULL, "lua/circular_buffer_compute.lua",
+                               "../../modules", 8000000, 10000, 1024 * 63);
+  mu_assert(sb, "lsb_create() received: NULL");
+  int result = lsb_init(sb, NULL);
+  mu_assert(result == 0, "lsb_init() received: %d %s", result,
+            lsb_get_error(sb));
+  for (int r = 0; r < 1440; ++r) {
+    process(sb, r + 5);
+  }
+
+  for (int layout = 0; layout < 5; ++layout) {
+    clock_t t = clock();
+    for (int x = 0; x < iter; ++x) {
+      process(sb, layout);
+    }
+    t = clock() - t;
+    mu_assert(lsb_get_state(sb) == LSB_RUNNING,
+              "benchmark_cbuf_compute() failed %s", lsb_get_error(sb));
+    printf("benchmark_cbuf_compute() %s %g seconds\n",
+           layouts[layout], ((float)t) / CLOCKS_PER_SEC / iter);
   }
-  t = clock() - t;
-  mu_assert(lsb_get_state(sb) == LSB_RUNNING, "benchmark_cbuf_add() failed %s", lsb_get_error(sb));
   e = lsb_destroy(sb, NULL);
   mu_assert(!e, "lsb_destroy() received: %s", e);
-  printf("benchmark_cbuf_add() %g seconds\n", ((float)t) / CLOCKS_PER_SEC / iter);
 
   return NULL;
 }
@@ -1196,9 +2874,30 @@ static char* all_tests()
   mu_run_test(test_simple);
   mu_run_test(test_output);
   mu_run_test(test_output_errors);
+  mu_run_test(test_output_batch);
+  mu_run_test(test_message_template);
+  mu_run_test(test_read_message);
+  mu_run_test(test_read_message_host);
+  mu_run_test(test_uuid);
   mu_run_test(test_cbuf_errors);
   mu_run_test(test_cbuf);
   mu_run_test(test_cbuf_delta);
+  mu_run_test(test_cbuf_layout);
+  mu_run_test(test_cbuf_running);
+  mu_run_test(test_cbuf_storage);
+  mu_run_test(test_cbuf_cold);
+  mu_run_test(test_cbuf_sparse);
+  mu_run_test(test_cbuf_write_stats);
+  mu_run_test(test_cbuf_restore);
+  mu_run_test(test_cbuf_tiered);
+  mu_run_test(test_cbuf_binary);
+  mu_run_test(test_cbuf_mannwhitneyu);
+  mu_run_test(test_cbuf_detector);
+  mu_run_test(test_cbuf_expr);
+  mu_run_test(test_cbuf_merge);
+  mu_run_test(test_stats);
+  mu_run_test(test_cbuf_quantile);
+  mu_run_test(test_cbuf_distinct);
   mu_run_test(test_cjson);
   mu_run_test(test_errors);
   mu_run_test(test_lpeg);
@@ -1215,11 +2914,26 @@ static char* all_tests()
   mu_run_test(benchmark_counter);
   mu_run_test(benchmark_serialize);
   mu_run_test(benchmark_deserialize);
+  mu_run_test(benchmark_cbuf_restore);
   mu_run_test(benchmark_lpeg_decoder);
   mu_run_test(benchmark_lua_types_output);
   mu_run_test(benchmark_cbuf_output);
+  mu_run_test(benchmark_cbuf_format);
+  mu_run_test(benchmark_cbuf_mannwhitneyu);
+  mu_run_test(benchmark_cbuf_detector);
+  mu_run_test(benchmark_cbuf_expr);
+  mu_run_test(benchmark_cbuf_merge);
+  mu_run_test(benchmark_stats_ndtr);
+  mu_run_test(benchmark_cbuf_quantile);
+  mu_run_test(benchmark_cbuf_distinct);
   mu_run_test(benchmark_table_output);
+  mu_run_test(benchmark_message_output);
+  mu_run_test(benchmark_template_output);
+  mu_run_test(benchmark_integer_output);
   mu_run_test(benchmark_cbuf_add);
+  mu_run_test(benchmark_cbuf_compute);
+  mu_run_test(benchmark_cbuf_cold);
+  mu_run_test(benchmark_cbuf_sparse);
   return NULL;
 }
 
@@ -0,0 +1,289 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/// @brief Element-wise column expression implementation @file
+
+#include "vector_expr.h"
+
+#include <ctype.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct parser
+{
+  vexpr*      e;
+  const char* s;
+  const char* p;
+  const char* error;
+  unsigned    depth;
+  unsigned    nesting;
+} parser;
+
+
+static void skip_space(parser* ps)
+{
+  while (isspace((unsigned char)*ps->p)) ++ps->p;
+}
+
+
+static int fail(parser* ps, const char* error)
+{
+  if (!ps->error) ps->error = error;
+  return 0;
+}
+
+
+// Appends an op and tracks the evaluation stack depth.
+static int emit(parser* ps, VEXPR_OP op, unsigned slot, double value)
+{
+  if (ps->e->n == VEXPR_MAX_OPS) return fail(ps, "expression too long");
+  vexpr_op* o = &ps->e->ops[ps->e->n++];
+  o->op = op;
+  o->slot = slot;
+  o->value = value;
+  switch (op) {
+  case VEXPR_CONST:
+  case VEXPR_COLUMN:
+    if (++ps->depth > VEXPR_MAX_DEPTH) {
+      return fail(ps, "expression too deeply nested");
+    }
+    break;
+  case VEXPR_NEG:
+  case VEXPR_ABS:
+  case VEXPR_SQRT:
+    break;
+  default:
+    --ps->depth;
+    break;
+  }
+  return 1;
+}
+
+
+// Parses a column reference, returns the zero based column.
+static int parse_column(parser* ps, unsigned* column)
+{
+  char* end;
+  if (*ps->p != 'c' || !isdigit((unsigned char)ps->p[1])) {
+    return fail(ps, "column reference expected");
+  }
+  unsigned long c = strtoul(ps->p + 1, &end, 10);
+  if (c == 0 || c > 0xffff) return fail(ps, "column out of range");
+  ps->p = end;
+  *column = (unsigned)c - 1;
+  return 1;
+}
+
+
+static int parse_expr(parser* ps);
+static int parse_unary(parser* ps);
+
+static int parse_operand(parser* ps)
+{
+  static const struct {
+    const char* name;
+    VEXPR_OP op;
+    int args;
+  } functions[] = {
+    { "abs", VEXPR_ABS, 1 },
+    { "sqrt", VEXPR_SQRT, 1 },
+    { "min", VEXPR_MIN, 2 },
+    { "max", VEXPR_MAX, 2 },
+    { NULL, VEXPR_CONST, 0 }
+  };
+
+  skip_space(ps);
+  const char* start = ps->p;
+  if (*ps->p == '-') {
+    ++ps->p;
+    return parse_unary(ps) && emit(ps, VEXPR_NEG, 0, 0);
+  }
+  if (*ps->p == '(') {
+    ++ps->p;
+    if (!parse_expr(ps)) return 0;
+    skip_space(ps);
+    if (*ps->p != ')') return fail(ps, "')' expected");
+    ++ps->p;
+    return 1;
+  }
+  if (isdigit((unsigned char)*ps->p) || *ps->p == '.') {
+    char* end;
+    double value = strtod(ps->p, &end);
+    if (end == ps->p) return fail(ps, "number expected");
+    ps->p = end;
+    return emit(ps, VEXPR_CONST, 0, value);
+  }
+  if (*ps->p == 'c' && isdigit((unsigned char)ps->p[1])) {
+    unsigned column, slot;
+    if (!parse_column(ps, &column)) return 0;
+    vexpr* e = ps->e;
+    for (slot = 0; slot < e->slots && e->columns[slot] != column; ++slot);
+    if (slot == e->slots) e->columns[e->slots++] = column;
+    return emit(ps, VEXPR_COLUMN, slot, 0);
+  }
+  while (isalpha((unsigned char)*ps->p)) ++ps->p;
+  size_t len = ps->p - start;
+  for (int i = 0; functions[i].name; ++i) {
+    if (len != strlen(functions[i].name)
+        || strncmp(start, functions[i].name, len) != 0) {
+      continue;
+    }
+    skip_space(ps);
+    if (*ps->p != '(') return fail(ps, "'(' expected");
+    ++ps->p;
+    for (int a = 0; a < functions[i].args; ++a) {
+      if (a > 0) {
+        skip_space(ps);
+        if (*ps->p != ',') return fail(ps, "',' expected");
+        ++ps->p;
+      }
+      if (!parse_expr(ps)) return 0;
+    }
+    skip_space(ps);
+    if (*ps->p != ')') return fail(ps, "')' expected");
+    ++ps->p;
+    return emit(ps, functions[i].op, 0, 0);
+  }
+  ps->p = start;
+  return fail(ps, "unexpected symbol");
+}
+
+
+// Every nested operand passes through here; the nesting is bounded so deep
+// input fails instead of exhausting the C stack.
+static int parse_unary(parser* ps)
+{
+  if (ps->nesting == VEXPR_MAX_NESTING) {
+    return fail(ps, "expression too deeply nested");
+  }
+  ++ps->nesting;
+  int ok = parse_operand(ps);
+  --ps->nesting;
+  return ok;
+}
+
+
+static int parse_term(parser* ps)
+{
+  if (!parse_unary(ps)) return 0;
+  for (;;) {
+    skip_space(ps);
+    char c = *ps->p;
+    if (c != '*' && c != '/') return 1;
+    ++ps->p;
+    if (!parse_unary(ps)) return 0;
+    if (!emit(ps, c == '*' ? VEXPR_MUL : VEXPR_DIV, 0, 0)) return 0;
+  }
+}
+
+
+static int parse_expr(parser* ps)
+{
+  if (!parse_term(ps)) return 0;
+  for (;;) {
+    skip_space(ps);
+    char c = *ps->p;
+    if (c != '+' && c != '-') return 1;
+    ++ps->p;
+    if (!parse_term(ps)) return 0;
+    if (!emit(ps, c == '+' ? VEXPR_ADD : VEXPR_SUB, 0, 0)) return 0;
+  }
+}
+
+
+const char* vexpr_compile(vexpr* e, const char* s, size_t* pos)
+{
+  parser ps = { e, s, s, NULL, 0, 0 };
+  e->n = 0;
+  e->slots = 0;
+  e->destination = 0;
+  e->assign = 0;
+
+  // optional cN = destination
+  skip_space(&ps);
+  const char* start = ps.p;
+  if (*ps.p == 'c' && isdigit((unsigned char)ps.p[1])) {
+    unsigned column;
+    if (parse_column(&ps, &column)) {
+      skip_space(&ps);
+      if (*ps.p == '=') {
+        ++ps.p;
+        e->destination = column;
+        e->assign = 1;
+      }
+    }
+    if (!e->assign) {
+      ps.error = NULL;
+      ps.p = start;
+    }
+  }
+
+  if (parse_expr(&ps)) {
+    skip_space(&ps);
+    if (*ps.p) fail(&ps, "unexpected symbol");
+  }
+  *pos = ps.p - s;
+  return ps.error;
+}
+
+
+void vexpr_eval(const vexpr* e, const double* slots, double* out, size_t n)
+{
+  double stack[VEXPR_MAX_DEPTH][VEXPR_BLOCK];
+  int top = -1;
+
+  for (unsigned i = 0; i < e->n; ++i) {
+    const vexpr_op* o = &e->ops[i];
+    double* a = stack[top > 0 ? top - 1 : 0];
+    double* b = stack[top >= 0 ? top : 0];
+    size_t j;
+    switch (o->op) {
+    case VEXPR_CONST:
+      b = stack[++top];
+      for (j = 0; j < n; ++j) b[j] = o->value;
+      break;
+    case VEXPR_COLUMN:
+      b = stack[++top];
+      memcpy(b, slots + o->slot * VEXPR_BLOCK, sizeof(double) * n);
+      break;
+    case VEXPR_NEG:
+      for (j = 0; j < n; ++j) b[j] = -b[j];
+      break;
+    case VEXPR_ABS:
+      for (j = 0; j < n; ++j) b[j] = fabs(b[j]);
+      break;
+    case VEXPR_SQRT:
+      for (j = 0; j < n; ++j) b[j] = sqrt(b[j]);
+      break;
+    case VEXPR_ADD:
+      for (j = 0; j < n; ++j) a[j] += b[j];
+      --top;
+      break;
+    case VEXPR_SUB:
+      for (j = 0; j < n; ++j) a[j] -= b[j];
+      --top;
+      break;
+    case VEXPR_MUL:
+      for (j = 0; j < n; ++j) a[j] *= b[j];
+      --top;
+      break;
+    case VEXPR_DIV:
+      for (j = 0; j < n; ++j) a[j] /= b[j];
+      --top;
+      break;
+    case VEXPR_MIN: // NaN only if both are NaN, like the min aggregation
+      for (j = 0; j < n; ++j) a[j] = b[j] < a[j] || a[j] != a[j] ? b[j] : a[j];
+      --top;
+      break;
+    case VEXPR_MAX:
+      for (j = 0; j < n; ++j) a[j] = b[j] > a[j] || a[j] != a[j] ? b[j] : a[j];
+      --top;
+      break;
+    }
+  }
+  memcpy(out, stack[0], sizeof(double) * n);
+}
@@ -0,0 +1,78 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/// @brief Element-wise arithmetic expressions over columns @file
+#ifndef vector_expr_h_
+#define vector_expr_h_
+
+#include <stddef.h>
+
+#define VEXPR_MAX_OPS 64
+#define VEXPR_MAX_DEPTH 16
+#define VEXPR_MAX_NESTING 32 // parentheses, unary minus and function calls
+#define VEXPR_BLOCK 64 // rows evaluated per pass
+
+typedef enum {
+  VEXPR_CONST,
+  VEXPR_COLUMN,
+  VEXPR_ADD,
+  VEXPR_SUB,
+  VEXPR_MUL,
+  VEXPR_DIV,
+  VEXPR_NEG,
+  VEXPR_ABS,
+  VEXPR_SQRT,
+  VEXPR_MIN,
+  VEXPR_MAX
+} VEXPR_OP;
+
+typedef struct vexpr_op
+{
+  VEXPR_OP  op;
+  unsigned  slot;   // VEXPR_COLUMN: index into vexpr.columns
+  double    value;  // VEXPR_CONST
+} vexpr_op;
+
+/**
+ * Compiled expression, a postfix program evaluated a block of rows at a time
+ * so every operation is a simple loop over the block.
+ *
+ * Grammar: [cN =] expr where expr is built from numbers, column references
+ * cN (one based), + - * / unary -, parentheses and the functions abs(x),
+ * sqrt(x), min(x, y) and max(x, y).
+ */
+typedef struct vexpr
+{
+  unsigned  n;                        // number of ops
+  unsigned  slots;                    // number of distinct columns referenced
+  unsigned  destination;              // zero based, only valid if assign
+  int       assign;                   // expression has a cN = prefix
+  unsigned  columns[VEXPR_MAX_OPS];   // zero based column of each slot
+  vexpr_op  ops[VEXPR_MAX_OPS];
+} vexpr;
+
+/**
+ * Compiles an expression.
+ *
+ * @param e Expression to initialize.
+ * @param s Expression source.
+ * @param pos Receives the source offset of an error.
+ *
+ * @return const char* NULL on success or the error message.
+ */
+const char* vexpr_compile(vexpr* e, const char* s, size_t* pos);
+
+/**
+ * Evaluates up to VEXPR_BLOCK rows.
+ *
+ * @param e Compiled expression.
+ * @param slots Values of the referenced columns, VEXPR_BLOCK doubles per slot.
+ * @param out Receives the n results.
+ * @param n Number of rows.
+ */
+void vexpr_eval(const vexpr* e, const double* slots, double* out, size_t n);
+
+#endif
@@ -0,0 +1,171 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/// @brief XOR (Gorilla) floating point series compression implementation
+/// @file
+
+#include "xor_codec.h"
+
+#include <stdint.h>
+#include <string.h>
+
+typedef struct
+{
+  unsigned char*  p;      // NULL when only sizing
+  size_t          bytes;  // completed bytes
+  unsigned        used;   // bits used in the current byte
+} bit_writer;
+
+typedef struct
+{
+  const unsigned char*  p;
+  uint64_t              bits;   // buffered bits, most significant first
+  unsigned              avail;  // number of buffered bits
+} bit_reader;
+
+
+static uint64_t double_bits(double d)
+{
+  uint64_t u;
+  memcpy(&u, &d, sizeof(u));
+  return u;
+}
+
+
+static double bits_double(uint64_t u)
+{
+  double d;
+  memcpy(&d, &u, sizeof(d));
+  return d;
+}
+
+
+static unsigned leading_zeros(uint64_t x)
+{
+#if defined(__GNUC__)
+  return (unsigned)__builtin_clzll(x);
+#else
+  unsigned n = 0;
+  for (uint64_t m = 1ULL << 63; !(x & m); m >>= 1) ++n;
+  return n;
+#endif
+}
+
+
+static unsigned trailing_zeros(uint64_t x)
+{
+#if defined(__GNUC__)
+  return (unsigned)__builtin_ctzll(x);
+#else
+  unsigned n = 0;
+  for (; !(x & 1); x >>= 1) ++n;
+  return n;
+#endif
+}
+
+
+static void put_bits(bit_writer* w, uint64_t v, unsigned n)
+{
+  while (n > 0) {
+    unsigned k = 8 - w->used;
+    if (k > n) k = n;
+    if (w->p) {
+      if (w->used == 0) w->p[w->bytes] = 0;
+      unsigned bits = (unsigned)(v >> (n - k)) & ((1u << k) - 1);
+      w->p[w->bytes] |= (unsigned char)(bits << (8 - w->used - k));
+    }
+    w->used += k;
+    n -= k;
+    if (w->used == 8) {
+      w->used = 0;
+      ++w->bytes;
+    }
+  }
+}
+
+
+// Reads n (1 - 57) bits; bytes are only consumed as their bits are needed so
+// the reader never runs past the end of the series.
+static uint64_t get_bits(bit_reader* r, unsigned n)
+{
+  while (r->avail < n) {
+    r->bits |= (uint64_t)*r->p++ << (56 - r->avail);
+    r->avail += 8;
+  }
+  uint64_t v = r->bits >> (64 - n);
+  r->bits <<= n;
+  r->avail -= n;
+  return v;
+}
+
+
+static uint64_t get_wide_bits(bit_reader* r, unsigned n)
+{
+  if (n <= 32) return get_bits(r, n);
+  uint64_t hi = get_bits(r, n - 32);
+  return hi << 32 | get_bits(r, 32);
+}
+
+
+size_t xor_encode(const double* values, size_t n, size_t stride,
+                  unsigned char* out)
+{
+  bit_writer w = { out, 0, 0 };
+  uint64_t prev = double_bits(values[0]);
+  unsigned prev_leading = 65, prev_trailing = 0; // no window yet
+  put_bits(&w, prev, 64);
+
+  for (size_t i = 1; i < n; ++i) {
+    uint64_t cur = double_bits(values[i * stride]);
+    uint64_t x = cur ^ prev;
+    prev = cur;
+    if (x == 0) {
+      put_bits(&w, 0, 1);
+      continue;
+    }
+    put_bits(&w, 1, 1);
+    unsigned leading = leading_zeros(x);
+    unsigned trailing = trailing_zeros(x);
+    if (leading > 31) leading = 31; // stored in 5 bits
+
+    if (leading >= prev_leading && trailing >= prev_trailing
+        && prev_leading != 65) { // reuse the previous window
+      put_bits(&w, 0, 1);
+      put_bits(&w, x >> prev_trailing, 64 - prev_leading - prev_trailing);
+    } else {
+      unsigned meaningful = 64 - leading - trailing;
+      put_bits(&w, 1, 1);
+      put_bits(&w, leading, 5);
+      put_bits(&w, meaningful - 1, 6);
+      put_bits(&w, x >> trailing, meaningful);
+      prev_leading = leading;
+      prev_trailing = trailing;
+    }
+  }
+  return w.bytes + (w.used ? 1 : 0);
+}
+
+
+void xor_decode(const unsigned char* in, size_t n, double* values,
+                size_t stride)
+{
+  bit_reader r = { in, 0, 0 };
+  uint64_t prev = get_wide_bits(&r, 64);
+  unsigned leading = 0, trailing = 0;
+  values[0] = bits_double(prev);
+
+  for (size_t i = 1; i < n; ++i) {
+    if (get_bits(&r, 1)) {
+      if (get_bits(&r, 1)) {
+        leading = (unsigned)get_bits(&r, 5);
+        unsigned meaningful = (unsigned)get_bits(&r, 6) + 1;
+        trailing = 64 - leading - meaningful;
+      }
+      prev ^= get_wide_bits(&r, 64 - leading - trailing) << trailing;
+    }
+    values[i * stride] = bits_double(prev);
+  }
+}
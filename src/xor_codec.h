@@ -0,0 +1,39 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/// @brief XOR (Gorilla) floating point series compression @file
+#ifndef xor_codec_h_
+#define xor_codec_h_
+
+#include <stddef.h>
+
+/**
+ * Compresses a series of doubles by XORing each value with its predecessor
+ * and only storing the meaningful bits of the result. Repeated values
+ * (including NaN runs) cost a single bit.
+ *
+ * @param values Pointer to the first value of the series.
+ * @param n Number of values in the series (must be > 0).
+ * @param stride Distance between consecutive values (in doubles).
+ * @param out Output buffer or NULL to only compute the encoded size.
+ *
+ * @return size_t Number of bytes in the encoded series.
+ */
+size_t xor_encode(const double* values, size_t n, size_t stride,
+                  unsigned char* out);
+
+/**
+ * Decompresses a series created by xor_encode.
+ *
+ * @param in Encoded series.
+ * @param n Number of values in the series.
+ * @param values Output pointer for the first value.
+ * @param stride Distance between consecutive output values (in doubles).
+ */
+void xor_decode(const unsigned char* in, size_t n, double* values,
+                size_t stride);
+
+#endif